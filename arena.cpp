@@ -0,0 +1,73 @@
+#include <windows.h>
+#include <assert.h>
+
+#include "arena.h"
+
+static volatile LONG64 GlobalCommittedBytes;
+static volatile LONG64 GlobalPeakCommittedBytes;
+static volatile LONG GlobalArenaCount;
+
+static void add_committed(s64 bytes) {
+	auto committed = InterlockedExchangeAdd64(&GlobalCommittedBytes, bytes) + bytes;
+
+	for (;;) {
+		auto peak = GlobalPeakCommittedBytes;
+		if (committed <= peak) break;
+		if (InterlockedCompareExchange64(&GlobalPeakCommittedBytes, committed, peak) == peak) break;
+	}
+}
+
+bool make_arena(MemoryArena &arena, size_t reserve_size) {
+	arena = {};
+
+	reserve_size = (reserve_size + ARENA_COMMIT_SIZE - 1) & ~(ARENA_COMMIT_SIZE - 1);
+	arena.base = (u8 *)VirtualAlloc(0, reserve_size, MEM_RESERVE, PAGE_NOACCESS);
+	if (!arena.base) return false;
+
+	arena.reserved = reserve_size;
+	InterlockedIncrement(&GlobalArenaCount);
+	return true;
+}
+
+void free_arena(MemoryArena &arena) {
+	if (arena.base) {
+		VirtualFree(arena.base, 0, MEM_RELEASE);
+		add_committed(-(s64)arena.committed);
+		InterlockedDecrement(&GlobalArenaCount);
+	}
+
+	arena = {};
+}
+
+void reset_arena(MemoryArena &arena) {
+	arena.used = 0;
+}
+
+void *push_size(MemoryArena &arena, size_t size, size_t alignment) {
+	assert(alignment && (alignment & (alignment - 1)) == 0);
+
+	auto start = (arena.used + alignment - 1) & ~(alignment - 1);
+	auto end = start + size;
+	if (end > arena.reserved || end < start) return 0;
+
+	if (end > arena.committed) {
+		auto commit_end = min((end + ARENA_COMMIT_SIZE - 1) & ~(ARENA_COMMIT_SIZE - 1), arena.reserved);
+		if (!VirtualAlloc(arena.base + arena.committed, commit_end - arena.committed, MEM_COMMIT, PAGE_READWRITE)) return 0;
+
+		add_committed((s64)(commit_end - arena.committed));
+		arena.committed = commit_end;
+	}
+
+	arena.used = end;
+	if (end > arena.peak) arena.peak = end;
+
+	return arena.base + start;
+}
+
+MemoryStats read_memory_stats() {
+	MemoryStats stats;
+	stats.committed = (u64)GlobalCommittedBytes;
+	stats.peak_committed = (u64)GlobalPeakCommittedBytes;
+	stats.arena_count = (int)GlobalArenaCount;
+	return stats;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "types.h"
+
+// A linear allocator over one block of reserved address space. Allocating is bumping used, and
+// everything in an arena goes away together, either with reset_arena (the pages stay committed,
+// so the next round of allocations doesn't touch the OS at all) or free_arena.
+//
+// Two ways these get used:
+//   - One arena per loaded asset (or group of assets). load_obj and decompress_tga_image put everything
+//     they keep in the arena they're given, so the whole asset is one contiguous block freed at once.
+//   - A frame arena, reset at the top of every frame, for anything that only lives until the frame is
+//     done. Once it has grown to the biggest frame it's seen, a frame costs no heap traffic at all.
+//
+// Pages are committed as the arena grows, never up front, so the memory a process actually has is the
+// peak of what it used and not whatever got reserved. Arenas aren't thread safe. Threads that need to
+// allocate at the same time should each have their own.
+struct MemoryArena {
+	u8 *base;
+	size_t reserved;
+	size_t committed;
+	size_t used;
+
+	// The most used has ever been, for sizing the reservation.
+	size_t peak;
+};
+
+// How much gets committed at a time. Committing page by page would mean a call into the OS every 4K.
+const size_t ARENA_COMMIT_SIZE = 64 * 1024;
+
+// reserve_size is the most the arena can ever hold. Reserving costs nothing but address space, so be generous.
+bool make_arena(MemoryArena &arena, size_t reserve_size);
+void free_arena(MemoryArena &arena);
+
+// Everything goes, but the committed pages are kept for next time.
+void reset_arena(MemoryArena &arena);
+
+// An arena over memory that belongs to something else, like a frame graph buffer, for handing to code
+// that takes its scratch from an arena. It's all committed already, so it never calls the OS. Don't
+// free_arena it.
+inline MemoryArena fixed_arena(void *memory, size_t size) {
+	MemoryArena arena = {};
+	arena.base = (u8 *)memory;
+	arena.reserved = size;
+	arena.committed = size;
+	return arena;
+}
+
+// Returns 0 when the reservation runs out. The memory isn't cleared, so it holds whatever was there before a reset.
+// alignment has to be a power of two.
+void *push_size(MemoryArena &arena, size_t size, size_t alignment = 16);
+
+#define push_array(arena, Type, count) ((Type *)push_size((arena), sizeof(Type) * (size_t)(count), alignof(Type)))
+#define push_struct(arena, Type) push_array(arena, Type, 1)
+
+// For scratch space inside something that's otherwise using the arena. Everything pushed after
+// the mark is given back by pop_to_mark.
+struct ArenaMark {
+	size_t used;
+};
+
+inline ArenaMark arena_mark(const MemoryArena &arena) {
+	return ArenaMark{ arena.used };
+}
+
+inline void pop_to_mark(MemoryArena &arena, ArenaMark mark) {
+	arena.used = mark.used;
+}
+
+// Across every arena in the process.
+struct MemoryStats {
+	u64 committed;
+	u64 peak_committed;
+	int arena_count;
+};
+
+MemoryStats read_memory_stats();
@@ -0,0 +1,179 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "assets.h"
+#include "utils.h"
+#include "tgaimage.h"
+#include "trace.h"
+#include "bake.h"
+
+static bool load_mesh(Asset &asset) {
+	// The arrays load_obj makes are never more than several times the size of the text they came from.
+	// The shortest possible face line is 8 bytes and turns into a 36 byte Face.
+	u64 size;
+	if (!get_file_size(asset.path, size)) return false;
+	if (!make_arena(asset.arena, (size_t)size * 8 + ARENA_COMMIT_SIZE)) return false;
+
+	asset.obj = load_obj(asset.path, asset.arena);
+	if (!asset.obj.face_count) return false;
+
+	// A vertex bake next to the mesh comes along with it, before it's prepared. Not having one is fine.
+	char bake_path[MAX_PATH];
+	vertex_bake_path(asset.path, bake_path, MAX_PATH);
+	load_vertex_bake(bake_path, asset.obj, asset.arena);
+
+	if (asset.prepare) {
+		asset.prepared = prepare_mesh(asset.obj);
+		if (!asset.prepared.corners) return false;
+	}
+
+	return true;
+}
+
+static bool load_texture(Asset &asset) {
+	auto image_load_result = load_tga_image(asset.path);
+	if (!image_load_result.loaded) return false;
+	defer { free_tga_image(image_load_result); };
+
+	// The header has the size, so the arena can be exactly as big as the pixels.
+	auto &spec = image_load_result.image.header->image_spec;
+	if (!make_arena(asset.arena, (size_t)spec.image_width * spec.image_height * sizeof(Color))) return false;
+
+	asset.texture = decompress_tga_image(&image_load_result.image, asset.arena);
+	return asset.texture.pixel_data != 0;
+}
+
+static DWORD WINAPI loader_thread_proc(LPVOID parameter) {
+	auto loader = (AssetLoader *)parameter;
+	TRACE_THREAD_NAME("asset loader");
+
+	for (;;) {
+		WaitForSingleObject(loader->requests, INFINITE);
+		if (loader->stopping) break;
+
+		// Every release of requests comes after a new asset is filled in, so this index is always a real one.
+		auto index = (int)InterlockedIncrement(&loader->next_asset) - 1;
+		assert(index < loader->asset_count);
+		auto &asset = loader->assets[index];
+
+		auto loaded = false;
+		{
+			TRACE_SCOPE(asset.kind == ASSET_MESH ? "load mesh asset" : "load texture asset");
+			loaded = asset.kind == ASSET_MESH ? load_mesh(asset) : load_texture(asset);
+		}
+
+		if (!loaded) {
+			char message[MAX_PATH + 32];
+			snprintf(message, sizeof(message), "Couldn't load %s.\n", asset.path);
+			OutputDebugString(message);
+		}
+
+		// The exchange is a full barrier, so whoever sees the new state sees everything that got loaded.
+		auto state = loaded ? ASSET_READY : ASSET_FAILED;
+		InterlockedExchange(&asset.state, state);
+		SetEvent(asset.done);
+
+		if (asset.callback) asset.callback(index, state, asset.user_data);
+	}
+
+	return 0;
+}
+
+bool start_asset_loader(AssetLoader &loader, int thread_count) {
+	if (thread_count <= 0) {
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		thread_count = (int)system_info.dwNumberOfProcessors;
+	}
+
+	if (thread_count > MAX_LOADER_THREADS) thread_count = MAX_LOADER_THREADS;
+
+	loader = {};
+
+	loader.requests = CreateSemaphore(0, 0, MAX_ASSETS + MAX_LOADER_THREADS, 0);
+	if (!loader.requests) return false;
+
+	for (auto index = 0; index < thread_count; ++index) {
+		loader.threads[index] = CreateThread(0, 0, loader_thread_proc, &loader, 0, 0);
+		if (!loader.threads[index]) return false;
+		loader.thread_count++;
+	}
+
+	return true;
+}
+
+void stop_asset_loader(AssetLoader &loader) {
+	InterlockedExchange(&loader.stopping, 1);
+	ReleaseSemaphore(loader.requests, loader.thread_count, 0);
+
+	for (auto index = 0; index < loader.thread_count; ++index) {
+		WaitForSingleObject(loader.threads[index], INFINITE);
+		CloseHandle(loader.threads[index]);
+	}
+
+	for (auto index = 0; index < loader.asset_count; ++index) {
+		auto &asset = loader.assets[index];
+		free_prepared_mesh(asset.prepared);
+		free_arena(asset.arena);
+		CloseHandle(asset.done);
+	}
+
+	if (loader.requests) CloseHandle(loader.requests);
+	loader.thread_count = 0;
+	loader.asset_count = 0;
+}
+
+static int request_asset(AssetLoader &loader, AssetKind kind, const char *path, bool prepare, AssetCallback callback, void *user_data) {
+	auto index = (int)loader.asset_count;
+	if (index >= MAX_ASSETS || strlen(path) >= MAX_PATH) return -1;
+
+	auto &asset = loader.assets[index];
+	asset = {};
+	asset.kind = kind;
+	strcpy_s(asset.path, sizeof(asset.path), path);
+	asset.prepare = prepare;
+	asset.callback = callback;
+	asset.user_data = user_data;
+	asset.state = ASSET_QUEUED;
+
+	asset.done = CreateEvent(0, TRUE, FALSE, 0);
+	if (!asset.done) return -1;
+
+	// The increment is a full barrier, so the asset is filled in before any loader thread can get to it.
+	InterlockedIncrement(&loader.asset_count);
+	ReleaseSemaphore(loader.requests, 1, 0);
+
+	return index;
+}
+
+int load_mesh_async(AssetLoader &loader, const char *path, bool prepare, AssetCallback callback, void *user_data) {
+	return request_asset(loader, ASSET_MESH, path, prepare, callback, user_data);
+}
+
+int load_texture_async(AssetLoader &loader, const char *path, AssetCallback callback, void *user_data) {
+	return request_asset(loader, ASSET_TEXTURE, path, false, callback, user_data);
+}
+
+AssetState wait_for_asset(AssetLoader &loader, int asset) {
+	TRACE_SCOPE("wait_for_asset");
+
+	WaitForSingleObject(loader.assets[asset].done, INFINITE);
+	return asset_state(loader, asset);
+}
+
+const WavefrontObj *get_mesh(const AssetLoader &loader, int asset) {
+	auto &entry = loader.assets[asset];
+	return entry.state == ASSET_READY && entry.kind == ASSET_MESH ? &entry.obj : 0;
+}
+
+const PreparedMesh *get_prepared_mesh(const AssetLoader &loader, int asset) {
+	auto &entry = loader.assets[asset];
+	return entry.state == ASSET_READY && entry.kind == ASSET_MESH && entry.prepare ? &entry.prepared : 0;
+}
+
+const TextureMap *get_texture(const AssetLoader &loader, int asset) {
+	auto &entry = loader.assets[asset];
+	return entry.state == ASSET_READY && entry.kind == ASSET_TEXTURE ? &entry.texture : 0;
+}
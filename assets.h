@@ -0,0 +1,97 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+#include "arena.h"
+#include "wavefront.h"
+#include "texture.h"
+#include "instancing.h"
+
+// Loads meshes and textures on background threads. A request returns right away with an index
+// for the asset, and the loading happens on whichever loader thread is free, so a mesh parse and
+// a texture decode run at the same time instead of one after the other. The caller keeps going
+// (making its window, drawing frames without the asset) and checks back, waits, or gets called back.
+//
+// Each asset gets its own arena, so everything it loaded is one block that goes away in stop_asset_loader.
+
+const int MAX_ASSETS = 256;
+const int MAX_LOADER_THREADS = 16;
+
+enum AssetKind {
+	ASSET_MESH,
+	ASSET_TEXTURE,
+};
+
+enum AssetState {
+	ASSET_QUEUED,
+	ASSET_READY,
+	ASSET_FAILED,
+};
+
+// Runs on the loader thread right after the asset is ready (or failed), so keep it short and thread safe.
+typedef void (*AssetCallback)(int asset, AssetState state, void *user_data);
+
+struct Asset {
+	AssetKind kind;
+	char path[MAX_PATH];
+
+	// For meshes, also build the PreparedMesh that draw_instances and the scene use, so that's off
+	// the render thread too.
+	bool prepare;
+
+	AssetCallback callback;
+	void *user_data;
+
+	volatile LONG state;
+
+	// Manual reset, set once the asset is ready or failed.
+	HANDLE done;
+
+	MemoryArena arena;
+	WavefrontObj obj;
+	PreparedMesh prepared;
+	TextureMap texture;
+};
+
+struct AssetLoader {
+	Asset assets[MAX_ASSETS];
+
+	// Requests are numbered in the order they were made. Loader threads take the next one each
+	// time the requests semaphore lets them through.
+	volatile LONG asset_count;
+	volatile LONG next_asset;
+	HANDLE requests;
+
+	HANDLE threads[MAX_LOADER_THREADS];
+	int thread_count;
+	volatile LONG stopping;
+};
+
+// thread_count of 0 means one per logical processor, up to MAX_LOADER_THREADS.
+bool start_asset_loader(AssetLoader &loader, int thread_count);
+
+// Anything still queued is dropped, and every asset's memory is freed, so nothing from the loader
+// can be in use anymore.
+void stop_asset_loader(AssetLoader &loader);
+
+// Requests have to come from one thread (whichever one started the loader).
+// They return the asset's index, or -1 if there's no room for another one.
+int load_mesh_async(AssetLoader &loader, const char *path, bool prepare, AssetCallback callback = 0, void *user_data = 0);
+int load_texture_async(AssetLoader &loader, const char *path, AssetCallback callback = 0, void *user_data = 0);
+
+inline AssetState asset_state(const AssetLoader &loader, int asset) {
+	return (AssetState)loader.assets[asset].state;
+}
+
+inline bool is_asset_ready(const AssetLoader &loader, int asset) {
+	return asset_state(loader, asset) == ASSET_READY;
+}
+
+// Blocks until the asset is ready or failed.
+AssetState wait_for_asset(AssetLoader &loader, int asset);
+
+// These return 0 until the asset is ready. Once it is, it doesn't change until stop_asset_loader.
+const WavefrontObj *get_mesh(const AssetLoader &loader, int asset);
+const PreparedMesh *get_prepared_mesh(const AssetLoader &loader, int asset);
+const TextureMap *get_texture(const AssetLoader &loader, int asset);
@@ -0,0 +1,567 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "bake.h"
+#include "utils.h"
+#include "trace.h"
+
+//
+// The acceleration structure. A plain BVH over the faces, split at the middle of the longest axis of the
+// centroids, which is nowhere near as good as a SAH build but is fine for a mesh this size and builds in
+// no time. The bake only ever asks "is anything in the way", so the traversal stops at the first hit.
+//
+
+const int BVH_LEAF_FACES = 4;
+// occluded's stack. Going down the tree never has more than one node per level waiting on it, plus the one
+// being looked at, so build_bvh gives up on a tree deeper than this instead of letting rays skip part of it.
+// It would take a far bigger mesh than any of these.
+const int BVH_STACK_SIZE = 128;
+
+struct BvhNode {
+	Vec3f min;
+
+	// For a leaf, the first of its faces in BakeBvh::faces. Otherwise the right child. The left child
+	// always comes right after its parent.
+	int offset;
+
+	Vec3f max;
+
+	// 0 for interior nodes.
+	int count;
+};
+
+// One corner and the two edges leaving it, which is what the ray test wants.
+struct BvhFace {
+	Vec3f a;
+	Vec3f ab;
+	Vec3f ac;
+};
+
+struct BakeBvh {
+	BvhNode *nodes;
+	int node_count;
+	BvhFace *faces;
+
+	// For offsetting ray origins off the surface, and the default max_distance.
+	f32 diagonal;
+};
+
+struct BvhBuild {
+	const WavefrontObj *obj;
+	BakeBvh *bvh;
+	int *order;
+	Vec3f *centroids;
+
+	// How many levels down the deepest leaf is, with the root at 1.
+	int max_depth;
+};
+
+static Vec3f min3(const Vec3f &a, const Vec3f &b) {
+	return Vec3f{ min(a.x, b.x), min(a.y, b.y), min(a.z, b.z) };
+}
+
+static Vec3f max3(const Vec3f &a, const Vec3f &b) {
+	return Vec3f{ max(a.x, b.x), max(a.y, b.y), max(a.z, b.z) };
+}
+
+static Vec3f face_corner(const WavefrontObj &obj, int face, int corner) {
+	return obj.verts[obj.faces[face].vertex_indices.dim[corner]].v3;
+}
+
+static int build_node(BvhBuild &build, int first, int count, int depth) {
+	auto &bvh = *build.bvh;
+	build.max_depth = max(build.max_depth, depth);
+
+	auto index = bvh.node_count++;
+	auto &node = bvh.nodes[index];
+
+	node.min = Vec3f{ FLT_MAX, FLT_MAX, FLT_MAX };
+	node.max = Vec3f{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	auto centroid_min = node.min;
+	auto centroid_max = node.max;
+
+	for (auto position = first; position < first + count; ++position) {
+		auto face = build.order[position];
+		for (auto corner = 0; corner < 3; ++corner) {
+			auto vertex = face_corner(*build.obj, face, corner);
+			node.min = min3(node.min, vertex);
+			node.max = max3(node.max, vertex);
+		}
+
+		centroid_min = min3(centroid_min, build.centroids[face]);
+		centroid_max = max3(centroid_max, build.centroids[face]);
+	}
+
+	if (count <= BVH_LEAF_FACES) {
+		node.offset = first;
+		node.count = count;
+		return index;
+	}
+
+	auto extent = centroid_max - centroid_min;
+	auto axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	auto split = (centroid_min.dim[axis] + centroid_max.dim[axis]) * 0.5f;
+
+	auto middle = first;
+	for (auto position = first; position < first + count; ++position) {
+		auto face = build.order[position];
+		if (build.centroids[face].dim[axis] < split) {
+			build.order[position] = build.order[middle];
+			build.order[middle++] = face;
+		}
+	}
+
+	// Everything on one side means the centroids are all in the same place. Any split is as good as another then.
+	if (middle == first || middle == first + count) middle = first + count / 2;
+
+	node.count = 0;
+	build_node(build, first, middle - first, depth + 1);
+
+	// node might have moved if this were a stretchy buffer, but the nodes are allocated up front.
+	bvh.nodes[index].offset = build_node(build, middle, first + count - middle, depth + 1);
+	return index;
+}
+
+static bool build_bvh(MemoryArena &arena, const WavefrontObj &obj, BakeBvh &bvh) {
+	TRACE_SCOPE("build_bvh");
+
+	bvh = {};
+
+	// A binary tree with at least one face per leaf never has more than 2n - 1 nodes.
+	bvh.nodes = push_array(arena, BvhNode, obj.face_count * 2);
+	bvh.faces = push_array(arena, BvhFace, obj.face_count);
+
+	BvhBuild build = { &obj, &bvh };
+	build.order = push_array(arena, int, obj.face_count);
+	build.centroids = push_array(arena, Vec3f, obj.face_count);
+	if (!bvh.nodes || !bvh.faces || !build.order || !build.centroids) return false;
+
+	for (auto face = 0; face < obj.face_count; ++face) {
+		build.order[face] = face;
+		build.centroids[face] = (face_corner(obj, face, 0) + face_corner(obj, face, 1) + face_corner(obj, face, 2)) / 3.0f;
+	}
+
+	build_node(build, 0, obj.face_count, 1);
+	if (build.max_depth >= BVH_STACK_SIZE) return false;
+
+	// The leaves point into order, so the faces go in that order.
+	for (auto position = 0; position < obj.face_count; ++position) {
+		auto face = build.order[position];
+		auto a = face_corner(obj, face, 0);
+		bvh.faces[position] = { a, face_corner(obj, face, 1) - a, face_corner(obj, face, 2) - a };
+	}
+
+	auto &root = bvh.nodes[0];
+	bvh.diagonal = (f32)length(root.max - root.min);
+	return true;
+}
+
+static bool hit_box(const BvhNode &node, const Vec3f &origin, const Vec3f &inverse_direction, f32 max_t) {
+	auto near_t = 0.0f;
+	auto far_t = max_t;
+
+	for (auto axis = 0; axis < 3; ++axis) {
+		auto t0 = (node.min.dim[axis] - origin.dim[axis]) * inverse_direction.dim[axis];
+		auto t1 = (node.max.dim[axis] - origin.dim[axis]) * inverse_direction.dim[axis];
+		near_t = max(near_t, min(t0, t1));
+		far_t = min(far_t, max(t0, t1));
+	}
+
+	return near_t <= far_t;
+}
+
+// Moller-Trumbore.
+static bool hit_face(const BvhFace &face, const Vec3f &origin, const Vec3f &direction, f32 max_t) {
+	auto p = direction.cross(face.ac);
+	auto determinant = face.ab.dot(p);
+	if (fabsf(determinant) < 1e-12f) return false;
+
+	auto inverse_determinant = 1.0f / determinant;
+	auto s = origin - face.a;
+	auto u = s.dot(p) * inverse_determinant;
+	if (u < 0 || u > 1) return false;
+
+	auto q = s.cross(face.ab);
+	auto v = direction.dot(q) * inverse_determinant;
+	if (v < 0 || u + v > 1) return false;
+
+	auto t = face.ac.dot(q) * inverse_determinant;
+	return t > 0 && t < max_t;
+}
+
+static bool occluded(const BakeBvh &bvh, const Vec3f &origin, const Vec3f &direction, f32 max_t) {
+	// Dividing by a zero component gives infinity, which the slab test copes with.
+	Vec3f inverse_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+
+	int stack[BVH_STACK_SIZE];
+	auto stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size) {
+		auto index = stack[--stack_size];
+		auto &node = bvh.nodes[index];
+		if (!hit_box(node, origin, inverse_direction, max_t)) continue;
+
+		if (node.count) {
+			for (auto face = node.offset; face < node.offset + node.count; ++face) {
+				if (hit_face(bvh.faces[face], origin, direction, max_t)) return true;
+			}
+		} else {
+			// Always fits, since build_bvh checked how deep the tree goes.
+			stack[stack_size++] = node.offset;
+			stack[stack_size++] = index + 1;
+		}
+	}
+
+	return false;
+}
+
+//
+// Sampling.
+//
+
+// xorshift32. Seeded from the vertex or texel, so a bake always comes out the same.
+static f32 next_random(u32 &state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Which face covers a lightmap texel's center, and where in it. -1 for none.
+struct LightmapTexel {
+	int face;
+	f32 weights[3];
+};
+
+struct BakeJob {
+	const BakeBvh *bvh;
+	const WavefrontObj *obj;
+	BakeSettings settings;
+	f32 bias;
+
+	// bake_vertices.
+	const Vec3f *normals;
+	Vec2f *baked;
+
+	// bake_lightmap.
+	TextureMap *lightmap;
+	const LightmapTexel *texels;
+};
+
+// Occlusion and direct light for one point on the surface.
+static Vec2f bake_point(const BakeJob &job, const Vec3f &position, const Vec3f &normal, u32 seed) {
+	auto &settings = job.settings;
+	auto origin = position + normal * job.bias;
+
+	// Any two directions perpendicular to the normal and each other (Duff et al., "Building an
+	// Orthonormal Basis, Revisited").
+	auto sign = normal.z >= 0 ? 1.0f : -1.0f;
+	auto a = -1.0f / (sign + normal.z);
+	auto b = normal.x * normal.y * a;
+	Vec3f tangent = { 1 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x };
+	Vec3f bitangent = { b, sign + normal.y * normal.y * a, -normal.y };
+
+	// Cosine weighted, so the fraction that gets through is already weighted the way a diffuse
+	// surface would see it. The samples are jittered on a grid so they don't clump.
+	auto state = seed * 2654435761u + 1;
+	auto side = max(1, (int)sqrtf((f32)settings.sample_count));
+	auto open = 0;
+
+	for (auto sample = 0; sample < settings.sample_count; ++sample) {
+		auto r1 = next_random(state);
+		auto r2 = next_random(state);
+		if (sample < side * side) {
+			r1 = (sample % side + r1) / side;
+			r2 = (sample / side + r2) / side;
+		}
+
+		auto radius = sqrtf(r1);
+		auto angle = 6.28318530718f * r2;
+		auto x = radius * cosf(angle);
+		auto y = radius * sinf(angle);
+		auto z = sqrtf(max(0.0f, 1 - r1));
+
+		auto direction = tangent * x + bitangent * y + normal * z;
+		if (!occluded(*job.bvh, origin, direction, settings.max_distance)) open++;
+	}
+
+	Vec2f result = { (f32)open / settings.sample_count, 0 };
+
+	auto facing = normal.dot(settings.light_dir);
+	if (facing > 0 && !occluded(*job.bvh, origin, settings.light_dir, FLT_MAX)) result.y = facing;
+
+	return result;
+}
+
+static void bake_vertex_job(void *data, int first, int last, int worker_index) {
+	TRACE_SCOPE("bake vertices");
+
+	auto &job = *(BakeJob *)data;
+	for (auto index = first; index < last; ++index) {
+		job.baked[index] = bake_point(job, job.obj->verts[index].v3, job.normals[index], (u32)index);
+	}
+}
+
+static void fill_settings(const BakeBvh &bvh, const BakeSettings &settings, BakeJob &job) {
+	job.settings = settings;
+	job.settings.sample_count = max(1, settings.sample_count);
+	job.settings.light_dir = normalize(settings.light_dir);
+	if (job.settings.max_distance <= 0) job.settings.max_distance = bvh.diagonal * 0.25f;
+
+	// Far enough off the surface that a ray doesn't hit the face it started on.
+	job.bias = bvh.diagonal * 1e-4f;
+}
+
+bool bake_vertices(JobSystem &jobs, MemoryArena &arena, const WavefrontObj &obj, const BakeSettings &settings, Vec2f *baked) {
+	TRACE_SCOPE("bake_vertices");
+
+	auto mark = arena_mark(arena);
+	defer { pop_to_mark(arena, mark); };
+
+	BakeBvh bvh;
+	if (!build_bvh(arena, obj, bvh)) return false;
+
+	// The corners that share a position can have different normals. The average of them is what the
+	// whole vertex gets. Positions without any normals fall back to the faces around them.
+	auto normals = push_array(arena, Vec3f, obj.vert_count);
+	auto face_normals = push_array(arena, Vec3f, obj.vert_count);
+	if (!normals || !face_normals) return false;
+
+	memset(normals, 0, obj.vert_count * sizeof(Vec3f));
+	memset(face_normals, 0, obj.vert_count * sizeof(Vec3f));
+
+	for (auto index = 0; index < obj.face_count; ++index) {
+		auto &face = obj.faces[index];
+		auto a = face_corner(obj, index, 0);
+		auto area_normal = (face_corner(obj, index, 1) - a).cross(face_corner(obj, index, 2) - a);
+
+		for (auto corner = 0; corner < 3; ++corner) {
+			auto vertex = face.vertex_indices.dim[corner];
+			normals[vertex] = normals[vertex] + normalize(obj.vert_normals[face.normal_indices.dim[corner]]);
+			face_normals[vertex] = face_normals[vertex] + area_normal;
+		}
+	}
+
+	for (auto index = 0; index < obj.vert_count; ++index) {
+		auto normal = length(normals[index]) > 1e-6 ? normals[index] : face_normals[index];
+		normals[index] = length(normal) > 1e-12 ? normalize(normal) : Vec3f{ 0, 0, 1 };
+	}
+
+	BakeJob job = {};
+	job.bvh = &bvh;
+	job.obj = &obj;
+	job.normals = normals;
+	job.baked = baked;
+	fill_settings(bvh, settings, job);
+
+	parallel_for(jobs, obj.vert_count, 64, bake_vertex_job, &job);
+	return true;
+}
+
+//
+// Lightmaps.
+//
+
+static void bake_lightmap_job(void *data, int first, int last, int worker_index) {
+	TRACE_SCOPE("bake lightmap rows");
+
+	auto &job = *(BakeJob *)data;
+	auto &obj = *job.obj;
+	auto &lightmap = *job.lightmap;
+
+	for (auto y = first; y < last; ++y) {
+		for (auto x = 0; x < lightmap.width; ++x) {
+			auto index = y * lightmap.width + x;
+			auto &texel = job.texels[index];
+			if (texel.face < 0) continue;
+
+			auto &face = obj.faces[texel.face];
+			Vec3f position = {};
+			Vec3f normal = {};
+			for (auto corner = 0; corner < 3; ++corner) {
+				position = position + face_corner(obj, texel.face, corner) * texel.weights[corner];
+				normal = normal + normalize(obj.vert_normals[face.normal_indices.dim[corner]]) * texel.weights[corner];
+			}
+
+			auto baked = bake_point(job, position, normalize(normal), (u32)index);
+			lightmap.pixel_data[index] = Color((u8)(baked.x * 255 + 0.5f), (u8)(baked.y * 255 + 0.5f), 0, 255);
+		}
+	}
+}
+
+// How many texels past the edge of the UV islands the values get spread.
+const int LIGHTMAP_DILATION = 4;
+
+bool bake_lightmap(JobSystem &jobs, MemoryArena &arena, const WavefrontObj &obj, const BakeSettings &settings, TextureMap &lightmap) {
+	TRACE_SCOPE("bake_lightmap");
+
+	auto mark = arena_mark(arena);
+	defer { pop_to_mark(arena, mark); };
+
+	BakeBvh bvh;
+	if (!build_bvh(arena, obj, bvh)) return false;
+
+	auto texel_count = lightmap.width * lightmap.height;
+	auto texels = push_array(arena, LightmapTexel, texel_count);
+	auto filled = push_array(arena, u8, texel_count);
+	auto next_filled = push_array(arena, u8, texel_count);
+	if (!texels || !filled || !next_filled) return false;
+
+	for (auto index = 0; index < texel_count; ++index) {
+		texels[index].face = -1;
+		lightmap.pixel_data[index] = BLACK;
+	}
+
+	// Put every face down in UV space and note which texel centers it covers. sample_nearest maps u to
+	// column u * width, so texel x is [x, x + 1) and its center is at x + 0.5.
+	{
+		TRACE_SCOPE("rasterize uvs");
+
+		for (auto index = 0; index < obj.face_count; ++index) {
+			auto &face = obj.faces[index];
+			Vec2f uv[3];
+			for (auto corner = 0; corner < 3; ++corner) {
+				auto coordinate = obj.text_coords[face.texture_indices.dim[corner]];
+				uv[corner] = Vec2f{ coordinate.x * lightmap.width - 0.5f, coordinate.y * lightmap.height - 0.5f };
+			}
+
+			auto double_area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+			if (fabsf(double_area) < 1e-12f) continue;
+
+			auto min_x = max(0, (int)ceilf(min(uv[0].x, min(uv[1].x, uv[2].x))));
+			auto max_x = min(lightmap.width - 1, (int)floorf(max(uv[0].x, max(uv[1].x, uv[2].x))));
+			auto min_y = max(0, (int)ceilf(min(uv[0].y, min(uv[1].y, uv[2].y))));
+			auto max_y = min(lightmap.height - 1, (int)floorf(max(uv[0].y, max(uv[1].y, uv[2].y))));
+
+			for (auto y = min_y; y <= max_y; ++y) {
+				for (auto x = min_x; x <= max_x; ++x) {
+					// Dividing by the signed area makes the weights come out positive inside either winding.
+					f32 weights[3];
+					for (auto corner = 0; corner < 3; ++corner) {
+						auto &p = uv[(corner + 1) % 3];
+						auto &q = uv[(corner + 2) % 3];
+						weights[corner] = ((q.x - p.x) * (y - p.y) - (q.y - p.y) * (x - p.x)) / double_area;
+					}
+					if (weights[0] < 0 || weights[1] < 0 || weights[2] < 0) continue;
+
+					auto &texel = texels[y * lightmap.width + x];
+					texel.face = index;
+					memcpy(texel.weights, weights, sizeof(weights));
+				}
+			}
+		}
+	}
+
+	BakeJob job = {};
+	job.bvh = &bvh;
+	job.obj = &obj;
+	job.lightmap = &lightmap;
+	job.texels = texels;
+	fill_settings(bvh, settings, job);
+
+	parallel_for(jobs, lightmap.height, 4, bake_lightmap_job, &job);
+
+	// Grow the islands outwards a texel at a time, each new texel taking the average of the ones it touches.
+	TRACE_SCOPE("dilate lightmap");
+
+	for (auto index = 0; index < texel_count; ++index) {
+		filled[index] = texels[index].face >= 0;
+	}
+
+	for (auto pass = 0; pass < LIGHTMAP_DILATION; ++pass) {
+		memcpy(next_filled, filled, texel_count);
+
+		for (auto y = 0; y < lightmap.height; ++y) {
+			for (auto x = 0; x < lightmap.width; ++x) {
+				auto index = y * lightmap.width + x;
+				if (filled[index]) continue;
+
+				int neighbours[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+				auto red = 0;
+				auto green = 0;
+				auto count = 0;
+
+				for (auto &neighbour : neighbours) {
+					if (neighbour[0] < 0 || neighbour[0] >= lightmap.width || neighbour[1] < 0 || neighbour[1] >= lightmap.height) continue;
+					auto other = neighbour[1] * lightmap.width + neighbour[0];
+					if (!filled[other]) continue;
+
+					red += lightmap.pixel_data[other].r;
+					green += lightmap.pixel_data[other].g;
+					count++;
+				}
+
+				if (!count) continue;
+				lightmap.pixel_data[index] = Color((u8)(red / count), (u8)(green / count), 0, 255);
+				next_filled[index] = 1;
+			}
+		}
+
+		memcpy(filled, next_filled, texel_count);
+	}
+
+	return true;
+}
+
+//
+// The .bake file. A header and then a Vec2f per vertex, in the same order as WavefrontObj::verts.
+//
+
+// "BAKE" in the first four bytes of the file.
+const u32 VERTEX_BAKE_MAGIC = 0x454B4142;
+const u32 VERTEX_BAKE_VERSION = 1;
+
+struct VertexBakeHeader {
+	u32 magic;
+	u32 version;
+	s32 vert_count;
+	u32 reserved;
+};
+
+void vertex_bake_path(const char *mesh_path, char *path, int path_size) {
+	snprintf(path, path_size, "%s", mesh_path);
+
+	// Only a dot after the last slash starts the extension.
+	auto dot = strrchr(path, '.');
+	auto slash = max(strrchr(path, '/'), strrchr(path, '\\'));
+	if (dot && dot > slash) *dot = 0;
+
+	auto length = (int)strlen(path);
+	snprintf(path + length, path_size - length, ".bake");
+}
+
+bool write_vertex_bake(const char *path, const WavefrontObj &obj, const Vec2f *baked) {
+	auto file = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	defer { CloseHandle(file); };
+
+	VertexBakeHeader header = { VERTEX_BAKE_MAGIC, VERTEX_BAKE_VERSION, obj.vert_count, 0 };
+	auto size = (DWORD)(obj.vert_count * sizeof(Vec2f));
+
+	DWORD written;
+	return WriteFile(file, &header, sizeof(header), &written, 0) && written == sizeof(header) &&
+		WriteFile(file, baked, size, &written, 0) && written == size;
+}
+
+bool load_vertex_bake(const char *path, WavefrontObj &obj, MemoryArena &arena) {
+	TRACE_SCOPE("load_vertex_bake");
+
+	auto file = read_entire_file(path);
+	if (!file.read) return false;
+	defer { free_file_contents(file); };
+
+	auto &header = *(VertexBakeHeader *)file.result;
+	if (file.result_size < sizeof(header) || header.magic != VERTEX_BAKE_MAGIC || header.version != VERTEX_BAKE_VERSION) return false;
+	if (header.vert_count != obj.vert_count || file.result_size < sizeof(header) + obj.vert_count * sizeof(Vec2f)) return false;
+
+	auto baked = push_array(arena, Vec2f, obj.vert_count);
+	if (!baked) return false;
+
+	memcpy(baked, file.result + sizeof(header), obj.vert_count * sizeof(Vec2f));
+	obj.baked = baked;
+	return true;
+}
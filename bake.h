@@ -0,0 +1,53 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "arena.h"
+#include "wavefront.h"
+#include "texture.h"
+#include "jobs.h"
+
+// Offline lighting. The bake tool (bake_main.cpp) shoots rays at the mesh to work out, for every vertex or
+// every lightmap texel, how much of the sky it can see (ambient occlusion) and whether the light reaches it
+// (static diffuse). That's far too slow to do every frame, but it only has to happen once, and then the
+// shaders in shaders.h just read the results.
+//
+// Both come out as a pair of numbers in [0, 1]:
+//    occlusion - the cosine weighted fraction of the hemisphere over the surface that isn't blocked
+//                within max_distance. 1 is wide open, 0 is buried.
+//    direct    - max(0, normal . light_dir), or 0 if anything is between the surface and the light.
+//
+// Per vertex, they go in a .bake file next to the .wfo, which load_vertex_bake reads into
+// WavefrontObj::baked. The asset loader picks it up on its own if it's there. In a lightmap they're
+// the red and green of a TGA laid out over the mesh's UVs, which loads like any other texture.
+
+struct BakeSettings {
+	// Rays per vertex or texel for the occlusion.
+	int sample_count;
+
+	// How far away something can be and still count as blocking the sky. 0 means a quarter of the
+	// diagonal of the mesh's bounding box.
+	f32 max_distance;
+
+	// Same meaning as the shaders' light_dir, pointing from the surface towards the light.
+	Vec3f light_dir;
+};
+
+// baked gets obj.vert_count entries, one per position. Corners that share a position share its value, with
+// the normal averaged over them. The BVH and scratch go in arena. Returns false if arena ran out, or the
+// mesh's BVH came out too deep to trace.
+bool bake_vertices(JobSystem &jobs, MemoryArena &arena, const WavefrontObj &obj, const BakeSettings &settings, Vec2f *baked);
+
+// Fills lightmap, which has its size and pixels set up already, with occlusion in red and direct in green.
+// Texels that no triangle covers get their neighbours' values spread into them for a few texels, so sampling
+// right along a UV seam doesn't pick up black. Returns false the same as bake_vertices.
+bool bake_lightmap(JobSystem &jobs, MemoryArena &arena, const WavefrontObj &obj, const BakeSettings &settings, TextureMap &lightmap);
+
+// The .bake file for mesh_path, i.e. the same path with .bake in place of the extension.
+void vertex_bake_path(const char *mesh_path, char *path, int path_size);
+
+bool write_vertex_bake(const char *path, const WavefrontObj &obj, const Vec2f *baked);
+
+// Sets obj.baked, with the values in arena. Fails if there's no file, or it was baked from a mesh with
+// a different vertex count, and then obj.baked stays null.
+bool load_vertex_bake(const char *path, WavefrontObj &obj, MemoryArena &arena);
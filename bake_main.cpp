@@ -0,0 +1,142 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "vectors.h"
+#include "wavefront.h"
+#include "tgaimage.h"
+#include "texture.h"
+#include "arena.h"
+#include "jobs.h"
+#include "trace.h"
+#include "bake.h"
+
+// Bakes ambient occlusion and static diffuse light for a mesh (see bake.h).
+//
+//    bake [--mesh data/african_head.wfo] [--samples 256] [--distance 0.5] [--light x y z]
+//         [--lightmap out.tga] [--size 1024] [--no-vertex] [--trace trace.json]
+//
+// By default it writes the per-vertex bake next to the mesh, where the viewer's asset loader finds it
+// (render --baked). --lightmap also writes a lightmap over the mesh's UVs (render --lightmap out.tga).
+// The light defaults to the viewer's.
+
+static f64 GlobalTicksToMs;
+
+static u64 now_ticks() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (u64)counter.QuadPart;
+}
+
+int main(int argc, char **argv) {
+	const char *mesh_path = "data/african_head.wfo";
+	const char *lightmap_path = 0;
+	const char *trace_file_name = 0;
+	auto lightmap_size = 1024;
+	auto bake_vertex = true;
+
+	BakeSettings settings = {};
+	settings.sample_count = 256;
+	settings.light_dir = Vec3f{ 1, -1, 1 };
+
+	for (auto index = 1; index < argc; ++index) {
+		if (strcmp(argv[index], "--mesh") == 0 && index + 1 < argc) {
+			mesh_path = argv[++index];
+		} else if (strcmp(argv[index], "--samples") == 0 && index + 1 < argc) {
+			settings.sample_count = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--distance") == 0 && index + 1 < argc) {
+			settings.max_distance = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--light") == 0 && index + 3 < argc) {
+			settings.light_dir.x = (f32)atof(argv[++index]);
+			settings.light_dir.y = (f32)atof(argv[++index]);
+			settings.light_dir.z = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--lightmap") == 0 && index + 1 < argc) {
+			lightmap_path = argv[++index];
+		} else if (strcmp(argv[index], "--size") == 0 && index + 1 < argc) {
+			lightmap_size = clamp(atoi(argv[++index]), 16, 8192);
+		} else if (strcmp(argv[index], "--no-vertex") == 0) {
+			bake_vertex = false;
+		} else if (strcmp(argv[index], "--trace") == 0 && index + 1 < argc) {
+			trace_file_name = argv[++index];
+		} else {
+			fprintf(stderr, "Unknown argument %s\n", argv[index]);
+			return 1;
+		}
+	}
+
+	TRACE_THREAD_NAME("main");
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	GlobalTicksToMs = 1000.0 / (f64)frequency.QuadPart;
+
+	// Only reserved up front. The mesh, the BVH and a lightmap's worth of scratch are all that go in it.
+	MemoryArena arena;
+	if (!make_arena(arena, (size_t)1024 * 1024 * 1024)) {
+		fprintf(stderr, "Couldn't reserve the arena.\n");
+		return 1;
+	}
+
+	auto obj = load_obj(mesh_path, arena);
+	if (!obj.face_count) {
+		fprintf(stderr, "Couldn't load %s.\n", mesh_path);
+		return 1;
+	}
+
+	JobSystem jobs;
+	if (!start_job_system(jobs, 0)) {
+		fprintf(stderr, "Couldn't start the job system.\n");
+		return 1;
+	}
+
+	printf("Baking %s: %d vertices, %d faces, %d samples on %d threads\n", mesh_path, obj.vert_count, obj.face_count, settings.sample_count, jobs.worker_count);
+	auto result = 0;
+
+	if (bake_vertex) {
+		auto start = now_ticks();
+		auto baked = push_array(arena, Vec2f, obj.vert_count);
+
+		char bake_path[MAX_PATH];
+		vertex_bake_path(mesh_path, bake_path, MAX_PATH);
+
+		if (!baked || !bake_vertices(jobs, arena, obj, settings, baked)) {
+			fprintf(stderr, "Couldn't bake the vertices. Either there wasn't the memory, or the mesh's BVH is too deep.\n");
+			result = 1;
+		} else if (!write_vertex_bake(bake_path, obj, baked)) {
+			fprintf(stderr, "Couldn't write %s.\n", bake_path);
+			result = 1;
+		} else {
+			printf("Wrote %s in %.0f ms\n", bake_path, (now_ticks() - start) * GlobalTicksToMs);
+		}
+	}
+
+	if (lightmap_path) {
+		auto start = now_ticks();
+
+		TextureMap lightmap = {};
+		lightmap.width = lightmap_size;
+		lightmap.height = lightmap_size;
+		lightmap.pixel_data = push_array(arena, Color, lightmap_size * lightmap_size);
+
+		if (!lightmap.pixel_data || !bake_lightmap(jobs, arena, obj, settings, lightmap)) {
+			fprintf(stderr, "Couldn't bake the lightmap. Either there wasn't the memory, or the mesh's BVH is too deep.\n");
+			result = 1;
+		} else if (!write_tga_image(lightmap_path, lightmap)) {
+			fprintf(stderr, "Couldn't write %s.\n", lightmap_path);
+			result = 1;
+		} else {
+			printf("Wrote %s (%dx%d) in %.0f ms\n", lightmap_path, lightmap_size, lightmap_size, (now_ticks() - start) * GlobalTicksToMs);
+		}
+	}
+
+	stop_job_system(jobs);
+	free_arena(arena);
+
+	if (trace_file_name && !write_trace(trace_file_name)) {
+		fprintf(stderr, "Couldn't write a trace to %s. Is RENDER_TRACE defined?\n", trace_file_name);
+	}
+
+	return result;
+}
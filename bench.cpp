@@ -0,0 +1,503 @@
+#include <windows.h>
+#include <intrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "stretchy_buffer.h"
+#include "types.h"
+#include "color.h"
+#include "render.h"
+#include "vectors.h"
+#include "wavefront.h"
+#include "tgaimage.h"
+#include "texture.h"
+#include "matrix_math.h"
+#include "camera.h"
+#include "raster.h"
+#include "shaders.h"
+#include "shadow.h"
+#include "trace.h"
+#include "arena.h"
+#include "jobs.h"
+#include "framegraph.h"
+#include "post.h"
+#include "passes.h"
+
+// Renders a fixed set of scenes along scripted camera orbits with no window attached, times every
+// stage of every frame, and writes the results out as JSON. Given the JSON from an earlier run,
+// it also says whether anything got slower than the threshold allows, and exits with 1 if so.
+//
+//    bench [--out results.json] [--baseline baseline.json] [--threshold 0.05] [--frames 120]
+//
+// Everything that goes into a frame is fixed: the meshes, the orbit, the resolutions, the frame count.
+// So two runs of the same build draw exactly the same pixels, and each case records a hash of its last
+// frame to prove it. If a hash changes between runs, the numbers aren't comparable anymore.
+//
+// The frames go through build_frame_graph on the job system, same as the viewer's, so it's the viewer's
+// frame that gets timed, and the stages are its passes. The shadow map is drawn once per case, in the first
+// warmup frame, the way the viewer only draws it when it's stale, so it isn't a stage. Post always has FXAA
+// on, so there's a post pass to time.
+
+struct BenchScene {
+	const char *name;
+	const char *mesh_path;
+	const char *diffuse_path;
+};
+
+static const BenchScene SCENES[] = {
+	{ "african_head", "data/african_head.wfo", "data/african_head_diffuse.tga" },
+};
+
+struct BenchResolution {
+	int width;
+	int height;
+};
+
+static const BenchResolution RESOLUTIONS[] = {
+	{ 512, 512 },
+	{ 1024, 1024 },
+	{ 1920, 1080 },
+};
+
+enum BenchStage {
+	STAGE_CLEAR,
+	STAGE_RASTER,
+	STAGE_OUTPUT,
+	STAGE_POST,
+	STAGE_FRAME,
+
+	STAGE_COUNT,
+};
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {
+	"clear",
+	"raster",
+	"output",
+	"post",
+	"frame",
+};
+
+// Frames before this many into each case aren't recorded. They're where the caches and the page tables get warmed up.
+const int WARMUP_FRAMES = 10;
+
+struct StageSummary {
+	f64 median_ms;
+	f64 p95_ms;
+	f64 p99_ms;
+	f64 mean_ms;
+	f64 min_ms;
+};
+
+struct BenchCase {
+	char name[64];
+	const BenchScene *scene;
+	BenchResolution resolution;
+
+	StageSummary stages[STAGE_COUNT];
+	u64 frame_hash;
+};
+
+static f64 GlobalTicksToMs;
+
+static u64 now_ticks() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (u64)counter.QuadPart;
+}
+
+static int compare_f64(const void *a, const void *b) {
+	auto lhs = *(const f64 *)a;
+	auto rhs = *(const f64 *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+// Nearest rank. samples has to be sorted.
+static f64 percentile(const f64 *samples, int count, f64 percent) {
+	auto rank = (int)ceil(percent / 100.0 * count);
+	return samples[clamp(rank - 1, 0, count - 1)];
+}
+
+static StageSummary summarize(f64 *samples, int count) {
+	qsort(samples, count, sizeof(f64), compare_f64);
+
+	StageSummary summary = {};
+	summary.median_ms = percentile(samples, count, 50);
+	summary.p95_ms = percentile(samples, count, 95);
+	summary.p99_ms = percentile(samples, count, 99);
+	summary.min_ms = samples[0];
+
+	for (auto index = 0; index < count; ++index) {
+		summary.mean_ms += samples[index];
+	}
+	summary.mean_ms /= count;
+
+	return summary;
+}
+
+// FNV-1a over the pixels.
+static u64 hash_backbuffer(const Backbuffer &buffer) {
+	auto bytes = (const u8 *)buffer.memory;
+	auto size = (u64)buffer.width * buffer.height * 4;
+
+	u64 hash = 14695981039346656037ull;
+	for (u64 index = 0; index < size; ++index) {
+		hash = (hash ^ bytes[index]) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
+static bool run_case(JobSystem &jobs, MemoryArena &frame_arena, BenchCase &bench_case, const WavefrontObj &obj, const TextureMap &texture_map, int frame_count) {
+	auto width = bench_case.resolution.width;
+	auto height = bench_case.resolution.height;
+
+	auto target = make_render_target(width, height);
+	auto buffer = make_backbuffer(width, height);
+	auto shadow_map = make_shadow_map(1024);
+	if (!target.tiles || !buffer.memory || !shadow_map.depth.tiles) return false;
+
+	// Same lighting and shading as the viewer.
+	auto light_dir = normalize(Vec3f{ 1, -1, 1 });
+	auto shadow_transform = make_viewport(0, 0, shadow_map.depth.width, shadow_map.depth.height) * look_at(light_dir, Vec3f{ 0, 0, 0 }, Vec3f{ 0, 1, 0 });
+
+	ShadowedGouraudShader shader = {};
+	shader.light_dir = light_dir;
+	shader.texture_map = &texture_map;
+	shader.shadow_map = &shadow_map;
+	shader.shadow_ambient = 0.3f;
+
+	PostSettings post_settings = {};
+	post_settings.fxaa = true;
+	auto post = make_post_processor(post_settings, width, height, jobs);
+
+	ShadingStats stats = {};
+
+	FramePasses passes = {};
+	passes.jobs = &jobs;
+	passes.frame_arena = &frame_arena;
+	passes.target = &target;
+	passes.render_mode = RENDER_FORWARD;
+	passes.stats = &stats;
+	passes.obj = &obj;
+	passes.draw = draw_shadowed_pass;
+	passes.output = upscale_pass;
+	passes.shadow_map = &shadow_map;
+	passes.shadow_transform = shadow_transform;
+	passes.light_dir = light_dir;
+	passes.shader = &shader;
+	passes.buffer = &buffer;
+	passes.post = &post;
+
+	FrameGraph graph = {};
+
+	// Keep the mesh square in the middle of wide resolutions instead of stretching it.
+	auto size = min(width, height);
+	auto viewport = make_viewport((width - size) / 2, (height - size) / 2, size, size);
+
+	f64 *samples[STAGE_COUNT];
+	for (auto stage = 0; stage < STAGE_COUNT; ++stage) {
+		samples[stage] = (f64 *)malloc(frame_count * sizeof(f64));
+	}
+
+	auto drawn = true;
+	for (auto frame = -WARMUP_FRAMES; frame < frame_count; ++frame) {
+		// One full turn around the mesh over the recorded frames. The warmup frames go around the
+		// end of the same orbit, so they look just like the frames that count.
+		TRACE_SCOPE("bench frame");
+		reset_arena(frame_arena);
+
+		const f32 radius = 3;
+		auto angle = 6.28318530718f * frame / frame_count;
+		auto camera = Vec3f{ radius * sinf(angle), 1, radius * cosf(angle) };
+
+		auto proj = Mat4_Identity;
+		set_matrix_entry(proj, 3, 2, -1.0f / radius);
+		passes.transform = viewport * proj * look_at(camera, Vec3f{ 0, 0, 0 }, Vec3f{ 0, 1, 0 });
+
+		auto start = now_ticks();
+		build_frame_graph(graph, passes, true);
+		if (!compile_frame_graph(graph, frame_arena)) {
+			drawn = false;
+			break;
+		}
+		execute_frame_graph(jobs, graph);
+		auto end = now_ticks();
+
+		if (frame < 0) continue;
+
+		samples[STAGE_CLEAR][frame] = graph.passes[passes.clear_index].ms;
+		samples[STAGE_RASTER][frame] = graph.passes[passes.draw_index].ms;
+		samples[STAGE_OUTPUT][frame] = graph.passes[passes.output_index].ms;
+		samples[STAGE_POST][frame] = passes.post_index >= 0 ? graph.passes[passes.post_index].ms : 0;
+		samples[STAGE_FRAME][frame] = (end - start) * GlobalTicksToMs;
+	}
+
+	for (auto stage = 0; stage < STAGE_COUNT; ++stage) {
+		if (drawn) bench_case.stages[stage] = summarize(samples[stage], frame_count);
+		free(samples[stage]);
+	}
+
+	bench_case.frame_hash = hash_backbuffer(buffer);
+
+	free_shadow_map(shadow_map);
+	free_backbuffer(buffer);
+	free_render_target(target);
+
+	return drawn;
+}
+
+static void write_machine_info(FILE *file) {
+	// The brand string is spread over three cpuid leaves, sixteen bytes each.
+	char cpu_name[49] = {};
+	int registers[4];
+
+	__cpuid(registers, 0x80000000);
+	if ((u32)registers[0] >= 0x80000004) {
+		for (auto leaf = 0; leaf < 3; ++leaf) {
+			__cpuid(registers, 0x80000002 + leaf);
+			memcpy(cpu_name + leaf * 16, registers, sizeof(registers));
+		}
+	}
+
+	// It's padded with spaces on some parts.
+	auto cpu_start = cpu_name;
+	while (*cpu_start == ' ') ++cpu_start;
+
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+
+	MEMORYSTATUSEX memory_status = {};
+	memory_status.dwLength = sizeof(memory_status);
+	GlobalMemoryStatusEx(&memory_status);
+
+	fprintf(file, "  \"machine\": {\n");
+	fprintf(file, "    \"cpu\": \"%s\",\n", cpu_start);
+	fprintf(file, "    \"logical_processors\": %lu,\n", (unsigned long)system_info.dwNumberOfProcessors);
+	fprintf(file, "    \"memory_mb\": %llu,\n", (unsigned long long)(memory_status.ullTotalPhys / (1024 * 1024)));
+#if defined(_MSC_VER)
+	fprintf(file, "    \"compiler\": \"msvc %d\",\n", _MSC_VER);
+#else
+	fprintf(file, "    \"compiler\": \"unknown\",\n");
+#endif
+#if defined(_DEBUG)
+	fprintf(file, "    \"build\": \"debug\",\n");
+#else
+	fprintf(file, "    \"build\": \"release\",\n");
+#endif
+	fprintf(file, "    \"pointer_bits\": %d\n", (int)(sizeof(void *) * 8));
+	fprintf(file, "  },\n");
+}
+
+// Each case goes on one line, which is what read_baseline counts on.
+static void write_results(FILE *file, const BenchCase *cases, int case_count, int frame_count) {
+	fprintf(file, "{\n");
+	write_machine_info(file);
+	fprintf(file, "  \"frames_per_case\": %d,\n", frame_count);
+	fprintf(file, "  \"warmup_frames\": %d,\n", WARMUP_FRAMES);
+	fprintf(file, "  \"cases\": [\n");
+
+	for (auto index = 0; index < case_count; ++index) {
+		auto &bench_case = cases[index];
+
+		fprintf(file, "    {\"case\": \"%s\", \"scene\": \"%s\", \"width\": %d, \"height\": %d, \"frame_hash\": \"%016llx\", \"frame_median_ms\": %.4f, \"stages\": {",
+			bench_case.name, bench_case.scene->name, bench_case.resolution.width, bench_case.resolution.height,
+			(unsigned long long)bench_case.frame_hash, bench_case.stages[STAGE_FRAME].median_ms);
+
+		for (auto stage = 0; stage < STAGE_COUNT; ++stage) {
+			auto &summary = bench_case.stages[stage];
+			fprintf(file, "%s\"%s\": {\"median_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"mean_ms\": %.4f, \"min_ms\": %.4f}",
+				stage ? ", " : "", STAGE_NAMES[stage], summary.median_ms, summary.p95_ms, summary.p99_ms, summary.mean_ms, summary.min_ms);
+		}
+
+		fprintf(file, "}}%s\n", index + 1 < case_count ? "," : "");
+	}
+
+	fprintf(file, "  ]\n");
+	fprintf(file, "}\n");
+}
+
+struct BaselineCase {
+	char name[64];
+	char frame_hash[17];
+	f64 frame_median_ms;
+};
+
+// Not a JSON parser. It only understands files that write_results wrote, where each case is one
+// line with the fields in a known order, and it skips any line it doesn't recognize.
+static BaselineCase *read_baseline(const char *path) {
+	FILE *file;
+	if (fopen_s(&file, path, "rb") != 0) return 0;
+
+	BaselineCase *cases = 0;
+	char line[4096];
+
+	while (fgets(line, sizeof(line), file)) {
+		BaselineCase baseline = {};
+		auto name = strstr(line, "\"case\": \"");
+		auto hash = strstr(line, "\"frame_hash\": \"");
+		auto median = strstr(line, "\"frame_median_ms\": ");
+		if (!name || !hash || !median) continue;
+
+		if (sscanf_s(name, "\"case\": \"%63[^\"]\"", baseline.name, (unsigned)sizeof(baseline.name)) != 1) continue;
+		if (sscanf_s(hash, "\"frame_hash\": \"%16[0-9a-f]\"", baseline.frame_hash, (unsigned)sizeof(baseline.frame_hash)) != 1) continue;
+		if (sscanf_s(median, "\"frame_median_ms\": %lf", &baseline.frame_median_ms) != 1) continue;
+
+		sb_push(cases, baseline);
+	}
+
+	fclose(file);
+	return cases;
+}
+
+// Returns how many cases got slower by more than threshold (a fraction, so 0.05 is 5%).
+static int compare_to_baseline(const BenchCase *cases, int case_count, const BaselineCase *baseline, f64 threshold) {
+	auto regressions = 0;
+
+	for (auto index = 0; index < case_count; ++index) {
+		auto &bench_case = cases[index];
+
+		const BaselineCase *match = 0;
+		for (auto baseline_index = 0; baseline_index < sb_count(baseline); ++baseline_index) {
+			if (strcmp(baseline[baseline_index].name, bench_case.name) == 0) match = &baseline[baseline_index];
+		}
+
+		if (!match) {
+			printf("%-28s no baseline\n", bench_case.name);
+			continue;
+		}
+
+		auto current = bench_case.stages[STAGE_FRAME].median_ms;
+		auto change = (current - match->frame_median_ms) / match->frame_median_ms;
+		auto regressed = change > threshold;
+		if (regressed) ++regressions;
+
+		char hash[17];
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)bench_case.frame_hash);
+
+		printf("%-28s %9.3f ms -> %9.3f ms (%+6.1f%%)%s%s\n", bench_case.name, match->frame_median_ms, current, change * 100,
+			regressed ? "  REGRESSION" : "", strcmp(hash, match->frame_hash) ? "  (image changed)" : "");
+	}
+
+	return regressions;
+}
+
+int main(int argc, char **argv) {
+	const char *out_path = "bench_results.json";
+	const char *baseline_path = 0;
+	const char *trace_path = 0;
+	f64 threshold = 0.05;
+	auto frame_count = 120;
+
+	for (auto index = 1; index < argc; ++index) {
+		auto has_value = index + 1 < argc;
+
+		if (strcmp(argv[index], "--out") == 0 && has_value) {
+			out_path = argv[++index];
+		} else if (strcmp(argv[index], "--baseline") == 0 && has_value) {
+			baseline_path = argv[++index];
+		} else if (strcmp(argv[index], "--threshold") == 0 && has_value) {
+			threshold = atof(argv[++index]);
+		} else if (strcmp(argv[index], "--frames") == 0 && has_value) {
+			frame_count = max(1, atoi(argv[++index]));
+		} else if (strcmp(argv[index], "--trace") == 0 && has_value) {
+			trace_path = argv[++index];
+		} else {
+			printf("usage: bench [--out results.json] [--baseline baseline.json] [--threshold 0.05] [--frames 120] [--trace trace.json]\n");
+			return 2;
+		}
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	GlobalTicksToMs = 1000.0 / (f64)frequency.QuadPart;
+
+	// The same job system and frame arena the viewer draws with.
+	JobSystem jobs;
+	if (!start_job_system(jobs, 0)) {
+		printf("Couldn't start the job system.\n");
+		return 2;
+	}
+
+	MemoryArena frame_arena;
+	if (!make_arena(frame_arena, 64 * 1024 * 1024)) {
+		printf("Couldn't reserve the frame arena.\n");
+		return 2;
+	}
+
+	const auto scene_count = (int)(sizeof(SCENES) / sizeof(SCENES[0]));
+	const auto resolution_count = (int)(sizeof(RESOLUTIONS) / sizeof(RESOLUTIONS[0]));
+
+	BenchCase *cases = 0;
+
+	for (auto scene_index = 0; scene_index < scene_count; ++scene_index) {
+		auto &scene = SCENES[scene_index];
+
+		// Each scene's assets get an arena of their own, freed once its cases are done.
+		MemoryArena asset_arena;
+		if (!make_arena(asset_arena, 256 * 1024 * 1024)) {
+			printf("Couldn't reserve memory for %s.\n", scene.name);
+			return 2;
+		}
+
+		auto obj = load_obj(scene.mesh_path, asset_arena);
+		auto image_load_result = load_tga_image(scene.diffuse_path);
+		if (!obj.face_count || !image_load_result.loaded) {
+			printf("Couldn't load %s.\n", scene.name);
+			return 2;
+		}
+
+		auto texture_map = decompress_tga_image(&image_load_result.image, asset_arena);
+		free_tga_image(image_load_result);
+
+		for (auto resolution_index = 0; resolution_index < resolution_count; ++resolution_index) {
+			BenchCase bench_case = {};
+			bench_case.scene = &scene;
+			bench_case.resolution = RESOLUTIONS[resolution_index];
+			snprintf(bench_case.name, sizeof(bench_case.name), "%s_%dx%d", scene.name, bench_case.resolution.width, bench_case.resolution.height);
+
+			if (!run_case(jobs, frame_arena, bench_case, obj, texture_map, frame_count)) {
+				printf("Couldn't allocate the targets or the frame graph for %s.\n", bench_case.name);
+				return 2;
+			}
+
+			auto &frame = bench_case.stages[STAGE_FRAME];
+			printf("%-28s median %8.3f ms  p95 %8.3f ms  p99 %8.3f ms\n", bench_case.name, frame.median_ms, frame.p95_ms, frame.p99_ms);
+
+			sb_push(cases, bench_case);
+		}
+
+		free_arena(asset_arena);
+	}
+
+	stop_job_system(jobs);
+	free_arena(frame_arena);
+
+	FILE *out;
+	if (fopen_s(&out, out_path, "wb") != 0) {
+		printf("Couldn't open %s.\n", out_path);
+		return 2;
+	}
+
+	write_results(out, cases, sb_count(cases), frame_count);
+	fclose(out);
+
+	if (trace_path && !write_trace(trace_path)) {
+		printf("Couldn't write a trace to %s. Is RENDER_TRACE defined?\n", trace_path);
+	}
+
+	if (!baseline_path) return 0;
+
+	auto baseline = read_baseline(baseline_path);
+	if (!baseline) {
+		printf("Couldn't read a baseline from %s.\n", baseline_path);
+		return 2;
+	}
+
+	printf("\nAgainst %s (threshold %.1f%%):\n", baseline_path, threshold * 100);
+	auto regressions = compare_to_baseline(cases, sb_count(cases), baseline, threshold);
+
+	return regressions ? 1 : 0;
+}
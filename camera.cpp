@@ -0,0 +1,86 @@
+#include "camera.h"
+
+Mat4f make_viewport(int x, int y, int width, int height) {
+	const int near_clip = 1;
+	const int far_clip = 255;
+	const int depth = far_clip - near_clip;
+
+	Mat4f result = Mat4_Identity;
+
+	set_matrix_entry(result, 0, 0, width * 0.5f);
+	set_matrix_entry(result, 0, 3, x + width * 0.5f);
+
+	set_matrix_entry(result, 1, 1, height * 0.5f);
+	set_matrix_entry(result, 1, 3, y + height * 0.5f);
+
+	set_matrix_entry(result, 2, 2, depth * 0.5f);
+	set_matrix_entry(result, 2, 3, depth * 0.5f);
+
+	return result;
+}
+
+Mat4f look_at(Vec3f eye, Vec3f center, Vec3f up) {
+	auto z = normalize(eye - center);
+	auto x = normalize(up.cross(z));
+	auto y = normalize(z.cross(x));
+
+	auto view = Mat4_Identity;
+	auto model = Mat4_Identity;
+
+	for (auto index = 0; index < 3; ++index) {
+		set_matrix_entry(view, 0, index, x.dim[index]);
+		set_matrix_entry(view, 1, index, y.dim[index]);
+		set_matrix_entry(view, 2, index, z.dim[index]);
+		set_matrix_entry(model, index, 3, -center.dim[index]);
+	}
+
+	return view * model;
+}
+
+static Vec4f matrix_row(const Mat4f &matrix, int row) {
+	Vec4f result;
+	for (auto col = 0; col < 4; ++col) {
+		result.dim[col] = matrix.dim[row * 4 + col];
+	}
+	return result;
+}
+
+Frustum make_frustum(const Mat4f &screen_transform, int width, int height) {
+	// A point p ends up at x = (row_x . p) / (row_w . p) on screen, and the same for y. With w > 0,
+	// 0 <= x <= width is the same as row_x . p >= 0 and (width * row_w - row_x) . p >= 0, which are planes.
+	auto row_x = matrix_row(screen_transform, 0);
+	auto row_y = matrix_row(screen_transform, 1);
+	auto row_w = matrix_row(screen_transform, 3);
+
+	Frustum frustum;
+	frustum.planes[FRUSTUM_LEFT] = row_x;
+	frustum.planes[FRUSTUM_RIGHT] = row_w * (f32)width - row_x;
+	frustum.planes[FRUSTUM_BOTTOM] = row_y;
+	frustum.planes[FRUSTUM_TOP] = row_w * (f32)height - row_y;
+	frustum.planes[FRUSTUM_NEAR] = row_w;
+
+	return frustum;
+}
+
+FrustumTest test_box(const Frustum &frustum, const Vec3f &box_min, const Vec3f &box_max) {
+	auto result = FRUSTUM_INSIDE;
+
+	for (auto index = 0; index < FRUSTUM_PLANE_COUNT; ++index) {
+		auto &plane = frustum.planes[index];
+
+		// The corner furthest along the plane's normal, and the one furthest against it.
+		Vec3f nearest;
+		Vec3f furthest;
+
+		for (auto axis = 0; axis < 3; ++axis) {
+			auto positive = plane.dim[axis] >= 0;
+			furthest.dim[axis] = positive ? box_max.dim[axis] : box_min.dim[axis];
+			nearest.dim[axis] = positive ? box_min.dim[axis] : box_max.dim[axis];
+		}
+
+		if (plane.x * furthest.x + plane.y * furthest.y + plane.z * furthest.z + plane.w < 0) return FRUSTUM_OUTSIDE;
+		if (plane.x * nearest.x + plane.y * nearest.y + plane.z * nearest.z + plane.w < 0) result = FRUSTUM_INTERSECTS;
+	}
+
+	return result;
+}
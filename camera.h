@@ -0,0 +1,39 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+
+Mat4f make_viewport(int x, int y, int width, int height);
+Mat4f look_at(Vec3f eye, Vec3f center, Vec3f up);
+
+// A plane is (a, b, c, d) with a * x + b * y + c * z + d >= 0 on the inside.
+//
+// The projection here only puts the camera distance into w, so there's no far plane.
+// The near plane just keeps things with w <= 0 out, since those would get flipped onto the screen.
+enum FrustumPlane {
+	FRUSTUM_LEFT,
+	FRUSTUM_RIGHT,
+	FRUSTUM_BOTTOM,
+	FRUSTUM_TOP,
+	FRUSTUM_NEAR,
+
+	FRUSTUM_PLANE_COUNT,
+};
+
+struct Frustum {
+	Vec4f planes[FRUSTUM_PLANE_COUNT];
+};
+
+// screen_transform takes world space to the screen, i.e. viewport * projection * view,
+// and the frustum is whatever lands in [0, width) x [0, height) in front of the camera.
+Frustum make_frustum(const Mat4f &screen_transform, int width, int height);
+
+enum FrustumTest {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE,
+};
+
+// Conservative. A box near a corner of the frustum can come back as intersecting when it's actually outside.
+FrustumTest test_box(const Frustum &frustum, const Vec3f &box_min, const Vec3f &box_max);
@@ -2,20 +2,18 @@
 
 #include "types.h"
 
+// The fields are in this order so that a Color in memory is exactly the ARGB u32 that the
+// framebuffer and StretchDIBits use (it's BGRA byte by byte on a little endian machine).
+// That way whole rows of them can be loaded and stored as-is.
 struct Color {
-	u8 r;
-	u8 g;
 	u8 b;
+	u8 g;
+	u8 r;
 	u8 a;
 
-	Color(f32 red, f32 green, f32 blue, f32 alpha) {
-		r = (u8)red;
-		g = (u8)green;
-		b = (u8)blue;
-		a = (u8)alpha;
-	}
+	Color(u8 red, u8 green, u8 blue, u8 alpha) : b(blue), g(green), r(red), a(alpha) {}
 
-	Color() : r(), g(), b(), a() {}
+	Color() : b(), g(), r(), a() {}
 };
 
 const Color WHITE = Color{ 255, 255, 255, 255 };
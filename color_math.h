@@ -0,0 +1,96 @@
+#pragma once
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "types.h"
+#include "color.h"
+
+// Light intensities are 8.8 fixed point all the way down the color path, so 256 is 1.0.
+// Anything over 1.0 brightens and saturates at 255 when it's packed back down to bytes.
+typedef u16 FixedLight;
+
+const FixedLight FIXED_LIGHT_ONE = 256;
+
+inline FixedLight to_fixed_light(f32 intensity) {
+	return (FixedLight)(clamp(intensity, 0.0f, 255.0f) * 256.0f);
+}
+
+// Scales a single color by an 8.8 light. Same math as modulate_row, one pixel at a time.
+inline Color modulate(Color color, FixedLight light) {
+	auto r = (color.r * light) >> 8;
+	auto g = (color.g * light) >> 8;
+	auto b = (color.b * light) >> 8;
+	return Color((u8)(r < 255 ? r : 255), (u8)(g < 255 ? g : 255), (u8)(b < 255 ? b : 255), 255);
+}
+
+// Channel by channel product, for tints. Multiplying by WHITE gives back the same color.
+inline Color multiply(Color color, Color tint) {
+	return Color(
+		(u8)((color.r * tint.r + 255) >> 8),
+		(u8)((color.g * tint.g + 255) >> 8),
+		(u8)((color.b * tint.b + 255) >> 8),
+		255);
+}
+
+// Takes one tile row worth of texels and lights, scales each texel by its light, and writes
+// the pixels that have their bit set in coverage to destination with alpha forced to 255.
+// Pixels without their bit set are left alone, so the texels and lights for those can be garbage.
+//
+// Bytes get widened to the top half of 16 bit lanes (c << 8), so a pmulhuw against the light
+// gives (c << 8) * light >> 16 = c * light >> 8. That's the whole multiply, for four pixels at a time
+// (eight with AVX2). packus does the clamp to 255 on the way back down.
+//
+// destination needs to be 16 byte aligned, which tile rows are.
+inline void modulate_row(u32 *destination, const Color texels[8], const FixedLight lights[8], int coverage) {
+	auto alpha = _mm_set1_epi32(0xFF000000);
+	auto zero = _mm_setzero_si128();
+	auto all_lights = _mm_loadu_si128((const __m128i *)lights);
+
+#if defined(__AVX2__)
+	auto texel_row = _mm256_loadu_si256((const __m256i *)texels);
+
+	// Each 128 bit half of a 256 bit register unpacks on its own, so pixels 0-1 and 4-5 end up
+	// in low and pixels 2-3 and 6-7 in high. The lights need to be spread out the same way.
+	auto low = _mm256_unpacklo_epi8(_mm256_setzero_si256(), texel_row);
+	auto high = _mm256_unpackhi_epi8(_mm256_setzero_si256(), texel_row);
+
+	auto paired = _mm256_cvtepu16_epi32(all_lights);
+	paired = _mm256_or_si256(paired, _mm256_slli_epi32(paired, 16));
+	auto low_lights = _mm256_unpacklo_epi32(paired, paired);
+	auto high_lights = _mm256_unpackhi_epi32(paired, paired);
+
+	low = _mm256_mulhi_epu16(low, low_lights);
+	high = _mm256_mulhi_epu16(high, high_lights);
+
+	auto pixels = _mm256_or_si256(_mm256_packus_epi16(low, high), _mm256_set1_epi32(0xFF000000));
+
+	auto bits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+	auto mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(coverage), bits), bits);
+
+	_mm256_maskstore_epi32((int *)destination, mask, pixels);
+#else
+	for (auto half = 0; half < 2; ++half) {
+		auto texel_quad = _mm_loadu_si128((const __m128i *)(texels + half * 4));
+
+		// [l0 l0 l1 l1 l2 l2 l3 l3] for this half, then each light spread over a whole pixel's four channels.
+		auto doubled = half ? _mm_unpackhi_epi16(all_lights, all_lights) : _mm_unpacklo_epi16(all_lights, all_lights);
+		auto low_lights = _mm_unpacklo_epi32(doubled, doubled);
+		auto high_lights = _mm_unpackhi_epi32(doubled, doubled);
+
+		auto low = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, texel_quad), low_lights);
+		auto high = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, texel_quad), high_lights);
+
+		auto pixels = _mm_or_si128(_mm_packus_epi16(low, high), alpha);
+
+		auto bits = _mm_set_epi32(8, 4, 2, 1);
+		auto mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(coverage >> (half * 4)), bits), bits);
+
+		auto target = (__m128i *)(destination + half * 4);
+		auto existing = _mm_load_si128(target);
+		_mm_store_si128(target, _mm_or_si128(_mm_and_si128(mask, pixels), _mm_andnot_si128(mask, existing)));
+	}
+#endif
+}
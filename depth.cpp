@@ -0,0 +1,158 @@
+#include <windows.h>
+#include <emmintrin.h>
+
+#include "depth.h"
+#include "stats.h"
+#include "trace.h"
+
+DepthBuffer depth_buffer_layout(int width, int height) {
+	DepthBuffer buffer = {};
+	buffer.width = width;
+	buffer.height = height;
+	buffer.tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	buffer.tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	return buffer;
+}
+
+DepthBuffer make_depth_buffer(int width, int height) {
+	auto buffer = depth_buffer_layout(width, height);
+	buffer.tiles = (DepthTile *)VirtualAlloc(0, depth_buffer_size(buffer), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	return buffer;
+}
+
+void free_depth_buffer(DepthBuffer &buffer) {
+	if (buffer.tiles) VirtualFree(buffer.tiles, 0, MEM_RELEASE);
+	buffer.tiles = 0;
+}
+
+void clear(DepthBuffer &buffer, f32 depth) {
+	auto tile_count = buffer.tiles_x * buffer.tiles_y;
+
+	for (auto index = 0; index < tile_count; ++index) {
+		for (auto pixel_index = 0; pixel_index < TILE_PIXELS; ++pixel_index) {
+			buffer.tiles[index].depth[pixel_index] = depth;
+		}
+	}
+}
+
+DepthView depth_view(DepthBuffer &buffer) {
+	DepthView view;
+	view.first_tile = buffer.tiles[0].depth;
+	view.tile_stride = sizeof(DepthTile) / sizeof(f32);
+	view.tiles_x = buffer.tiles_x;
+	view.width = buffer.width;
+	view.height = buffer.height;
+	return view;
+}
+
+DepthView depth_view(RenderTarget &target) {
+	DepthView view;
+	view.first_tile = target.tiles[0].depth;
+	view.tile_stride = sizeof(RenderTile) / sizeof(f32);
+	view.tiles_x = target.tiles_x;
+	view.width = target.width;
+	view.height = target.height;
+	return view;
+}
+
+// How many of the four lanes are set in a movemask.
+static const int LANES_SET[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+void draw_triangle_depth(const DepthView &view, const Triangle &triangle) {
+	TriangleSetup setup;
+	auto set_up = setup_triangle(triangle, view.width, view.height, setup);
+	count_triangle(set_up);
+	if (!set_up) return;
+
+	rasterize_triangle_depth(view, setup);
+}
+
+void rasterize_triangle_depth(const DepthView &view, const TriangleSetup &setup) {
+	auto pixels_tested = 0;
+	auto pixels_inside = 0;
+	auto depth_passed = 0;
+
+	// These are the same multiplies and adds as edge_at and depth_at, just four lanes wide. There's no FMA
+	// here (or in the scalar path, since we don't build with /fp:fast), so each lane rounds the same way.
+	auto lane_offsets = _mm_set_ps(3, 2, 1, 0);
+	auto zero = _mm_setzero_ps();
+
+	__m128 edge_a[3];
+	for (auto edge = 0; edge < 3; ++edge) {
+		edge_a[edge] = _mm_set1_ps(setup.edge_a[edge]);
+	}
+
+	auto z_a = _mm_set1_ps(setup.z_a);
+
+	for (auto tile_y = setup.min_y / TILE_SIZE; tile_y <= setup.max_y / TILE_SIZE; ++tile_y) {
+		auto tile_min_y = max(setup.min_y, tile_y * TILE_SIZE);
+		auto tile_max_y = min(setup.max_y, tile_y * TILE_SIZE + TILE_SIZE - 1);
+
+		for (auto tile_x = setup.min_x / TILE_SIZE; tile_x <= setup.max_x / TILE_SIZE; ++tile_x) {
+			auto tile_first_x = tile_x * TILE_SIZE;
+			auto tile_depth = view.first_tile + (tile_y * view.tiles_x + tile_x) * view.tile_stride;
+
+			// Lanes outside the bounding box have to be masked off, since a tile row is always done as two groups of four.
+			auto lowest_dx = _mm_set1_ps((f32)(max(setup.min_x, tile_first_x) - setup.origin_x));
+			auto highest_dx = _mm_set1_ps((f32)(min(setup.max_x, tile_first_x + TILE_SIZE - 1) - setup.origin_x));
+
+			pixels_tested += (min(setup.max_x, tile_first_x + TILE_SIZE - 1) - max(setup.min_x, tile_first_x) + 1) * (tile_max_y - tile_min_y + 1);
+
+			for (auto y = tile_min_y; y <= tile_max_y; ++y) {
+				__m128 rows[3];
+				for (auto edge = 0; edge < 3; ++edge) {
+					rows[edge] = _mm_set1_ps(edge_row(setup, edge, y));
+				}
+
+				auto row_depth = _mm_set1_ps(depth_row(setup, y));
+				auto depth_row_pointer = tile_depth + (y % TILE_SIZE) * TILE_SIZE;
+
+				for (auto group = 0; group < TILE_SIZE; group += 4) {
+					auto dx = _mm_add_ps(_mm_set1_ps((f32)(tile_first_x + group - setup.origin_x)), lane_offsets);
+
+					auto inside = _mm_and_ps(_mm_cmpge_ps(dx, lowest_dx), _mm_cmple_ps(dx, highest_dx));
+					for (auto edge = 0; edge < 3; ++edge) {
+						auto value = _mm_add_ps(_mm_mul_ps(edge_a[edge], dx), rows[edge]);
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(value, zero));
+					}
+
+					auto inside_lanes = _mm_movemask_ps(inside);
+					if (inside_lanes == 0) continue;
+
+					auto depth = _mm_add_ps(_mm_mul_ps(z_a, dx), row_depth);
+					auto stored = _mm_load_ps(depth_row_pointer + group);
+					auto nearer = _mm_and_ps(inside, _mm_cmpgt_ps(depth, stored));
+
+					pixels_inside += LANES_SET[inside_lanes];
+					depth_passed += LANES_SET[_mm_movemask_ps(nearer)];
+
+					auto blended = _mm_or_ps(_mm_and_ps(nearer, depth), _mm_andnot_ps(nearer, stored));
+					_mm_store_ps(depth_row_pointer + group, blended);
+				}
+			}
+		}
+	}
+
+	auto &stats = thread_pipeline_stats();
+	stats.pixels_tested += pixels_tested;
+	stats.pixels_inside += pixels_inside;
+	stats.depth_passed += depth_passed;
+	stats.depth_failed += pixels_inside - depth_passed;
+	stats.pixels_written += depth_passed;
+}
+
+void draw_mesh_depth(const DepthView &view, const WavefrontObj &obj, const Mat4f &transform) {
+	TRACE_SCOPE("draw_mesh_depth");
+
+	for (auto index = 0; index < obj.face_count; ++index) {
+		auto &face = obj.faces[index];
+
+		Triangle triangle = {
+			project_to_vec3f(transform * obj.verts[face.vertex_indices.x].v3),
+			project_to_vec3f(transform * obj.verts[face.vertex_indices.y].v3),
+			project_to_vec3f(transform * obj.verts[face.vertex_indices.z].v3),
+		};
+
+		draw_triangle_depth(view, triangle);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "triangle.h"
+#include "render.h"
+#include "wavefront.h"
+
+// Depth with no color attached, laid out in the same 8x8 tiles as a RenderTarget.
+struct DepthTile {
+	f32 depth[TILE_PIXELS];
+};
+
+struct DepthBuffer {
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+
+	DepthTile *tiles;
+};
+
+// Lets the depth-only rasterizer write into either a DepthBuffer or the depth half of a
+// RenderTarget. The only difference between the two is how far apart the tiles are.
+struct DepthView {
+	f32 *first_tile;
+	int tile_stride; // In floats.
+	int tiles_x;
+	int width;
+	int height;
+};
+
+DepthBuffer make_depth_buffer(int width, int height);
+void free_depth_buffer(DepthBuffer &buffer);
+
+// make_depth_buffer without the tiles, for when they come from somewhere else. It takes depth_buffer_size
+// bytes to fill them in, and free_depth_buffer mustn't be called on it.
+DepthBuffer depth_buffer_layout(int width, int height);
+
+inline size_t depth_buffer_size(const DepthBuffer &buffer) {
+	return (size_t)buffer.tiles_x * buffer.tiles_y * sizeof(DepthTile);
+}
+void clear(DepthBuffer &buffer, f32 depth);
+
+DepthView depth_view(DepthBuffer &buffer);
+DepthView depth_view(RenderTarget &target);
+
+inline f32 get_depth(const DepthBuffer &buffer, int x, int y) {
+	return buffer.tiles[tile_index(buffer.tiles_x, x, y)].depth[tile_pixel_index(x, y)];
+}
+
+// Only interpolates z and only touches depth, four pixels at a time. No varyings, no shader, no color.
+// Depth comes out exactly the same as it does from draw_triangle<Shader> for the same triangle.
+void draw_triangle_depth(const DepthView &view, const Triangle &triangle);
+
+// The part of draw_triangle_depth after setup, for callers that need to adjust the setup first (see clip_rows).
+void rasterize_triangle_depth(const DepthView &view, const TriangleSetup &setup);
+
+// transform takes object space all the way to the screen, same as draw_mesh.
+void draw_mesh_depth(const DepthView &view, const WavefrontObj &obj, const Mat4f &transform);
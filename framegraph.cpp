@@ -0,0 +1,307 @@
+#include <windows.h>
+#include <assert.h>
+
+#include "framegraph.h"
+#include "trace.h"
+
+void begin_frame_graph(FrameGraph &graph) {
+	graph.pass_count = 0;
+	graph.buffer_count = 0;
+	graph.level_count = 0;
+	graph.transient_size = 0;
+	graph.heap_size = 0;
+	graph.overflowed = false;
+}
+
+static int add_buffer(FrameGraph &graph, const char *name, bool transient, size_t size, void *memory) {
+	if (graph.buffer_count == MAX_GRAPH_BUFFERS) {
+		graph.overflowed = true;
+		return 0;
+	}
+
+	auto index = graph.buffer_count++;
+	auto &buffer = graph.buffers[index];
+	buffer = {};
+	buffer.name = name;
+	buffer.transient = transient;
+	buffer.size = size;
+	buffer.memory = memory;
+	return index;
+}
+
+int import_buffer(FrameGraph &graph, const char *name, void *memory) {
+	return add_buffer(graph, name, false, 0, memory);
+}
+
+int create_buffer(FrameGraph &graph, const char *name, size_t size) {
+	return add_buffer(graph, name, true, size, 0);
+}
+
+int add_pass(FrameGraph &graph, const char *name, PassProc proc, void *data) {
+	if (graph.pass_count == MAX_GRAPH_PASSES) {
+		graph.overflowed = true;
+		return 0;
+	}
+
+	auto index = graph.pass_count++;
+	auto &pass = graph.passes[index];
+	pass = {};
+	pass.name = name;
+	pass.proc = proc;
+	pass.data = data;
+	return index;
+}
+
+void read_buffer(FrameGraph &graph, int pass, int buffer) {
+	auto &reader = graph.passes[pass];
+	if (reader.read_count == MAX_PASS_BUFFERS) {
+		graph.overflowed = true;
+		return;
+	}
+
+	reader.reads[reader.read_count++] = buffer;
+}
+
+void write_buffer(FrameGraph &graph, int pass, int buffer) {
+	auto &writer = graph.passes[pass];
+	if (writer.write_count == MAX_PASS_BUFFERS) {
+		graph.overflowed = true;
+		return;
+	}
+
+	writer.writes[writer.write_count++] = buffer;
+}
+
+static size_t align_size(size_t size) {
+	return (size + GRAPH_BUFFER_ALIGNMENT - 1) & ~(GRAPH_BUFFER_ALIGNMENT - 1);
+}
+
+// Works out where each transient buffer goes in the heap. Biggest first, each at the lowest offset that doesn't
+// overlap anything already placed that's alive at the same time. Buffers that are alive together can't share,
+// so the heap is never smaller than the most that's alive in any one level, and in practice it's right about that.
+static void place_transient_buffers(FrameGraph &graph, size_t *offsets) {
+	int placed[MAX_GRAPH_BUFFERS];
+	auto placed_count = 0;
+
+	for (;;) {
+		// The biggest one left. There are only ever a few, so picking each time is fine.
+		auto next = -1;
+		for (auto index = 0; index < graph.buffer_count; ++index) {
+			auto &buffer = graph.buffers[index];
+			if (!buffer.transient || buffer.first_level < 0 || offsets[index] != (size_t)-1) continue;
+			if (next < 0 || buffer.size > graph.buffers[next].size) next = index;
+		}
+
+		if (next < 0) break;
+
+		auto &buffer = graph.buffers[next];
+		auto size = align_size(buffer.size);
+
+		// Try right after each of the live ones, and the very start, and keep the lowest that fits.
+		size_t best = (size_t)-1;
+		for (auto candidate = -1; candidate < placed_count; ++candidate) {
+			auto offset = candidate < 0 ? 0 : offsets[placed[candidate]] + align_size(graph.buffers[placed[candidate]].size);
+			if (offset >= best) continue;
+
+			auto fits = true;
+			for (auto other_index = 0; other_index < placed_count && fits; ++other_index) {
+				auto other = placed[other_index];
+				auto &other_buffer = graph.buffers[other];
+
+				auto live_together = buffer.first_level <= other_buffer.last_level && other_buffer.first_level <= buffer.last_level;
+				auto overlap = offset < offsets[other] + align_size(other_buffer.size) && offsets[other] < offset + size;
+				if (live_together && overlap) fits = false;
+			}
+
+			if (fits) best = offset;
+		}
+
+		offsets[next] = best;
+		placed[placed_count++] = next;
+		graph.heap_size = max(graph.heap_size, best + size);
+	}
+}
+
+bool compile_frame_graph(FrameGraph &graph, MemoryArena &arena) {
+	TRACE_SCOPE("compile_frame_graph");
+
+	if (graph.overflowed) return false;
+
+	// Per buffer, going through the passes in the order they were declared: who wrote it last, and who has read
+	// it since then. Reads wait on the last write. Writes wait on the last write and on every read since.
+	int last_writer[MAX_GRAPH_BUFFERS];
+	u64 readers[MAX_GRAPH_BUFFERS];
+
+	// Only what a pass actually reads, for the culling. Waiting to write after somebody's read doesn't make
+	// the reader necessary.
+	u64 inputs[MAX_GRAPH_PASSES];
+
+	for (auto index = 0; index < graph.buffer_count; ++index) {
+		last_writer[index] = -1;
+		readers[index] = 0;
+	}
+
+	for (auto pass_index = 0; pass_index < graph.pass_count; ++pass_index) {
+		auto &pass = graph.passes[pass_index];
+		pass.depends_on = 0;
+		inputs[pass_index] = 0;
+
+		for (auto index = 0; index < pass.read_count; ++index) {
+			auto buffer = pass.reads[index];
+			if (last_writer[buffer] >= 0) {
+				pass.depends_on |= 1ull << last_writer[buffer];
+				inputs[pass_index] |= 1ull << last_writer[buffer];
+			}
+		}
+
+		for (auto index = 0; index < pass.write_count; ++index) {
+			auto buffer = pass.writes[index];
+			if (last_writer[buffer] >= 0) pass.depends_on |= 1ull << last_writer[buffer];
+			pass.depends_on |= readers[buffer];
+		}
+
+		// Only after both loops, so a pass that reads and writes the same buffer doesn't wait on itself.
+		for (auto index = 0; index < pass.read_count; ++index) {
+			readers[pass.reads[index]] |= 1ull << pass_index;
+		}
+
+		for (auto index = 0; index < pass.write_count; ++index) {
+			last_writer[pass.writes[index]] = pass_index;
+			readers[pass.writes[index]] = 0;
+		}
+
+		pass.depends_on &= ~(1ull << pass_index);
+		inputs[pass_index] &= ~(1ull << pass_index);
+	}
+
+	// Culling. Dependencies only ever point back, so going from the last pass to the first sees every pass
+	// that's needed before anything it needs.
+	u64 needed = 0;
+	for (auto pass_index = graph.pass_count - 1; pass_index >= 0; --pass_index) {
+		auto &pass = graph.passes[pass_index];
+
+		auto writes_import = false;
+		for (auto index = 0; index < pass.write_count; ++index) {
+			if (!graph.buffers[pass.writes[index]].transient) writes_import = true;
+		}
+
+		if (writes_import) needed |= 1ull << pass_index;
+		if (needed & (1ull << pass_index)) needed |= inputs[pass_index];
+	}
+
+	// Levels, and the lifetimes of the buffers in levels.
+	for (auto index = 0; index < graph.buffer_count; ++index) {
+		graph.buffers[index].first_level = -1;
+		graph.buffers[index].last_level = -1;
+	}
+
+	graph.level_count = 0;
+	for (auto pass_index = 0; pass_index < graph.pass_count; ++pass_index) {
+		auto &pass = graph.passes[pass_index];
+		pass.culled = !(needed & (1ull << pass_index));
+		pass.level = 0;
+		if (pass.culled) continue;
+
+		// A culled pass can still be somebody's dependency, if it only reads what they write. It's not running, so it's not in the way.
+		pass.depends_on &= needed;
+		for (auto index = 0; index < pass_index; ++index) {
+			if (pass.depends_on & (1ull << index)) pass.level = max(pass.level, graph.passes[index].level + 1);
+		}
+
+		graph.level_count = max(graph.level_count, pass.level + 1);
+
+		int *used[] = { pass.reads, pass.writes };
+		int used_count[] = { pass.read_count, pass.write_count };
+		for (auto list = 0; list < 2; ++list) {
+			for (auto index = 0; index < used_count[list]; ++index) {
+				auto &buffer = graph.buffers[used[list][index]];
+				if (buffer.first_level < 0 || pass.level < buffer.first_level) buffer.first_level = pass.level;
+				buffer.last_level = max(buffer.last_level, pass.level);
+			}
+		}
+	}
+
+	// The order, a level at a time and in declaration order within a level.
+	auto order_count = 0;
+	for (auto level = 0; level < graph.level_count; ++level) {
+		graph.level_starts[level] = order_count;
+		for (auto pass_index = 0; pass_index < graph.pass_count; ++pass_index) {
+			auto &pass = graph.passes[pass_index];
+			if (!pass.culled && pass.level == level) graph.order[order_count++] = pass_index;
+		}
+	}
+	graph.level_starts[graph.level_count] = order_count;
+
+	// Transient memory. Buffers that no pass that's left uses don't get any.
+	size_t offsets[MAX_GRAPH_BUFFERS];
+	graph.transient_size = 0;
+	graph.heap_size = 0;
+
+	for (auto index = 0; index < graph.buffer_count; ++index) {
+		offsets[index] = (size_t)-1;
+		auto &buffer = graph.buffers[index];
+		if (buffer.transient) {
+			buffer.memory = 0;
+			if (buffer.first_level >= 0) graph.transient_size += align_size(buffer.size);
+		}
+	}
+
+	place_transient_buffers(graph, offsets);
+
+	if (graph.heap_size) {
+		auto heap = (u8 *)push_size(arena, graph.heap_size, GRAPH_BUFFER_ALIGNMENT);
+		if (!heap) return false;
+
+		for (auto index = 0; index < graph.buffer_count; ++index) {
+			if (offsets[index] != (size_t)-1) graph.buffers[index].memory = heap + offsets[index];
+		}
+	}
+
+	return true;
+}
+
+static f64 ticks_to_ms() {
+	static f64 TicksToMs;
+	if (!TicksToMs) {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		TicksToMs = 1000.0 / (f64)frequency.QuadPart;
+	}
+
+	return TicksToMs;
+}
+
+static void run_pass(FrameGraph &graph, int pass_index) {
+	auto &pass = graph.passes[pass_index];
+	TRACE_SCOPE(pass.name);
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	pass.proc(graph, pass_index, pass.data);
+	QueryPerformanceCounter(&end);
+
+	pass.ms = (f32)((end.QuadPart - start.QuadPart) * ticks_to_ms());
+}
+
+static void pass_job(void *data, int first, int last, int worker_index) {
+	run_pass(*(FrameGraph *)data, first);
+}
+
+void execute_frame_graph(JobSystem &jobs, FrameGraph &graph) {
+	TRACE_SCOPE("execute_frame_graph");
+
+	for (auto level = 0; level < graph.level_count; ++level) {
+		auto first = graph.level_starts[level];
+		auto last = graph.level_starts[level + 1];
+
+		// The last pass of the level runs right here, so a level of one doesn't go through the deques at all,
+		// and this thread isn't just waiting on the others.
+		JobCounter counter = {};
+		for (auto index = first; index < last - 1; ++index) {
+			add_job(jobs, pass_job, &graph, &counter, graph.order[index], graph.order[index] + 1);
+		}
+
+		run_pass(graph, graph.order[last - 1]);
+		wait_for_counter(jobs, counter);
+	}
+}
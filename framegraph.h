@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "types.h"
+#include "arena.h"
+#include "jobs.h"
+
+// A frame as a graph of passes. Instead of main calling render_shadow_map, clear, draw_mesh and so on in
+// whatever order it has written down, each pass says which buffers it reads and writes, and the graph
+// works out the rest:
+//   - The order. A pass that reads a buffer goes after whatever was declared before it writing that buffer,
+//     and a pass that writes one goes after everything declared before it that reads or writes it. So the
+//     declaration order is always a valid order, and only the real dependencies are kept.
+//   - What can run at the same time. Passes are put in levels, each one level after the latest of what it
+//     depends on, and the passes in a level run as jobs next to each other. A single threaded pass like the
+//     shadow map no longer leaves every other core waiting while it runs.
+//   - What doesn't need to run at all. Imported buffers (the ones that live outside the graph, like the
+//     render target) are what the frame is for. A pass that nothing leading to one of those reads from gets culled.
+//   - Where the transient buffers go. Those only live for the frame, from the first level that touches them to
+//     the last, and buffers whose levels don't overlap share memory. It all comes out of one block of
+//     the arena given to compile_frame_graph, which is only as big as the most that's alive at once.
+//
+// The graph gets built from scratch every frame, which is cheap (it's a few dozen passes at the very most) and
+// means turning a pass on or off is just not adding it. Transient memory isn't cleared, and since it's aliased,
+// it holds whatever the last buffer there left in it, so a pass that writes one has to write all of it.
+//
+// Passes in the same level run at the same time, so they mustn't share anything that isn't thread safe
+// without declaring it, like an arena. They're free to use the job system themselves.
+
+const int MAX_GRAPH_PASSES = 64;
+const int MAX_GRAPH_BUFFERS = 64;
+const int MAX_PASS_BUFFERS = 8;
+
+// Transient buffers start on a cache line, so two of them never share one.
+const size_t GRAPH_BUFFER_ALIGNMENT = 64;
+
+struct FrameGraph;
+
+// pass is the index add_pass returned, data whatever was given to it.
+typedef void (*PassProc)(FrameGraph &graph, int pass, void *data);
+
+struct GraphBuffer {
+	// A string literal, for the log and the trace.
+	const char *name;
+
+	bool transient;
+	size_t size;
+
+	// Imported buffers have it from the start. Transient ones get it from compile_frame_graph.
+	void *memory;
+
+	// The levels the buffer is used in, [first_level, last_level]. Set by compile_frame_graph.
+	int first_level;
+	int last_level;
+};
+
+struct GraphPass {
+	// A string literal. It's also the pass's scope in the trace.
+	const char *name;
+	PassProc proc;
+	void *data;
+
+	int reads[MAX_PASS_BUFFERS];
+	int read_count;
+	int writes[MAX_PASS_BUFFERS];
+	int write_count;
+
+	// Set by compile_frame_graph. Passes with a bit set in depends_on have to be done before this one starts.
+	u64 depends_on;
+	bool culled;
+	int level;
+
+	// How long the pass took in the last execute_frame_graph.
+	f32 ms;
+};
+
+struct FrameGraph {
+	GraphPass passes[MAX_GRAPH_PASSES];
+	int pass_count;
+
+	GraphBuffer buffers[MAX_GRAPH_BUFFERS];
+	int buffer_count;
+
+	// The passes that weren't culled, by level. Level n is order[level_starts[n]] up to order[level_starts[n + 1]].
+	int order[MAX_GRAPH_PASSES];
+	int level_starts[MAX_GRAPH_PASSES + 1];
+	int level_count;
+
+	// What the transient buffers would take each on their own, and what they take aliased.
+	size_t transient_size;
+	size_t heap_size;
+
+	// Set if add_pass or the buffers ran out of room. compile_frame_graph fails, and nothing runs.
+	bool overflowed;
+};
+
+// Forgets the last frame's passes and buffers.
+void begin_frame_graph(FrameGraph &graph);
+
+// A buffer that lives outside the graph. memory can be anything the passes know what to do with, like a RenderTarget.
+int import_buffer(FrameGraph &graph, const char *name, void *memory);
+
+// size bytes that only live for this frame.
+int create_buffer(FrameGraph &graph, const char *name, size_t size);
+
+int add_pass(FrameGraph &graph, const char *name, PassProc proc, void *data);
+void read_buffer(FrameGraph &graph, int pass, int buffer);
+void write_buffer(FrameGraph &graph, int pass, int buffer);
+
+// Works out the dependencies, the levels, what gets culled and where the transient buffers go, and takes
+// the memory for them from arena. Returns false if the graph overflowed or arena ran out.
+bool compile_frame_graph(FrameGraph &graph, MemoryArena &arena);
+
+// Runs the passes a level at a time. Has to be called from the thread that started the job system,
+// or from one of its workers.
+void execute_frame_graph(JobSystem &jobs, FrameGraph &graph);
+
+inline void *graph_buffer(const FrameGraph &graph, int buffer) {
+	return graph.buffers[buffer].memory;
+}
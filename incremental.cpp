@@ -0,0 +1,206 @@
+#include <windows.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <assert.h>
+
+#include "incremental.h"
+#include "stretchy_buffer.h"
+#include "trace.h"
+
+// Folds one thing drawn over a tile into the tile's hash. Unlike adding or xoring, this depends on
+// the order, which matters since the order things are drawn in can change which one wins a depth tie.
+static u64 fold_hash(u64 hash, u64 value) {
+	hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+	return hash ^ (hash >> 32);
+}
+
+bool make_tile_history(TileHistory &history, const RenderTarget &target, int buffer_count) {
+	assert(buffer_count > 0 && buffer_count <= MAX_FRAMES_IN_FLIGHT);
+
+	history = {};
+	history.tiles_x = target.tiles_x;
+	history.tiles_y = target.tiles_y;
+	history.buffer_count = buffer_count;
+
+	auto tile_count = (SIZE_T)target.tiles_x * target.tiles_y;
+	history.hashes = (u64 *)VirtualAlloc(0, tile_count * sizeof(u64), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	history.previous_hashes = (u64 *)VirtualAlloc(0, tile_count * sizeof(u64), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	history.dirty = (u8 *)VirtualAlloc(0, tile_count, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!history.hashes || !history.previous_hashes || !history.dirty) return false;
+
+	for (auto index = 0; index < buffer_count; ++index) {
+		history.stale[index] = (u8 *)VirtualAlloc(0, tile_count, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!history.stale[index]) return false;
+	}
+
+	return true;
+}
+
+void free_tile_history(TileHistory &history) {
+	if (history.hashes) VirtualFree(history.hashes, 0, MEM_RELEASE);
+	if (history.previous_hashes) VirtualFree(history.previous_hashes, 0, MEM_RELEASE);
+	if (history.dirty) VirtualFree(history.dirty, 0, MEM_RELEASE);
+
+	for (auto index = 0; index < history.buffer_count; ++index) {
+		if (history.stale[index]) VirtualFree(history.stale[index], 0, MEM_RELEASE);
+	}
+
+	sb_free(history.node_rects);
+	history = {};
+}
+
+// Compares this frame's hashes with the last ones and keeps them for the next frame.
+static int finish_update(TileHistory &history) {
+	auto tile_count = history.tiles_x * history.tiles_y;
+	auto dirty_count = 0;
+
+	for (auto index = 0; index < tile_count; ++index) {
+		auto dirty = !history.primed || history.hashes[index] != history.previous_hashes[index];
+		history.dirty[index] = (u8)dirty;
+		dirty_count += dirty;
+	}
+
+	if (dirty_count) {
+		for (auto buffer = 0; buffer < history.buffer_count; ++buffer) {
+			auto stale = history.stale[buffer];
+			for (auto index = 0; index < tile_count; ++index) {
+				stale[index] |= history.dirty[index];
+			}
+		}
+	}
+
+	auto swap = history.hashes;
+	history.hashes = history.previous_hashes;
+	history.previous_hashes = swap;
+
+	history.primed = true;
+	history.dirty_count = dirty_count;
+	return dirty_count;
+}
+
+int update_frame_tiles(TileHistory &history, u64 frame_hash) {
+	TRACE_SCOPE("update_frame_tiles");
+
+	auto tile_count = history.tiles_x * history.tiles_y;
+	for (auto index = 0; index < tile_count; ++index) {
+		history.hashes[index] = frame_hash;
+	}
+
+	return finish_update(history);
+}
+
+// Where the box lands on screen, padded by a pixel so rounding in setup can't reach past it.
+static TileRect screen_tiles(const TileHistory &history, const Aabb &bounds, const Mat4f &screen_transform) {
+	TileRect everything = { 0, 0, history.tiles_x - 1, history.tiles_y - 1 };
+
+	auto min_x = FLT_MAX;
+	auto min_y = FLT_MAX;
+	auto max_x = -FLT_MAX;
+	auto max_y = -FLT_MAX;
+
+	for (auto corner = 0; corner < 8; ++corner) {
+		Vec3f position = {
+			(corner & 1) ? bounds.max.x : bounds.min.x,
+			(corner & 2) ? bounds.max.y : bounds.min.y,
+			(corner & 4) ? bounds.max.z : bounds.min.z,
+		};
+
+		// Same as instance_rows. Behind the camera the projection flips, so it could be anywhere.
+		auto clip = screen_transform * position;
+		if (clip.w <= 0) return everything;
+
+		auto x = clip.x / clip.w;
+		auto y = clip.y / clip.w;
+		min_x = min(min_x, x);
+		min_y = min(min_y, y);
+		max_x = max(max_x, x);
+		max_y = max(max_y, y);
+	}
+
+	// Off to one side of the screen entirely.
+	auto last_x = (f32)(history.tiles_x * TILE_SIZE - 1);
+	auto last_y = (f32)(history.tiles_y * TILE_SIZE - 1);
+	if (max_x < 0 || max_y < 0 || min_x > last_x || min_y > last_y) {
+		TileRect nothing = { 1, 0, 0, 0 };
+		return nothing;
+	}
+
+	// Clamped while they're still floats, since a corner near the camera can be way out past what an int holds.
+	TileRect result;
+	result.min_x = (int)clamp(floorf(min_x) - 1, 0.0f, last_x) / TILE_SIZE;
+	result.min_y = (int)clamp(floorf(min_y) - 1, 0.0f, last_y) / TILE_SIZE;
+	result.max_x = (int)clamp(ceilf(max_x) + 1, 0.0f, last_x) / TILE_SIZE;
+	result.max_y = (int)clamp(ceilf(max_y) + 1, 0.0f, last_y) / TILE_SIZE;
+	return result;
+}
+
+int update_scene_tiles(TileHistory &history, Scene &scene, const Mat4f &screen_transform, u64 frame_hash) {
+	TRACE_SCOPE("update_scene_tiles");
+
+	auto tile_count = history.tiles_x * history.tiles_y;
+	for (auto index = 0; index < tile_count; ++index) {
+		history.hashes[index] = frame_hash;
+	}
+
+	auto visible_count = sb_count(scene.visible);
+	if (history.node_rects) stb__sbn(history.node_rects) = 0;
+
+	for (auto index = 0; index < visible_count; ++index) {
+		auto &node = scene.nodes[scene.visible[index]];
+
+		auto node_hash = hash_value(node.mesh);
+		node_hash = hash_value(node.texture_map, node_hash);
+		node_hash = hash_value(node.model, node_hash);
+
+		auto rect = screen_tiles(history, node.world_bounds, screen_transform);
+		sb_push(history.node_rects, rect);
+
+		for (auto tile_y = rect.min_y; tile_y <= rect.max_y; ++tile_y) {
+			for (auto tile_x = rect.min_x; tile_x <= rect.max_x; ++tile_x) {
+				auto &hash = history.hashes[tile_y * history.tiles_x + tile_x];
+				hash = fold_hash(hash, node_hash);
+			}
+		}
+	}
+
+	auto dirty_count = finish_update(history);
+
+	// Only the nodes with a dirty tile somewhere under them are left to draw. Every node that
+	// touches a dirty tile has to stay, even if it didn't change itself, since that tile gets cleared.
+	auto kept = 0;
+	for (auto index = 0; index < visible_count; ++index) {
+		auto &rect = history.node_rects[index];
+		auto touches_dirty = false;
+
+		for (auto tile_y = rect.min_y; tile_y <= rect.max_y && !touches_dirty; ++tile_y) {
+			for (auto tile_x = rect.min_x; tile_x <= rect.max_x; ++tile_x) {
+				if (history.dirty[tile_y * history.tiles_x + tile_x]) {
+					touches_dirty = true;
+					break;
+				}
+			}
+		}
+
+		if (touches_dirty) scene.visible[kept++] = scene.visible[index];
+	}
+
+	if (scene.visible) stb__sbn(scene.visible) = kept;
+
+	return dirty_count;
+}
+
+void mark_buffers_stale(TileHistory &history) {
+	auto tile_count = (size_t)history.tiles_x * history.tiles_y;
+	for (auto buffer = 0; buffer < history.buffer_count; ++buffer) {
+		memset(history.stale[buffer], 1, tile_count);
+	}
+}
+
+void resolve_stale_tiles(JobSystem &jobs, TileHistory &history, const RenderTarget &target, Backbuffer &buffer, int buffer_index) {
+	assert(buffer_index >= 0 && buffer_index < history.buffer_count);
+	assert(target.tiles_x == history.tiles_x && target.tiles_y == history.tiles_y);
+
+	resolve(jobs, target, buffer, history.stale[buffer_index]);
+	memset(history.stale[buffer_index], 0, (size_t)history.tiles_x * history.tiles_y);
+}
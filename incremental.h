@@ -0,0 +1,89 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "render.h"
+#include "present.h"
+#include "scene.h"
+#include "jobs.h"
+
+// Redrawing only what changed. Every frame each tile gets a hash of everything that can affect its
+// pixels: a hash of the frame-wide state (camera, light, shader settings) that the caller works out,
+// with a hash of each thing drawn over it folded in, in the order they're drawn. Tiles whose hash
+// is the same as last frame's still have the right pixels in the target, so they're left alone,
+// and a frame where no tile changed doesn't have to be drawn or presented at all.
+//
+// The hashing is conservative. Things are binned by their screen bounds, so a tile can come out dirty
+// when nothing really touched it, which only costs drawing it again. A tile can't come out clean
+// when something that touches it changed, as long as everything that changes is in a hash.
+//
+// The backbuffers are a separate problem. Each one in the present queue last got resolved into a
+// frame or two ago, so each keeps its own set of tiles that have changed since then.
+
+// The tiles a node's screen bounds cover, [min, max] inclusive. Empty when min_x > max_x.
+struct TileRect {
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+};
+
+struct TileHistory {
+	int tiles_x;
+	int tiles_y;
+
+	// This frame's hashes and last frame's.
+	u64 *hashes;
+	u64 *previous_hashes;
+
+	// 1 for the tiles this frame has to draw. Goes to the target as tile_mask.
+	u8 *dirty;
+	int dirty_count;
+
+	// For each backbuffer, 1 for the tiles that changed since the last resolve into it.
+	u8 *stale[MAX_FRAMES_IN_FLIGHT];
+	int buffer_count;
+
+	// Until there's been a frame, there's nothing to compare against and everything is dirty.
+	bool primed;
+
+	// update_scene_tiles' scratch, a rect per visible node. Stretchy buffer.
+	TileRect *node_rects;
+};
+
+// FNV-1a, the same as bench uses for whole frames. Chain calls by passing the last result as hash.
+inline u64 hash_bytes(const void *data, size_t size, u64 hash = 14695981039346656037ull) {
+	auto bytes = (const u8 *)data;
+	for (size_t index = 0; index < size; ++index) {
+		hash = (hash ^ bytes[index]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+template <typename T>
+inline u64 hash_value(const T &value, u64 hash = 14695981039346656037ull) {
+	return hash_bytes(&value, sizeof(value), hash);
+}
+
+// buffer_count is how many backbuffers the present queue has.
+bool make_tile_history(TileHistory &history, const RenderTarget &target, int buffer_count);
+void free_tile_history(TileHistory &history);
+
+// For frames that are drawn as a whole (a single mesh, instances). If frame_hash is the same as last
+// frame's, nothing is dirty. Otherwise everything is. Returns how many tiles are dirty.
+int update_frame_tiles(TileHistory &history, u64 frame_hash);
+
+// For a scene after cull_scene (and occlusion_cull_scene). Each visible node is hashed with its mesh,
+// texture and model, and binned by its world bounds on screen. Then the nodes that don't touch a dirty
+// tile are taken out of scene.visible, since draw_scene would only be drawing them into clean tiles.
+// screen_transform is the same as draw_scene's. Returns how many tiles are dirty.
+int update_scene_tiles(TileHistory &history, Scene &scene, const Mat4f &screen_transform, u64 frame_hash);
+
+// The target still has the right pixels, but every backbuffer needs all of them again. For when the
+// window has to be painted from scratch.
+void mark_buffers_stale(TileHistory &history);
+
+// Copies the tiles that changed since the last time into buffer, which is backbuffer buffer_index
+// of the present queue, and marks them as up to date for it.
+void resolve_stale_tiles(JobSystem &jobs, TileHistory &history, const RenderTarget &target, Backbuffer &buffer, int buffer_index);
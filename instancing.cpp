@@ -0,0 +1,78 @@
+#include <windows.h>
+#include <float.h>
+#include <math.h>
+
+#include "instancing.h"
+#include "trace.h"
+
+PreparedMesh prepare_mesh(const WavefrontObj &obj) {
+	TRACE_SCOPE("prepare_mesh");
+
+	PreparedMesh mesh = {};
+
+	auto triangle_count = obj.face_count;
+	if (triangle_count == 0) return mesh;
+
+	mesh.corners = (MeshVertex *)VirtualAlloc(0, triangle_count * 3 * sizeof(MeshVertex), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!mesh.corners) return mesh;
+
+	mesh.triangle_count = triangle_count;
+
+	for (auto index = 0; index < triangle_count; ++index) {
+		for (auto corner = 0; corner < 3; ++corner) {
+			mesh.corners[index * 3 + corner] = fetch_vertex(obj, obj.faces[index], corner);
+		}
+	}
+
+	mesh.bounds_min = mesh.corners[0].position;
+	mesh.bounds_max = mesh.corners[0].position;
+
+	for (auto index = 1; index < triangle_count * 3; ++index) {
+		auto &position = mesh.corners[index].position;
+
+		for (auto axis = 0; axis < 3; ++axis) {
+			mesh.bounds_min.dim[axis] = min(mesh.bounds_min.dim[axis], position.dim[axis]);
+			mesh.bounds_max.dim[axis] = max(mesh.bounds_max.dim[axis], position.dim[axis]);
+		}
+	}
+
+	return mesh;
+}
+
+void free_prepared_mesh(PreparedMesh &mesh) {
+	if (mesh.corners) VirtualFree(mesh.corners, 0, MEM_RELEASE);
+	mesh = {};
+}
+
+bool instance_rows(const PreparedMesh &mesh, const Mat4f &transform, int height, int &min_y, int &max_y) {
+	auto lowest = FLT_MAX;
+	auto highest = -FLT_MAX;
+
+	for (auto corner = 0; corner < 8; ++corner) {
+		Vec3f position = {
+			(corner & 1) ? mesh.bounds_max.x : mesh.bounds_min.x,
+			(corner & 2) ? mesh.bounds_max.y : mesh.bounds_min.y,
+			(corner & 4) ? mesh.bounds_max.z : mesh.bounds_min.z,
+		};
+
+		auto clip = transform * position;
+
+		// Part of the box is behind the camera, where the projection flips things around.
+		// There's no clipping to deal with that yet, so just say it could be anywhere.
+		if (clip.w <= 0) {
+			min_y = 0;
+			max_y = height - 1;
+			return true;
+		}
+
+		auto y = clip.y / clip.w;
+		lowest = min(lowest, y);
+		highest = max(highest, y);
+	}
+
+	if (highest < 0 || lowest >= (f32)height) return false;
+
+	min_y = max(0, (int)floorf(lowest));
+	max_y = min(height - 1, (int)ceilf(highest));
+	return true;
+}
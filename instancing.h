@@ -0,0 +1,245 @@
+#pragma once
+
+#include <windows.h>
+#include <stdlib.h>
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "color.h"
+#include "color_math.h"
+#include "render.h"
+#include "triangle.h"
+#include "raster.h"
+#include "wavefront.h"
+#include "jobs.h"
+#include "arena.h"
+#include "utils.h"
+#include "trace.h"
+
+// A mesh with every face's corners already pulled out of the WavefrontObj index lists.
+// draw_mesh does that lookup for every face, every time. With a few thousand copies of
+// the same mesh on screen it's much better to do it once and walk a flat array after that.
+struct PreparedMesh {
+	// Three per triangle.
+	MeshVertex *corners;
+	int triangle_count;
+
+	// Object space bounding box, for working out what part of the screen an instance can touch.
+	Vec3f bounds_min;
+	Vec3f bounds_max;
+};
+
+PreparedMesh prepare_mesh(const WavefrontObj &obj);
+void free_prepared_mesh(PreparedMesh &mesh);
+
+struct Instance {
+	// Object space to world space.
+	Mat4f model;
+
+	// Multiplies whatever color the shader comes up with. WHITE leaves it alone.
+	Color tint;
+};
+
+// Works out the rows of a height tall target that the mesh can land on with this transform. It's
+// conservative, since it goes off the bounding box. Returns false if the mesh is entirely above or below the target.
+bool instance_rows(const PreparedMesh &mesh, const Mat4f &transform, int height, int &min_y, int &max_y);
+
+// draw_mesh for a prepared mesh. transform takes object space all the way to the screen.
+// Returns how many fragments got shaded.
+template <typename Shader>
+u64 draw_prepared_mesh(RenderTarget &target, const PreparedMesh &mesh, Shader &shader, const Mat4f &transform) {
+	u64 fragments_shaded = 0;
+	MicroBatch<Shader> batch;
+	batch.count = 0;
+
+	for (auto index = 0; index < mesh.triangle_count; ++index) {
+		auto corners = &mesh.corners[index * 3];
+
+		shader.begin_triangle(corners);
+
+		f32 varyings[3][VARYING_STORAGE(Shader)];
+		Vec3f screen[3];
+
+		for (auto corner = 0; corner < 3; ++corner) {
+			screen[corner] = project_to_vec3f(transform * shader.vertex(corners[corner], varyings[corner]));
+		}
+
+		Triangle triangle = { screen[0], screen[1], screen[2] };
+
+		TriangleSetup setup;
+		auto set_up = setup_triangle(triangle, target.width, target.height, setup);
+		count_triangle(set_up);
+		if (!set_up) continue;
+
+		fragments_shaded += submit_triangle(target, batch, shader, setup, varyings);
+	}
+
+	fragments_shaded += flush_micro_batch(target, batch);
+	return fragments_shaded;
+}
+
+// Wraps a shader to apply an instance's tint after the fragment stage.
+template <typename Shader>
+struct TintedShader {
+	enum { VARYING_COUNT = Shader::VARYING_COUNT };
+	enum { WRITES_DEPTH = Shader::WRITES_DEPTH };
+
+	Shader shader;
+	Color tint;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {
+		shader.begin_triangle(corners);
+	}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		return shader.vertex(in, varyings);
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		if (!shader.fragment(varyings, color, light)) return false;
+
+		color = multiply(color, tint);
+		return true;
+	}
+};
+
+// Where an instance ended up on screen, worked out once per draw.
+struct PlacedInstance {
+	Mat4f transform;
+	int min_y;
+	int max_y;
+	bool visible;
+};
+
+template <typename Shader>
+struct InstancedDraw {
+	RenderTarget *target;
+	const PreparedMesh *mesh;
+	const Shader *shader;
+	const Instance *instances;
+	int instance_count;
+	Mat4f view_transform;
+
+	PlacedInstance *placed;
+
+	int band_rows;
+	int band_count;
+	volatile LONG64 fragments_shaded;
+};
+
+template <typename Shader>
+void place_instances(void *data, int first, int last, int worker_index) {
+	TRACE_SCOPE("place_instances");
+
+	auto &draw = *(InstancedDraw<Shader> *)data;
+
+	for (auto index = first; index < last; ++index) {
+		auto &placed = draw.placed[index];
+		placed.transform = draw.view_transform * draw.instances[index].model;
+		placed.visible = instance_rows(*draw.mesh, placed.transform, draw.target->height, placed.min_y, placed.max_y);
+	}
+}
+
+// Each band of rows is one job, so nobody else can be writing its tiles and there's nothing to lock.
+// The catch is that an instance spanning several bands gets its vertices transformed once per band,
+// which is why the bands are tile rows and not single rows.
+template <typename Shader>
+void draw_instance_bands(void *data, int first, int last, int worker_index) {
+	auto &draw = *(InstancedDraw<Shader> *)data;
+	auto &target = *draw.target;
+	auto &mesh = *draw.mesh;
+
+	u64 fragments_shaded = 0;
+
+	// Bands don't overlap, so one batch can carry over from one band to the next.
+	MicroBatch<TintedShader<Shader>> batch;
+	batch.count = 0;
+
+	for (auto band = first; band < last; ++band) {
+		TRACE_SCOPE("draw instance band");
+
+		auto band_min_y = band * draw.band_rows;
+		auto band_max_y = min(band_min_y + draw.band_rows, target.height) - 1;
+
+		for (auto instance_index = 0; instance_index < draw.instance_count; ++instance_index) {
+			auto &placed = draw.placed[instance_index];
+			if (!placed.visible || placed.max_y < band_min_y || placed.min_y > band_max_y) continue;
+
+			TintedShader<Shader> shader = { *draw.shader, draw.instances[instance_index].tint };
+
+			for (auto triangle_index = 0; triangle_index < mesh.triangle_count; ++triangle_index) {
+				auto corners = &mesh.corners[triangle_index * 3];
+
+				shader.begin_triangle(corners);
+
+				f32 varyings[3][VARYING_STORAGE(Shader)];
+				Vec3f screen[3];
+
+				for (auto corner = 0; corner < 3; ++corner) {
+					screen[corner] = project_to_vec3f(placed.transform * shader.vertex(corners[corner], varyings[corner]));
+				}
+
+				// Most of the triangles of an instance that spans a few bands are in some other band.
+				// Checking that here is a lot cheaper than finding out after setup.
+				auto lowest = min(screen[0].y, min(screen[1].y, screen[2].y));
+				auto highest = max(screen[0].y, max(screen[1].y, screen[2].y));
+				if (highest < (f32)band_min_y || lowest >= (f32)(band_max_y + 1)) continue;
+
+				Triangle triangle = { screen[0], screen[1], screen[2] };
+
+				TriangleSetup setup;
+				auto set_up = setup_triangle(triangle, target.width, target.height, setup) && clip_rows(setup, band_min_y, band_max_y);
+				count_triangle(set_up);
+				if (!set_up) continue;
+
+				fragments_shaded += submit_triangle(target, batch, shader, setup, varyings);
+			}
+		}
+	}
+
+	fragments_shaded += flush_micro_batch(target, batch);
+
+	InterlockedExchangeAdd64(&draw.fragments_shaded, (LONG64)fragments_shaded);
+}
+
+// Draws a copy of mesh for every instance, spread over the job system's workers. view_transform takes world
+// space to the screen, i.e. viewport * projection * view, and each instance's model goes on the right of it.
+//
+// Every copy shares the one shader, so lighting stays in the mesh's object space. That's right for instances
+// that are only moved and scaled. Rotated ones get lit as if they weren't.
+//
+// Each band gets its own copy of the shader, so per-triangle state like FlatShader's is fine.
+// The per-instance transforms are scratch space in frame_arena, given back before this returns.
+// Returns how many fragments got shaded.
+template <typename Shader>
+u64 draw_instances(JobSystem &jobs, MemoryArena &frame_arena, RenderTarget &target, const PreparedMesh &mesh, const Shader &shader, const Instance *instances, int instance_count, const Mat4f &view_transform) {
+	if (instance_count <= 0 || mesh.triangle_count <= 0) return 0;
+
+	TRACE_SCOPE("draw_instances");
+
+	InstancedDraw<Shader> draw = {};
+	draw.target = &target;
+	draw.mesh = &mesh;
+	draw.shader = &shader;
+	draw.instances = instances;
+	draw.instance_count = instance_count;
+	draw.view_transform = view_transform;
+
+	auto mark = arena_mark(frame_arena);
+	defer { pop_to_mark(frame_arena, mark); };
+
+	draw.placed = push_array(frame_arena, PlacedInstance, instance_count);
+	if (!draw.placed) return 0;
+
+	// A few bands per worker so one that lands on a busy part of the screen doesn't hold everyone up.
+	auto tile_rows_per_band = max(1, target.tiles_y / (jobs.worker_count * 4));
+	draw.band_rows = tile_rows_per_band * TILE_SIZE;
+	draw.band_count = (target.height + draw.band_rows - 1) / draw.band_rows;
+
+	// Placing an instance is a matrix multiply and eight corners, so it takes a lot of them to be worth a job.
+	parallel_for(jobs, instance_count, 256, place_instances<Shader>, &draw);
+	parallel_for(jobs, draw.band_count, 1, draw_instance_bands<Shader>, &draw);
+
+	return (u64)draw.fragments_shaded;
+}
@@ -0,0 +1,276 @@
+#include <windows.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "jobs.h"
+#include "trace.h"
+
+static thread_local int ThreadJobWorker = -1;
+
+// Only the deque's owner calls this.
+static bool push_job(JobDeque &deque, const Job &job) {
+	auto bottom = deque.bottom;
+	auto top = deque.top;
+	if (bottom - top >= JOB_DEQUE_SIZE) return false;
+
+	deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)] = job;
+
+	// The job has to be in the slot before a thief can see the new bottom.
+	MemoryBarrier();
+	deque.bottom = bottom + 1;
+	return true;
+}
+
+// Only the deque's owner calls this. Takes the newest job, which is the one most likely to still be in cache.
+static bool pop_job(JobDeque &deque, Job &job) {
+	auto bottom = deque.bottom - 1;
+
+	// Claiming the bottom slot has to be visible before top is read, or a thief and the owner could
+	// both think they got the last job. The exchange is a full barrier.
+	InterlockedExchange64(&deque.bottom, bottom);
+	auto top = deque.top;
+
+	if (top > bottom) {
+		deque.bottom = bottom + 1;
+		return false;
+	}
+
+	job = deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)];
+	if (top < bottom) return true;
+
+	// The last job. A thief could be going for it too, so whoever moves top first gets it.
+	auto won = InterlockedCompareExchange64(&deque.top, top + 1, top) == top;
+	deque.bottom = bottom + 1;
+	return won;
+}
+
+// Takes the oldest job from somebody else's deque.
+static bool steal_job(JobDeque &deque, Job &job) {
+	auto top = deque.top;
+	MemoryBarrier();
+	auto bottom = deque.bottom;
+	if (top >= bottom) return false;
+
+	// The copy happens before the compare exchange, so if somebody else got there first it just gets thrown away.
+	job = deque.jobs[top & (JOB_DEQUE_SIZE - 1)];
+	return InterlockedCompareExchange64(&deque.top, top + 1, top) == top;
+}
+
+static bool find_job(JobSystem &system, int worker_index, Job &job) {
+	if (pop_job(*system.workers[worker_index].deque, job)) return true;
+
+	// Start with the next worker over, so thieves don't all pile onto worker 0.
+	for (auto offset = 1; offset < system.worker_count; ++offset) {
+		auto victim = (worker_index + offset) % system.worker_count;
+		if (steal_job(*system.workers[victim].deque, job)) return true;
+	}
+
+	return false;
+}
+
+static void run_job(const Job &job, int worker_index) {
+	job.proc(job.data, job.first, job.last, worker_index);
+	if (job.counter) InterlockedDecrement(&job.counter->pending);
+}
+
+static DWORD WINAPI job_worker_proc(LPVOID parameter) {
+	auto worker = (JobWorker *)parameter;
+	auto &system = *worker->system;
+	ThreadJobWorker = worker->index;
+
+	char name[32];
+	snprintf(name, sizeof(name), "job worker %d", worker->index);
+	TRACE_THREAD_NAME(name);
+
+	for (;;) {
+		Job job;
+
+		// A short spin first, since more work usually turns up right away in the middle of a frame.
+		auto found = false;
+		for (auto attempt = 0; attempt < 64 && !found; ++attempt) {
+			found = find_job(system, worker->index, job);
+			if (!found) YieldProcessor();
+		}
+
+		if (!found) {
+			// Saying we're asleep before looking one last time means a push either sees us asleep and wakes
+			// us, or happened early enough for this look to find it.
+			InterlockedIncrement(&system.sleeping);
+			found = find_job(system, worker->index, job);
+
+			if (!found && !system.stopping) {
+				WaitForSingleObject(system.work_available, INFINITE);
+			}
+
+			InterlockedDecrement(&system.sleeping);
+		}
+
+		if (found) {
+			run_job(job, worker->index);
+		} else if (system.stopping) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// The nth set bit of mask, or 0 if there aren't that many.
+static KAFFINITY nth_processor(KAFFINITY mask, int n) {
+	for (auto bit = 0; bit < (int)(sizeof(KAFFINITY) * 8); ++bit) {
+		auto processor = (KAFFINITY)1 << bit;
+		if ((mask & processor) && n-- == 0) return processor;
+	}
+
+	return 0;
+}
+
+bool start_job_system(JobSystem &system, int worker_count, const GROUP_AFFINITY *processors) {
+	if (worker_count <= 0 && processors) {
+		worker_count = 0;
+		while (nth_processor(processors->Mask, worker_count)) ++worker_count;
+	}
+
+	if (worker_count <= 0) {
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		worker_count = (int)system_info.dwNumberOfProcessors;
+	}
+
+	if (worker_count > MAX_JOB_WORKERS) worker_count = MAX_JOB_WORKERS;
+
+	system = {};
+	system.worker_count = worker_count;
+
+	system.work_available = CreateSemaphore(0, 0, 0x7FFFFFFF, 0);
+	if (!system.work_available) return false;
+
+	for (auto index = 0; index < worker_count; ++index) {
+		auto &worker = system.workers[index];
+		worker.system = &system;
+		worker.index = index;
+
+		worker.deque = (JobDeque *)VirtualAlloc(0, sizeof(JobDeque), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!worker.deque) return false;
+	}
+
+	// Worker 0 is whoever started the system. It isn't pinned, since it's also running the message loop and
+	// whatever else, but it's left processor 0 to itself.
+	ThreadJobWorker = 0;
+
+	for (auto index = 1; index < worker_count; ++index) {
+		auto &worker = system.workers[index];
+
+		worker.thread = CreateThread(0, 0, job_worker_proc, &worker, 0, 0);
+		if (!worker.thread) return false;
+
+		if (processors) {
+			GROUP_AFFINITY affinity = {};
+			affinity.Group = processors->Group;
+			affinity.Mask = nth_processor(processors->Mask, index);
+			if (affinity.Mask) SetThreadGroupAffinity(worker.thread, &affinity, 0);
+		} else if (index < (int)(sizeof(DWORD_PTR) * 8)) {
+			SetThreadAffinityMask(worker.thread, (DWORD_PTR)1 << index);
+		}
+	}
+
+	return true;
+}
+
+void stop_job_system(JobSystem &system) {
+	InterlockedExchange(&system.stopping, 1);
+	ReleaseSemaphore(system.work_available, system.worker_count, 0);
+
+	for (auto index = 0; index < system.worker_count; ++index) {
+		auto &worker = system.workers[index];
+
+		if (worker.thread) {
+			WaitForSingleObject(worker.thread, INFINITE);
+			CloseHandle(worker.thread);
+		}
+
+		if (worker.deque) VirtualFree(worker.deque, 0, MEM_RELEASE);
+	}
+
+	if (system.work_available) CloseHandle(system.work_available);
+
+	ThreadJobWorker = -1;
+	system.worker_count = 0;
+}
+
+// Only workers have a deque to push to and an index for per-worker scratch, so anybody else can't hand out
+// jobs. Running them right here wouldn't help, since there's no worker_index to give them that some worker
+// isn't already using.
+static bool is_job_worker(const JobSystem &system, const char *what) {
+	auto worker_index = ThreadJobWorker;
+	if (worker_index >= 0 && worker_index < system.worker_count) return true;
+
+	char message[128];
+	snprintf(message, sizeof(message), "%s called from a thread that isn't a job worker. Nothing got run.\n", what);
+	OutputDebugString(message);
+	assert(!"not a job worker");
+	return false;
+}
+
+bool add_job(JobSystem &system, JobProc proc, void *data, JobCounter *counter, int first, int last) {
+	if (!is_job_worker(system, "add_job")) return false;
+	auto worker_index = ThreadJobWorker;
+
+	Job job = { proc, data, first, last, counter };
+	if (counter) InterlockedIncrement(&counter->pending);
+
+	if (!push_job(*system.workers[worker_index].deque, job)) {
+		run_job(job, worker_index);
+		return true;
+	}
+
+	// The push has to be visible before sleeping is read. See the other side in job_worker_proc.
+	MemoryBarrier();
+	if (system.sleeping > 0) ReleaseSemaphore(system.work_available, 1, 0);
+	return true;
+}
+
+void wait_for_counter(JobSystem &system, JobCounter &counter) {
+	TRACE_SCOPE("wait for jobs");
+
+	// Anybody can wait. Threads that aren't workers just can't help out while they do.
+	auto worker_index = ThreadJobWorker;
+	if (worker_index < 0 || worker_index >= system.worker_count) {
+		while (counter.pending > 0) SwitchToThread();
+		return;
+	}
+
+	while (counter.pending > 0) {
+		Job job;
+		if (find_job(system, worker_index, job)) {
+			run_job(job, worker_index);
+		} else {
+			// Whatever's left is running on other workers. Nothing to help with, just wait it out.
+			YieldProcessor();
+		}
+	}
+}
+
+bool parallel_for(JobSystem &system, int count, int grain_size, JobProc proc, void *data) {
+	if (count <= 0) return true;
+	if (!is_job_worker(system, "parallel_for")) return false;
+	if (grain_size < 1) grain_size = 1;
+
+	// Not worth a trip through the deques.
+	if (count <= grain_size) {
+		proc(data, 0, count, job_worker_index());
+		return true;
+	}
+
+	JobCounter counter = {};
+	for (auto first = 0; first < count; first += grain_size) {
+		add_job(system, proc, data, &counter, first, min(first + grain_size, count));
+	}
+
+	wait_for_counter(system, counter);
+	return true;
+}
+
+int job_worker_index() {
+	return ThreadJobWorker;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+
+// The one place threads for parallel work come from. There's a thread per logical processor, minus
+// one for the thread that starts the system, which does its share of the work whenever it's waiting.
+// So everything that wants to go wide (instance transforms and bands, clears, resolves) shares the same
+// threads, and there are never more of them busy than there are processors.
+//
+// Every worker has its own deque of jobs. It pushes and pops at the bottom of its own, and when that's
+// empty it steals from the top of somebody else's. Most of the time a worker is on its own deque and
+// doesn't touch anything shared, and the stealing spreads the work out when it's uneven.
+//
+// Only the job system's threads and the thread that started it can add jobs or wait on them, and
+// there's only meant to be one job system at a time.
+
+const int MAX_JOB_WORKERS = 64;
+
+// Has to be a power of two. A push that doesn't fit just runs the job right there.
+const int JOB_DEQUE_SIZE = 4096;
+
+// worker_index is in [0, worker_count) and is the same for everything a thread runs, so it can index
+// per-worker scratch. first and last are the range of a parallel_for chunk, [first, last).
+typedef void (*JobProc)(void *data, int first, int last, int worker_index);
+
+// Counts jobs that haven't finished. Adding a job with a counter bumps it, and it goes back down when the
+// job is done, so waiting on a counter is waiting on a whole group of jobs. Jobs that depend on a group
+// can wait on its counter themselves; the wait runs other jobs in the meantime instead of blocking.
+struct JobCounter {
+	volatile LONG pending;
+};
+
+struct Job {
+	JobProc proc;
+	void *data;
+	int first;
+	int last;
+	JobCounter *counter;
+};
+
+// Chase-Lev. The owner works at bottom, thieves take from top.
+struct alignas(64) JobDeque {
+	volatile LONG64 top;
+	alignas(64) volatile LONG64 bottom;
+	Job jobs[JOB_DEQUE_SIZE];
+};
+
+struct JobSystem;
+
+struct JobWorker {
+	JobSystem *system;
+	int index;
+	HANDLE thread;
+
+	// 128K each, so they're allocated separately instead of living in the JobSystem.
+	JobDeque *deque;
+};
+
+struct JobSystem {
+	JobWorker workers[MAX_JOB_WORKERS];
+	int worker_count;
+
+	// Workers with nothing to steal go to sleep on this. Pushing a job wakes one up if any are asleep.
+	HANDLE work_available;
+	volatile LONG sleeping;
+	volatile LONG stopping;
+};
+
+// worker_count of 0 means one per logical processor. Worker 0 is the calling thread. The others get threads
+// pinned to their own logical processors, so the OS doesn't shuffle them around and their caches stay warm.
+//
+// processors limits that to the processors in one group's mask, e.g. one NUMA node's. Worker n gets the nth
+// processor in the mask, and worker_count of 0 means one per processor in it. The calling thread is left
+// wherever it is, so it should already be on one of them.
+bool start_job_system(JobSystem &system, int worker_count, const GROUP_AFFINITY *processors = 0);
+void stop_job_system(JobSystem &system);
+
+// counter can be null for jobs nobody waits on. add_job and parallel_for only work on the job system's own
+// threads, i.e. the one that started it and the workers, or jobs running on them. Anywhere else they run
+// nothing and return false.
+bool add_job(JobSystem &system, JobProc proc, void *data, JobCounter *counter, int first = 0, int last = 0);
+
+// Runs other jobs until the counter gets to zero. Threads that aren't workers just wait.
+void wait_for_counter(JobSystem &system, JobCounter &counter);
+
+// Calls proc over [0, count) in chunks of grain_size, spread over the workers, and returns when it's all done.
+// Small grains balance better and big ones cost less to hand out. A chunk per few hundred microseconds of work
+// is about right.
+bool parallel_for(JobSystem &system, int count, int grain_size, JobProc proc, void *data);
+
+// The index of the calling thread in the job system, or -1 if it isn't one of them.
+int job_worker_index();
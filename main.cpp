@@ -1,6 +1,9 @@
 #include <windows.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include <limits>
 
 #include "stretchy_buffer.h"
@@ -13,9 +16,45 @@
 #include "tgaimage.h"
 #include "texture.h"
 #include "matrix_math.h"
+#include "camera.h"
+#include "present.h"
+#include "stats.h"
+#include "trace.h"
+#include "arena.h"
+#include "raster.h"
+#include "shaders.h"
+#include "shadow.h"
+#include "jobs.h"
+#include "instancing.h"
+#include "scene.h"
+#include "assets.h"
+#include "video.h"
+#include "incremental.h"
+#include "resolution.h"
+#include "multiview.h"
+#include "regions.h"
+#include "framegraph.h"
+#include "post.h"
+#include "stream.h"
+#include "passes.h"
 
 static bool GlobalRunning = true;
 
+// Set when the window has to be painted again from scratch. Only --incremental cares, since it's the only
+// time a frame might not get presented anyway.
+static bool GlobalRepaint = false;
+
+static f64 GlobalTicksToMs;
+
+static u64 now_ticks() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (u64)counter.QuadPart;
+}
+
+// Too big for the stack.
+static AssetLoader GlobalAssetLoader;
+
 static LRESULT CALLBACK window_proc(HWND window, UINT message, WPARAM w_param, LPARAM l_param) {
 	// If I put this in a custom proc, then the WM_DESTROY, WM_CLOSE, and WM_QUIT messages are never sent to that proc.
 	// I wonder what's going on there...
@@ -35,7 +74,7 @@ static LRESULT CALLBACK window_proc(HWND window, UINT message, WPARAM w_param, L
 	return 0;
 }
 
-static void handle_message(HWND window, Backbuffer &buffer, MSG message) {
+static void handle_message(HWND window, MSG message) {
 	switch (message.message) {
 	case WM_QUIT:
 		GlobalRunning = false;
@@ -43,10 +82,12 @@ static void handle_message(HWND window, Backbuffer &buffer, MSG message) {
 
 	case WM_PAINT:
 	{
+		// The present thread blits every frame as it finishes, so there's nothing to draw here.
+		// This just validates the window so it stops asking.
 		PAINTSTRUCT paint;
-		auto context = BeginPaint(window, &paint);
-		render(buffer, context);
+		BeginPaint(window, &paint);
 		EndPaint(window, &paint);
+		GlobalRepaint = true;
 	} break;
 
 	default:
@@ -56,23 +97,28 @@ static void handle_message(HWND window, Backbuffer &buffer, MSG message) {
 	}
 }
 
-Mat4f make_viewport(int x, int y, int width, int height) {
-	const int near_clip = 1;
-	const int far_clip = 255;
-	const int depth = far_clip - near_clip;
-
-	Mat4f result = Mat4_Identity;
-
-	set_matrix_entry(result, 0, 0, width * 0.5f);
-	set_matrix_entry(result, 0, 3, x + width * 0.5f);
-
-	set_matrix_entry(result, 1, 1, height * 0.5f);
-	set_matrix_entry(result, 1, 3, y + height * 0.5f);
-
-	set_matrix_entry(result, 2, 2, depth * 0.5f);
-	set_matrix_entry(result, 2, 3, depth * 0.5f);
-
-	return result;
+struct PresentTarget {
+	HWND window;
+	PresentQueue *queue;
+
+	// Null unless --video was given. The render thread marks which frames go in the video, since the
+	// ones from before the assets are in are just clear.
+	VideoWriter *video;
+	volatile bool record[MAX_FRAMES_IN_FLIGHT];
+};
+
+static void present_to_window(Backbuffer &buffer, void *user_data) {
+	auto target = (PresentTarget *)user_data;
+	auto context = GetDC(target->window);
+	render(buffer, context);
+	ReleaseDC(target->window, context);
+
+	// The conversion happens here on the present thread, and the writing on the video writer's thread,
+	// so the render thread never waits on either unless the encoder can't keep up.
+	auto frame = (int)(&buffer - target->queue->frames);
+	if (target->video && target->record[frame]) {
+		submit_video_frame(*target->video, buffer);
+	}
 }
 
 inline Vec2i get_window_dimensions(int client_width, int client_height) {
@@ -90,26 +136,150 @@ inline Vec2i get_window_dimensions(int client_width, int client_height) {
 	return result;
 }
 
-inline Mat4f look_at(Vec3f eye, Vec3f center, Vec3f up) {
-	auto z = normalize(eye - center);
-	auto x = normalize(up.cross(z));
-	auto y = normalize(z.cross(x));
+// A square grid of shrunken copies filling the same [-1, 1] area the single mesh does, each with its own tint.
+static Instance *make_crowd(int count) {
+	auto instances = (Instance *)malloc(count * sizeof(Instance));
+	if (!instances) return 0;
 
-	auto view = Mat4_Identity;
-	auto model = Mat4_Identity;
+	auto side = (int)ceilf(sqrtf((f32)count));
+	auto scale = 1.0f / side;
+
+	for (auto index = 0; index < count; ++index) {
+		auto column = index % side;
+		auto row = index / side;
 
-	for (auto index = 0; index < 3; ++index) {
-		set_matrix_entry(view, 0, index, x.dim[index]);
-		set_matrix_entry(view, 1, index, y.dim[index]);
-		set_matrix_entry(view, 2, index, z.dim[index]);
-		set_matrix_entry(model, index, 3, -center.dim[index]);
+		auto model = Mat4_Identity;
+		set_matrix_entry(model, 0, 0, scale);
+		set_matrix_entry(model, 1, 1, scale);
+		set_matrix_entry(model, 2, 2, scale);
+		set_matrix_entry(model, 0, 3, -1 + (2 * column + 1) * scale);
+		set_matrix_entry(model, 1, 3, -1 + (2 * row + 1) * scale);
+
+		instances[index].model = model;
+		instances[index].tint = Color((u8)(255 - 127 * column / side), (u8)(128 + 127 * row / side), 255, 255);
 	}
 
-	return view * model;
+	return instances;
+}
+
+// Rows of full size copies going back into the distance. Most of them are off screen, and most
+// of the rest are behind the rows in front, so both kinds of culling have something to do.
+static Mat4f scene_node_model(int index, int count, f32 seconds) {
+	auto side = (int)ceilf(sqrtf((f32)count));
+	const f32 spacing = 1.5f;
+
+	// A little bob, so the nodes move every frame without usually leaving their fat bounds.
+	auto model = Mat4_Identity;
+	set_matrix_entry(model, 0, 3, (index % side - side / 2) * spacing);
+	set_matrix_entry(model, 1, 3, 0.05f * sinf(seconds * 2 + index));
+	set_matrix_entry(model, 2, 3, -(index / side) * spacing);
+	return model;
 }
 
 //int CALLBACK WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR command_line, int show_code) {
-int main() {
+int main(int argc, char **argv) {
+	// --processes starts copies of this with nothing but this on the command line, one per band of the screen.
+	if (argc == 4 && strcmp(argv[1], "--region-worker") == 0) {
+		return run_region_worker(argv[2], atoi(argv[3]));
+	}
+
+	auto render_mode = RENDER_FORWARD;
+	auto instance_count = 0;
+	auto view_count = 0;
+	auto scene_node_count = 0;
+	auto show_heat_map = false;
+	auto heat_map_mode = HEAT_MAP_OVERDRAW;
+	const char *trace_file_name = 0;
+	const char *video_file_name = 0;
+	auto video_format = VIDEO_Y4M;
+	auto video_fps = 30;
+	auto frame_limit = 0;
+	auto incremental = false;
+	auto moving_node_count = -1;
+	auto target_ms = 0.0f;
+	auto min_scale = 0.5f;
+	auto process_count = -1;
+	auto baked_shading = false;
+	const char *lightmap_file_name = 0;
+	const char *stream_file_name = 0;
+	u64 stream_budget_mb = 256;
+
+	PostSettings post_settings = {};
+	post_settings.gamma = 1;
+
+	for (auto index = 1; index < argc; ++index) {
+		if (strcmp(argv[index], "--prepass") == 0) {
+			render_mode = RENDER_DEPTH_PREPASS;
+		} else if (strcmp(argv[index], "--instances") == 0 && index + 1 < argc) {
+			instance_count = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--views") == 0 && index + 1 < argc) {
+			view_count = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--scene") == 0 && index + 1 < argc) {
+			scene_node_count = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--overdraw") == 0) {
+			show_heat_map = true;
+			heat_map_mode = HEAT_MAP_OVERDRAW;
+		} else if (strcmp(argv[index], "--tile-cost") == 0) {
+			show_heat_map = true;
+			heat_map_mode = HEAT_MAP_TILE_COST;
+		} else if (strcmp(argv[index], "--trace") == 0 && index + 1 < argc) {
+			trace_file_name = argv[++index];
+		} else if (strcmp(argv[index], "--video") == 0 && index + 1 < argc) {
+			video_file_name = argv[++index];
+		} else if (strcmp(argv[index], "--raw-rgb") == 0) {
+			video_format = VIDEO_RAW_RGB;
+		} else if (strcmp(argv[index], "--fps") == 0 && index + 1 < argc) {
+			video_fps = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--frames") == 0 && index + 1 < argc) {
+			frame_limit = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--incremental") == 0) {
+			incremental = true;
+		} else if (strcmp(argv[index], "--moving") == 0 && index + 1 < argc) {
+			moving_node_count = atoi(argv[++index]);
+		} else if (strcmp(argv[index], "--target-ms") == 0 && index + 1 < argc) {
+			target_ms = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--min-scale") == 0 && index + 1 < argc) {
+			min_scale = clamp((f32)atof(argv[++index]), 0.1f, 1.0f);
+		} else if (strcmp(argv[index], "--processes") == 0 && index + 1 < argc) {
+			process_count = max(0, atoi(argv[++index]));
+		} else if (strcmp(argv[index], "--baked") == 0) {
+			baked_shading = true;
+		} else if (strcmp(argv[index], "--lightmap") == 0 && index + 1 < argc) {
+			lightmap_file_name = argv[++index];
+			baked_shading = true;
+		} else if (strcmp(argv[index], "--fxaa") == 0) {
+			post_settings.fxaa = true;
+		} else if (strcmp(argv[index], "--sharpen") == 0 && index + 1 < argc) {
+			post_settings.sharpen = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--exposure") == 0 && index + 1 < argc) {
+			post_settings.exposure = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--gamma") == 0 && index + 1 < argc) {
+			post_settings.gamma = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--stream") == 0 && index + 1 < argc) {
+			stream_file_name = argv[++index];
+		} else if (strcmp(argv[index], "--budget") == 0 && index + 1 < argc) {
+			stream_budget_mb = (u64)max(1, atoi(argv[++index]));
+		}
+	}
+
+	// With the video going to stdout, everything that would normally be printed goes to stderr instead.
+	auto log_file = (video_file_name && strcmp(video_file_name, "-") == 0) ? stderr : stdout;
+
+	TRACE_THREAD_NAME("main");
+
+	// Start loading before anything else, so the mesh and the texture load alongside each other and
+	// alongside the window setup. Frames just come out clear until both are in.
+	auto start_time = timeGetTime();
+	auto &loader = GlobalAssetLoader;
+	if (!start_asset_loader(loader, 0)) {
+		OutputDebugString("Bad asset loader.\n");
+		return -1;
+	}
+
+	auto mesh_asset = load_mesh_async(loader, "data/african_head.wfo", scene_node_count > 0 || instance_count > 0 || view_count > 0);
+	auto texture_asset = load_texture_async(loader, "data/african_head_diffuse.tga");
+	auto lightmap_asset = lightmap_file_name ? load_texture_async(loader, lightmap_file_name) : -1;
+
 	auto instance = GetModuleHandle(NULL);
 	WNDCLASSEX window_class = {};
 
@@ -135,27 +305,30 @@ int main() {
 		return -2;
 	}
 
-	Backbuffer buffer = {};
-	buffer.width = client_width;
-	buffer.height = client_height;
-	buffer.bytes_per_pixel = 4;
-	buffer.stride = client_width * buffer.bytes_per_pixel;
-	buffer.memory = (u8 *)malloc(client_width * client_height * buffer.bytes_per_pixel);
+	// Started before the present queue, since the present thread hands it frames.
+	VideoWriter video;
+	if (video_file_name && !start_video_writer(video, video_file_name, video_format, client_width, client_height, video_fps, 8)) {
+		OutputDebugString("Bad video writer.\n");
+		return -3;
+	}
 
-	buffer.info.bmiHeader.biSize = sizeof(buffer.info.bmiHeader);
-	buffer.info.bmiHeader.biWidth = client_width;
-	buffer.info.bmiHeader.biHeight = client_height;
-	buffer.info.bmiHeader.biPlanes = 1;
-	buffer.info.bmiHeader.biBitCount = 32;
-	buffer.info.bmiHeader.biCompression = BI_RGB;
+	PresentTarget present_target = {};
+	present_target.window = window;
+	present_target.video = video_file_name ? &video : 0;
 
-	auto obj = load_obj("data/african_head.wfo");
-	auto image_load_result = load_tga_image("data/african_head_diffuse.tga");
-	if (!image_load_result.loaded) return -1;
-	assert(image_load_result.loaded);
+	PresentQueue present_queue;
+	present_target.queue = &present_queue;
+	if (!start_present_queue(present_queue, 2, client_width, client_height, present_to_window, &present_target)) {
+		OutputDebugString("Bad present queue.\n");
+		return -3;
+	}
 
-	auto image = image_load_result.image;
-	auto texture_map = decompress_tga_image(&image);
+	// Everything that only lasts a frame.
+	MemoryArena frame_arena;
+	if (!make_arena(frame_arena, 64 * 1024 * 1024)) {
+		OutputDebugString("Bad frame arena.\n");
+		return -1;
+	}
 
 	auto camera = Vec3f{ 1, 1, 3 };
 	
@@ -170,77 +343,534 @@ int main() {
 	auto model_view = look_at(camera, Vec3f{ 0, 0, 0 }, Vec3f{ 0, 1, 0 });
 
 	auto light_dir = normalize(Vec3f{ 1, -1, 1 });
-	auto z_buffer_length = client_height * client_width;
-	auto z_buffer = (f32 *)malloc(z_buffer_length * sizeof(f32));
+	auto target = make_render_target(client_width, client_height);
+
+	auto transform = viewport * proj * model_view;
+
+	// The light is directional, so an orthographic view down light_dir covers it. The head fits in [-1, 1].
+	// It only gets drawn again when the light or the mesh changes, which for now is just the once.
+	auto shadow_map = make_shadow_map(1024);
+	if (!shadow_map.depth.tiles) {
+		OutputDebugString("Bad shadow map.\n");
+		return -1;
+	}
+
+	auto shadow_transform = make_viewport(0, 0, shadow_map.depth.width, shadow_map.depth.height) * look_at(light_dir, Vec3f{ 0, 0, 0 }, Vec3f{ 0, 1, 0 });
+
+	ShadowedGouraudShader shader = {};
+	shader.light_dir = light_dir;
+	shader.shadow_map = &shadow_map;
+	shader.shadow_ambient = 0.3f;
+
+	// Everything that goes wide shares these, with this thread as worker 0.
+	JobSystem jobs;
+	if (!start_job_system(jobs, 0)) {
+		OutputDebugString("Bad job system.\n");
+		return -4;
+	}
+
+	// --instances N swaps the single shadowed head for a grid of N tinted ones, drawn with the instanced path.
+	Instance *instances = 0;
+
+	GouraudShader crowd_shader = {};
+	crowd_shader.light_dir = light_dir;
+
+	// --baked lights the single head with what the bake tool worked out per vertex (from the .bake next to
+	// the mesh), and --lightmap file.tga with a lightmap instead. Neither needs the shadow map.
+	BakedVertexShader baked_shader = {};
+	baked_shader.ambient = 0.4f;
+
+	LightmapShader lightmap_shader = {};
+	lightmap_shader.ambient = baked_shader.ambient;
+
+	// --scene N draws N copies through the scene instead, culled against the view every frame.
+	auto scene = make_scene();
+	auto frustum = make_frustum(transform, client_width, client_height);
+	auto occlusion = make_occlusion_buffer(client_width, client_height);
+
+	if (instance_count > 0) {
+		instances = make_crowd(instance_count);
+
+		if (!instances) {
+			OutputDebugString("Bad instancing setup.\n");
+			return -4;
+		}
+	}
+
+	// --views N draws the single head from N cameras going around it, all in one pass, and shows them in a grid.
+	auto view_side = view_count > 0 ? (int)ceilf(sqrtf((f32)view_count)) : 1;
+	auto view_size = (min(client_width, client_height) / view_side) / TILE_SIZE * TILE_SIZE;
+	MeshView *views = 0;
+	RenderTarget *view_targets = 0;
+
+	if (view_count > 0) {
+		views = (MeshView *)calloc(view_count, sizeof(MeshView));
+		view_targets = (RenderTarget *)calloc(view_count, sizeof(RenderTarget));
+		if (!views || !view_targets) {
+			OutputDebugString("Bad view setup.\n");
+			return -4;
+		}
+
+		for (auto index = 0; index < view_count; ++index) {
+			view_targets[index] = make_render_target(view_size, view_size);
+			if (!view_targets[index].tiles) {
+				OutputDebugString("Bad view target.\n");
+				return -4;
+			}
+
+			auto angle = 6.28318530718f * index / view_count;
+			auto view_camera = Vec3f{ camera.z * sinf(angle), 1, camera.z * cosf(angle) };
+
+			views[index].target = &view_targets[index];
+			views[index].transform = make_viewport(0, 0, view_size, view_size) * proj * look_at(view_camera, Vec3f{ 0, 0, 0 }, Vec3f{ 0, 1, 0 });
+		}
+
+		// The grid replaces the one big view, so there's nothing for these to work with.
+		incremental = false;
+	}
+
+	// --stream file.chunks draws a chunked mesh from the partition tool, keeping at most --budget MB of it (256 by
+	// default) in memory past its coarsest level. The camera flies over it, so there's always something to read.
+	StreamedMesh streamed_mesh = {};
+	if (stream_file_name) {
+		if (!open_streamed_mesh(streamed_mesh, stream_file_name, stream_budget_mb * 1024 * 1024)) {
+			fprintf(log_file, "Couldn't open %s as a chunked mesh with a %llu MB budget.\n", stream_file_name, stream_budget_mb);
+			return -4;
+		}
+
+		fprintf(log_file, "Streaming %s: %d chunks in %d levels, %llu KB always in memory, %d slots of %llu KB\n",
+			stream_file_name, streamed_mesh.header.chunk_count, streamed_mesh.header.level_count,
+			streamed_mesh.header.coarse_size / 1024, streamed_mesh.slot_count, streamed_mesh.slot_size / 1024);
+
+		// The camera moves every frame, so there's never anything to leave alone.
+		incremental = false;
+	}
+
+	// These get filled in once the loader is done with them.
+	const WavefrontObj *obj = 0;
+	const PreparedMesh *prepared_mesh = 0;
+	auto assets_ready = false;
+
+	if (show_heat_map && !enable_overdraw(target)) {
+		OutputDebugString("Bad overdraw buffer.\n");
+		return -5;
+	}
+
+	// --incremental only draws the tiles whose inputs changed, and doesn't present at all when none did.
+	TileHistory history = {};
+	if (incremental && !make_tile_history(history, target, present_queue.frame_count)) {
+		OutputDebugString("Bad tile history.\n");
+		return -5;
+	}
+
+	// --target-ms X picks the render size every frame to keep the frame under X ms. The other two want the
+	// target and the backbuffer to stay the same size, so they turn it off.
+	auto dynamic_resolution = target_ms > 0 && !incremental && !show_heat_map && view_count == 0 && process_count < 0;
+	auto resolution = make_resolution_controller(target_ms, min_scale, 1.0f);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	GlobalTicksToMs = 1000.0 / (f64)frequency.QuadPart;
+
+	// --processes N splits the single shadowed head between N worker processes (0 for one per NUMA node), each
+	// drawing a band of rows with its own copy of everything. Only the plain forward path does that, so anything
+	// else on the command line wins.
+	auto use_regions = process_count >= 0 && !baked_shading && render_mode == RENDER_FORWARD && instance_count == 0 && scene_node_count == 0 &&
+		view_count == 0 && !stream_file_name && !incremental && !show_heat_map && target_ms <= 0;
+
+	RegionRenderer regions = {};
+	if (use_regions) {
+		if (!start_region_renderer(regions, process_count, client_width, client_height, "data/african_head.wfo", "data/african_head_diffuse.tga")) {
+			OutputDebugString("Bad region workers.\n");
+			return -6;
+		}
+
+		fprintf(log_file, "Drawing with %d worker processes\n", regions.region_count);
+	}
+
+	// --fxaa, --sharpen X, --exposure X and --gamma X go over the finished frame in the backbuffer. --incremental keeps
+	// whatever didn't change from the last time the buffer was used, which would get them again, and the heat maps are
+	// only for looking at, so neither gets them.
+	PostProcessor post = {};
+	if (!incremental && !show_heat_map) post = make_post_processor(post_settings, client_width, client_height, jobs);
+
+	// --moving N only bobs the first N scene nodes, so there's something for --incremental to leave alone.
+	if (moving_node_count < 0 || moving_node_count > scene_node_count) moving_node_count = scene_node_count;
 
 	timeBeginPeriod(1);
 
+	ShadingStats stats = {};
+
+	// Built again for every frame that gets drawn, from whatever the command line and the assets allow.
+	FrameGraph graph = {};
+	auto last_graph_shape = (u64)0;
+
+	FramePasses passes = {};
+	passes.jobs = &jobs;
+	passes.frame_arena = &frame_arena;
+	passes.target = &target;
+	passes.render_mode = render_mode;
+	passes.stats = &stats;
+	passes.shadow_map = &shadow_map;
+	passes.shader = &shader;
+	passes.crowd_shader = &crowd_shader;
+	passes.baked_shader = &baked_shader;
+	passes.lightmap_shader = &lightmap_shader;
+	passes.scene = &scene;
+	passes.instances = instances;
+	passes.instance_count = instance_count;
+	passes.views = views;
+	passes.view_targets = view_targets;
+	passes.view_count = view_count;
+	passes.view_side = view_side;
+	passes.view_size = view_size;
+	passes.streamed_mesh = &streamed_mesh;
+	passes.heat_map_mode = heat_map_mode;
+	passes.history = &history;
+	passes.regions = &regions;
+	passes.post = &post;
+
+	auto recorded_frames = 0;
+	auto drew_frame = true;
+	auto frames_skipped = 0;
+
 	auto last_time = timeGetTime();
+
+	// Whatever goes wrong in the loop stops it the same way closing the window does, so the loader's threads
+	// and everything else still get cleaned up below.
+	auto exit_code = 0;
+
+	// What the scene was last culled against, for --incremental.
+	auto culled_scene_version = (u32)0;
+	auto culled_frame_hash = (u64)0;
+
 	while (GlobalRunning) {
+		TRACE_SCOPE("frame");
+
 		MSG message;
 		while (PeekMessage(&message, 0, 0, 0, PM_REMOVE)) {
-			handle_message(window, buffer, message);
+			handle_message(window, message);
 		}
 
-		// At the moment, it's taking about a second to render each frame.
-		// That's crazy long. I might try to parallelize the draw_triangle call as much
-		// as possible at some point, but I don't want to get stuck figuring out how
-		// to use whatever threading API that Windows has.
 		auto current_time = timeGetTime();
 		auto delta_t = (current_time - last_time);
-		if (delta_t != 0) {
-			printf("FPS %ld\n", 1000 / delta_t);
+		last_time = current_time;
+
+		// Skipped frames have nothing to report.
+		if (drew_frame) {
+			if (frames_skipped) {
+				fprintf(log_file, "Skipped %d unchanged frames\n", frames_skipped);
+				frames_skipped = 0;
+			}
+
+			if (delta_t != 0) {
+				fprintf(log_file, "FPS %ld\n", 1000 / delta_t);
+			}
+
+			if (stats.pixels_covered) {
+				fprintf(log_file, "Shaded %llu fragments for %llu pixels (%.2fx)\n", stats.fragments_shaded, stats.pixels_covered, (f64)stats.fragments_shaded / stats.pixels_covered);
+			}
+
+			// Everything from the last frame, including the shadow map pass.
+			auto pipeline = read_pipeline_stats();
+			if (pipeline.triangles_submitted) {
+				fprintf(log_file, "Triangles %llu (%llu culled), pixels tested %llu, inside %llu, depth pass %llu / fail %llu, shaded %llu, discarded %llu, written %llu\n",
+					pipeline.triangles_submitted, pipeline.triangles_culled, pipeline.pixels_tested, pipeline.pixels_inside,
+					pipeline.depth_passed, pipeline.depth_failed, pipeline.fragments_shaded, pipeline.fragments_discarded, pipeline.pixels_written);
+			}
+			reset_pipeline_stats();
+
+			auto memory = read_memory_stats();
+			fprintf(log_file, "Frame arena peak %llu KB, %llu KB committed in %d arenas (peak %llu KB)\n",
+				(u64)frame_arena.peak / 1024, memory.committed / 1024, memory.arena_count, memory.peak_committed / 1024);
 		}
 
-		last_time = current_time;
+		reset_arena(frame_arena);
+
+		auto lightmap_loaded = lightmap_asset < 0 || asset_state(loader, lightmap_asset) != ASSET_QUEUED;
+		if (!assets_ready && lightmap_loaded && asset_state(loader, mesh_asset) != ASSET_QUEUED && asset_state(loader, texture_asset) != ASSET_QUEUED) {
+			obj = get_mesh(loader, mesh_asset);
+			prepared_mesh = get_prepared_mesh(loader, mesh_asset);
+			auto texture_map = get_texture(loader, texture_asset);
+			if (!obj || !texture_map) {
+				fprintf(log_file, "Couldn't load the mesh or its texture, stopping.\n");
+				exit_code = -1;
+				GlobalRunning = false;
+				continue;
+			}
+
+			shader.texture_map = texture_map;
+			crowd_shader.texture_map = texture_map;
+			baked_shader.texture_map = texture_map;
+			lightmap_shader.texture_map = texture_map;
+
+			if (lightmap_asset >= 0) {
+				lightmap_shader.lightmap = get_texture(loader, lightmap_asset);
+				if (!lightmap_shader.lightmap) {
+					fprintf(log_file, "Couldn't load the lightmap, stopping.\n");
+					exit_code = -1;
+					GlobalRunning = false;
+					continue;
+				}
+			}
+
+			if (baked_shading && !lightmap_file_name && !obj->baked) {
+				fprintf(log_file, "There's no vertex bake for the mesh, so --baked has nothing to show. Run bake first.\n");
+			}
+
+			for (auto index = 0; index < scene_node_count; ++index) {
+				add_node(scene, prepared_mesh, texture_map, scene_node_model(index, scene_node_count, 0));
+			}
+
+			assets_ready = true;
+			fprintf(log_file, "Assets ready %lu ms after starting\n", timeGetTime() - start_time);
+		}
 
-		clear(buffer, BLACK);
+		auto draw_streamed = assets_ready && stream_file_name;
+		if (draw_streamed) {
+			// Down the middle of the field from the front, and back to the front once it gets to the end.
+			auto &bounds = streamed_mesh.header.bounds;
+			auto travel = fmodf((current_time - start_time) / 1000.0f, max(bounds.max.z - bounds.min.z, 1.0f));
+			auto center = Vec3f{ 0, 0, bounds.max.z - 1 - travel };
+
+			model_view = look_at(center + camera, center, Vec3f{ 0, 1, 0 });
+			transform = viewport * proj * model_view;
+			frustum = make_frustum(transform, target.width, target.height);
+
+			update_streamed_mesh(streamed_mesh, frustum, transform);
+
+			auto &stream = streamed_mesh.stats;
+			fprintf(log_file, "Streaming %d chunks (", stream.visible);
+			for (auto level = 0; level < streamed_mesh.header.level_count; ++level) {
+				fprintf(log_file, level ? " %d" : "%d", stream.drawn[level]);
+			}
+			fprintf(log_file, " by level, %d coarser than wanted), %d reads started, %d going, %d of %d slots, %llu reads and %llu evictions, %llu MB read\n",
+				stream.coarser, stream.started, stream.loading, stream.slots_used, streamed_mesh.slot_count, stream.reads, stream.evictions, stream.bytes_read / (1024 * 1024));
+		}
+
+		// Everything the whole frame depends on. Scene nodes get hashed one at a time in update_scene_tiles.
+		// The instances never change after make_crowd, so where they are is enough.
+		auto frame_hash = (u64)0;
+		if (incremental) {
+			frame_hash = hash_value(transform);
+			frame_hash = hash_value(shadow_transform, frame_hash);
+			frame_hash = hash_value(light_dir, frame_hash);
+			frame_hash = hash_value(render_mode, frame_hash);
+			frame_hash = hash_value(baked_shading, frame_hash);
+			frame_hash = hash_value(assets_ready, frame_hash);
+			frame_hash = hash_value(shader.texture_map, frame_hash);
+			frame_hash = hash_value(shader.shadow_ambient, frame_hash);
+			frame_hash = hash_value(instances, frame_hash);
+			frame_hash = hash_value(instance_count, frame_hash);
+		}
+
+		auto draw_scene_nodes = assets_ready && scene_node_count > 0;
+		auto scene_unchanged = false;
+		if (draw_scene_nodes) {
+			auto seconds = current_time / 1000.0f;
+			for (auto index = 0; index < moving_node_count; ++index) {
+				set_node_transform(scene, index, scene_node_model(index, scene_node_count, seconds));
+			}
+
+			// With --incremental, a frame where no node moved and nothing else changed would only cull its way
+			// to the same nodes as the last one, and then find every tile clean. So it skips all of that.
+			scene_unchanged = incremental && history.primed && scene.version == culled_scene_version && frame_hash == culled_frame_hash;
+			if (!scene_unchanged) {
+				auto in_frustum = cull_scene(scene, frustum);
+				auto visible = occlusion_cull_scene(scene, occlusion, transform);
+				if (!incremental) fprintf(log_file, "Drawing %d of %d scene nodes (%d in the frustum)\n", visible, scene_node_count, in_frustum);
+
+				culled_scene_version = scene.version;
+				culled_frame_hash = frame_hash;
+			}
+		}
+
+		auto dirty_tiles = target.tiles_x * target.tiles_y;
+		if (incremental) {
+			if (scene_unchanged) {
+				dirty_tiles = 0;
+			} else {
+				dirty_tiles = draw_scene_nodes ? update_scene_tiles(history, scene, transform, frame_hash) : update_frame_tiles(history, frame_hash);
+			}
+			target.tile_mask = history.dirty;
+
+			if (draw_scene_nodes && dirty_tiles) {
+				fprintf(log_file, "Redrawing %d tiles and %d scene nodes\n", dirty_tiles, sb_count(scene.visible));
+			}
+		}
+
+		// When nothing changed, what's on screen is already right. The window might still need painting,
+		// and the video still needs its frame, but otherwise there's nothing to do until the next check.
+		auto repaint = GlobalRepaint;
+		GlobalRepaint = false;
+
+		drew_frame = dirty_tiles > 0 || repaint || present_target.video;
+		if (!drew_frame) {
+			target.tile_mask = 0;
+			frames_skipped++;
+			MsgWaitForMultipleObjects(0, 0, FALSE, 15, QS_ALLINPUT);
+			continue;
+		}
+
+		if (incremental && repaint) mark_buffers_stale(history);
+
+		// Blocks only if the present thread is still holding every other frame.
+		auto &buffer = acquire_frame(present_queue);
+		auto buffer_index = (int)(&buffer - present_queue.frames);
+
+		auto frame_start = now_ticks();
+
+		passes.transform = transform;
+		passes.shadow_transform = shadow_transform;
+		passes.obj = obj;
+		passes.prepared_mesh = prepared_mesh;
+		passes.buffer = &buffer;
+		passes.buffer_index = buffer_index;
+		passes.light_dir = light_dir;
+
+		passes.draw = 0;
+		if (assets_ready) {
+			passes.draw = draw_shadowed_pass;
+			if (draw_streamed) {
+				passes.draw = draw_streamed_pass;
+			} else if (draw_scene_nodes) {
+				passes.draw = draw_scene_pass;
+			} else if (instance_count > 0) {
+				passes.draw = draw_instances_pass;
+			} else if (view_count > 0) {
+				passes.draw = draw_views_pass;
+			} else if (lightmap_file_name) {
+				passes.draw = draw_lightmapped_pass;
+			} else if (baked_shading) {
+				passes.draw = draw_baked_pass;
+			}
+		}
+
+		passes.output = upscale_pass;
+		if (view_count > 0) {
+			passes.output = resolve_views_pass;
+		} else if (use_regions) {
+			passes.region_frame.transform = transform;
+			passes.region_frame.shadow_transform = shadow_transform;
+			passes.region_frame.light_dir = light_dir;
+			passes.region_frame.shadow_ambient = shader.shadow_ambient;
+			passes.output = render_regions_pass;
+		} else if (show_heat_map) {
+			passes.output = resolve_heat_map_pass;
+		} else if (incremental) {
+			passes.output = resolve_stale_tiles_pass;
+		}
+
+		// The workers draw into their own targets and resolve straight into the frame, in the output pass.
+		build_frame_graph(graph, passes, !use_regions && dirty_tiles > 0);
 
-		for (auto index = 0; index < z_buffer_length; ++index) {
-			z_buffer[index] = FLT_MIN;
+		if (!compile_frame_graph(graph, frame_arena)) {
+			fprintf(log_file, "Couldn't set up the frame graph, stopping.\n");
+			exit_code = -1;
+			GlobalRunning = false;
+			continue;
 		}
 
-		for (auto index = 0; index < sb_count(obj.faces); ++index) {
-			auto face = &obj.faces[index];
+		// The passes only change when the assets come in or the shadow map needs drawing, so the graph gets
+		// logged then, with that frame's times. The trace has every frame's.
+		auto graph_shape = hash_value(graph.heap_size);
+		for (auto index = 0; index < graph.level_starts[graph.level_count]; ++index) {
+			auto &pass = graph.passes[graph.order[index]];
+			graph_shape = hash_value(pass.name, graph_shape);
+			graph_shape = hash_value(pass.level, graph_shape);
+		}
+
+		execute_frame_graph(jobs, graph);
+
+		if (graph_shape != last_graph_shape) {
+			fprintf(log_file, "Frame graph: %d passes in %d levels, %llu KB of transient buffers in %llu KB\n",
+				graph.level_starts[graph.level_count], graph.level_count, (u64)graph.transient_size / 1024, (u64)graph.heap_size / 1024);
+
+			fprintf(log_file, "Passes:");
+			for (auto index = 0; index < graph.level_starts[graph.level_count]; ++index) {
+				auto &pass = graph.passes[graph.order[index]];
+				fprintf(log_file, " %s %.2f ms (level %d)", pass.name, pass.ms, pass.level);
+			}
+			fprintf(log_file, "\n");
+
+			last_graph_shape = graph_shape;
+		}
+
+		if (passes.regions_failed) {
+			fprintf(log_file, "A worker process died, stopping.\n");
+			exit_code = -1;
+			GlobalRunning = false;
+		}
+
+		if (use_regions) {
+			stats.pixels_covered = 0;
+		} else if (dirty_tiles > 0) {
+			stats.pixels_covered = count_covered_pixels(jobs, target, FLT_MIN);
+		}
+		target.tile_mask = 0;
+
+		// The output and post passes cost the same at any resolution, and come last, so everything else is
+		// what the scale changes.
+		auto fixed_ms = graph.passes[passes.output_index].ms;
+		if (passes.post_index >= 0) fixed_ms += graph.passes[passes.post_index].ms;
+		auto scaled_ms = max((f32)((now_ticks() - frame_start) * GlobalTicksToMs) - fixed_ms, 0.0f);
+
+		auto record = assets_ready && present_target.video;
+		present_target.record[buffer_index] = record;
+		submit_frame(present_queue);
+
+		// --frames N is for rendering a fixed length clip and then getting out of the encoder's way.
+		if (record) recorded_frames++;
+		if (frame_limit > 0 && recorded_frames >= frame_limit) GlobalRunning = false;
+		if (present_target.video && video.failed) {
+			fprintf(log_file, "Writing the video failed, stopping.\n");
+			exit_code = -1;
+			GlobalRunning = false;
+		}
 
-			Vec3f vertices[] = {
-				obj.verts[face->vertex_indices.x].v3,
-				obj.verts[face->vertex_indices.y].v3,
-				obj.verts[face->vertex_indices.z].v3
-			};
+		// The next frame is drawn at the new size. Everything that maps onto the target goes with it,
+		// and the shadow map, which has its own size, doesn't.
+		if (dynamic_resolution && update_resolution(resolution, scaled_ms, fixed_ms)) {
+			int width, height;
+			scaled_size(resolution, client_width, client_height, width, height);
+			resize_render_target(target, width, height);
 
-			Vec3f transformed_verts[] = 
-			{
-				project_to_vec3f(viewport * proj * model_view * vertices[0]),
-				project_to_vec3f(viewport * proj * model_view * vertices[1]),
-				project_to_vec3f(viewport * proj * model_view * vertices[2]),
-			};
+			viewport = make_viewport(0, 0, width, height);
+			transform = viewport * proj * model_view;
+			frustum = make_frustum(transform, width, height);
 
-			Vec3f normals[] = {
-				obj.vert_normals[face->normal_indices.x],
-				obj.vert_normals[face->normal_indices.y],
-				obj.vert_normals[face->normal_indices.z],
-			};
-/*
-			auto clip_coordinates = proj * vertices[0];
-			auto screen_coordinates = viewport * project_to_vec3f(clip_coordinates);
-			auto normalized_screen_coordinates = project_to_vec3f(screen_coordinates);
-*/
-			Vec2f uvs[3] =
-			{
-				obj.text_coords[face->texture_indices.x].v2,
-				obj.text_coords[face->texture_indices.y].v2,
-				obj.text_coords[face->texture_indices.z].v2
-			};
+			resize_occlusion_buffer(occlusion, width, height);
 
-			Triangle triangle = { transformed_verts[0], transformed_verts[1], transformed_verts[2] };
-			draw_triangle(buffer, triangle, texture_map, uvs, z_buffer, normals, light_dir);
+			fprintf(log_file, "Rendering at %dx%d (%.0f%%), %.2f ms scaled + %.2f ms fixed against %.2f ms\n",
+				width, height, resolution.scale * 100, resolution.scaled_ms, resolution.fixed_ms, target_ms);
 		}
+	}
 
-		auto context = GetDC(window);
-		render(buffer, context);
-		ReleaseDC(window, context);
+	// The present queue first, since it's what's feeding the video writer.
+	stop_present_queue(present_queue);
+	if (use_regions) stop_region_renderer(regions);
+	if (video_file_name) stop_video_writer(video);
+	free_render_target(target);
+	free_shadow_map(shadow_map);
+	free_tile_history(history);
+	free_scene(scene);
+	free_occlusion_buffer(occlusion);
+	close_streamed_mesh(streamed_mesh);
+	free(instances);
+
+	for (auto index = 0; index < view_count; ++index) {
+		free_render_target(view_targets[index]);
+	}
+	free(view_targets);
+	free(views);
+	stop_job_system(jobs);
+	stop_asset_loader(loader);
+	free_arena(frame_arena);
+
+	// Only the last TRACE_RING_EVENTS scopes of each thread are still around by now, which is plenty to look at.
+	if (trace_file_name && !write_trace(trace_file_name)) {
+		fprintf(log_file, "Couldn't write a trace to %s. Is RENDER_TRACE defined?\n", trace_file_name);
 	}
 
-	return 0;
+	return exit_code;
 }
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "render.h"
+#include "triangle.h"
+#include "raster.h"
+#include "instancing.h"
+#include "jobs.h"
+#include "arena.h"
+#include "utils.h"
+#include "trace.h"
+
+// Drawing the same mesh from several cameras at once (stereo pairs, cube map faces, a grid of thumbnails).
+//
+// The vertex stage hands back object space positions and the draw call does the transform to the screen,
+// so everything the shader does per vertex (the attribute fetch, normalizing the normal, the lighting, the
+// UVs) is the same for every view. draw_mesh_views runs it once for a batch of triangles, then every view
+// projects and rasterizes that batch into its own target. The views are spread over the job system, and
+// since each has its own target nobody is writing anybody else's tiles.
+
+const int VIEW_BATCH_TRIANGLES = 256;
+
+struct MeshView {
+	RenderTarget *target;
+
+	// Object space to this view's screen, i.e. viewport * projection * view * model.
+	Mat4f transform;
+
+	// Filled in by draw_mesh_views.
+	u64 fragments_shaded;
+};
+
+template <typename Shader>
+struct ViewBatch {
+	// What the vertex stage came up with for each corner of each triangle.
+	Vec4f positions[VIEW_BATCH_TRIANGLES][3];
+	f32 varyings[VIEW_BATCH_TRIANGLES][3][VARYING_STORAGE(Shader)];
+
+	// The shader as it was right after each triangle's begin_triangle, for shaders like FlatShader
+	// that keep something from it for the fragment stage.
+	Shader shaders[VIEW_BATCH_TRIANGLES];
+
+	int triangle_count;
+};
+
+template <typename Shader>
+struct MultiViewDraw {
+	MeshView *views;
+	const ViewBatch<Shader> *batch;
+};
+
+template <typename Shader>
+void draw_view_batch(void *data, int first, int last, int worker_index) {
+	auto &draw = *(MultiViewDraw<Shader> *)data;
+	auto &batch = *draw.batch;
+
+	for (auto view_index = first; view_index < last; ++view_index) {
+		TRACE_SCOPE("draw view batch");
+
+		auto &view = draw.views[view_index];
+		u64 fragments_shaded = 0;
+
+		for (auto triangle_index = 0; triangle_index < batch.triangle_count; ++triangle_index) {
+			auto positions = batch.positions[triangle_index];
+
+			Triangle triangle = {
+				project_to_vec3f(view.transform * positions[0]),
+				project_to_vec3f(view.transform * positions[1]),
+				project_to_vec3f(view.transform * positions[2]),
+			};
+
+			// Every view gets its own copy, so nothing the fragment stage does to it can leak between them.
+			auto shader = batch.shaders[triangle_index];
+			fragments_shaded += draw_triangle(*view.target, shader, triangle, batch.varyings[triangle_index]);
+		}
+
+		// Only the job drawing this view touches it.
+		view.fragments_shaded += fragments_shaded;
+	}
+}
+
+// Draws mesh into every view's target. The targets have to be cleared already, and can't be shared between
+// views. The batch is scratch space in frame_arena, given back before this returns.
+// Returns how many fragments got shaded over all the views.
+template <typename Shader>
+u64 draw_mesh_views(JobSystem &jobs, MemoryArena &frame_arena, const PreparedMesh &mesh, Shader &shader, MeshView *views, int view_count) {
+	if (view_count <= 0 || mesh.triangle_count <= 0) return 0;
+
+	TRACE_SCOPE("draw_mesh_views");
+
+	auto mark = arena_mark(frame_arena);
+	defer { pop_to_mark(frame_arena, mark); };
+
+	auto batch = push_struct(frame_arena, ViewBatch<Shader>);
+	if (!batch) return 0;
+
+	for (auto index = 0; index < view_count; ++index) {
+		views[index].fragments_shaded = 0;
+	}
+
+	MultiViewDraw<Shader> draw = { views, batch };
+
+	for (auto first = 0; first < mesh.triangle_count; first += VIEW_BATCH_TRIANGLES) {
+		batch->triangle_count = min(VIEW_BATCH_TRIANGLES, mesh.triangle_count - first);
+
+		{
+			TRACE_SCOPE("shade view batch vertices");
+
+			for (auto index = 0; index < batch->triangle_count; ++index) {
+				auto corners = &mesh.corners[(first + index) * 3];
+
+				shader.begin_triangle(corners);
+				for (auto corner = 0; corner < 3; ++corner) {
+					batch->positions[index][corner] = shader.vertex(corners[corner], batch->varyings[index][corner]);
+				}
+
+				batch->shaders[index] = shader;
+			}
+		}
+
+		parallel_for(jobs, view_count, 1, draw_view_batch<Shader>, &draw);
+	}
+
+	u64 fragments_shaded = 0;
+	for (auto index = 0; index < view_count; ++index) {
+		fragments_shaded += views[index].fragments_shaded;
+	}
+
+	return fragments_shaded;
+}
@@ -0,0 +1,267 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#include "occlusion.h"
+
+const u32 FULL_ROW = 0xFFFFFFFF;
+
+static int tiles_across(int size, int tile_size) {
+	return (size + tile_size - 1) / tile_size;
+}
+
+OcclusionBuffer make_occlusion_buffer(int width, int height) {
+	OcclusionBuffer buffer = {};
+	buffer.tile_capacity = tiles_across(width, OCCLUSION_TILE_WIDTH) * tiles_across(height, OCCLUSION_TILE_HEIGHT);
+	resize_occlusion_buffer(buffer, width, height);
+
+	auto size = (SIZE_T)buffer.tile_capacity * sizeof(OcclusionTile);
+	buffer.tiles = (OcclusionTile *)VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+	return buffer;
+}
+
+bool resize_occlusion_buffer(OcclusionBuffer &buffer, int width, int height) {
+	auto tiles_x = tiles_across(width, OCCLUSION_TILE_WIDTH);
+	auto tiles_y = tiles_across(height, OCCLUSION_TILE_HEIGHT);
+	if (width <= 0 || height <= 0 || tiles_x * tiles_y > buffer.tile_capacity) return false;
+
+	buffer.width = width;
+	buffer.height = height;
+	buffer.tiles_x = tiles_x;
+	buffer.tiles_y = tiles_y;
+	return true;
+}
+
+void free_occlusion_buffer(OcclusionBuffer &buffer) {
+	if (buffer.tiles) VirtualFree(buffer.tiles, 0, MEM_RELEASE);
+	buffer.tiles = 0;
+}
+
+void clear(OcclusionBuffer &buffer) {
+	auto tile_count = buffer.tiles_x * buffer.tiles_y;
+
+	for (auto index = 0; index < tile_count; ++index) {
+		auto &tile = buffer.tiles[index];
+
+		for (auto row = 0; row < OCCLUSION_TILE_HEIGHT; ++row) {
+			tile.mask[row] = 0;
+		}
+
+		tile.far_reference = -FLT_MAX;
+		tile.far_working = FLT_MAX;
+	}
+}
+
+// Bits first through last of a row, inclusive.
+static u32 column_mask(int first, int last) {
+	auto below_last = last >= 31 ? FULL_ROW : (1u << (last + 1)) - 1;
+	return below_last & ~((1u << first) - 1);
+}
+
+// The bits of a tile's rows that are on the target. Only the tiles along the right and bottom edges
+// have any that aren't.
+static void tile_extent(const OcclusionBuffer &buffer, int tile_x, int tile_y, u32 extent[OCCLUSION_TILE_HEIGHT]) {
+	auto columns = column_mask(0, min(OCCLUSION_TILE_WIDTH - 1, buffer.width - 1 - tile_x * OCCLUSION_TILE_WIDTH));
+
+	for (auto row = 0; row < OCCLUSION_TILE_HEIGHT; ++row) {
+		extent[row] = tile_y * OCCLUSION_TILE_HEIGHT + row < buffer.height ? columns : 0;
+	}
+}
+
+static void update_tile(OcclusionTile &tile, const u32 coverage[OCCLUSION_TILE_HEIGHT], const u32 extent[OCCLUSION_TILE_HEIGHT], f32 far_depth) {
+	// If the new triangle is further in front of the working layer than the working layer is in front of
+	// the reference, the working layer is probably the back of something and not worth keeping.
+	// Throwing it away just loses some culling, never correctness.
+	if (far_depth - tile.far_working > tile.far_working - tile.far_reference) {
+		for (auto row = 0; row < OCCLUSION_TILE_HEIGHT; ++row) {
+			tile.mask[row] = 0;
+		}
+
+		tile.far_working = FLT_MAX;
+	}
+
+	tile.far_working = min(tile.far_working, far_depth);
+
+	auto full = true;
+	for (auto row = 0; row < OCCLUSION_TILE_HEIGHT; ++row) {
+		tile.mask[row] |= coverage[row];
+		if (tile.mask[row] != extent[row]) full = false;
+	}
+
+	if (full) {
+		tile.far_reference = max(tile.far_reference, tile.far_working);
+		tile.far_working = FLT_MAX;
+
+		for (auto row = 0; row < OCCLUSION_TILE_HEIGHT; ++row) {
+			tile.mask[row] = 0;
+		}
+	}
+}
+
+void draw_occluder_triangle(OcclusionBuffer &buffer, const Triangle &triangle) {
+	TriangleSetup setup;
+	if (!setup_triangle(triangle, buffer.width, buffer.height, setup)) return;
+
+	auto nearest = max(triangle.p1.z, max(triangle.p2.z, triangle.p3.z));
+	auto farthest = min(triangle.p1.z, min(triangle.p2.z, triangle.p3.z));
+
+	auto zero = _mm_setzero_ps();
+	auto lane_offsets = _mm_set_ps(3, 2, 1, 0);
+
+	for (auto tile_y = setup.min_y / OCCLUSION_TILE_HEIGHT; tile_y <= setup.max_y / OCCLUSION_TILE_HEIGHT; ++tile_y) {
+		auto tile_min_y = max(setup.min_y, tile_y * OCCLUSION_TILE_HEIGHT);
+		auto tile_max_y = min(setup.max_y, tile_y * OCCLUSION_TILE_HEIGHT + OCCLUSION_TILE_HEIGHT - 1);
+
+		for (auto tile_x = setup.min_x / OCCLUSION_TILE_WIDTH; tile_x <= setup.max_x / OCCLUSION_TILE_WIDTH; ++tile_x) {
+			auto tile_min_x = max(setup.min_x, tile_x * OCCLUSION_TILE_WIDTH);
+			auto tile_max_x = min(setup.max_x, tile_x * OCCLUSION_TILE_WIDTH + OCCLUSION_TILE_WIDTH - 1);
+			auto &tile = buffer.tiles[tile_y * buffer.tiles_x + tile_x];
+
+			// All of this triangle that lands in the tile is behind the reference already.
+			if (nearest < tile.far_reference) continue;
+
+			auto columns = column_mask(tile_min_x % OCCLUSION_TILE_WIDTH, tile_max_x % OCCLUSION_TILE_WIDTH);
+
+			u32 coverage[OCCLUSION_TILE_HEIGHT] = {};
+			auto any_coverage = false;
+
+			for (auto y = tile_min_y; y <= tile_max_y; ++y) {
+				// edge_row and edge_at, four lanes wide. Same multiplies and adds in the same order, so every
+				// pixel comes out inside or outside exactly like it does in draw_triangle.
+				__m128 rows[3];
+				__m128 steps[3];
+				for (auto edge = 0; edge < 3; ++edge) {
+					rows[edge] = _mm_set1_ps(edge_row(setup, edge, y));
+					steps[edge] = _mm_set1_ps(setup.edge_a[edge]);
+				}
+
+				u32 row_bits = 0;
+
+				// Four columns at a time, but only the groups of four the triangle's box reaches.
+				auto group_start = (tile_min_x - tile_x * OCCLUSION_TILE_WIDTH) & ~3;
+				for (auto group = group_start; group < OCCLUSION_TILE_WIDTH && tile_x * OCCLUSION_TILE_WIDTH + group <= tile_max_x; group += 4) {
+					auto dx = _mm_add_ps(_mm_set1_ps((f32)(tile_x * OCCLUSION_TILE_WIDTH + group - setup.origin_x)), lane_offsets);
+
+					auto inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(steps[0], dx), rows[0]), zero);
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(steps[1], dx), rows[1]), zero));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(steps[2], dx), rows[2]), zero));
+
+					row_bits |= (u32)_mm_movemask_ps(inside) << group;
+				}
+
+				row_bits &= columns;
+				coverage[y % OCCLUSION_TILE_HEIGHT] = row_bits;
+				if (row_bits) any_coverage = true;
+			}
+
+			if (!any_coverage) continue;
+
+			// The depth plane is smallest at a corner of the area it covers in this tile. Going out to max + 1
+			// is past the last pixel, which leaves room for this not rounding the same way depth_at does.
+			// It can't be farther than the farthest vertex either.
+			auto left = (f32)(tile_min_x - setup.origin_x);
+			auto right = (f32)(tile_max_x + 1 - setup.origin_x);
+			auto top = (f32)(tile_min_y - setup.origin_y);
+			auto bottom = (f32)(tile_max_y + 1 - setup.origin_y);
+
+			auto far_depth = min(
+				min(setup.z_a * left + setup.z_b * top, setup.z_a * right + setup.z_b * top),
+				min(setup.z_a * left + setup.z_b * bottom, setup.z_a * right + setup.z_b * bottom)) + setup.z_c;
+			far_depth = max(far_depth, farthest);
+
+			u32 extent[OCCLUSION_TILE_HEIGHT];
+			tile_extent(buffer, tile_x, tile_y, extent);
+			update_tile(tile, coverage, extent, far_depth);
+		}
+	}
+}
+
+void draw_occluder(OcclusionBuffer &buffer, const PreparedMesh &mesh, const Mat4f &transform) {
+	for (auto index = 0; index < mesh.triangle_count; ++index) {
+		auto corners = &mesh.corners[index * 3];
+		auto clip_a = transform * corners[0].position;
+		auto clip_b = transform * corners[1].position;
+		auto clip_c = transform * corners[2].position;
+
+		// A corner behind the camera would get flipped onto the screen with a depth that means nothing.
+		// There's no clipping here, so the triangle just doesn't hide anything. Leaving an occluder out
+		// only ever means drawing more, never less.
+		if (clip_a.w <= 0 || clip_b.w <= 0 || clip_c.w <= 0) continue;
+
+		Triangle triangle = {
+			project_to_vec3f(clip_a),
+			project_to_vec3f(clip_b),
+			project_to_vec3f(clip_c),
+		};
+
+		draw_occluder_triangle(buffer, triangle);
+	}
+}
+
+bool is_occluded(const OcclusionBuffer &buffer, const Vec3f &box_min, const Vec3f &box_max, const Mat4f &transform) {
+	auto min_x = FLT_MAX;
+	auto min_y = FLT_MAX;
+	auto max_x = -FLT_MAX;
+	auto max_y = -FLT_MAX;
+	auto nearest = -FLT_MAX;
+
+	for (auto corner = 0; corner < 8; ++corner) {
+		Vec3f position = {
+			(corner & 1) ? box_max.x : box_min.x,
+			(corner & 2) ? box_max.y : box_min.y,
+			(corner & 4) ? box_max.z : box_min.z,
+		};
+
+		auto clip = transform * position;
+
+		// Reaches behind the camera. Nothing sensible to test, so it has to be drawn.
+		if (clip.w <= 0) return false;
+
+		auto screen = project_to_vec3f(clip);
+		min_x = min(min_x, screen.x);
+		min_y = min(min_y, screen.y);
+		max_x = max(max_x, screen.x);
+		max_y = max(max_y, screen.y);
+		nearest = max(nearest, screen.z);
+	}
+
+	// Off the buffer entirely. Frustum culling should have caught it, but there's nothing here hiding it.
+	auto first_x = (int)floorf(min_x);
+	auto first_y = (int)floorf(min_y);
+	auto last_x = (int)floorf(max_x);
+	auto last_y = (int)floorf(max_y);
+	if (last_x < 0 || last_y < 0 || first_x >= buffer.width || first_y >= buffer.height) return false;
+
+	first_x = max(first_x, 0);
+	first_y = max(first_y, 0);
+	last_x = min(last_x, buffer.width - 1);
+	last_y = min(last_y, buffer.height - 1);
+
+	for (auto tile_y = first_y / OCCLUSION_TILE_HEIGHT; tile_y <= last_y / OCCLUSION_TILE_HEIGHT; ++tile_y) {
+		auto tile_min_y = max(first_y, tile_y * OCCLUSION_TILE_HEIGHT);
+		auto tile_max_y = min(last_y, tile_y * OCCLUSION_TILE_HEIGHT + OCCLUSION_TILE_HEIGHT - 1);
+
+		for (auto tile_x = first_x / OCCLUSION_TILE_WIDTH; tile_x <= last_x / OCCLUSION_TILE_WIDTH; ++tile_x) {
+			auto &tile = buffer.tiles[tile_y * buffer.tiles_x + tile_x];
+
+			if (nearest < tile.far_reference) continue;
+
+			// Not behind the reference, so the only way this tile hides it is if the working
+			// layer covers every pixel of the box here and the box is behind that too.
+			if (nearest >= tile.far_working) return false;
+
+			auto tile_min_x = max(first_x, tile_x * OCCLUSION_TILE_WIDTH);
+			auto tile_max_x = min(last_x, tile_x * OCCLUSION_TILE_WIDTH + OCCLUSION_TILE_WIDTH - 1);
+			auto columns = column_mask(tile_min_x % OCCLUSION_TILE_WIDTH, tile_max_x % OCCLUSION_TILE_WIDTH);
+
+			for (auto y = tile_min_y; y <= tile_max_y; ++y) {
+				if ((columns & ~tile.mask[y % OCCLUSION_TILE_HEIGHT]) != 0) return false;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "triangle.h"
+#include "instancing.h"
+
+// Masked software occlusion culling, roughly the way Intel's Masked Occlusion Culling paper does it.
+//
+// Occluders get rasterized into a buffer the size of the real target, and instead of a depth per pixel
+// each 32x4 tile keeps a coverage mask and two depths:
+//
+//   - far_reference: everything in the tile is at least this near, so anything entirely farther than
+//     it is hidden. Starts out at -FLT_MAX, which hides nothing.
+//   - far_working: the farthest depth of the pixels in mask, which are still being filled in. Once the
+//     mask covers the whole tile it gets folded into far_reference and starts over.
+//
+// Bounding boxes then get tested against that before anything is sent down the real pipeline.
+//
+// Depth is the same as everywhere else: bigger is nearer.
+//
+// Both halves are conservative. Boxes are tested with their nearest depth over the whole rectangle they
+// touch, and occluders with their farthest. Coverage is sampled at the same points with the same math
+// as draw_triangle, so a pixel only counts as covered if drawing the occluder would have drawn it.
+// The paper goes at a lower resolution and samples pixel centers, which is cheaper but lets an occluder
+// claim part of a low res pixel it doesn't cover, and hide something seen through a gap along its edge.
+// Testing whole low res pixels instead fixes that, but then hardly anything gets covered, since most
+// triangles are smaller than one.
+
+const int OCCLUSION_TILE_WIDTH = 32;
+const int OCCLUSION_TILE_HEIGHT = 4;
+
+struct OcclusionTile {
+	// One u32 per row, bit x for column x.
+	u32 mask[OCCLUSION_TILE_HEIGHT];
+	f32 far_reference;
+	f32 far_working;
+};
+
+struct OcclusionBuffer {
+	// The target's size. The tiles along the right and bottom can hang off it, and the pixels out
+	// there count as covered as far as filling a tile goes.
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+
+	// How many tiles there's room for, from the size the buffer was made at. resize_occlusion_buffer
+	// can shrink it and grow it back without reallocating anything.
+	int tile_capacity;
+
+	OcclusionTile *tiles;
+};
+
+// width and height are the target's, the one the transforms passed in here map onto.
+OcclusionBuffer make_occlusion_buffer(int width, int height);
+void free_occlusion_buffer(OcclusionBuffer &buffer);
+
+// For when the target changes size. Whatever was in the buffer is garbage until the next clear. Returns
+// false if it needs more tiles than the buffer was made with.
+bool resize_occlusion_buffer(OcclusionBuffer &buffer, int width, int height);
+void clear(OcclusionBuffer &buffer);
+
+// The triangle is in the target's screen space, same as for draw_triangle.
+void draw_occluder_triangle(OcclusionBuffer &buffer, const Triangle &triangle);
+
+// transform takes object space to the target's screen, same as draw_mesh.
+void draw_occluder(OcclusionBuffer &buffer, const PreparedMesh &mesh, const Mat4f &transform);
+
+// True if everything inside the object space box would be hidden by the occluders drawn so far.
+bool is_occluded(const OcclusionBuffer &buffer, const Vec3f &box_min, const Vec3f &box_max, const Mat4f &transform);
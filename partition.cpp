@@ -0,0 +1,429 @@
+#include <windows.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "partition.h"
+#include "raster.h"
+#include "utils.h"
+#include "trace.h"
+
+// Chunks are split at the middle of the longest axis of their triangles' centroids, the same way the bake's
+// BVH is, just with far bigger leaves. The tree over the chunks in the file is built the same way again.
+const int CHUNK_NODE_CHUNKS = 4;
+
+static Vec3f min3(const Vec3f &a, const Vec3f &b) {
+	return Vec3f{ min(a.x, b.x), min(a.y, b.y), min(a.z, b.z) };
+}
+
+static Vec3f max3(const Vec3f &a, const Vec3f &b) {
+	return Vec3f{ max(a.x, b.x), max(a.y, b.y), max(a.z, b.z) };
+}
+
+static ChunkBounds empty_bounds() {
+	return ChunkBounds{ Vec3f{ FLT_MAX, FLT_MAX, FLT_MAX }, Vec3f{ -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+}
+
+static int longest_axis(const Vec3f &extent) {
+	return extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+}
+
+// Moves the items in order[first, first + count) whose centers are below the middle of the longest axis to the
+// front, and returns where the rest start. Never comes back with everything on one side.
+static int split_at_middle(int *order, int first, int count, const Vec3f *centers) {
+	auto center_min = Vec3f{ FLT_MAX, FLT_MAX, FLT_MAX };
+	auto center_max = Vec3f{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (auto position = first; position < first + count; ++position) {
+		center_min = min3(center_min, centers[order[position]]);
+		center_max = max3(center_max, centers[order[position]]);
+	}
+
+	auto axis = longest_axis(center_max - center_min);
+	auto split = (center_min.dim[axis] + center_max.dim[axis]) * 0.5f;
+
+	auto middle = first;
+	for (auto position = first; position < first + count; ++position) {
+		auto item = order[position];
+		if (centers[item].dim[axis] < split) {
+			order[position] = order[middle];
+			order[middle++] = item;
+		}
+	}
+
+	if (middle == first || middle == first + count) middle = first + count / 2;
+	return middle;
+}
+
+//
+// Cutting up the one copy of the mesh.
+//
+
+struct BaseChunk {
+	// Into the face order.
+	int first;
+	int count;
+
+	// Per level, the corners that are left, with the coarse levels' positions already moved.
+	MeshVertex *corners[MAX_CHUNK_LEVELS];
+	int triangle_counts[MAX_CHUNK_LEVELS];
+
+	ChunkBounds bounds;
+};
+
+static void split_faces(int *order, int first, int count, const Vec3f *centroids, int chunk_triangles, BaseChunk *chunks, int &chunk_count) {
+	if (count <= chunk_triangles) {
+		auto &chunk = chunks[chunk_count++];
+		chunk = {};
+		chunk.first = first;
+		chunk.count = count;
+		return;
+	}
+
+	auto middle = split_at_middle(order, first, count, centroids);
+	split_faces(order, first, middle - first, centroids, chunk_triangles, chunks, chunk_count);
+	split_faces(order, middle, first + count - middle, centroids, chunk_triangles, chunks, chunk_count);
+}
+
+// A level's clustering. Every vertex gets the cell it's in, and its new position, the average of the cell's vertices.
+struct Clustering {
+	int *cells;
+	Vec3f *positions;
+};
+
+struct CellSlot {
+	s32 x, y, z;
+	s32 cell;
+};
+
+static u32 hash_cell(s32 x, s32 y, s32 z) {
+	auto hash = (u32)x * 73856093u ^ (u32)y * 19349663u ^ (u32)z * 83492791u;
+	return hash ^ (hash >> 16);
+}
+
+static bool cluster_vertices(MemoryArena &arena, const WavefrontObj &obj, f32 cell_size, Clustering &clustering) {
+	auto capacity = 1;
+	while (capacity < obj.vert_count * 2) capacity *= 2;
+
+	clustering.cells = push_array(arena, int, obj.vert_count);
+	clustering.positions = push_array(arena, Vec3f, obj.vert_count);
+
+	auto mark = arena_mark(arena);
+	auto slots = push_array(arena, CellSlot, capacity);
+	auto sums = push_array(arena, Vec3f, obj.vert_count);
+	auto counts = push_array(arena, int, obj.vert_count);
+	if (!clustering.cells || !clustering.positions || !slots || !sums || !counts) return false;
+
+	for (auto index = 0; index < capacity; ++index) slots[index].cell = -1;
+
+	auto cell_count = 0;
+	for (auto vertex = 0; vertex < obj.vert_count; ++vertex) {
+		auto &position = obj.verts[vertex].v3;
+		auto x = (s32)floorf(position.x / cell_size);
+		auto y = (s32)floorf(position.y / cell_size);
+		auto z = (s32)floorf(position.z / cell_size);
+
+		auto slot = hash_cell(x, y, z) & (capacity - 1);
+		while (slots[slot].cell >= 0 && (slots[slot].x != x || slots[slot].y != y || slots[slot].z != z)) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		if (slots[slot].cell < 0) {
+			slots[slot] = CellSlot{ x, y, z, cell_count };
+			sums[cell_count] = Vec3f{ 0, 0, 0 };
+			counts[cell_count] = 0;
+			cell_count++;
+		}
+
+		auto cell = slots[slot].cell;
+		clustering.cells[vertex] = cell;
+		sums[cell] = sums[cell] + position;
+		counts[cell]++;
+	}
+
+	for (auto vertex = 0; vertex < obj.vert_count; ++vertex) {
+		auto cell = clustering.cells[vertex];
+		clustering.positions[vertex] = sums[cell] * (1.0f / counts[cell]);
+	}
+
+	pop_to_mark(arena, mark);
+	return true;
+}
+
+// Fills in the chunk's corners for a level. clustering is null for level 0.
+static bool build_chunk_level(MemoryArena &arena, const WavefrontObj &obj, const int *order, const Clustering *clustering, BaseChunk &chunk, int level) {
+	auto corners = push_array(arena, MeshVertex, chunk.count * 3);
+	if (!corners) return false;
+
+	auto triangle_count = 0;
+	for (auto position = chunk.first; position < chunk.first + chunk.count; ++position) {
+		auto &face = obj.faces[order[position]];
+
+		if (clustering) {
+			auto a = clustering->cells[face.vertex_indices.dim[0]];
+			auto b = clustering->cells[face.vertex_indices.dim[1]];
+			auto c = clustering->cells[face.vertex_indices.dim[2]];
+			if (a == b || b == c || a == c) continue;
+		}
+
+		// The normals and UVs stay as they were. Only the positions move, so the shading keeps most of its detail.
+		for (auto corner = 0; corner < 3; ++corner) {
+			auto &vertex = corners[triangle_count * 3 + corner];
+			vertex = fetch_vertex(obj, face, corner);
+			if (clustering) vertex.position = clustering->positions[face.vertex_indices.dim[corner]];
+
+			chunk.bounds.min = min3(chunk.bounds.min, vertex.position);
+			chunk.bounds.max = max3(chunk.bounds.max, vertex.position);
+		}
+
+		triangle_count++;
+	}
+
+	chunk.corners[level] = corners;
+	chunk.triangle_counts[level] = triangle_count;
+	return true;
+}
+
+//
+// The tree over every chunk of every copy.
+//
+
+struct ChunkTreeBuild {
+	ChunkNode *nodes;
+	int node_count;
+	int *order;
+	Vec3f *centers;
+	const ChunkBounds *bounds;
+};
+
+static int build_chunk_node(ChunkTreeBuild &build, int first, int count) {
+	auto index = build.node_count++;
+	auto &node = build.nodes[index];
+
+	node.bounds = empty_bounds();
+	for (auto position = first; position < first + count; ++position) {
+		auto &bounds = build.bounds[build.order[position]];
+		node.bounds.min = min3(node.bounds.min, bounds.min);
+		node.bounds.max = max3(node.bounds.max, bounds.max);
+	}
+
+	if (count <= CHUNK_NODE_CHUNKS) {
+		node.offset = first;
+		node.count = count;
+		return index;
+	}
+
+	auto middle = split_at_middle(build.order, first, count, build.centers);
+
+	node.count = 0;
+	build_chunk_node(build, first, middle - first);
+	build.nodes[index].offset = build_chunk_node(build, middle, first + count - middle);
+	return index;
+}
+
+//
+// Writing.
+//
+
+static u8 GlobalZeroes[CHUNK_DATA_ALIGNMENT];
+
+static bool write_bytes(HANDLE file, const void *data, u64 size) {
+	auto bytes = (const u8 *)data;
+	while (size) {
+		auto part = (DWORD)min(size, (u64)64 * 1024 * 1024);
+		DWORD written;
+		if (!WriteFile(file, bytes, part, &written, 0) || written != part) return false;
+
+		bytes += part;
+		size -= part;
+	}
+
+	return true;
+}
+
+static bool pad_to(HANDLE file, u64 &written, u64 offset) {
+	while (written < offset) {
+		auto part = min(offset - written, (u64)sizeof(GlobalZeroes));
+		if (!write_bytes(file, GlobalZeroes, part)) return false;
+		written += part;
+	}
+
+	return true;
+}
+
+static u64 align_offset(u64 offset) {
+	return (offset + CHUNK_DATA_ALIGNMENT - 1) & ~(CHUNK_DATA_ALIGNMENT - 1);
+}
+
+static Vec3f copy_offset(const PartitionSettings &settings, int copy) {
+	auto column = copy % settings.grid;
+	auto row = copy / settings.grid;
+	return Vec3f{ (column - (settings.grid - 1) * 0.5f) * settings.spacing, 0, -row * settings.spacing };
+}
+
+bool write_chunked_mesh(const char *path, const WavefrontObj &obj, const PartitionSettings &settings, MemoryArena &arena, PartitionResult &result) {
+	TRACE_SCOPE("write_chunked_mesh");
+
+	result = {};
+	if (obj.face_count == 0 || settings.level_count < 1 || settings.level_count > MAX_CHUNK_LEVELS || settings.grid < 1) return false;
+
+	// Cutting up the mesh.
+	auto order = push_array(arena, int, obj.face_count);
+	auto centroids = push_array(arena, Vec3f, obj.face_count);
+	auto base_chunks = push_array(arena, BaseChunk, obj.face_count);
+	if (!order || !centroids || !base_chunks) return false;
+
+	auto edge_length = 0.0f;
+	for (auto face = 0; face < obj.face_count; ++face) {
+		order[face] = face;
+
+		Vec3f corners[3];
+		for (auto corner = 0; corner < 3; ++corner) {
+			corners[corner] = obj.verts[obj.faces[face].vertex_indices.dim[corner]].v3;
+		}
+
+		centroids[face] = (corners[0] + corners[1] + corners[2]) * (1.0f / 3);
+		edge_length += (f32)(length(corners[1] - corners[0]) + length(corners[2] - corners[1]) + length(corners[0] - corners[2]));
+	}
+	edge_length /= obj.face_count * 3.0f;
+
+	auto base_count = 0;
+	split_faces(order, 0, obj.face_count, centroids, max(settings.chunk_triangles, 1), base_chunks, base_count);
+
+	for (auto index = 0; index < base_count; ++index) base_chunks[index].bounds = empty_bounds();
+
+	// Twice the average edge for level 1 leaves around a quarter of the triangles, and each level doubles it again.
+	for (auto level = 0; level < settings.level_count; ++level) {
+		Clustering clustering;
+		if (level > 0 && !cluster_vertices(arena, obj, edge_length * (f32)(1 << level), clustering)) return false;
+
+		for (auto index = 0; index < base_count; ++index) {
+			if (!build_chunk_level(arena, obj, order, level > 0 ? &clustering : 0, base_chunks[index], level)) return false;
+		}
+	}
+
+	// Every chunk of every copy, and the tree over them. Chunk index is copy * base_count + base chunk, until
+	// the tree puts them in its own order.
+	auto copy_count = settings.grid * settings.grid;
+	auto chunk_count = copy_count * base_count;
+
+	auto chunk_bounds = push_array(arena, ChunkBounds, chunk_count);
+	auto chunk_centers = push_array(arena, Vec3f, chunk_count);
+	auto chunk_order = push_array(arena, int, chunk_count);
+	auto nodes = push_array(arena, ChunkNode, chunk_count * 2);
+	auto entries = push_array(arena, ChunkEntry, chunk_count);
+	if (!chunk_bounds || !chunk_centers || !chunk_order || !nodes || !entries) return false;
+
+	ChunkFileHeader header = {};
+	header.magic = CHUNK_FILE_MAGIC;
+	header.version = CHUNK_FILE_VERSION;
+	header.chunk_count = chunk_count;
+	header.level_count = settings.level_count;
+	header.bounds = empty_bounds();
+
+	for (auto chunk = 0; chunk < chunk_count; ++chunk) {
+		auto offset = copy_offset(settings, chunk / base_count);
+		auto &base = base_chunks[chunk % base_count];
+
+		chunk_bounds[chunk] = ChunkBounds{ base.bounds.min + offset, base.bounds.max + offset };
+		chunk_centers[chunk] = (chunk_bounds[chunk].min + chunk_bounds[chunk].max) * 0.5f;
+		chunk_order[chunk] = chunk;
+
+		header.bounds.min = min3(header.bounds.min, chunk_bounds[chunk].min);
+		header.bounds.max = max3(header.bounds.max, chunk_bounds[chunk].max);
+	}
+
+	ChunkTreeBuild build = { nodes, 0, chunk_order, chunk_centers, chunk_bounds };
+	build_chunk_node(build, 0, chunk_count);
+	header.node_count = build.node_count;
+
+	// Where everything goes. The coarse block right after the tables, then the other levels in the tree's order,
+	// so chunks that get looked at together are near each other on disk too.
+	auto coarsest = settings.level_count - 1;
+	auto offset = sizeof(ChunkFileHeader) + sizeof(ChunkNode) * (u64)header.node_count + sizeof(ChunkEntry) * (u64)chunk_count;
+
+	header.coarse_offset = align_offset(offset);
+	offset = header.coarse_offset;
+
+	for (auto position = 0; position < chunk_count; ++position) {
+		auto chunk = chunk_order[position];
+		auto &base = base_chunks[chunk % base_count];
+		auto &entry = entries[position];
+
+		entry = {};
+		entry.bounds = chunk_bounds[chunk];
+		entry.levels[coarsest].offset = offset;
+		entry.levels[coarsest].triangle_count = base.triangle_counts[coarsest];
+		offset += sizeof(MeshVertex) * 3 * (u64)base.triangle_counts[coarsest];
+	}
+
+	header.coarse_size = offset - header.coarse_offset;
+
+	for (auto position = 0; position < chunk_count; ++position) {
+		auto &base = base_chunks[chunk_order[position] % base_count];
+		auto &entry = entries[position];
+
+		for (auto level = 0; level < coarsest; ++level) {
+			auto size = sizeof(MeshVertex) * 3 * (u64)base.triangle_counts[level];
+			offset = align_offset(offset);
+			entry.levels[level].offset = offset;
+			entry.levels[level].triangle_count = base.triangle_counts[level];
+			offset += size;
+
+			header.max_level_size = max(header.max_level_size, size);
+		}
+	}
+
+	for (auto level = 0; level < settings.level_count; ++level) {
+		for (auto index = 0; index < base_count; ++index) {
+			result.triangles[level] += (u64)base_chunks[index].triangle_counts[level] * copy_count;
+		}
+	}
+
+	auto file = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	defer { CloseHandle(file); };
+
+	if (!write_bytes(file, &header, sizeof(header))) return false;
+	if (!write_bytes(file, nodes, sizeof(ChunkNode) * (u64)header.node_count)) return false;
+	if (!write_bytes(file, entries, sizeof(ChunkEntry) * (u64)chunk_count)) return false;
+	auto written = sizeof(ChunkFileHeader) + sizeof(ChunkNode) * (u64)header.node_count + sizeof(ChunkEntry) * (u64)chunk_count;
+
+	// Each copy's corners get moved into place in scratch that's big enough for the biggest level.
+	auto scratch_count = 0;
+	for (auto index = 0; index < base_count; ++index) {
+		scratch_count = max(scratch_count, base_chunks[index].triangle_counts[0] * 3);
+	}
+
+	auto scratch = push_array(arena, MeshVertex, max(scratch_count, 1));
+	if (!scratch) return false;
+
+	for (auto pass = 0; pass < 2; ++pass) {
+		for (auto position = 0; position < chunk_count; ++position) {
+			auto chunk = chunk_order[position];
+			auto &base = base_chunks[chunk % base_count];
+			auto copy = copy_offset(settings, chunk / base_count);
+
+			// The coarsest levels on the first pass, everything else on the second.
+			auto first_level = pass == 0 ? coarsest : 0;
+			auto last_level = pass == 0 ? coarsest : coarsest - 1;
+
+			for (auto level = first_level; level <= last_level; ++level) {
+				auto &entry_level = entries[position].levels[level];
+				auto corner_count = entry_level.triangle_count * 3;
+
+				for (auto corner = 0; corner < corner_count; ++corner) {
+					scratch[corner] = base.corners[level][corner];
+					scratch[corner].position = scratch[corner].position + copy;
+				}
+
+				if (!pad_to(file, written, entry_level.offset)) return false;
+				if (!write_bytes(file, scratch, sizeof(MeshVertex) * (u64)corner_count)) return false;
+				written += sizeof(MeshVertex) * (u64)corner_count;
+			}
+		}
+	}
+
+	result.chunk_count = chunk_count;
+	result.file_size = written;
+	return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "arena.h"
+#include "wavefront.h"
+
+// Chunked meshes, for meshes too big to have in memory all at once. The partition tool (partition_main.cpp)
+// cuts a mesh up into chunks of nearby triangles, makes coarser versions of each chunk, and writes it all into
+// one .chunks file. The viewer only reads the chunks it can see, at the detail it needs (see stream.h).
+//
+// The file is, in order:
+//    ChunkFileHeader
+//    ChunkNode[node_count]    a BVH over the chunks, for culling them without looking at every one
+//    ChunkEntry[chunk_count]  each chunk's bounds and where each of its levels is
+//    the coarse block         the coarsest level of every chunk, back to back, which the viewer reads whole
+//    the rest                 every other level of every chunk, each one starting on CHUNK_DATA_ALIGNMENT
+//
+// A level is just the triangles' corners as MeshVertex, three per triangle, the same as PreparedMesh::corners,
+// so whatever gets read from the file can be drawn as it is. Level 0 is the mesh as it was, and each level
+// after it has around a quarter of the triangles of the one before.
+//
+// The coarse levels come from clustering the vertices on a grid, the cells twice as big each level, and moving
+// every vertex to the average of its cell. Triangles with two corners in the same cell go away. The cells are
+// the same across the whole mesh, so two chunks at the same level agree on where their shared edge is. Chunks
+// at different levels don't, and there can be small cracks between them.
+
+const u32 CHUNK_FILE_MAGIC = 0x4B4E4843;
+const u32 CHUNK_FILE_VERSION = 1;
+
+const int MAX_CHUNK_LEVELS = 4;
+
+// Sector and page aligned, so a level can be read straight into memory without the file system
+// having to read part of a sector it's already been through.
+const u64 CHUNK_DATA_ALIGNMENT = 4096;
+
+struct ChunkBounds {
+	Vec3f min;
+	Vec3f max;
+};
+
+struct ChunkFileHeader {
+	u32 magic;
+	u32 version;
+
+	s32 chunk_count;
+	s32 level_count;
+	s32 node_count;
+	u32 reserved;
+
+	ChunkBounds bounds;
+
+	// Where the coarsest levels are, all together.
+	u64 coarse_offset;
+	u64 coarse_size;
+
+	// The biggest any level but the coarsest gets, in bytes. The viewer's cache slots are this big.
+	u64 max_level_size;
+};
+
+struct ChunkLevel {
+	u64 offset;
+	s32 triangle_count;
+	u32 reserved;
+};
+
+struct ChunkEntry {
+	ChunkBounds bounds;
+	ChunkLevel levels[MAX_CHUNK_LEVELS];
+};
+
+// Laid out like the bake's BVH. The left child always comes right after its parent.
+struct ChunkNode {
+	ChunkBounds bounds;
+
+	// For a leaf, the first of its chunks. Otherwise the right child.
+	s32 offset;
+
+	// 0 for interior nodes.
+	s32 count;
+};
+
+struct PartitionSettings {
+	// The most triangles a chunk gets at level 0.
+	int chunk_triangles;
+
+	// Including level 0, up to MAX_CHUNK_LEVELS.
+	int level_count;
+
+	// For making big test files out of a small mesh: grid by grid copies of it, spacing apart on x and z.
+	// 1 is just the mesh.
+	int grid;
+	f32 spacing;
+};
+
+struct PartitionResult {
+	int chunk_count;
+	u64 triangles[MAX_CHUNK_LEVELS];
+	u64 file_size;
+};
+
+// Scratch goes in arena, which only ever needs to hold a few times the one copy of the mesh, however big
+// grid makes the file. Returns false if arena ran out or the file couldn't be written.
+bool write_chunked_mesh(const char *path, const WavefrontObj &obj, const PartitionSettings &settings, MemoryArena &arena, PartitionResult &result);
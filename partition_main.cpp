@@ -0,0 +1,105 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "vectors.h"
+#include "wavefront.h"
+#include "arena.h"
+#include "trace.h"
+#include "partition.h"
+
+// Cuts a mesh up into chunks for streaming (see partition.h and stream.h).
+//
+//    partition [--mesh data/african_head.wfo] [--out data/african_head.chunks] [--chunk-triangles 1024]
+//              [--levels 3] [--grid 1] [--spacing 2.2] [--trace trace.json]
+//
+// --grid N writes N by N copies of the mesh instead of the one, going back into the distance on z, which is an
+// easy way to get a file far bigger than the viewer's budget out of a small mesh. 100 makes one of about 3 GB
+// from the head.
+
+static f64 GlobalTicksToMs;
+
+static u64 now_ticks() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (u64)counter.QuadPart;
+}
+
+int main(int argc, char **argv) {
+	const char *mesh_path = "data/african_head.wfo";
+	const char *out_path = "data/african_head.chunks";
+	const char *trace_file_name = 0;
+
+	PartitionSettings settings = {};
+	settings.chunk_triangles = 1024;
+	settings.level_count = 3;
+	settings.grid = 1;
+	settings.spacing = 2.2f;
+
+	for (auto index = 1; index < argc; ++index) {
+		if (strcmp(argv[index], "--mesh") == 0 && index + 1 < argc) {
+			mesh_path = argv[++index];
+		} else if (strcmp(argv[index], "--out") == 0 && index + 1 < argc) {
+			out_path = argv[++index];
+		} else if (strcmp(argv[index], "--chunk-triangles") == 0 && index + 1 < argc) {
+			settings.chunk_triangles = max(atoi(argv[++index]), 16);
+		} else if (strcmp(argv[index], "--levels") == 0 && index + 1 < argc) {
+			settings.level_count = clamp(atoi(argv[++index]), 1, MAX_CHUNK_LEVELS);
+		} else if (strcmp(argv[index], "--grid") == 0 && index + 1 < argc) {
+			settings.grid = clamp(atoi(argv[++index]), 1, 1000);
+		} else if (strcmp(argv[index], "--spacing") == 0 && index + 1 < argc) {
+			settings.spacing = (f32)atof(argv[++index]);
+		} else if (strcmp(argv[index], "--trace") == 0 && index + 1 < argc) {
+			trace_file_name = argv[++index];
+		} else {
+			fprintf(stderr, "Unknown argument %s\n", argv[index]);
+			return 1;
+		}
+	}
+
+	TRACE_THREAD_NAME("main");
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	GlobalTicksToMs = 1000.0 / (f64)frequency.QuadPart;
+
+	// Only reserved up front. The mesh, its levels and the tables for every chunk are all that go in it.
+	MemoryArena arena;
+	if (!make_arena(arena, (size_t)1024 * 1024 * 1024)) {
+		fprintf(stderr, "Couldn't reserve the arena.\n");
+		return 1;
+	}
+
+	auto obj = load_obj(mesh_path, arena);
+	if (!obj.face_count) {
+		fprintf(stderr, "Couldn't load %s.\n", mesh_path);
+		return 1;
+	}
+
+	printf("Partitioning %s: %d faces, %d by %d copies, at most %d triangles a chunk, %d levels\n",
+		mesh_path, obj.face_count, settings.grid, settings.grid, settings.chunk_triangles, settings.level_count);
+
+	auto start = now_ticks();
+	auto result = 0;
+
+	PartitionResult partition;
+	if (!write_chunked_mesh(out_path, obj, settings, arena, partition)) {
+		fprintf(stderr, "Couldn't write %s.\n", out_path);
+		result = 1;
+	} else {
+		printf("Wrote %s in %.0f ms: %d chunks, %llu MB\n", out_path, (now_ticks() - start) * GlobalTicksToMs, partition.chunk_count, partition.file_size / (1024 * 1024));
+		for (auto level = 0; level < settings.level_count; ++level) {
+			printf("  Level %d: %llu triangles\n", level, partition.triangles[level]);
+		}
+	}
+
+	free_arena(arena);
+
+	if (trace_file_name && !write_trace(trace_file_name)) {
+		fprintf(stderr, "Couldn't write a trace to %s. Is RENDER_TRACE defined?\n", trace_file_name);
+	}
+
+	return result;
+}
@@ -0,0 +1,171 @@
+#include <windows.h>
+#include <string.h>
+#include <float.h>
+
+#include "passes.h"
+
+static void clear_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	clear(*frame.jobs, *frame.target, BLACK, FLT_MIN);
+
+	for (auto index = 0; index < frame.view_count; ++index) {
+		clear(*frame.jobs, frame.view_targets[index], BLACK, FLT_MIN);
+	}
+}
+
+static void shadow_map_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	render_shadow_map(*frame.shadow_map, *frame.obj, frame.shadow_transform);
+}
+
+void draw_scene_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	frame.stats->fragments_shaded = draw_scene(*frame.target, *frame.scene, *frame.crowd_shader, frame.transform);
+}
+
+void draw_streamed_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	frame.stats->fragments_shaded = draw_streamed_mesh(*frame.target, *frame.streamed_mesh, *frame.crowd_shader, frame.transform);
+}
+
+void draw_instances_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+
+	// model_view has no model in it, it's just the camera, so transform is world space to the screen.
+	frame.stats->fragments_shaded = draw_instances(*frame.jobs, *frame.frame_arena, *frame.target, *frame.prepared_mesh, *frame.crowd_shader,
+		frame.instances, frame.instance_count, frame.transform);
+}
+
+void draw_views_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+
+	// The shadow map is in object space, so one is right for every view.
+	frame.stats->fragments_shaded = draw_mesh_views(*frame.jobs, *frame.frame_arena, *frame.prepared_mesh, *frame.shader, frame.views, frame.view_count);
+}
+
+static MemoryArena mesh_scratch(FrameGraph &graph, const FramePasses &frame) {
+	return fixed_arena(graph_buffer(graph, frame.mesh_scratch_buffer), frame.mesh_scratch_size);
+}
+
+void draw_lightmapped_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	auto scratch = mesh_scratch(graph, frame);
+	frame.stats->fragments_shaded = draw_mesh(*frame.jobs, scratch, *frame.target, *frame.obj, *frame.lightmap_shader, frame.transform, frame.render_mode);
+}
+
+void draw_baked_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	auto scratch = mesh_scratch(graph, frame);
+	frame.stats->fragments_shaded = draw_mesh(*frame.jobs, scratch, *frame.target, *frame.obj, *frame.baked_shader, frame.transform, frame.render_mode);
+}
+
+void draw_shadowed_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	auto scratch = mesh_scratch(graph, frame);
+	frame.stats->fragments_shaded = draw_mesh(*frame.jobs, scratch, *frame.target, *frame.obj, *frame.shader, frame.transform, frame.render_mode);
+}
+
+void upscale_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	upscale(*frame.jobs, *frame.target, *frame.buffer);
+}
+
+void resolve_stale_tiles_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	resolve_stale_tiles(*frame.jobs, *frame.history, *frame.target, *frame.buffer, frame.buffer_index);
+}
+
+void resolve_heat_map_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	resolve_heat_map(*frame.target, *frame.buffer, frame.heat_map_mode, 8);
+}
+
+void resolve_views_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+
+	// The buffer is bottom-up, so the first row of the grid goes at the top.
+	clear(*frame.buffer, BLACK);
+	for (auto index = 0; index < frame.view_count; ++index) {
+		auto column = index % frame.view_side;
+		auto row = frame.view_side - 1 - index / frame.view_side;
+		resolve(frame.view_targets[index], *frame.buffer, column * frame.view_size, row * frame.view_size);
+	}
+}
+
+void render_regions_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	frame.regions_failed = !render_regions(*frame.regions, frame.region_frame, *frame.buffer);
+	frame.stats->fragments_shaded = frame.regions->fragments_shaded;
+}
+
+static void post_pass(FrameGraph &graph, int pass, void *data) {
+	auto &frame = *(FramePasses *)data;
+	post_process(*frame.jobs, *frame.post, *frame.buffer, graph_buffer(graph, frame.post_buffer));
+}
+
+
+void build_frame_graph(FrameGraph &graph, FramePasses &frame, bool redraw) {
+	frame.clear_index = -1;
+	frame.shadow_index = -1;
+	frame.draw_index = -1;
+	frame.post_index = -1;
+	frame.regions_failed = false;
+
+	// The clear and the shadow map don't touch each other's buffers, so they end up running side by side,
+	// and the draw waits for both.
+	begin_frame_graph(graph);
+	auto target_buffer = import_buffer(graph, "target", frame.target);
+	auto backbuffer = import_buffer(graph, "backbuffer", frame.buffer);
+
+	if (redraw) {
+		frame.clear_index = add_pass(graph, "clear", clear_pass, &frame);
+		write_buffer(graph, frame.clear_index, target_buffer);
+	}
+
+	if (redraw && frame.draw) {
+		auto shadowed = frame.draw == draw_views_pass || frame.draw == draw_shadowed_pass;
+		if (shadowed) {
+			frame.shadow_buffer = import_buffer(graph, "shadow map", frame.shadow_map->depth.tiles);
+
+			if (frame.shadow_obj != frame.obj || memcmp(&frame.shadow_light_dir, &frame.light_dir, sizeof(frame.light_dir)) != 0) {
+				frame.shadow_index = add_pass(graph, "shadow map", shadow_map_pass, &frame);
+				write_buffer(graph, frame.shadow_index, frame.shadow_buffer);
+
+				frame.shadow_obj = frame.obj;
+				frame.shadow_light_dir = frame.light_dir;
+			}
+		}
+
+		// draw_mesh bins the triangles by band first, and the bins go in a transient buffer.
+		frame.mesh_scratch_size = 0;
+		if (frame.draw == draw_shadowed_pass) {
+			frame.mesh_scratch_size = draw_mesh_scratch_size<ShadowedGouraudShader>(*frame.jobs, *frame.target, *frame.obj);
+		} else if (frame.draw == draw_baked_pass) {
+			frame.mesh_scratch_size = draw_mesh_scratch_size<BakedVertexShader>(*frame.jobs, *frame.target, *frame.obj);
+		} else if (frame.draw == draw_lightmapped_pass) {
+			frame.mesh_scratch_size = draw_mesh_scratch_size<LightmapShader>(*frame.jobs, *frame.target, *frame.obj);
+		}
+
+		frame.draw_index = add_pass(graph, "draw", frame.draw, &frame);
+		if (shadowed) read_buffer(graph, frame.draw_index, frame.shadow_buffer);
+		read_buffer(graph, frame.draw_index, target_buffer);
+		write_buffer(graph, frame.draw_index, target_buffer);
+		if (frame.mesh_scratch_size) {
+			frame.mesh_scratch_buffer = create_buffer(graph, "mesh scratch", frame.mesh_scratch_size);
+			write_buffer(graph, frame.draw_index, frame.mesh_scratch_buffer);
+		}
+	}
+
+	frame.output_index = add_pass(graph, "output", frame.output, &frame);
+	read_buffer(graph, frame.output_index, target_buffer);
+	write_buffer(graph, frame.output_index, backbuffer);
+
+	// Post's memory is only alive after the draw is done, so it goes where the mesh scratch was.
+	if (frame.post && frame.post->enabled) {
+		frame.post_index = add_pass(graph, "post", post_pass, &frame);
+		frame.post_buffer = create_buffer(graph, "post", post_memory_size(*frame.post));
+		read_buffer(graph, frame.post_index, backbuffer);
+		write_buffer(graph, frame.post_index, backbuffer);
+		write_buffer(graph, frame.post_index, frame.post_buffer);
+	}
+}
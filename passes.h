@@ -0,0 +1,119 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "render.h"
+#include "raster.h"
+#include "shaders.h"
+#include "shadow.h"
+#include "jobs.h"
+#include "arena.h"
+#include "framegraph.h"
+#include "instancing.h"
+#include "scene.h"
+#include "multiview.h"
+#include "incremental.h"
+#include "regions.h"
+#include "post.h"
+#include "stream.h"
+
+// The frame's passes, and the graph they go in. The viewer and the bench both draw their frames through
+// build_frame_graph, so whatever changes about how a frame gets drawn changes for both, and the bench's
+// numbers are always for the frame the viewer really draws.
+//
+// A frame goes: the clear and the shadow map (when it's stale) side by side, then the draw, then an output
+// pass that gets the target into the backbuffer, then post over the backbuffer. The draw and the output are
+// whichever of the passes below the caller picks.
+
+// Everything the passes need. It's the data for all of them, and the caller fills in the parts that change
+// before building each frame's graph. Whatever the caller doesn't use can stay 0.
+struct FramePasses {
+	JobSystem *jobs;
+	MemoryArena *frame_arena;
+	RenderTarget *target;
+	RenderMode render_mode;
+	Mat4f transform;
+	ShadingStats *stats;
+
+	const WavefrontObj *obj;
+	const PreparedMesh *prepared_mesh;
+
+	// One of the draw passes below, or 0 for nothing to draw yet. output is one of the output passes.
+	PassProc draw;
+	PassProc output;
+
+	// The light and the head don't move, so the shadow map pass is only there for the frames where it's stale.
+	// shadow_obj and shadow_light_dir are what it was last drawn for, and build_frame_graph keeps them up to date.
+	ShadowMap *shadow_map;
+	Mat4f shadow_transform;
+	Vec3f light_dir;
+	int shadow_buffer;
+	const WavefrontObj *shadow_obj;
+	Vec3f shadow_light_dir;
+
+	ShadowedGouraudShader *shader;
+	GouraudShader *crowd_shader;
+	BakedVertexShader *baked_shader;
+	LightmapShader *lightmap_shader;
+
+	Scene *scene;
+	const Instance *instances;
+	int instance_count;
+
+	MeshView *views;
+	RenderTarget *view_targets;
+	int view_count;
+	int view_side;
+	int view_size;
+
+	StreamedMesh *streamed_mesh;
+
+	// Transient, for draw_mesh's bins. It's only alive while the draw is, so it shares memory with post's.
+	int mesh_scratch_buffer;
+	size_t mesh_scratch_size;
+
+	// What the output passes need. buffer is the backbuffer this frame is going in.
+	Backbuffer *buffer;
+	int buffer_index;
+	HeatMapMode heat_map_mode;
+	TileHistory *history;
+	RegionRenderer *regions;
+	RegionFrame region_frame;
+	bool regions_failed;
+
+	// Only gets a pass when it's enabled.
+	PostProcessor *post;
+	int post_buffer;
+
+	// Where build_frame_graph put the passes, for their times after execute_frame_graph. -1 for the ones
+	// that aren't in this frame.
+	int clear_index;
+	int shadow_index;
+	int draw_index;
+	int output_index;
+	int post_index;
+};
+
+// The draw passes.
+void draw_shadowed_pass(FrameGraph &graph, int pass, void *data);
+void draw_baked_pass(FrameGraph &graph, int pass, void *data);
+void draw_lightmapped_pass(FrameGraph &graph, int pass, void *data);
+void draw_scene_pass(FrameGraph &graph, int pass, void *data);
+void draw_streamed_pass(FrameGraph &graph, int pass, void *data);
+void draw_instances_pass(FrameGraph &graph, int pass, void *data);
+void draw_views_pass(FrameGraph &graph, int pass, void *data);
+
+// The output passes.
+void upscale_pass(FrameGraph &graph, int pass, void *data);
+void resolve_stale_tiles_pass(FrameGraph &graph, int pass, void *data);
+void resolve_heat_map_pass(FrameGraph &graph, int pass, void *data);
+void resolve_views_pass(FrameGraph &graph, int pass, void *data);
+
+// The worker processes draw into their own targets, and this is where they resolve straight into the frame.
+// It sets regions_failed if one of them died.
+void render_regions_pass(FrameGraph &graph, int pass, void *data);
+
+// Starts graph over with this frame's passes. With redraw false there's no clear or draw, only the output
+// and post, for when the target is already right. The caller compiles and executes it.
+void build_frame_graph(FrameGraph &graph, FramePasses &frame, bool redraw);
@@ -0,0 +1,484 @@
+#include <windows.h>
+#include <intrin.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#include "post.h"
+#include "trace.h"
+
+// The blend directions get clamped to this many pixels. The taps go at most half of it from the pixel,
+// and the bilinear filter needs one more past that.
+const int FXAA_SPAN_MAX = 8;
+const int FXAA_APRON_ROWS = FXAA_SPAN_MAX / 2 + 1;
+
+// Edges with less contrast than this get left alone. The threshold is whichever is higher: an eighth of the
+// brightest luma around the pixel, or a flat 16 out of 255 so noise in the dark doesn't count as an edge.
+const int FXAA_EDGE_SHIFT = 3;
+const int FXAA_EDGE_MIN = 16;
+
+// Keeps the direction from blowing up on edges that are nearly flat.
+const f32 FXAA_REDUCE_MUL = 1.0f / 8;
+const f32 FXAA_REDUCE_MIN = 1.0f / 128;
+
+// 1 4 6 4 1, both ways.
+const int BLUR_RADIUS = 2;
+
+// The rows past each side of a band that a band's work can reach: FXAA's taps, around the rows the blur needs.
+const int APRON_ROWS = FXAA_APRON_ROWS + BLUR_RADIUS;
+
+// Luma weights out of 256, in the same proportions as everything else uses.
+const int LUMA_RED = 77;
+const int LUMA_GREEN = 150;
+const int LUMA_BLUE = 29;
+
+// Where everything for one band goes in its worker's scratch. Rows of color are padded to an even number
+// of pixels, so the blur can always go two at a time, and rows of luma have sixteen bytes either side.
+struct BandLayout {
+	int color_stride;
+	int luma_stride;
+
+	size_t input_offset;
+	size_t luma_offset;
+	size_t antialiased_offset;
+	size_t blurred_offset;
+	size_t size;
+};
+
+static BandLayout band_layout(int width) {
+	BandLayout layout = {};
+	layout.color_stride = (width + 1) & ~1;
+	layout.luma_stride = ((width + 15) & ~15) + 32;
+
+	auto input_size = (size_t)(POST_BAND_ROWS + 2 * APRON_ROWS) * layout.color_stride * sizeof(u32);
+	auto luma_size = (size_t)(POST_BAND_ROWS + 2 * BLUR_RADIUS + 2) * layout.luma_stride;
+	auto antialiased_size = (size_t)(POST_BAND_ROWS + 2 * BLUR_RADIUS) * layout.color_stride * sizeof(u32);
+
+	// One row of the vertical blur, four 16 bit channels a pixel, with BLUR_RADIUS pixels either side.
+	auto blurred_size = (size_t)(layout.color_stride + 2 * BLUR_RADIUS) * 4 * sizeof(u16);
+
+	layout.input_offset = 0;
+	layout.luma_offset = layout.input_offset + ((input_size + 63) & ~(size_t)63);
+	layout.antialiased_offset = layout.luma_offset + ((luma_size + 63) & ~(size_t)63);
+	layout.blurred_offset = layout.antialiased_offset + ((antialiased_size + 63) & ~(size_t)63);
+	layout.size = layout.blurred_offset + ((blurred_size + 63) & ~(size_t)63);
+	return layout;
+}
+
+static void build_curve(PostProcessor &post) {
+	// Back to linear, scaled by the exposure. When that pushes white past 1, a Reinhard curve with its white
+	// point at the new white brings it back down smoothly instead of clipping everything bright.
+	auto scale = powf(2, post.settings.exposure);
+	auto encode = 1 / (2.2f * post.settings.gamma);
+
+	post.identity_curve = true;
+	for (auto index = 0; index < 256; ++index) {
+		auto value = powf(index / 255.0f, 2.2f) * scale;
+		if (scale > 1) value = value * (1 + value / (scale * scale)) / (1 + value);
+
+		auto encoded = powf(min(value, 1.0f), encode);
+		post.curve[index] = (u8)clamp((int)(encoded * 255 + 0.5f), 0, 255);
+		if (post.curve[index] != index) post.identity_curve = false;
+	}
+}
+
+PostProcessor make_post_processor(const PostSettings &settings, int width, int height, const JobSystem &jobs) {
+	PostProcessor post = {};
+	post.settings = settings;
+	if (post.settings.gamma <= 0) post.settings.gamma = 1;
+
+	build_curve(post);
+	post.sharpen_amount = (s16)clamp((int)(settings.sharpen * 16 + 0.5f), 0, 128);
+
+	post.enabled = !post.identity_curve || settings.fxaa || post.sharpen_amount > 0;
+	if (!post.enabled) return post;
+
+	post.width = width;
+	post.height = height;
+	post.band_count = (height + POST_BAND_ROWS - 1) / POST_BAND_ROWS;
+	post.worker_count = jobs.worker_count;
+
+	// A slot per boundary, with the first one (the top of the first band) never used, so slot n is the top of band n.
+	// Rounded up so the scratch after it starts on a cache line.
+	post.seams_size = ((size_t)post.band_count * 2 * APRON_ROWS * width * sizeof(u32) + 63) & ~(size_t)63;
+	post.scratch_size = band_layout(width).size;
+
+	return post;
+}
+
+size_t post_memory_size(const PostProcessor &post) {
+	if (!post.enabled) return 0;
+	return post.seams_size + post.scratch_size * post.worker_count;
+}
+
+static inline u32 *buffer_row(Backbuffer &buffer, int y) {
+	return (u32 *)&buffer.memory[y * buffer.stride];
+}
+
+// Row y of the seam copy around the top of band, which holds [top - APRON_ROWS, top + APRON_ROWS).
+static inline u32 *seam_row(const PostProcessor &post, int band, int y) {
+	auto top = band * POST_BAND_ROWS;
+	return &post.seams[((size_t)band * 2 * APRON_ROWS + (y - (top - APRON_ROWS))) * post.width];
+}
+
+struct PostJob {
+	PostProcessor *post;
+	Backbuffer *buffer;
+};
+
+// Seams [first, last), before anything gets overwritten.
+static void copy_seams_job(void *data, int first, int last, int worker_index) {
+	auto &job = *(PostJob *)data;
+	auto &post = *job.post;
+
+	for (auto band = max(first, 1); band < last; ++band) {
+		auto top = band * POST_BAND_ROWS;
+		auto min_y = max(top - APRON_ROWS, 0);
+		auto max_y = min(top + APRON_ROWS, post.height);
+
+		for (auto y = min_y; y < max_y; ++y) {
+			memcpy(seam_row(post, band, y), buffer_row(*job.buffer, y), post.width * sizeof(u32));
+		}
+	}
+}
+
+static inline u32 apply_curve(const u8 *curve, u32 pixel) {
+	return 0xFF000000 | (curve[(pixel >> 16) & 0xFF] << 16) | (curve[(pixel >> 8) & 0xFF] << 8) | curve[pixel & 0xFF];
+}
+
+// Luma out of 255 for four pixels, in the low byte of each lane. Every product fits in the low 16 bits
+// of its lane, so a 16 bit multiply does it.
+static inline __m128i luma4(__m128i pixels) {
+	auto byte_mask = _mm_set1_epi32(0xFF);
+	auto blue = _mm_and_si128(pixels, byte_mask);
+	auto green = _mm_and_si128(_mm_srli_epi32(pixels, 8), byte_mask);
+	auto red = _mm_and_si128(_mm_srli_epi32(pixels, 16), byte_mask);
+
+	auto sum = _mm_add_epi32(_mm_mullo_epi16(red, _mm_set1_epi32(LUMA_RED)), _mm_mullo_epi16(green, _mm_set1_epi32(LUMA_GREEN)));
+	sum = _mm_add_epi32(sum, _mm_mullo_epi16(blue, _mm_set1_epi32(LUMA_BLUE)));
+	return _mm_srli_epi32(sum, 8);
+}
+
+static inline f32 luma_of(f32 red, f32 green, f32 blue) {
+	return (red * LUMA_RED + green * LUMA_GREEN + blue * LUMA_BLUE) / 256;
+}
+
+struct Band {
+	const PostProcessor *post;
+	BandLayout layout;
+
+	// The rows of the band, [min_y, max_y), and how far FXAA's output goes past them for the blur.
+	int min_y;
+	int max_y;
+	int blur_rows;
+
+	u32 *input;
+	u8 *luma;
+	u32 *antialiased;
+	u16 *blurred;
+};
+
+// Rows of each run from the first row they're needed for, so they can be addressed by the row in the buffer.
+static inline u32 *input_row(const Band &band, int y) {
+	return &band.input[(size_t)(y - (band.min_y - APRON_ROWS)) * band.layout.color_stride];
+}
+
+static inline u8 *luma_row(const Band &band, int y) {
+	return &band.luma[(size_t)(y - (band.min_y - BLUR_RADIUS - 1)) * band.layout.luma_stride + 16];
+}
+
+static inline u32 *antialiased_row(const Band &band, int y) {
+	return &band.antialiased[(size_t)(y - (band.min_y - BLUR_RADIUS)) * band.layout.color_stride];
+}
+
+// Bilinear, with x and y in pixels and pixel centers on the integers. Never reaches more than FXAA_APRON_ROWS
+// away from the pixel it's for, which input_row has.
+static void sample_bilinear(const Band &band, f32 x, f32 y, f32 *color) {
+	auto x0 = (int)floorf(x);
+	auto y0 = (int)floorf(y);
+	auto weight_x = x - x0;
+	auto weight_y = y - y0;
+	auto width = band.post->width;
+
+	auto left = clamp(x0, 0, width - 1);
+	auto right = clamp(x0 + 1, 0, width - 1);
+	auto top = input_row(band, y0);
+	auto bottom = input_row(band, y0 + 1);
+
+	u32 pixels[4] = { top[left], top[right], bottom[left], bottom[right] };
+	f32 weights[4] = { (1 - weight_x) * (1 - weight_y), weight_x * (1 - weight_y), (1 - weight_x) * weight_y, weight_x * weight_y };
+
+	color[0] = color[1] = color[2] = 0;
+	for (auto index = 0; index < 4; ++index) {
+		color[0] += weights[index] * ((pixels[index] >> 16) & 0xFF);
+		color[1] += weights[index] * ((pixels[index] >> 8) & 0xFF);
+		color[2] += weights[index] * (pixels[index] & 0xFF);
+	}
+}
+
+// The blend for one pixel that's on an edge. The luma of the corners around it says which way the edge runs,
+// and the pixel becomes the average of a couple of taps along it, or four if that isn't too far out of range.
+static u32 fxaa_pixel(const Band &band, int x, int y) {
+	auto width = band.post->width;
+	auto above = luma_row(band, y - 1);
+	auto here = luma_row(band, y);
+	auto below = luma_row(band, y + 1);
+
+	auto left = max(x - 1, 0);
+	auto right = min(x + 1, width - 1);
+
+	auto luma_nw = above[left] / 255.0f;
+	auto luma_ne = above[right] / 255.0f;
+	auto luma_sw = below[left] / 255.0f;
+	auto luma_se = below[right] / 255.0f;
+	auto luma_m = here[x] / 255.0f;
+
+	auto luma_min = min(luma_m, min(min(luma_nw, luma_ne), min(luma_sw, luma_se)));
+	auto luma_max = max(luma_m, max(max(luma_nw, luma_ne), max(luma_sw, luma_se)));
+
+	auto direction_x = -((luma_nw + luma_ne) - (luma_sw + luma_se));
+	auto direction_y = (luma_nw + luma_sw) - (luma_ne + luma_se);
+
+	auto reduce = max((luma_nw + luma_ne + luma_sw + luma_se) * 0.25f * FXAA_REDUCE_MUL, FXAA_REDUCE_MIN);
+	auto scale = 1 / (min(fabsf(direction_x), fabsf(direction_y)) + reduce);
+	direction_x = clamp(direction_x * scale, (f32)-FXAA_SPAN_MAX, (f32)FXAA_SPAN_MAX);
+	direction_y = clamp(direction_y * scale, (f32)-FXAA_SPAN_MAX, (f32)FXAA_SPAN_MAX);
+
+	f32 near_a[3], near_b[3], far_a[3], far_b[3];
+	sample_bilinear(band, x + direction_x * (1.0f / 3 - 0.5f), y + direction_y * (1.0f / 3 - 0.5f), near_a);
+	sample_bilinear(band, x + direction_x * (2.0f / 3 - 0.5f), y + direction_y * (2.0f / 3 - 0.5f), near_b);
+	sample_bilinear(band, x - direction_x * 0.5f, y - direction_y * 0.5f, far_a);
+	sample_bilinear(band, x + direction_x * 0.5f, y + direction_y * 0.5f, far_b);
+
+	f32 two_taps[3], four_taps[3];
+	for (auto channel = 0; channel < 3; ++channel) {
+		two_taps[channel] = 0.5f * (near_a[channel] + near_b[channel]);
+		four_taps[channel] = 0.5f * two_taps[channel] + 0.25f * (far_a[channel] + far_b[channel]);
+	}
+
+	// The far taps can land across a different edge. If they pull the luma out of what's around the pixel, they did.
+	auto luma_four = luma_of(four_taps[0], four_taps[1], four_taps[2]) / 255;
+	auto result = (luma_four < luma_min || luma_four > luma_max) ? two_taps : four_taps;
+
+	return 0xFF000000 | ((u32)(result[0] + 0.5f) << 16) | ((u32)(result[1] + 0.5f) << 8) | (u32)(result[2] + 0.5f);
+}
+
+// The FXAA output for row y. The comparison with the neighbours is sixteen pixels at a time, and most of them
+// come out under the threshold and get copied as they are.
+static void fxaa_row(const Band &band, int y) {
+	auto width = band.post->width;
+	auto above = luma_row(band, y - 1);
+	auto here = luma_row(band, y);
+	auto below = luma_row(band, y + 1);
+	auto source = input_row(band, y);
+	auto destination = antialiased_row(band, y);
+
+	auto low_bits = _mm_set1_epi8(0xFF >> FXAA_EDGE_SHIFT);
+	auto edge_min = _mm_set1_epi8((char)FXAA_EDGE_MIN);
+
+	for (auto x = 0; x < width; x += 16) {
+		auto middle = _mm_loadu_si128((const __m128i *)&here[x]);
+		auto north = _mm_loadu_si128((const __m128i *)&above[x]);
+		auto south = _mm_loadu_si128((const __m128i *)&below[x]);
+		auto west = _mm_loadu_si128((const __m128i *)&here[x - 1]);
+		auto east = _mm_loadu_si128((const __m128i *)&here[x + 1]);
+
+		auto luma_max = _mm_max_epu8(_mm_max_epu8(_mm_max_epu8(north, south), _mm_max_epu8(west, east)), middle);
+		auto luma_min = _mm_min_epu8(_mm_min_epu8(_mm_min_epu8(north, south), _mm_min_epu8(west, east)), middle);
+		auto range = _mm_subs_epu8(luma_max, luma_min);
+
+		// There's no byte shift, so shift the words and mask off what came down from the byte above.
+		auto threshold = _mm_max_epu8(_mm_and_si128(_mm_srli_epi16(luma_max, FXAA_EDGE_SHIFT), low_bits), edge_min);
+
+		// range >= threshold exactly when taking range from threshold bottoms out at zero.
+		unsigned long edges = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(threshold, range), _mm_setzero_si128()));
+
+		auto count = min(16, width - x);
+		memcpy(&destination[x], &source[x], count * sizeof(u32));
+
+		edges &= (1 << count) - 1;
+		while (edges) {
+			unsigned long lane;
+			_BitScanForward(&lane, edges);
+			edges &= edges - 1;
+			destination[x + lane] = fxaa_pixel(band, x + lane, y);
+		}
+	}
+}
+
+static void luma_row_from_input(const Band &band, int y) {
+	auto width = band.post->width;
+	auto source = input_row(band, y);
+	auto destination = luma_row(band, y);
+
+	auto x = 0;
+	for (; x + 16 <= width; x += 16) {
+		auto a = luma4(_mm_loadu_si128((const __m128i *)&source[x]));
+		auto b = luma4(_mm_loadu_si128((const __m128i *)&source[x + 4]));
+		auto c = luma4(_mm_loadu_si128((const __m128i *)&source[x + 8]));
+		auto d = luma4(_mm_loadu_si128((const __m128i *)&source[x + 12]));
+		_mm_storeu_si128((__m128i *)&destination[x], _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+
+	for (; x < width; ++x) {
+		auto pixel = source[x];
+		destination[x] = (u8)((((pixel >> 16) & 0xFF) * LUMA_RED + ((pixel >> 8) & 0xFF) * LUMA_GREEN + (pixel & 0xFF) * LUMA_BLUE) >> 8);
+	}
+
+	// The edge pixels again past both ends, for the neighbours of the first and last, and for the loads that
+	// run past the end of the row.
+	memset(destination - 16, destination[0], 16);
+	memset(destination + width, destination[width - 1], band.layout.luma_stride - 16 - width);
+}
+
+// The unsharp mask for row y, from the antialiased rows, into the buffer.
+static void sharpen_row(const Band &band, int y, u32 *destination) {
+	auto width = band.post->width;
+	auto height = band.post->height;
+	auto zero = _mm_setzero_si128();
+
+	// Straight down first, into blurred, for the pixels of the row and two more either side.
+	const u8 *rows[5];
+	for (auto offset = -BLUR_RADIUS; offset <= BLUR_RADIUS; ++offset) {
+		rows[offset + BLUR_RADIUS] = (const u8 *)antialiased_row(band, clamp(y + offset, 0, height - 1));
+	}
+
+	auto blurred = band.blurred + BLUR_RADIUS * 4;
+	for (auto x = 0; x < band.layout.color_stride; x += 2) {
+		auto load = [&](int row) { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&rows[row][x * 4]), zero); };
+
+		auto sum = _mm_add_epi16(load(0), load(4));
+		sum = _mm_add_epi16(sum, _mm_slli_epi16(_mm_add_epi16(load(1), load(3)), 2));
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(load(2), _mm_set1_epi16(6)));
+		_mm_storeu_si128((__m128i *)&blurred[x * 4], sum);
+	}
+
+	for (auto offset = 1; offset <= BLUR_RADIUS; ++offset) {
+		memcpy(&blurred[-offset * 4], &blurred[0], 4 * sizeof(u16));
+		memcpy(&blurred[(width - 1 + offset) * 4], &blurred[(width - 1) * 4], 4 * sizeof(u16));
+	}
+
+	// Then across, which takes the weights to 256 in all, so the blur is the sum shifted down by 8. Each weighted
+	// sum is at most 255 * 256, which just fits in 16 bits unsigned. The difference from the blur is at most 255
+	// either way and the amount at most 128, so that fits signed.
+	auto amount = _mm_set1_epi16(band.post->sharpen_amount);
+	auto center_row = rows[BLUR_RADIUS];
+
+	for (auto x = 0; x < width; x += 2) {
+		auto at = [&](int offset) { return _mm_loadu_si128((const __m128i *)&blurred[(x + offset) * 4]); };
+
+		auto sum = _mm_add_epi16(at(-2), at(2));
+		sum = _mm_add_epi16(sum, _mm_slli_epi16(_mm_add_epi16(at(-1), at(1)), 2));
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(at(0), _mm_set1_epi16(6)));
+		auto blur = _mm_srli_epi16(sum, 8);
+
+		auto center = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&center_row[x * 4]), zero);
+		auto detail = _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(center, blur), amount), 4);
+		auto result = _mm_packus_epi16(_mm_add_epi16(center, detail), zero);
+
+		// Anything past the end of the row belongs to the next row, which might be another band's.
+		if (x + 1 < width) {
+			_mm_storel_epi64((__m128i *)&destination[x], result);
+		} else {
+			destination[x] = (u32)_mm_cvtsi128_si32(result);
+		}
+	}
+}
+
+static void post_band_job(void *data, int first, int last, int worker_index) {
+	auto &job = *(PostJob *)data;
+	auto &post = *job.post;
+	auto &buffer = *job.buffer;
+
+	Band band = {};
+	band.post = &post;
+	band.layout = band_layout(post.width);
+
+	auto scratch = post.scratch + post.scratch_size * worker_index;
+	band.input = (u32 *)(scratch + band.layout.input_offset);
+	band.luma = scratch + band.layout.luma_offset;
+	band.antialiased = (u32 *)(scratch + band.layout.antialiased_offset);
+	band.blurred = (u16 *)(scratch + band.layout.blurred_offset);
+
+	auto fxaa = post.settings.fxaa;
+	auto sharpen = post.sharpen_amount > 0;
+
+	for (auto index = first; index < last; ++index) {
+		TRACE_SCOPE("post band");
+
+		band.min_y = index * POST_BAND_ROWS;
+		band.max_y = min(band.min_y + POST_BAND_ROWS, post.height);
+		band.blur_rows = sharpen ? BLUR_RADIUS : 0;
+
+		// What the later steps need past the band. Rows past the top and bottom of the buffer repeat the edge rows.
+		auto apron = fxaa ? FXAA_APRON_ROWS + band.blur_rows : band.blur_rows;
+
+		for (auto y = band.min_y - apron; y < band.max_y + apron; ++y) {
+			auto source_y = clamp(y, 0, post.height - 1);
+
+			const u32 *source;
+			if (source_y < band.min_y) {
+				source = seam_row(post, index, source_y);
+			} else if (source_y >= band.max_y) {
+				source = seam_row(post, index + 1, source_y);
+			} else {
+				source = buffer_row(buffer, source_y);
+			}
+
+			auto destination = input_row(band, y);
+			if (post.identity_curve) {
+				memcpy(destination, source, post.width * sizeof(u32));
+			} else {
+				for (auto x = 0; x < post.width; ++x) {
+					destination[x] = apply_curve(post.curve, source[x]);
+				}
+			}
+		}
+
+		// The rows FXAA writes, clamped to the buffer, since the blur clamps the same way.
+		auto first_row = max(band.min_y - band.blur_rows, 0);
+		auto last_row = min(band.max_y + band.blur_rows, post.height);
+
+		if (fxaa) {
+			for (auto y = first_row - 1; y < last_row + 1; ++y) {
+				luma_row_from_input(band, y);
+			}
+
+			for (auto y = first_row; y < last_row; ++y) {
+				fxaa_row(band, y);
+			}
+		} else {
+			for (auto y = first_row; y < last_row; ++y) {
+				memcpy(antialiased_row(band, y), input_row(band, y), post.width * sizeof(u32));
+			}
+		}
+
+		for (auto y = band.min_y; y < band.max_y; ++y) {
+			if (sharpen) {
+				sharpen_row(band, y, buffer_row(buffer, y));
+			} else {
+				memcpy(buffer_row(buffer, y), antialiased_row(band, y), post.width * sizeof(u32));
+			}
+		}
+	}
+}
+
+void post_process(JobSystem &jobs, PostProcessor &post, Backbuffer &buffer, void *memory) {
+	if (!post.enabled) return;
+
+	TRACE_SCOPE("post_process");
+
+	assert(buffer.width == post.width && buffer.height == post.height && buffer.bytes_per_pixel == 4);
+	assert(memory && ((size_t)memory & 63) == 0);
+
+	post.seams = (u32 *)memory;
+	post.scratch = (u8 *)memory + post.seams_size;
+
+	PostJob job = { &post, &buffer };
+	parallel_for(jobs, post.band_count, 8, copy_seams_job, &job);
+	parallel_for(jobs, post.band_count, 1, post_band_job, &job);
+
+	post.seams = 0;
+	post.scratch = 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "types.h"
+#include "render.h"
+#include "jobs.h"
+
+// Post-processing over the finished backbuffer, after the resolve (or the upscale) and before it goes to
+// the present thread. Three things, in this order, any of them optional:
+//   - A tone and gamma curve, as a lookup table on each of red, green and blue.
+//   - FXAA. Each pixel's luma gets compared with its neighbours', sixteen pixels at a time, and only the ones
+//     on an edge with enough contrast get blended along it. That's a few percent of the pixels, so it
+//     costs a fraction of what drawing at a higher resolution would.
+//   - Sharpening, as an unsharp mask over a separable 5 tap binomial blur, done in 16 bit fixed point eight
+//     channels at a time.
+//
+// All three are done together, a band of POST_BAND_ROWS rows per job. Each band gets copied into its worker's
+// scratch once, goes through everything there, and gets written back once. The curve and FXAA also work on a
+// few rows past the band's edges, since the steps after them need those rows, and those rows belong to the
+// neighbouring bands, which are being overwritten at the same time. So before the bands start, the rows on either
+// side of every boundary get copied aside, and bands read their neighbours' rows from those copies.
+
+// A 1024 wide band is 128K of color. With the scratch that goes with it, it stays in a core's own cache.
+const int POST_BAND_ROWS = 32;
+
+struct PostSettings {
+	// In stops. Anything above 0 brightens and rolls off towards white instead of clipping.
+	f32 exposure;
+
+	// On top of the usual 2.2. Above 1 brightens the midtones, below 1 darkens them.
+	f32 gamma;
+
+	bool fxaa;
+
+	// How much of the difference from the blurred image gets added back. 0 is off, 0.5 is subtle, 2 is a lot.
+	// Goes in steps of 1/16, up to 8.
+	f32 sharpen;
+};
+
+struct PostProcessor {
+	PostSettings settings;
+	bool enabled;
+
+	// Same for red, green and blue. identity_curve when it wouldn't change anything.
+	u8 curve[256];
+	bool identity_curve;
+
+	// sharpen in steps of 1/16.
+	s16 sharpen_amount;
+
+	int width;
+	int height;
+	int band_count;
+
+	// The memory post_process gets is the seams, copies of the rows on either side of each boundary between
+	// bands, and then scratch_size for each worker, so each band has somewhere to work without allocating.
+	// The pointers are only set while post_process runs.
+	size_t seams_size;
+	size_t scratch_size;
+	int worker_count;
+
+	u32 *seams;
+	u8 *scratch;
+};
+
+// For a width by height backbuffer, with room for every worker in jobs. It doesn't hold on to any memory
+// between frames. main gets what post_process needs from the frame graph, where it shares with whatever
+// the passes before it used.
+PostProcessor make_post_processor(const PostSettings &settings, int width, int height, const JobSystem &jobs);
+
+// How much memory post_process needs. 0 with nothing turned on in the settings.
+size_t post_memory_size(const PostProcessor &post);
+
+// buffer has to be the size given to make_post_processor, and memory post_memory_size bytes, 64 byte aligned.
+// Whatever is in memory gets overwritten.
+void post_process(JobSystem &jobs, PostProcessor &post, Backbuffer &buffer, void *memory);
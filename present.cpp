@@ -0,0 +1,84 @@
+#include <windows.h>
+#include <assert.h>
+
+#include "present.h"
+#include "trace.h"
+
+static DWORD WINAPI present_thread_proc(LPVOID parameter) {
+	auto queue = (PresentQueue *)parameter;
+	TRACE_THREAD_NAME("present");
+
+	for (;;) {
+		WaitForSingleObject(queue->ready_frames, INFINITE);
+
+		// Every submit releases ready_frames once and stop releases it one more time
+		// after the last submit. So if everything submitted has been presented, this
+		// wake up was the stop request.
+		if (queue->presented == queue->submitted) break;
+
+		auto &frame = queue->frames[queue->next_present];
+		{
+			TRACE_SCOPE("present");
+			queue->present_proc(frame, queue->user_data);
+		}
+
+		queue->next_present = (queue->next_present + 1) % queue->frame_count;
+		queue->presented++;
+
+		ReleaseSemaphore(queue->free_frames, 1, 0);
+	}
+
+	return 0;
+}
+
+bool start_present_queue(PresentQueue &queue, int frame_count, int width, int height, PresentProc present_proc, void *user_data) {
+	assert(frame_count > 0 && frame_count <= MAX_FRAMES_IN_FLIGHT);
+
+	queue = {};
+	queue.frame_count = frame_count;
+	queue.present_proc = present_proc;
+	queue.user_data = user_data;
+
+	for (auto index = 0; index < frame_count; ++index) {
+		queue.frames[index] = make_backbuffer(width, height);
+		if (!queue.frames[index].memory) return false;
+	}
+
+	queue.free_frames = CreateSemaphore(0, frame_count, frame_count, 0);
+	queue.ready_frames = CreateSemaphore(0, 0, frame_count + 1, 0);
+	if (!queue.free_frames || !queue.ready_frames) return false;
+
+	queue.thread = CreateThread(0, 0, present_thread_proc, &queue, 0, 0);
+	return queue.thread != 0;
+}
+
+Backbuffer &acquire_frame(PresentQueue &queue) {
+	TRACE_SCOPE("acquire_frame");
+	WaitForSingleObject(queue.free_frames, INFINITE);
+	return queue.frames[queue.next_acquire];
+}
+
+void submit_frame(PresentQueue &queue) {
+	queue.next_acquire = (queue.next_acquire + 1) % queue.frame_count;
+
+	// The increment is a full barrier, so the frame's pixels are visible before the present thread can wake up for it.
+	InterlockedIncrement(&queue.submitted);
+	ReleaseSemaphore(queue.ready_frames, 1, 0);
+}
+
+void stop_present_queue(PresentQueue &queue) {
+	if (queue.thread) {
+		ReleaseSemaphore(queue.ready_frames, 1, 0);
+		WaitForSingleObject(queue.thread, INFINITE);
+		CloseHandle(queue.thread);
+	}
+
+	if (queue.free_frames) CloseHandle(queue.free_frames);
+	if (queue.ready_frames) CloseHandle(queue.ready_frames);
+
+	for (auto index = 0; index < queue.frame_count; ++index) {
+		free_backbuffer(queue.frames[index]);
+	}
+
+	queue = {};
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+#include "render.h"
+
+const int MAX_FRAMES_IN_FLIGHT = 3;
+
+// Runs on the present thread. The render thread won't touch the buffer again
+// until this returns, so it's free to blit, copy, or encode it however it likes.
+typedef void (*PresentProc)(Backbuffer &buffer, void *user_data);
+
+// A ring of backbuffers shared between the render thread and a present thread.
+// The render thread acquires a frame, draws into it, and submits it. The present
+// thread hands submitted frames to present_proc in order and then gives them back.
+// That way frame N can be presented while frame N + 1 is being rasterized.
+//
+// The two semaphores are the fences. free_frames counts the frames the render thread
+// is allowed to draw into, and ready_frames counts the frames waiting to be presented.
+// A frame only goes back into free_frames after present_proc is done with it.
+struct PresentQueue {
+	Backbuffer frames[MAX_FRAMES_IN_FLIGHT];
+	int frame_count;
+
+	HANDLE free_frames;
+	HANDLE ready_frames;
+
+	// Only touched by the render thread.
+	int next_acquire;
+
+	// Only touched by the present thread.
+	int next_present;
+	LONG presented;
+
+	// The present thread compares this against presented to tell a stop request
+	// apart from a submitted frame.
+	volatile LONG submitted;
+
+	PresentProc present_proc;
+	void *user_data;
+
+	HANDLE thread;
+};
+
+bool start_present_queue(PresentQueue &queue, int frame_count, int width, int height, PresentProc present_proc, void *user_data);
+
+// Blocks until a frame is no longer being presented.
+Backbuffer &acquire_frame(PresentQueue &queue);
+void submit_frame(PresentQueue &queue);
+
+// Presents whatever has already been submitted, then joins the present thread.
+void stop_present_queue(PresentQueue &queue);
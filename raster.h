@@ -0,0 +1,684 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "triangle.h"
+#include "render.h"
+#include "color.h"
+#include "color_math.h"
+#include "depth.h"
+#include "stats.h"
+#include "trace.h"
+#include "wavefront.h"
+#include "jobs.h"
+#include "arena.h"
+#include "utils.h"
+
+// I still don't really like templates, but this is the one place they earn their keep.
+// Each shader is its own type and draw_triangle gets stamped out once per shader, so
+// the varying loops, the depth write, and whatever the fragment stage does (or doesn't
+// do) all get resolved by the compiler instead of being checked for every pixel.
+//
+// A shader looks like this:
+//
+//    struct SomeShader {
+//        // How many floats the vertex stage hands to the fragment stage.
+//        // They're interpolated with the barycentric coefficients.
+//        enum { VARYING_COUNT = 3 };
+//
+//        // Whether fragments that pass the depth test update the depth buffer.
+//        enum { WRITES_DEPTH = 1 };
+//
+//        // Called once per face, before the vertex stage. For anything that needs the
+//        // whole triangle, like a face normal. Most shaders leave it empty.
+//        void begin_triangle(const MeshVertex corners[3]);
+//
+//        // Returns the position in object space. The draw call applies its own transform
+//        // afterwards, which is what lets the same shader get used for instances and views.
+//        Vec4f vertex(const MeshVertex &in, f32 *varyings);
+//
+//        // Returns false to discard the fragment. Discarded fragments don't write depth either.
+//        // The final pixel is color scaled by light, which is 8.8 fixed point (see color_math.h).
+//        // The scaling and the write happen a whole tile row at a time after the fragments are shaded.
+//        bool fragment(const f32 *varyings, Color &color, FixedLight &light);
+//    };
+
+// One corner of a face, with everything pulled out of the WavefrontObj index lists.
+struct MeshVertex {
+	Vec3f position;
+	Vec3f normal;
+	Vec2f uv;
+
+	// Occlusion and direct light from the bake, or wide open and unlit without one.
+	Vec2f baked;
+};
+
+inline MeshVertex fetch_vertex(const WavefrontObj &obj, const Face &face, int corner) {
+	MeshVertex result;
+	result.position = obj.verts[face.vertex_indices.dim[corner]].v3;
+	result.normal = obj.vert_normals[face.normal_indices.dim[corner]];
+	result.uv = obj.text_coords[face.texture_indices.dim[corner]].v2;
+	result.baked = obj.baked ? obj.baked[face.vertex_indices.dim[corner]] : Vec2f{ 1, 0 };
+	return result;
+}
+
+enum DepthTest {
+	// The normal forward test. Passes if the fragment is nearer than what's stored.
+	DEPTH_TEST_NEARER,
+
+	// For the shading pass after a depth pre-pass. The pre-pass already left the nearest depth
+	// for every pixel in the buffer, so only the fragment that put it there passes.
+	DEPTH_TEST_EQUAL,
+};
+
+// Arrays can't have zero length, but VARYING_COUNT can be zero.
+#define VARYING_STORAGE(Shader) ((Shader::VARYING_COUNT) > 0 ? (Shader::VARYING_COUNT) : 1)
+
+// The part of draw_triangle after setup, for callers that need to adjust the setup first (see clip_rows).
+// Returns how many fragments got shaded.
+template <typename Shader, DepthTest depth_test = DEPTH_TEST_NEARER>
+int rasterize_triangle(RenderTarget &target, Shader &shader, const TriangleSetup &setup, const f32 varyings[3][VARYING_STORAGE(Shader)]) {
+	auto fragments_shaded = 0;
+
+	// Kept in locals and added to the thread's PipelineStats once at the end.
+	auto pixels_tested = 0;
+	auto pixels_inside = 0;
+	auto depth_failed = 0;
+	auto fragments_discarded = 0;
+	auto pixels_written = 0;
+
+	// Walk the bounding box a tile at a time so the color and depth for the pixels being
+	// tested stay in cache until we're done with them.
+	for (auto tile_y = setup.min_y / TILE_SIZE; tile_y <= setup.max_y / TILE_SIZE; ++tile_y) {
+		auto tile_min_y = max(setup.min_y, tile_y * TILE_SIZE);
+		auto tile_max_y = min(setup.max_y, tile_y * TILE_SIZE + TILE_SIZE - 1);
+
+		for (auto tile_x = setup.min_x / TILE_SIZE; tile_x <= setup.max_x / TILE_SIZE; ++tile_x) {
+			auto tile_min_x = max(setup.min_x, tile_x * TILE_SIZE);
+			auto tile_max_x = min(setup.max_x, tile_x * TILE_SIZE + TILE_SIZE - 1);
+			if (target.tile_mask && !target.tile_mask[tile_y * target.tiles_x + tile_x]) continue;
+
+			auto &tile = target.tiles[tile_y * target.tiles_x + tile_x];
+			auto overdraw = target.overdraw ? &target.overdraw[(tile_y * target.tiles_x + tile_x) * TILE_PIXELS] : 0;
+
+			pixels_tested += (tile_max_x - tile_min_x + 1) * (tile_max_y - tile_min_y + 1);
+
+			for (auto y = tile_min_y; y <= tile_max_y; ++y) {
+				auto row_0 = edge_row(setup, 0, y);
+				auto row_1 = edge_row(setup, 1, y);
+				auto row_2 = edge_row(setup, 2, y);
+				auto row_depth = depth_row(setup, y);
+
+				// Shade the row first and write it all at once. Only pixels with their bit in coverage get written.
+				Color texels[TILE_SIZE];
+				FixedLight lights[TILE_SIZE];
+				auto coverage = 0;
+
+				for (auto x = tile_min_x; x <= tile_max_x; ++x) {
+					auto edge_0 = edge_at(setup, 0, row_0, x);
+					auto edge_1 = edge_at(setup, 1, row_1, x);
+					auto edge_2 = edge_at(setup, 2, row_2, x);
+					if (edge_0 < 0 || edge_1 < 0 || edge_2 < 0) continue;
+					++pixels_inside;
+
+					auto depth = depth_at(setup, row_depth, x);
+
+					auto pixel_index = tile_pixel_index(x, y);
+					if ((depth_test == DEPTH_TEST_NEARER && tile.depth[pixel_index] >= depth) ||
+						(depth_test == DEPTH_TEST_EQUAL && tile.depth[pixel_index] != depth)) {
+						++depth_failed;
+						continue;
+					}
+
+					// The edge functions are the barycentric coefficients, just scaled by twice the area. And the barycentric
+					// coefficients are literally the weights we want for everything else. "What percentage of each vertex is a given point?"
+					auto barycentric_coefficients = Vec3f{ edge_0, edge_1, edge_2 } * setup.inverse_double_area;
+
+					f32 interpolated[VARYING_STORAGE(Shader)];
+					for (auto index = 0; index < Shader::VARYING_COUNT; ++index) {
+						interpolated[index] =
+							barycentric_coefficients.x * varyings[0][index] +
+							barycentric_coefficients.y * varyings[1][index] +
+							barycentric_coefficients.z * varyings[2][index];
+					}
+
+					auto lane = x % TILE_SIZE;
+					++fragments_shaded;
+					if (overdraw) overdraw[pixel_index]++;
+
+					if (!shader.fragment(interpolated, texels[lane], lights[lane])) {
+						++fragments_discarded;
+						continue;
+					}
+
+					// Bounds were already clamped in setup, so this can skip set_pixel's checks.
+					// After a pre-pass the depth is already there.
+					if (Shader::WRITES_DEPTH && depth_test == DEPTH_TEST_NEARER) tile.depth[pixel_index] = depth;
+					coverage |= 1 << lane;
+					++pixels_written;
+				}
+
+				if (coverage) modulate_row(&tile.color[tile_pixel_index(0, y)], texels, lights, coverage);
+			}
+		}
+	}
+
+	auto &stats = thread_pipeline_stats();
+	stats.pixels_tested += pixels_tested;
+	stats.pixels_inside += pixels_inside;
+	stats.depth_passed += pixels_inside - depth_failed;
+	stats.depth_failed += depth_failed;
+	stats.fragments_shaded += fragments_shaded;
+	stats.fragments_discarded += fragments_discarded;
+	stats.pixels_written += pixels_written;
+
+	return fragments_shaded;
+}
+
+// Tiny triangles. With a dense mesh, or a mesh far away, most triangles cover a pixel or two, and for those
+// rasterize_triangle is mostly overhead: the walk over tiles, the row buffers, a modulate_row for a single pixel.
+// Anything whose bounding box fits in MICRO_TRIANGLE_SIZE square goes through rasterize_micro_triangle instead,
+// which tests each row of the box with one SSE compare per edge and shades the pixels that are inside one at
+// a time. It does the same math as rasterize_triangle, so the pixels come out exactly the same.
+const int MICRO_TRIANGLE_SIZE = 4;
+
+inline bool is_micro_triangle(const RenderTarget &target, const TriangleSetup &setup) {
+	// Masked targets go the long way, since the mask is per tile and these don't look at tiles.
+	return setup.max_x - setup.min_x < MICRO_TRIANGLE_SIZE && setup.max_y - setup.min_y < MICRO_TRIANGLE_SIZE && !target.tile_mask;
+}
+
+// Adds to stats instead of the thread's PipelineStats, so a batch can add them all up first.
+template <typename Shader, DepthTest depth_test = DEPTH_TEST_NEARER>
+int rasterize_micro_triangle(RenderTarget &target, Shader &shader, const TriangleSetup &setup, const f32 varyings[3][VARYING_STORAGE(Shader)], PipelineStats &stats) {
+	auto width = setup.max_x - setup.min_x + 1;
+	auto lanes = (1 << width) - 1;
+	auto fragments_shaded = 0;
+
+	// x - origin_x for each lane. They're small integers, so this is exactly what edge_at converts.
+	auto lane_x = _mm_add_ps(_mm_set1_ps((f32)(setup.min_x - setup.origin_x)), _mm_set_ps(3, 2, 1, 0));
+	auto zero = _mm_setzero_ps();
+
+	stats.pixels_tested += width * (setup.max_y - setup.min_y + 1);
+
+	for (auto y = setup.min_y; y <= setup.max_y; ++y) {
+		// edge_at's multiply and add, four pixels at a time.
+		f32 edges[3][4];
+		auto inside = lanes;
+		for (auto edge = 0; edge < 3; ++edge) {
+			auto values = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup.edge_a[edge]), lane_x), _mm_set1_ps(edge_row(setup, edge, y)));
+			_mm_storeu_ps(edges[edge], values);
+			inside &= ~_mm_movemask_ps(_mm_cmplt_ps(values, zero));
+		}
+
+		if (!inside) continue;
+		auto row_depth = depth_row(setup, y);
+
+		for (auto lane = 0; lane < width; ++lane) {
+			if (!(inside & (1 << lane))) continue;
+			stats.pixels_inside++;
+
+			auto x = setup.min_x + lane;
+			auto depth = depth_at(setup, row_depth, x);
+
+			auto tile = tile_index(target.tiles_x, x, y);
+			auto pixel_index = tile_pixel_index(x, y);
+			auto &depth_stored = target.tiles[tile].depth[pixel_index];
+			if ((depth_test == DEPTH_TEST_NEARER && depth_stored >= depth) ||
+				(depth_test == DEPTH_TEST_EQUAL && depth_stored != depth)) {
+				stats.depth_failed++;
+				continue;
+			}
+			stats.depth_passed++;
+
+			auto barycentric_coefficients = Vec3f{ edges[0][lane], edges[1][lane], edges[2][lane] } * setup.inverse_double_area;
+
+			f32 interpolated[VARYING_STORAGE(Shader)];
+			for (auto index = 0; index < Shader::VARYING_COUNT; ++index) {
+				interpolated[index] =
+					barycentric_coefficients.x * varyings[0][index] +
+					barycentric_coefficients.y * varyings[1][index] +
+					barycentric_coefficients.z * varyings[2][index];
+			}
+
+			++fragments_shaded;
+			if (target.overdraw) target.overdraw[tile * TILE_PIXELS + pixel_index]++;
+
+			Color texel;
+			FixedLight light;
+			if (!shader.fragment(interpolated, texel, light)) {
+				stats.fragments_discarded++;
+				continue;
+			}
+
+			if (Shader::WRITES_DEPTH && depth_test == DEPTH_TEST_NEARER) depth_stored = depth;
+			target.tiles[tile].color[pixel_index] = pack_argb(modulate(texel, light));
+			stats.pixels_written++;
+		}
+	}
+
+	stats.fragments_shaded += fragments_shaded;
+	return fragments_shaded;
+}
+
+inline void add_raster_stats(const PipelineStats &local) {
+	auto &stats = thread_pipeline_stats();
+	stats.pixels_tested += local.pixels_tested;
+	stats.pixels_inside += local.pixels_inside;
+	stats.depth_passed += local.depth_passed;
+	stats.depth_failed += local.depth_failed;
+	stats.fragments_shaded += local.fragments_shaded;
+	stats.fragments_discarded += local.fragments_discarded;
+	stats.pixels_written += local.pixels_written;
+}
+
+// Tiny triangles waiting to be rasterized together, so the per-call work (and the stats) is paid once for
+// the lot. Each keeps a copy of the shader as it was after its begin_triangle, for shaders like FlatShader.
+const int MICRO_BATCH_TRIANGLES = 32;
+
+template <typename Shader>
+struct MicroBatch {
+	TriangleSetup setups[MICRO_BATCH_TRIANGLES];
+	f32 varyings[MICRO_BATCH_TRIANGLES][3][VARYING_STORAGE(Shader)];
+	Shader shaders[MICRO_BATCH_TRIANGLES];
+	int count;
+};
+
+// Returns how many fragments got shaded.
+template <typename Shader, DepthTest depth_test = DEPTH_TEST_NEARER>
+int flush_micro_batch(RenderTarget &target, MicroBatch<Shader> &batch) {
+	if (!batch.count) return 0;
+
+	PipelineStats stats = {};
+	auto fragments_shaded = 0;
+	for (auto index = 0; index < batch.count; ++index) {
+		fragments_shaded += rasterize_micro_triangle<Shader, depth_test>(target, batch.shaders[index], batch.setups[index], batch.varyings[index], stats);
+	}
+
+	add_raster_stats(stats);
+	batch.count = 0;
+	return fragments_shaded;
+}
+
+// For draw loops. Tiny triangles go in the batch, and anything bigger flushes it before going through
+// rasterize_triangle, so everything still lands in the order it was submitted. Flush the batch at the end.
+// Returns how many fragments got shaded, which for batched triangles is whenever the batch gets flushed.
+template <typename Shader, DepthTest depth_test = DEPTH_TEST_NEARER>
+int submit_triangle(RenderTarget &target, MicroBatch<Shader> &batch, Shader &shader, const TriangleSetup &setup, const f32 varyings[3][VARYING_STORAGE(Shader)]) {
+	if (is_micro_triangle(target, setup)) {
+		auto fragments_shaded = batch.count == MICRO_BATCH_TRIANGLES ? flush_micro_batch<Shader, depth_test>(target, batch) : 0;
+
+		auto index = batch.count++;
+		batch.setups[index] = setup;
+		memcpy(batch.varyings[index], varyings, sizeof(batch.varyings[index]));
+		batch.shaders[index] = shader;
+		return fragments_shaded;
+	}
+
+	auto fragments_shaded = flush_micro_batch<Shader, depth_test>(target, batch);
+	return fragments_shaded + rasterize_triangle<Shader, depth_test>(target, shader, setup, varyings);
+}
+
+// Returns how many fragments got shaded.
+template <typename Shader, DepthTest depth_test = DEPTH_TEST_NEARER>
+int draw_triangle(RenderTarget &target, Shader &shader, const Triangle &triangle, const f32 varyings[3][VARYING_STORAGE(Shader)]) {
+	TriangleSetup setup;
+	auto set_up = setup_triangle(triangle, target.width, target.height, setup);
+	count_triangle(set_up);
+	if (!set_up) return 0;
+
+	if (is_micro_triangle(target, setup)) {
+		PipelineStats stats = {};
+		auto fragments_shaded = rasterize_micro_triangle<Shader, depth_test>(target, shader, setup, varyings, stats);
+		add_raster_stats(stats);
+		return fragments_shaded;
+	}
+
+	return rasterize_triangle<Shader, depth_test>(target, shader, setup, varyings);
+}
+
+// transform takes object space all the way to the screen, i.e. viewport * projection * model_view.
+// Returns how many fragments got shaded.
+template <typename Shader, DepthTest depth_test = DEPTH_TEST_NEARER>
+u64 draw_mesh(RenderTarget &target, const WavefrontObj &obj, Shader &shader, const Mat4f &transform) {
+	TRACE_SCOPE("draw_mesh");
+
+	u64 fragments_shaded = 0;
+	MicroBatch<Shader> batch;
+	batch.count = 0;
+
+	for (auto index = 0; index < obj.face_count; ++index) {
+		auto &face = obj.faces[index];
+
+		MeshVertex corners[] = {
+			fetch_vertex(obj, face, 0),
+			fetch_vertex(obj, face, 1),
+			fetch_vertex(obj, face, 2),
+		};
+
+		shader.begin_triangle(corners);
+
+		f32 varyings[3][VARYING_STORAGE(Shader)];
+		Vec3f screen[3];
+
+		for (auto corner = 0; corner < 3; ++corner) {
+			screen[corner] = project_to_vec3f(transform * shader.vertex(corners[corner], varyings[corner]));
+		}
+
+		Triangle triangle = { screen[0], screen[1], screen[2] };
+
+		TriangleSetup setup;
+		auto set_up = setup_triangle(triangle, target.width, target.height, setup);
+		count_triangle(set_up);
+		if (!set_up) continue;
+
+		fragments_shaded += submit_triangle<Shader, depth_test>(target, batch, shader, setup, varyings);
+	}
+
+	fragments_shaded += flush_micro_batch<Shader, depth_test>(target, batch);
+	return fragments_shaded;
+}
+
+// draw_mesh, but only the rows [min_y, max_y] of the target, for when the target is split between threads or
+// processes by rows. Triangles outside them are skipped before setup, and the ones that straddle the edge get
+// clip_rows, so every pixel comes out exactly like draw_mesh would have drawn it.
+// Returns how many fragments got shaded.
+template <typename Shader>
+u64 draw_mesh_rows(RenderTarget &target, const WavefrontObj &obj, Shader &shader, const Mat4f &transform, int min_y, int max_y) {
+	TRACE_SCOPE("draw_mesh_rows");
+
+	u64 fragments_shaded = 0;
+	MicroBatch<Shader> batch;
+	batch.count = 0;
+
+	for (auto index = 0; index < obj.face_count; ++index) {
+		auto &face = obj.faces[index];
+
+		MeshVertex corners[] = {
+			fetch_vertex(obj, face, 0),
+			fetch_vertex(obj, face, 1),
+			fetch_vertex(obj, face, 2),
+		};
+
+		shader.begin_triangle(corners);
+
+		f32 varyings[3][VARYING_STORAGE(Shader)];
+		Vec3f screen[3];
+
+		for (auto corner = 0; corner < 3; ++corner) {
+			screen[corner] = project_to_vec3f(transform * shader.vertex(corners[corner], varyings[corner]));
+		}
+
+		auto lowest = min(screen[0].y, min(screen[1].y, screen[2].y));
+		auto highest = max(screen[0].y, max(screen[1].y, screen[2].y));
+		if (highest < (f32)min_y || lowest >= (f32)(max_y + 1)) continue;
+
+		Triangle triangle = { screen[0], screen[1], screen[2] };
+
+		TriangleSetup setup;
+		auto set_up = setup_triangle(triangle, target.width, target.height, setup) && clip_rows(setup, min_y, max_y);
+		count_triangle(set_up);
+		if (!set_up) continue;
+
+		fragments_shaded += submit_triangle(target, batch, shader, setup, varyings);
+	}
+
+	fragments_shaded += flush_micro_batch(target, batch);
+	return fragments_shaded;
+}
+
+enum RenderMode {
+	// Shade as we go. Anything nearer than what's in the depth buffer gets shaded, even if
+	// something else covers it later, so back to front submission shades pixels over and over.
+	RENDER_FORWARD,
+
+	// Fill the depth buffer with the depth-only path first, then shade exactly one fragment per pixel.
+	// Whether that pays off depends on how much overdraw the scene has and how expensive the shader is.
+	//
+	// One difference: a fragment the shader discards still occludes things behind it, since the
+	// pre-pass has no idea what the shader will do. For a shader like GouraudShader, which discards
+	// surfaces facing away from the light, that means they come out as the clear color instead of
+	// showing whatever is behind them.
+	RENDER_DEPTH_PREPASS,
+};
+
+struct ShadingStats {
+	u64 fragments_shaded;
+	u64 pixels_covered;
+};
+
+// draw_mesh, but with a choice of how to handle overdraw. The target's depth has to be cleared
+// already, same as for draw_mesh. Returns how many fragments got shaded.
+template <typename Shader>
+u64 draw_mesh(RenderTarget &target, const WavefrontObj &obj, Shader &shader, const Mat4f &transform, RenderMode mode) {
+	if (mode == RENDER_DEPTH_PREPASS) {
+		TRACE_SCOPE("draw_mesh with pre-pass");
+		draw_mesh_depth(depth_view(target), obj, transform);
+		return draw_mesh<Shader, DEPTH_TEST_EQUAL>(target, obj, shader, transform);
+	}
+
+	return draw_mesh(target, obj, shader, transform);
+}
+
+// draw_mesh, spread over the job system. It goes in two steps, the same way draw_instances does:
+//
+//   - The faces get split into chunks, and each chunk's vertex stage, projection and setup run as a job.
+//     What comes out of that is kept for every triangle, along with the shader as it was after its
+//     begin_triangle.
+//   - Every triangle gets binned into the bands of tile rows it touches. Then each band is a job that
+//     rasterizes its bin in the order the faces came in, clipped to its rows. Nobody else writes its tiles,
+//     so there's nothing to lock, and every pixel comes out exactly like draw_mesh would have drawn it.
+//
+// With a depth pre-pass, each band does its depth-only pass and then its shading pass, from the same setups.
+//
+// The triangles and the bins are scratch space in frame_arena, given back before this returns. If they don't
+// fit, it's just draw_mesh on this thread. Returns how many fragments got shaded.
+const int MESH_SETUP_GRAIN = 256;
+
+template <typename Shader>
+struct BinnedTriangle {
+	TriangleSetup setup;
+	f32 varyings[3][VARYING_STORAGE(Shader)];
+	Shader shader;
+	bool set_up;
+};
+
+template <typename Shader>
+struct BinnedDraw {
+	RenderTarget *target;
+	const WavefrontObj *obj;
+	const Shader *shader;
+	Mat4f transform;
+	RenderMode mode;
+
+	BinnedTriangle<Shader> *triangles;
+
+	// Band n's triangles are bins[bin_starts[n]] up to bins[bin_starts[n + 1]].
+	int band_rows;
+	int band_count;
+	int *bin_starts;
+	int *bins;
+
+	volatile LONG64 fragments_shaded;
+};
+
+template <typename Shader>
+void set_up_mesh_triangles(void *data, int first, int last, int worker_index) {
+	TRACE_SCOPE("set up mesh triangles");
+
+	auto &draw = *(BinnedDraw<Shader> *)data;
+	auto &obj = *draw.obj;
+	auto shader = *draw.shader;
+
+	for (auto index = first; index < last; ++index) {
+		auto &face = obj.faces[index];
+		auto &triangle = draw.triangles[index];
+
+		MeshVertex corners[] = {
+			fetch_vertex(obj, face, 0),
+			fetch_vertex(obj, face, 1),
+			fetch_vertex(obj, face, 2),
+		};
+
+		shader.begin_triangle(corners);
+
+		Vec3f screen[3];
+		for (auto corner = 0; corner < 3; ++corner) {
+			screen[corner] = project_to_vec3f(draw.transform * shader.vertex(corners[corner], triangle.varyings[corner]));
+		}
+
+		Triangle screen_triangle = { screen[0], screen[1], screen[2] };
+		triangle.set_up = setup_triangle(screen_triangle, draw.target->width, draw.target->height, triangle.setup);
+		count_triangle(triangle.set_up);
+
+		// The pre-pass counts them again, the same as draw_mesh_depth would.
+		if (draw.mode == RENDER_DEPTH_PREPASS) count_triangle(triangle.set_up);
+
+		triangle.shader = shader;
+	}
+}
+
+template <typename Shader, DepthTest depth_test>
+u64 draw_mesh_band(BinnedDraw<Shader> &draw, int band) {
+	auto &target = *draw.target;
+	auto band_min_y = band * draw.band_rows;
+	auto band_max_y = min(band_min_y + draw.band_rows, target.height) - 1;
+
+	auto first = draw.bin_starts[band];
+	auto last = draw.bin_starts[band + 1];
+
+	if (depth_test == DEPTH_TEST_EQUAL) {
+		auto view = depth_view(target);
+		for (auto index = first; index < last; ++index) {
+			auto setup = draw.triangles[draw.bins[index]].setup;
+			if (clip_rows(setup, band_min_y, band_max_y)) rasterize_triangle_depth(view, setup);
+		}
+	}
+
+	u64 fragments_shaded = 0;
+	MicroBatch<Shader> batch;
+	batch.count = 0;
+
+	for (auto index = first; index < last; ++index) {
+		auto &triangle = draw.triangles[draw.bins[index]];
+
+		auto setup = triangle.setup;
+		if (!clip_rows(setup, band_min_y, band_max_y)) continue;
+
+		// Every band gets its own copy, so nothing the fragment stage does to it can leak between them.
+		auto shader = triangle.shader;
+		fragments_shaded += submit_triangle<Shader, depth_test>(target, batch, shader, setup, triangle.varyings);
+	}
+
+	fragments_shaded += flush_micro_batch<Shader, depth_test>(target, batch);
+	return fragments_shaded;
+}
+
+template <typename Shader>
+void draw_mesh_bands(void *data, int first, int last, int worker_index) {
+	auto &draw = *(BinnedDraw<Shader> *)data;
+
+	u64 fragments_shaded = 0;
+	for (auto band = first; band < last; ++band) {
+		TRACE_SCOPE("draw mesh band");
+
+		if (draw.mode == RENDER_DEPTH_PREPASS) {
+			fragments_shaded += draw_mesh_band<Shader, DEPTH_TEST_EQUAL>(draw, band);
+		} else {
+			fragments_shaded += draw_mesh_band<Shader, DEPTH_TEST_NEARER>(draw, band);
+		}
+	}
+
+	InterlockedExchangeAdd64(&draw.fragments_shaded, (LONG64)fragments_shaded);
+}
+
+// The same bands as draw_instances, a few per worker.
+inline int mesh_band_rows(const JobSystem &jobs, const RenderTarget &target) {
+	auto tile_rows_per_band = max(1, target.tiles_y / (jobs.worker_count * 4));
+	return tile_rows_per_band * TILE_SIZE;
+}
+
+// The most scratch the draw_mesh below can take from its arena, for giving it an arena of its own. The bins
+// are sized as if every triangle reached every band, since how many they really reach isn't known until setup.
+template <typename Shader>
+size_t draw_mesh_scratch_size(const JobSystem &jobs, const RenderTarget &target, const WavefrontObj &obj) {
+	auto band_rows = mesh_band_rows(jobs, target);
+	auto band_count = (size_t)(target.height + band_rows - 1) / band_rows;
+	auto face_count = (size_t)max(obj.face_count, 0);
+
+	// Room to align each of the three.
+	return sizeof(BinnedTriangle<Shader>) * face_count + sizeof(int) * (band_count + 1) + sizeof(int) * max(face_count * band_count, (size_t)1) + 3 * 64;
+}
+
+template <typename Shader>
+u64 draw_mesh(JobSystem &jobs, MemoryArena &frame_arena, RenderTarget &target, const WavefrontObj &obj, Shader &shader, const Mat4f &transform, RenderMode mode) {
+	if (obj.face_count <= 0) return 0;
+
+	TRACE_SCOPE("draw_mesh on the job system");
+
+	BinnedDraw<Shader> draw = {};
+	draw.target = &target;
+	draw.obj = &obj;
+	draw.shader = &shader;
+	draw.transform = transform;
+	draw.mode = mode;
+
+	auto mark = arena_mark(frame_arena);
+	defer { pop_to_mark(frame_arena, mark); };
+
+	draw.band_rows = mesh_band_rows(jobs, target);
+	draw.band_count = (target.height + draw.band_rows - 1) / draw.band_rows;
+
+	draw.triangles = push_array(frame_arena, BinnedTriangle<Shader>, obj.face_count);
+	draw.bin_starts = push_array(frame_arena, int, draw.band_count + 1);
+	if (!draw.triangles || !draw.bin_starts) return draw_mesh(target, obj, shader, transform, mode);
+
+	parallel_for(jobs, obj.face_count, MESH_SETUP_GRAIN, set_up_mesh_triangles<Shader>, &draw);
+
+	// Counted first, so each bin can go right after the one before it.
+	{
+		TRACE_SCOPE("bin mesh triangles");
+
+		for (auto band = 0; band <= draw.band_count; ++band) {
+			draw.bin_starts[band] = 0;
+		}
+
+		for (auto index = 0; index < obj.face_count; ++index) {
+			auto &triangle = draw.triangles[index];
+			if (!triangle.set_up) continue;
+
+			for (auto band = triangle.setup.min_y / draw.band_rows; band <= triangle.setup.max_y / draw.band_rows; ++band) {
+				draw.bin_starts[band + 1]++;
+			}
+		}
+
+		for (auto band = 0; band < draw.band_count; ++band) {
+			draw.bin_starts[band + 1] += draw.bin_starts[band];
+		}
+
+		draw.bins = push_array(frame_arena, int, max(draw.bin_starts[draw.band_count], 1));
+		if (!draw.bins) {
+			pop_to_mark(frame_arena, mark);
+			return draw_mesh(target, obj, shader, transform, mode);
+		}
+
+		// bin_starts gets used as each bin's end while filling it, which leaves it one band off at the end.
+		for (auto index = 0; index < obj.face_count; ++index) {
+			auto &triangle = draw.triangles[index];
+			if (!triangle.set_up) continue;
+
+			for (auto band = triangle.setup.min_y / draw.band_rows; band <= triangle.setup.max_y / draw.band_rows; ++band) {
+				draw.bins[draw.bin_starts[band]++] = index;
+			}
+		}
+
+		for (auto band = draw.band_count; band > 0; --band) {
+			draw.bin_starts[band] = draw.bin_starts[band - 1];
+		}
+		draw.bin_starts[0] = 0;
+	}
+
+	parallel_for(jobs, draw.band_count, 1, draw_mesh_bands<Shader>, &draw);
+
+	return (u64)draw.fragments_shaded;
+}
@@ -0,0 +1,387 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+
+#include "regions.h"
+#include "arena.h"
+#include "utils.h"
+#include "wavefront.h"
+#include "tgaimage.h"
+#include "texture.h"
+#include "shadow.h"
+#include "shaders.h"
+#include "raster.h"
+#include "jobs.h"
+#include "trace.h"
+
+// Loading the assets can take a while, but not this long.
+const DWORD REGION_START_TIMEOUT_MS = 60 * 1000;
+const DWORD REGION_STOP_TIMEOUT_MS = 5 * 1000;
+
+// Each job draws this many tile rows of its band. Every job runs the vertex stage for the whole mesh,
+// the same as draw_instance_bands, so these can't be too thin.
+const int REGION_ROWS_PER_JOB = 4;
+
+static int numa_node_count() {
+	ULONG highest_node;
+	if (!GetNumaHighestNodeNumber(&highest_node)) return 1;
+	return (int)highest_node + 1;
+}
+
+static void event_name(char *buffer, size_t size, const char *name, const char *kind, int index) {
+	snprintf(buffer, size, "%s_%s_%d", name, kind, index);
+}
+
+static void close_regions(RegionRenderer &renderer) {
+	for (auto index = 0; index < MAX_REGIONS; ++index) {
+		if (renderer.processes[index]) CloseHandle(renderer.processes[index]);
+		if (renderer.go[index]) CloseHandle(renderer.go[index]);
+		if (renderer.done[index]) CloseHandle(renderer.done[index]);
+	}
+
+	if (renderer.control) UnmapViewOfFile(renderer.control);
+	if (renderer.mapping) CloseHandle(renderer.mapping);
+	renderer = {};
+}
+
+// Waits for worker index to signal done. False if it exited (or gave up) instead.
+static bool wait_for_region(RegionRenderer &renderer, int index, DWORD timeout) {
+	HANDLE handles[] = { renderer.done[index], renderer.processes[index] };
+	auto result = WaitForMultipleObjects(2, handles, FALSE, timeout);
+	return result == WAIT_OBJECT_0 && !renderer.control->regions[index].failed;
+}
+
+bool start_region_renderer(RegionRenderer &renderer, int region_count, int width, int height, const char *mesh_path, const char *texture_path) {
+	renderer = {};
+
+	// The paths go to the workers in the control block. One too long for it would be cut off, and the workers
+	// would load the wrong file or none at all.
+	if (strlen(mesh_path) >= MAX_PATH || strlen(texture_path) >= MAX_PATH) return false;
+
+	auto node_count = numa_node_count();
+	if (region_count <= 0) region_count = node_count;
+
+	// Bands are whole tile rows, so there can't be more of them than that.
+	auto tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+	region_count = clamp(region_count, 1, min(MAX_REGIONS, tile_rows));
+
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	auto page_size = (size_t)system_info.dwPageSize;
+
+	// The framebuffer starts on a page of its own, so the workers writing it never share a page with the control block.
+	auto stride = width * 4;
+	auto framebuffer_offset = (sizeof(RegionControl) + page_size - 1) / page_size * page_size;
+	auto mapping_size = (u64)framebuffer_offset + (u64)stride * height;
+
+	snprintf(renderer.name, sizeof(renderer.name), "LearnRenderRegions_%lu", GetCurrentProcessId());
+	renderer.mapping = CreateFileMapping(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, (DWORD)(mapping_size >> 32), (DWORD)mapping_size, renderer.name);
+	if (!renderer.mapping) return false;
+
+	renderer.control = (RegionControl *)MapViewOfFile(renderer.mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (!renderer.control) {
+		close_regions(renderer);
+		return false;
+	}
+
+	renderer.framebuffer = (u8 *)renderer.control + framebuffer_offset;
+	renderer.region_count = region_count;
+
+	// A fresh mapping is already zeroed.
+	auto &control = *renderer.control;
+	control.width = width;
+	control.height = height;
+	control.stride = stride;
+	control.framebuffer_offset = framebuffer_offset;
+	control.coordinator_id = GetCurrentProcessId();
+	control.region_count = region_count;
+	strcpy_s(control.mesh_path, sizeof(control.mesh_path), mesh_path);
+	strcpy_s(control.texture_path, sizeof(control.texture_path), texture_path);
+
+	for (auto index = 0; index < region_count; ++index) {
+		auto &slot = control.regions[index];
+		slot.min_y = tile_rows * index / region_count * TILE_SIZE;
+		slot.max_y = min(tile_rows * (index + 1) / region_count * TILE_SIZE, height) - 1;
+		slot.node = index % node_count;
+	}
+
+	char exe_path[MAX_PATH];
+	if (!GetModuleFileName(0, exe_path, MAX_PATH)) {
+		close_regions(renderer);
+		return false;
+	}
+
+	for (auto index = 0; index < region_count; ++index) {
+		char name[128];
+		event_name(name, sizeof(name), renderer.name, "go", index);
+		renderer.go[index] = CreateEvent(0, FALSE, FALSE, name);
+		event_name(name, sizeof(name), renderer.name, "done", index);
+		renderer.done[index] = CreateEvent(0, FALSE, FALSE, name);
+
+		if (!renderer.go[index] || !renderer.done[index]) {
+			stop_region_renderer(renderer);
+			return false;
+		}
+
+		// CreateProcess wants to be able to write to the command line.
+		char command_line[MAX_PATH + 128];
+		snprintf(command_line, sizeof(command_line), "\"%s\" --region-worker %s %d", exe_path, renderer.name, index);
+
+		STARTUPINFO startup_info = {};
+		startup_info.cb = sizeof(startup_info);
+		PROCESS_INFORMATION process_info = {};
+
+		if (!CreateProcess(exe_path, command_line, 0, 0, FALSE, 0, 0, 0, &startup_info, &process_info)) {
+			stop_region_renderer(renderer);
+			return false;
+		}
+
+		CloseHandle(process_info.hThread);
+		renderer.processes[index] = process_info.hProcess;
+	}
+
+	// Every worker signals done once when it's loaded and ready for its first go.
+	for (auto index = 0; index < region_count; ++index) {
+		if (!wait_for_region(renderer, index, REGION_START_TIMEOUT_MS)) {
+			stop_region_renderer(renderer);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool render_regions(RegionRenderer &renderer, const RegionFrame &frame, Backbuffer &buffer) {
+	TRACE_SCOPE("render_regions");
+
+	auto &control = *renderer.control;
+	assert(buffer.width == control.width && buffer.height == control.height && buffer.stride == control.stride);
+
+	// Setting an event is a full barrier, so the workers see the whole frame once they're awake.
+	control.frame = frame;
+	for (auto index = 0; index < renderer.region_count; ++index) {
+		SetEvent(renderer.go[index]);
+	}
+
+	renderer.fragments_shaded = 0;
+	for (auto index = 0; index < renderer.region_count; ++index) {
+		if (!wait_for_region(renderer, index, INFINITE)) return false;
+		renderer.fragments_shaded += control.regions[index].fragments_shaded;
+	}
+
+	{
+		TRACE_SCOPE("copy regions");
+		memcpy(buffer.memory, renderer.framebuffer, (size_t)control.stride * control.height);
+	}
+
+	return true;
+}
+
+void stop_region_renderer(RegionRenderer &renderer) {
+	if (!renderer.control) return;
+
+	renderer.control->quit = 1;
+
+	HANDLE processes[MAX_REGIONS];
+	auto process_count = 0;
+
+	for (auto index = 0; index < MAX_REGIONS; ++index) {
+		if (!renderer.processes[index]) continue;
+		SetEvent(renderer.go[index]);
+		processes[process_count++] = renderer.processes[index];
+	}
+
+	// Anything that hasn't gone by now is stuck, and there's nobody else to clean it up.
+	if (process_count && WaitForMultipleObjects(process_count, processes, TRUE, REGION_STOP_TIMEOUT_MS) != WAIT_OBJECT_0) {
+		for (auto index = 0; index < process_count; ++index) {
+			TerminateProcess(processes[index], 1);
+		}
+	}
+
+	close_regions(renderer);
+}
+
+//
+// The worker side.
+//
+
+struct RegionDraw {
+	RenderTarget *target;
+	const WavefrontObj *obj;
+	const ShadowedGouraudShader *shader;
+	Mat4f transform;
+
+	// Tile rows, relative to the target.
+	int first_row;
+
+	volatile LONG64 fragments_shaded;
+};
+
+static void draw_region_rows(void *data, int first, int last, int worker_index) {
+	TRACE_SCOPE("draw region rows");
+
+	auto &draw = *(RegionDraw *)data;
+	auto min_y = (draw.first_row + first) * TILE_SIZE;
+	auto max_y = min((draw.first_row + last) * TILE_SIZE, draw.target->height) - 1;
+
+	// The shader doesn't keep anything per triangle, but a copy costs nothing and means it never matters.
+	auto shader = *draw.shader;
+	auto fragments_shaded = draw_mesh_rows(*draw.target, *draw.obj, shader, draw.transform, min_y, max_y);
+	InterlockedExchangeAdd64(&draw.fragments_shaded, (LONG64)fragments_shaded);
+}
+
+// Same sizing as the asset loader's, but loaded right here on the pinned thread.
+static bool load_region_mesh(const char *path, MemoryArena &arena, WavefrontObj &obj) {
+	u64 size;
+	if (!get_file_size(path, size)) return false;
+	if (!make_arena(arena, (size_t)size * 8 + ARENA_COMMIT_SIZE)) return false;
+
+	obj = load_obj(path, arena);
+	return obj.face_count > 0;
+}
+
+static bool load_region_texture(const char *path, MemoryArena &arena, TextureMap &texture) {
+	auto image_load_result = load_tga_image(path);
+	if (!image_load_result.loaded) return false;
+	defer { free_tga_image(image_load_result); };
+
+	auto &spec = image_load_result.image.header->image_spec;
+	if (!make_arena(arena, (size_t)spec.image_width * spec.image_height * sizeof(Color))) return false;
+
+	texture = decompress_tga_image(&image_load_result.image, arena);
+	return texture.pixel_data != 0;
+}
+
+int run_region_worker(const char *name, int index) {
+	if (index < 0 || index >= MAX_REGIONS) return 1;
+
+	auto mapping = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (!mapping) return 1;
+
+	auto control = (RegionControl *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (!control) return 1;
+
+	auto &slot = control->regions[index];
+
+	char event[128];
+	event_name(event, sizeof(event), name, "go", index);
+	auto go = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, event);
+	event_name(event, sizeof(event), name, "done", index);
+	auto done = OpenEvent(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, event);
+	auto coordinator = OpenProcess(SYNCHRONIZE, FALSE, control->coordinator_id);
+
+	if (!go || !done || !coordinator) return 1;
+
+	TRACE_THREAD_NAME("region worker");
+
+	// Everything from here on, allocations included, happens on the node. Windows gives a page to the node
+	// of the processor that first touches it, so pinning before anything gets allocated is what keeps the
+	// mesh, the texture and the target local.
+	GROUP_AFFINITY processors = {};
+	auto pinned = GetNumaNodeProcessorMaskEx((USHORT)slot.node, &processors) && processors.Mask &&
+		SetThreadGroupAffinity(GetCurrentThread(), &processors, 0);
+
+	// Without a node to stay on, at least don't have every worker start a thread for every processor.
+	JobSystem jobs;
+	auto started = false;
+	if (pinned) {
+		started = start_job_system(jobs, 0, &processors);
+	} else {
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		started = start_job_system(jobs, max(1, (int)system_info.dwNumberOfProcessors / control->region_count));
+	}
+
+	MemoryArena mesh_arena = {};
+	MemoryArena texture_arena = {};
+	WavefrontObj obj = {};
+	TextureMap texture = {};
+
+	auto target = make_render_target(control->width, control->height);
+	auto shadow_map = make_shadow_map(1024);
+
+	// Only the band's tiles get cleared and drawn.
+	auto mask = (u8 *)calloc(target.tiles_x * target.tiles_y, 1);
+
+	auto ready = started && target.tiles && shadow_map.depth.tiles && mask &&
+		load_region_mesh(control->mesh_path, mesh_arena, obj) &&
+		load_region_texture(control->texture_path, texture_arena, texture);
+
+	if (!ready) {
+		slot.failed = 1;
+		SetEvent(done);
+		return 1;
+	}
+
+	auto first_row = slot.min_y / TILE_SIZE;
+	auto last_row = slot.max_y / TILE_SIZE + 1;
+	memset(&mask[first_row * target.tiles_x], 1, (last_row - first_row) * target.tiles_x);
+	target.tile_mask = mask;
+
+	// The shared framebuffer looks like any other backbuffer to resolve.
+	Backbuffer framebuffer = {};
+	framebuffer.width = control->width;
+	framebuffer.height = control->height;
+	framebuffer.bytes_per_pixel = 4;
+	framebuffer.stride = control->stride;
+	framebuffer.memory = (u8 *)control + control->framebuffer_offset;
+
+	SetEvent(done);
+
+	auto shadow_drawn = false;
+	auto shadow_transform = Mat4f{};
+
+	for (;;) {
+		HANDLE handles[] = { go, coordinator };
+		if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) break;
+		if (control->quit) break;
+
+		TRACE_SCOPE("region frame");
+
+		auto frame = control->frame;
+
+		// Every worker has its own, since the mesh is all over the light's view and the bands aren't. It only
+		// needs drawing again when the light moves.
+		if (!shadow_drawn || memcmp(&shadow_transform, &frame.shadow_transform, sizeof(shadow_transform)) != 0) {
+			render_shadow_map(shadow_map, obj, frame.shadow_transform);
+			shadow_transform = frame.shadow_transform;
+			shadow_drawn = true;
+		}
+		clear(jobs, target, BLACK, FLT_MIN);
+
+		ShadowedGouraudShader shader = {};
+		shader.light_dir = frame.light_dir;
+		shader.texture_map = &texture;
+		shader.shadow_map = &shadow_map;
+		shader.shadow_ambient = frame.shadow_ambient;
+
+		RegionDraw draw = {};
+		draw.target = &target;
+		draw.obj = &obj;
+		draw.shader = &shader;
+		draw.transform = frame.transform;
+		draw.first_row = first_row;
+
+		parallel_for(jobs, last_row - first_row, REGION_ROWS_PER_JOB, draw_region_rows, &draw);
+		resolve(jobs, target, framebuffer, mask);
+
+		slot.fragments_shaded = (u64)draw.fragments_shaded;
+		SetEvent(done);
+	}
+
+	stop_job_system(jobs);
+	free(mask);
+	free_shadow_map(shadow_map);
+	free_render_target(target);
+	free_arena(texture_arena);
+	free_arena(mesh_arena);
+	CloseHandle(coordinator);
+	CloseHandle(done);
+	CloseHandle(go);
+	UnmapViewOfFile(control);
+	CloseHandle(mapping);
+
+	return 0;
+}
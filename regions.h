@@ -0,0 +1,106 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "render.h"
+
+// Sort-first rendering over several processes, for machines with more than one NUMA node.
+//
+// With one process, the mesh, the texture and the target all end up on whichever node touched them first,
+// and the threads on every other node pay for going across to it on every fetch. Here the screen is cut
+// into bands of tile rows, and each band gets a process of its own, pinned to one node. The process loads
+// its own copy of the mesh and the texture from the pinned thread, so they come out in that node's memory,
+// runs its job system on that node's processors only, and draws every triangle that touches its band.
+//
+// The coordinator (the normal windowed process) hands each frame's camera and light to the workers through
+// a named file mapping, wakes them with an event each, and waits for their done events. The workers resolve
+// their bands straight into a shared framebuffer after the control block, so all that's left for the
+// coordinator is one copy into its backbuffer.
+//
+// Triangles that straddle bands get clipped to each band with clip_rows, so the pieces come out exactly
+// like the single-process draw_mesh would have drawn them.
+
+const int MAX_REGIONS = 64;
+
+// Everything a frame needs that can change from one frame to the next.
+struct RegionFrame {
+	// Object space to the screen, and to the shadow map.
+	Mat4f transform;
+	Mat4f shadow_transform;
+
+	Vec3f light_dir;
+	f32 shadow_ambient;
+};
+
+struct RegionSlot {
+	// The rows this worker draws, [min_y, max_y]. Always whole tile rows, apart from the last band.
+	int min_y;
+	int max_y;
+
+	// The NUMA node the worker pins itself to.
+	int node;
+
+	// Set by the worker if it couldn't start, right before it signals done and exits.
+	volatile LONG failed;
+
+	// How many fragments the worker shaded in the last frame.
+	u64 fragments_shaded;
+};
+
+// The start of the shared mapping. The framebuffer comes after it, at framebuffer_offset.
+struct RegionControl {
+	int width;
+	int height;
+	int stride;
+	size_t framebuffer_offset;
+
+	// Workers watch the coordinator, so they don't hang around if it goes away without stopping them.
+	DWORD coordinator_id;
+
+	char mesh_path[MAX_PATH];
+	char texture_path[MAX_PATH];
+
+	// Written by the coordinator before it sets the go events, read by the workers after.
+	RegionFrame frame;
+
+	// Set by stop_region_renderer. Workers that see it after a go event exit instead of drawing.
+	volatile LONG quit;
+
+	int region_count;
+	RegionSlot regions[MAX_REGIONS];
+};
+
+// The coordinator's side.
+struct RegionRenderer {
+	char name[64];
+	HANDLE mapping;
+	RegionControl *control;
+	u8 *framebuffer;
+
+	int region_count;
+
+	// Auto reset. go_i wakes worker i for a frame, done_i is worker i saying its band is in the framebuffer.
+	HANDLE go[MAX_REGIONS];
+	HANDLE done[MAX_REGIONS];
+	HANDLE processes[MAX_REGIONS];
+
+	// Over all the workers, for the last frame.
+	u64 fragments_shaded;
+};
+
+// Starts region_count worker processes (0 means one per NUMA node), each running this same executable with
+// --region-worker, and waits for them to load mesh_path and texture_path. Returns false if any of them
+// couldn't, or either path is MAX_PATH long or more, in which case nothing is left running.
+bool start_region_renderer(RegionRenderer &renderer, int region_count, int width, int height, const char *mesh_path, const char *texture_path);
+
+// Has the workers draw a frame and copies it into buffer, which has to be the size given to
+// start_region_renderer. Returns false if a worker died, and then there's no point calling it again.
+bool render_regions(RegionRenderer &renderer, const RegionFrame &frame, Backbuffer &buffer);
+
+void stop_region_renderer(RegionRenderer &renderer);
+
+// The worker's side, for main to call when it gets --region-worker <name> <index>. Returns the exit code.
+int run_region_worker(const char *name, int index);
@@ -1,12 +1,85 @@
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include <algorithm>
 
 #include "types.h"
 #include "render.h"
 #include "color.h"
 #include "texture.h"
+#include "trace.h"
+#include "jobs.h"
+
+Backbuffer make_backbuffer(int width, int height) {
+	Backbuffer buffer = {};
+	buffer.width = width;
+	buffer.height = height;
+	buffer.bytes_per_pixel = 4;
+	buffer.stride = width * buffer.bytes_per_pixel;
+	buffer.memory = (u8 *)malloc(width * height * buffer.bytes_per_pixel);
+
+	buffer.info.bmiHeader.biSize = sizeof(buffer.info.bmiHeader);
+	buffer.info.bmiHeader.biWidth = width;
+	buffer.info.bmiHeader.biHeight = height;
+	buffer.info.bmiHeader.biPlanes = 1;
+	buffer.info.bmiHeader.biBitCount = 32;
+	buffer.info.bmiHeader.biCompression = BI_RGB;
+
+	return buffer;
+}
+
+void free_backbuffer(Backbuffer &buffer) {
+	free(buffer.memory);
+	buffer.memory = 0;
+}
+
+RenderTarget make_render_target(int width, int height) {
+	RenderTarget target = {};
+	target.width = width;
+	target.height = height;
+	target.tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	target.tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	target.tile_capacity = target.tiles_x * target.tiles_y;
+
+	// VirtualAlloc so the tiles start on a page boundary and each one sits on its own cache lines.
+	auto size = (SIZE_T)target.tile_capacity * sizeof(RenderTile);
+	target.tiles = (RenderTile *)VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+	return target;
+}
+
+bool resize_render_target(RenderTarget &target, int width, int height) {
+	auto tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	auto tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	if (width <= 0 || height <= 0 || tiles_x * tiles_y > target.tile_capacity) return false;
+
+	target.width = width;
+	target.height = height;
+	target.tiles_x = tiles_x;
+	target.tiles_y = tiles_y;
+	return true;
+}
+
+void free_render_target(RenderTarget &target) {
+	if (target.tiles) VirtualFree(target.tiles, 0, MEM_RELEASE);
+	if (target.overdraw) VirtualFree(target.overdraw, 0, MEM_RELEASE);
+	target.tiles = 0;
+	target.overdraw = 0;
+}
+
+bool enable_overdraw(RenderTarget &target) {
+	if (!target.overdraw) {
+		auto size = (SIZE_T)target.tile_capacity * TILE_PIXELS * sizeof(u16);
+		target.overdraw = (u16 *)VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+
+	return target.overdraw != 0;
+}
 
 void render(Backbuffer &buffer, HDC context) {
+	TRACE_SCOPE("render");
+
 	// Could probably actually handle resizing and such, but whatever.
 	auto width = buffer.width;
 	auto height = buffer.height;
@@ -37,6 +110,241 @@ void clear(Backbuffer &buffer, const Color &color) {
 	}
 }
 
+// Tiles [first_tile, last_tile).
+static void clear_tiles(RenderTarget &target, int first_tile, int last_tile, u32 pixel, f32 depth) {
+	// Pixels past the right and bottom edges get cleared too. Nothing reads them, it's just simpler.
+	for (auto index = first_tile; index < last_tile; ++index) {
+		if (target.tile_mask && !target.tile_mask[index]) continue;
+
+		auto &tile = target.tiles[index];
+
+		for (auto pixel_index = 0; pixel_index < TILE_PIXELS; ++pixel_index) {
+			tile.color[pixel_index] = pixel;
+			tile.depth[pixel_index] = depth;
+		}
+
+		if (target.overdraw) memset(&target.overdraw[index * TILE_PIXELS], 0, TILE_PIXELS * sizeof(u16));
+	}
+}
+
+void clear(RenderTarget &target, const Color &color, f32 depth) {
+	TRACE_SCOPE("clear");
+	clear_tiles(target, 0, target.tiles_x * target.tiles_y, pack_argb(color), depth);
+}
+
+struct ClearJob {
+	RenderTarget *target;
+	u32 pixel;
+	f32 depth;
+};
+
+static void clear_job(void *data, int first, int last, int worker_index) {
+	auto &job = *(ClearJob *)data;
+	clear_tiles(*job.target, first, last, job.pixel, job.depth);
+}
+
+void clear(JobSystem &jobs, RenderTarget &target, const Color &color, f32 depth) {
+	TRACE_SCOPE("clear");
+
+	// 256 tiles is 128K of color and depth.
+	ClearJob job = { &target, pack_argb(color), depth };
+	parallel_for(jobs, target.tiles_x * target.tiles_y, 256, clear_job, &job);
+}
+
+// Tile rows [first_row, last_row). tiles can be null for all of them. The target's bottom left corner goes at x, y in the buffer.
+static void resolve_tile_rows(const RenderTarget &target, Backbuffer &buffer, const u8 *tiles, int x, int y, int first_row, int last_row) {
+	for (auto tile_y = first_row; tile_y < last_row; ++tile_y) {
+		auto min_y = tile_y * TILE_SIZE;
+		auto rows = min(TILE_SIZE, target.height - min_y);
+
+		for (auto tile_x = 0; tile_x < target.tiles_x; ++tile_x) {
+			if (tiles && !tiles[tile_y * target.tiles_x + tile_x]) continue;
+
+			auto min_x = tile_x * TILE_SIZE;
+			auto columns = min(TILE_SIZE, target.width - min_x);
+			auto &tile = target.tiles[tile_y * target.tiles_x + tile_x];
+
+			for (auto row = 0; row < rows; ++row) {
+				auto destination = (u32 *)&buffer.memory[(y + min_y + row) * buffer.stride + (x + min_x) * buffer.bytes_per_pixel];
+				memcpy(destination, &tile.color[row * TILE_SIZE], columns * sizeof(u32));
+			}
+		}
+	}
+}
+
+void resolve(const RenderTarget &target, Backbuffer &buffer) {
+	TRACE_SCOPE("resolve");
+
+	assert(target.width == buffer.width && target.height == buffer.height);
+	resolve_tile_rows(target, buffer, 0, 0, 0, 0, target.tiles_y);
+}
+
+void resolve(const RenderTarget &target, Backbuffer &buffer, int x, int y) {
+	TRACE_SCOPE("resolve");
+
+	assert(x >= 0 && y >= 0 && x + target.width <= buffer.width && y + target.height <= buffer.height);
+	resolve_tile_rows(target, buffer, 0, x, y, 0, target.tiles_y);
+}
+
+struct ResolveJob {
+	const RenderTarget *target;
+	Backbuffer *buffer;
+	const u8 *tiles;
+};
+
+static void resolve_job(void *data, int first, int last, int worker_index) {
+	auto &job = *(ResolveJob *)data;
+	resolve_tile_rows(*job.target, *job.buffer, job.tiles, 0, 0, first, last);
+}
+
+void resolve(JobSystem &jobs, const RenderTarget &target, Backbuffer &buffer) {
+	resolve(jobs, target, buffer, 0);
+}
+
+void resolve(JobSystem &jobs, const RenderTarget &target, Backbuffer &buffer, const u8 *tiles) {
+	TRACE_SCOPE("resolve");
+
+	assert(target.width == buffer.width && target.height == buffer.height);
+
+	ResolveJob job = { &target, &buffer, tiles };
+	parallel_for(jobs, target.tiles_y, 2, resolve_job, &job);
+}
+
+// weight is out of 256. Red and blue go through together, since there's room between them for the multiply.
+static inline u32 lerp_pixel(u32 a, u32 b, u32 weight) {
+	auto red_blue = (((a & 0xFF00FF) * (256 - weight) + (b & 0xFF00FF) * weight) >> 8) & 0xFF00FF;
+	auto green = (((a & 0x00FF00) * (256 - weight) + (b & 0x00FF00) * weight) >> 8) & 0x00FF00;
+	return 0xFF000000 | red_blue | green;
+}
+
+static inline u32 target_pixel(const RenderTarget &target, int x, int y) {
+	return tile_at(target, x, y).color[tile_pixel_index(x, y)];
+}
+
+struct UpscaleJob {
+	const RenderTarget *target;
+	Backbuffer *buffer;
+
+	// How far one buffer pixel moves in the target, in 16.16 fixed point.
+	s32 step_x;
+	s32 step_y;
+};
+
+// Where the center of pixel n lands in the target, in 16.16 fixed point, clamped to the edge pixels' centers.
+static inline s32 source_position(int n, s32 step, int source_size) {
+	auto position = (s32)(((s64)n * 2 + 1) * step / 2) - 0x8000;
+	return clamp(position, 0, (source_size - 1) << 16);
+}
+
+// Rows [first, last) of the buffer.
+static void upscale_job(void *data, int first, int last, int worker_index) {
+	auto &job = *(UpscaleJob *)data;
+	auto &target = *job.target;
+	auto &buffer = *job.buffer;
+
+	for (auto y = first; y < last; ++y) {
+		auto source_y = source_position(y, job.step_y, target.height);
+		auto y0 = source_y >> 16;
+		auto y1 = min(y0 + 1, target.height - 1);
+		auto weight_y = (u32)(source_y >> 8) & 0xFF;
+
+		auto destination = (u32 *)&buffer.memory[y * buffer.stride];
+
+		for (auto x = 0; x < buffer.width; ++x) {
+			auto source_x = source_position(x, job.step_x, target.width);
+			auto x0 = source_x >> 16;
+			auto x1 = min(x0 + 1, target.width - 1);
+			auto weight_x = (u32)(source_x >> 8) & 0xFF;
+
+			auto top = lerp_pixel(target_pixel(target, x0, y0), target_pixel(target, x1, y0), weight_x);
+			auto bottom = lerp_pixel(target_pixel(target, x0, y1), target_pixel(target, x1, y1), weight_x);
+			destination[x] = lerp_pixel(top, bottom, weight_y);
+		}
+	}
+}
+
+void upscale(JobSystem &jobs, const RenderTarget &target, Backbuffer &buffer) {
+	if (target.width == buffer.width && target.height == buffer.height) {
+		resolve(jobs, target, buffer);
+		return;
+	}
+
+	TRACE_SCOPE("upscale");
+
+	UpscaleJob job = { &target, &buffer };
+	job.step_x = (s32)(((s64)target.width << 16) / buffer.width);
+	job.step_y = (s32)(((s64)target.height << 16) / buffer.height);
+
+	// 16 rows is 64K of a 1024 wide buffer.
+	parallel_for(jobs, buffer.height, 16, upscale_job, &job);
+}
+
+// Black, then blue, cyan, green, yellow and red as t goes from 0 to 1.
+static u32 heat_color(f32 t) {
+	if (t <= 0) return 0xFF000000;
+	if (t > 1) t = 1;
+
+	const u32 stops[] = { 0x0000FF, 0x00FFFF, 0x00FF00, 0xFFFF00, 0xFF0000 };
+	const int stop_count = sizeof(stops) / sizeof(stops[0]);
+
+	auto position = t * (stop_count - 1);
+	auto index = min((int)position, stop_count - 2);
+	auto blend = position - index;
+
+	u32 result = 0xFF000000;
+	for (auto shift = 0; shift <= 16; shift += 8) {
+		auto from = (f32)((stops[index] >> shift) & 0xFF);
+		auto to = (f32)((stops[index + 1] >> shift) & 0xFF);
+		result |= (u32)(from + (to - from) * blend) << shift;
+	}
+
+	return result;
+}
+
+void resolve_heat_map(const RenderTarget &target, Backbuffer &buffer, HeatMapMode mode, int full_scale) {
+	TRACE_SCOPE("resolve_heat_map");
+
+	assert(target.width == buffer.width && target.height == buffer.height);
+	if (!target.overdraw || full_scale <= 0) return;
+
+	for (auto tile_y = 0; tile_y < target.tiles_y; ++tile_y) {
+		auto min_y = tile_y * TILE_SIZE;
+		auto rows = min(TILE_SIZE, target.height - min_y);
+
+		for (auto tile_x = 0; tile_x < target.tiles_x; ++tile_x) {
+			auto min_x = tile_x * TILE_SIZE;
+			auto columns = min(TILE_SIZE, target.width - min_x);
+			auto counts = &target.overdraw[(tile_y * target.tiles_x + tile_x) * TILE_PIXELS];
+
+			u32 tile_color = 0;
+			if (mode == HEAT_MAP_TILE_COST) {
+				u32 total = 0;
+				for (auto pixel_index = 0; pixel_index < TILE_PIXELS; ++pixel_index) {
+					total += counts[pixel_index];
+				}
+
+				tile_color = heat_color((f32)total / (full_scale * TILE_PIXELS));
+			}
+
+			for (auto row = 0; row < rows; ++row) {
+				auto destination = (u32 *)&buffer.memory[(min_y + row) * buffer.stride + min_x * buffer.bytes_per_pixel];
+
+				for (auto column = 0; column < columns; ++column) {
+					destination[column] = mode == HEAT_MAP_TILE_COST ? tile_color : heat_color((f32)counts[row * TILE_SIZE + column] / full_scale);
+				}
+			}
+		}
+	}
+}
+
+void set_pixel(RenderTarget &target, int x, int y, const Color &color) {
+	if (x < 0 || y < 0 || x >= target.width || y >= target.height) {
+		return;
+	}
+
+	tile_at(target, x, y).color[tile_pixel_index(x, y)] = pack_argb(color);
+}
+
 void set_pixel(Backbuffer &buffer, int x, int y, const Color &color) {
 	if (x < 0 || y < 0 || x >= buffer.width || y >= buffer.height) {
 		return;
@@ -90,65 +398,48 @@ void draw_line(Backbuffer &buffer, Vec2i p1, Vec2i p2, const Color &color) {
 	}
 }
 
-static inline void apply_lighting(Color &color, f32 light_intensity) {
-	color.r = (u8)(color.r * light_intensity);
-	color.g = (u8)(color.g * light_intensity);
-	color.b = (u8)(color.b * light_intensity);
-}
-
-void draw_triangle(Backbuffer &buffer, const Triangle &triangle, const TextureMap &texture_map, const Vec2f uvs[3], f32 *z_buffer, const Vec3f normals[3], const Vec3f light_dir) {
-	auto min_x = clamp(min(triangle.p1.x, min(triangle.p2.x, triangle.p3.x)), 0.0f, (f32)buffer.width);
-	auto max_x = clamp(max(triangle.p1.x, max(triangle.p2.x, triangle.p3.x)), 0.0f, (f32)buffer.height);
-	auto min_y = clamp(min(triangle.p1.y, min(triangle.p2.y, triangle.p3.y)), 0.0f, (f32)buffer.width);
-	auto max_y = clamp(max(triangle.p1.y, max(triangle.p2.y, triangle.p3.y)), 0.0f, (f32)buffer.height);
+// Tile rows [first_row, last_row). Goes a tile at a time, in the order they sit in memory.
+static u64 count_covered_tile_rows(const RenderTarget &target, f32 clear_depth, int first_row, int last_row) {
+	u64 result = 0;
 
-	auto min_point = Vec2f{ min_x, min_y };
-	auto max_point = Vec2f{ max_x, max_y };
+	for (auto tile_y = first_row; tile_y < last_row; ++tile_y) {
+		auto rows = min(TILE_SIZE, target.height - tile_y * TILE_SIZE);
 
-	auto intensity = Vec3f{
-		normalize(normals[0]).dot(light_dir),
-		normalize(normals[1]).dot(light_dir),
-		normalize(normals[2]).dot(light_dir)
-	};
+		for (auto tile_x = 0; tile_x < target.tiles_x; ++tile_x) {
+			auto columns = min(TILE_SIZE, target.width - tile_x * TILE_SIZE);
+			auto &tile = target.tiles[tile_y * target.tiles_x + tile_x];
 
-	// This loop could be pretty easily parallelized.
-	// foreach coordinate (x, y):
-	//    new thread(coordinate, screen_triangle, triangle, z_value_place, color_place)
-	// So rather than indexing into the buffers themselves, each thread directly inserts
-	// the z-buffer and pixel color values.
-	// I really just don't want to have to figure out the thread API. There are some things
-	// that you can't easily do in C++.
-	for (auto y = (int)min_point.y; y < max_point.y; ++y) {
-		for (auto x = (int)min_point.x; x < max_point.x; ++x) {
-			auto barycentric_coefficients = triangle.barycentric_coefficients_of(x, y);
-			if (barycentric_coefficients.x < 0 || barycentric_coefficients.y < 0 || barycentric_coefficients.z < 0) continue;
-
-			auto depth =
-				triangle.p1.z * barycentric_coefficients.x +
-				triangle.p2.z * barycentric_coefficients.y +
-				triangle.p3.z * barycentric_coefficients.z;
-
-			if (z_buffer[y * buffer.width + x] >= depth) continue;
+			for (auto row = 0; row < rows; ++row) {
+				for (auto column = 0; column < columns; ++column) {
+					if (tile.depth[row * TILE_SIZE + column] != clear_depth) ++result;
+				}
+			}
+		}
+	}
 
-			auto light_intensity = barycentric_coefficients.dot(intensity);
+	return result;
+}
 
-			if (light_intensity <= 0) continue;
+u64 count_covered_pixels(const RenderTarget &target, f32 clear_depth) {
+	return count_covered_tile_rows(target, clear_depth, 0, target.tiles_y);
+}
 
-			// We have the barycentric coefficients, so we can use them to find out where to index into the texture map.
-			// I spent way too long trying to figure out how to do this. But I'd forgotten that barycentric coefficients literally
-			// are the value that you want. "What percentage of each vertex is a given point?"
-			auto texture_map_bary_coord_x = barycentric_coefficients.x * uvs[0].x + barycentric_coefficients.y * uvs[1].x + barycentric_coefficients.z * uvs[2].x;
-			auto texture_map_bary_coord_y = barycentric_coefficients.x * uvs[0].y + barycentric_coefficients.y * uvs[1].y + barycentric_coefficients.z * uvs[2].y;
-			auto texture_map_coord_x = (int)(texture_map_bary_coord_x * texture_map.width);
-			auto texture_map_coord_y = (int)(texture_map_bary_coord_y * texture_map.height);
+struct CoverageJob {
+	const RenderTarget *target;
+	f32 clear_depth;
+	volatile LONG64 covered;
+};
 
-			auto color = texture_map.pixel_data[texture_map_coord_y * texture_map.width + texture_map_coord_x];
+static void coverage_job(void *data, int first, int last, int worker_index) {
+	auto &job = *(CoverageJob *)data;
+	auto covered = count_covered_tile_rows(*job.target, job.clear_depth, first, last);
+	InterlockedExchangeAdd64(&job.covered, (LONG64)covered);
+}
 
-			//auto color = WHITE;
-			apply_lighting(color, light_intensity);
+u64 count_covered_pixels(JobSystem &jobs, const RenderTarget &target, f32 clear_depth) {
+	TRACE_SCOPE("count covered pixels");
 
-			z_buffer[y * buffer.width + x] = depth;
-			set_pixel(buffer, x, y, color);
-		}
-	}
+	CoverageJob job = { &target, clear_depth, 0 };
+	parallel_for(jobs, target.tiles_y, 2, coverage_job, &job);
+	return (u64)job.covered;
 }
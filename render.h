@@ -17,10 +17,113 @@ struct Backbuffer {
 	u8 *memory;
 };
 
-struct TextureMap;
+const int TILE_SIZE = 8;
+const int TILE_PIXELS = TILE_SIZE * TILE_SIZE;
+
+// Color and depth for one 8x8 block of pixels, stored next to each other.
+// Addressing the framebuffer as y * stride + x means every row of a triangle's
+// bounding box lands on a new cache line (and pretty often a new page). With tiles,
+// a small triangle usually stays inside one or two of these.
+struct RenderTile {
+	u32 color[TILE_PIXELS];
+	f32 depth[TILE_PIXELS];
+};
+
+// What the rasterizer actually draws into. It only gets turned into the linear
+// layout that StretchDIBits wants once per frame, in resolve.
+struct RenderTarget {
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+
+	// How many tiles there's room for, from the size the target was made at. resize_render_target
+	// can shrink the target and grow it back without reallocating anything.
+	int tile_capacity;
+
+	RenderTile *tiles;
+
+	// Optional, for debugging. When it's there, the rasterizer counts every fragment it shades here,
+	// in the same tile order as tiles, so resolve_heat_map can show where the fill work went.
+	u16 *overdraw;
+
+	// Also optional. When it's there, clear and the rasterizer leave alone every tile whose entry is 0,
+	// which is how a frame redraws only the tiles that changed (see incremental.h). The depth-only path
+	// in depth.h doesn't look at it.
+	const u8 *tile_mask;
+};
+
+// These only ever see coordinates inside the target. Doing the math unsigned lets the
+// divides and remainders turn into plain shifts and masks.
+inline int tile_index(int tiles_x, int x, int y) {
+	return ((u32)y / TILE_SIZE) * tiles_x + ((u32)x / TILE_SIZE);
+}
+
+inline int tile_pixel_index(int x, int y) {
+	return ((u32)y % TILE_SIZE) * TILE_SIZE + ((u32)x % TILE_SIZE);
+}
+
+inline RenderTile &tile_at(const RenderTarget &target, int x, int y) {
+	return target.tiles[tile_index(target.tiles_x, x, y)];
+}
+
+inline u32 pack_argb(const Color &color) {
+	return 0xFF << 24 | color.r << 16 | color.g << 8 | color.b;
+}
+
+Backbuffer make_backbuffer(int width, int height);
+void free_backbuffer(Backbuffer &buffer);
+
+RenderTarget make_render_target(int width, int height);
+void free_render_target(RenderTarget &target);
+
+// Changes the size the target gets drawn at. The tiles are laid out for the new size, so whatever was in it
+// is garbage until the next clear. Returns false if it needs more tiles than the target was made with.
+bool resize_render_target(RenderTarget &target, int width, int height);
 
 void set_pixel(Backbuffer &buffer, int x, int y, const Color &color);
+void set_pixel(RenderTarget &target, int x, int y, const Color &color);
 void render(Backbuffer &buffer, HDC context);
 void clear(Backbuffer &buffer, const Color &color);
+void clear(RenderTarget &target, const Color &color, f32 depth);
+
+// Copies the tiled target into the buffer's linear layout. The two need to be the same size.
+void resolve(const RenderTarget &target, Backbuffer &buffer);
+
+// Copies a smaller target into part of the buffer, with its bottom left corner at x, y. It has to fit.
+void resolve(const RenderTarget &target, Backbuffer &buffer, int x, int y);
+
+// The same, split up over the job system.
+struct JobSystem;
+void clear(JobSystem &jobs, RenderTarget &target, const Color &color, f32 depth);
+void resolve(JobSystem &jobs, const RenderTarget &target, Backbuffer &buffer);
+
+// Only copies the tiles whose entry in tiles is nonzero.
+void resolve(JobSystem &jobs, const RenderTarget &target, Backbuffer &buffer, const u8 *tiles);
+
+// resolve for a target smaller than the buffer, stretching it over the whole buffer with bilinear filtering.
+// Pixel centers line up, so the corners of the two stay together. Same as resolve when the sizes match.
+void upscale(JobSystem &jobs, const RenderTarget &target, Backbuffer &buffer);
+
+// Gives the target an overdraw buffer. clear zeroes it along with everything else.
+bool enable_overdraw(RenderTarget &target);
+
+enum HeatMapMode {
+	// How many fragments got shaded for each pixel.
+	HEAT_MAP_OVERDRAW,
+
+	// The same counts added up over each 8x8 tile. Closer to what each tile cost, since a tile that
+	// a lot of tiny triangles land on pays for setup and traversal many times over.
+	HEAT_MAP_TILE_COST,
+};
+
+// resolve, but with the overdraw counts as colors instead of the colors. Black is nothing,
+// then blue through to red at full_scale and anything over. For HEAT_MAP_TILE_COST, full_scale
+// is per pixel, so a tile is red when it averages full_scale fragments a pixel.
+void resolve_heat_map(const RenderTarget &target, Backbuffer &buffer, HeatMapMode mode, int full_scale);
+
+// Counts the pixels whose depth isn't clear_depth anymore, either on this thread or over the job system.
+u64 count_covered_pixels(const RenderTarget &target, f32 clear_depth);
+u64 count_covered_pixels(JobSystem &jobs, const RenderTarget &target, f32 clear_depth);
+
 void draw_line(Backbuffer &buffer, Vec2i p1, Vec2i p2, const Color &color);
-void draw_triangle(Backbuffer &buffer, const Triangle &triangle, const TextureMap &texture_map, const Vec2f uvs[3], f32 *z_buffer, const Vec3f normals[3], const Vec3f light_dir);
@@ -0,0 +1,71 @@
+#include <math.h>
+
+#include "resolution.h"
+#include "render.h"
+
+// How much each new frame counts for in the averages.
+const f32 SMOOTHING = 0.2f;
+
+const int SETTLE_FRAMES = 8;
+
+// Only go up once the scaled part is under this much of its budget.
+const f32 GROW_THRESHOLD = 0.85f;
+
+// What a change aims for, as a fraction of the budget.
+const f32 AIM = 0.95f;
+
+// Limits on a single change. Going down can be quick, going up is careful.
+const f32 MAX_SHRINK = 0.75f;
+const f32 MAX_GROW = 1.1f;
+
+// Anything smaller than this isn't worth a change of size.
+const f32 MIN_CHANGE = 0.02f;
+
+ResolutionController make_resolution_controller(f32 target_ms, f32 min_scale, f32 max_scale) {
+	ResolutionController controller = {};
+	controller.target_ms = target_ms;
+	controller.min_scale = min_scale;
+	controller.max_scale = max_scale;
+	controller.scale = max_scale;
+	return controller;
+}
+
+bool update_resolution(ResolutionController &controller, f32 scaled_ms, f32 fixed_ms) {
+	if (controller.frames_since_change == 0) {
+		controller.scaled_ms = scaled_ms;
+		controller.fixed_ms = fixed_ms;
+	} else {
+		controller.scaled_ms += (scaled_ms - controller.scaled_ms) * SMOOTHING;
+		controller.fixed_ms += (fixed_ms - controller.fixed_ms) * SMOOTHING;
+	}
+
+	if (++controller.frames_since_change < SETTLE_FRAMES) return false;
+
+	// Whatever the fixed part costs comes out of the budget first. If that's nearly all of it,
+	// the best that can be done is to go as small as allowed.
+	auto budget = max(controller.target_ms - controller.fixed_ms, controller.target_ms * 0.1f);
+	if (controller.scaled_ms <= 0) return false;
+
+	auto ratio = budget / controller.scaled_ms;
+	if (ratio >= 1 && ratio * GROW_THRESHOLD < 1) return false;
+
+	// Either way, aim a little under the budget, so a change doesn't land right on the edge of it.
+	auto scale = controller.scale * sqrtf(ratio * AIM);
+	scale = clamp(scale, controller.scale * MAX_SHRINK, controller.scale * MAX_GROW);
+	scale = clamp(scale, controller.min_scale, controller.max_scale);
+	if (fabsf(scale - controller.scale) < MIN_CHANGE) return false;
+
+	controller.scale = scale;
+	controller.frames_since_change = 0;
+	return true;
+}
+
+static int scale_dimension(int full, f32 scale) {
+	auto size = (int)(full * scale / TILE_SIZE + 0.5f) * TILE_SIZE;
+	return clamp(size, min(full, TILE_SIZE), full);
+}
+
+void scaled_size(const ResolutionController &controller, int full_width, int full_height, int &width, int &height) {
+	width = scale_dimension(full_width, controller.scale);
+	height = scale_dimension(full_height, controller.scale);
+}
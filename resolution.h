@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+
+// Dynamic resolution. Instead of the frame time going wherever the window size and the face count
+// take it, this picks how big to render each frame so it comes in under a budget, and upscale
+// stretches the result over the backbuffer.
+//
+// It splits the frame into the part that scales with the render size (clearing, rasterizing, shading)
+// and the part that doesn't (the upscale itself, which is always the size of the backbuffer). Only the
+// first part gets to use what's left of the budget. The cost of the scaled part is taken to go with the
+// pixel count, so with r = budget / scaled_ms the new scale is scale * sqrt(r). That's only roughly
+// true, since the vertex work doesn't shrink with the resolution, but it gets corrected the next time round.
+//
+// Going down happens as soon as a frame is over, going up only once there's a good margin, and not by
+// much at a time. That way it settles instead of bouncing between two sizes.
+
+struct ResolutionController {
+	f32 target_ms;
+
+	// Fractions of the full width and height.
+	f32 min_scale;
+	f32 max_scale;
+	f32 scale;
+
+	// Averaged over the last few frames, so one slow frame doesn't change the size.
+	f32 scaled_ms;
+	f32 fixed_ms;
+
+	// Timings right after a change are still partly from the old size, so they're left to settle.
+	int frames_since_change;
+};
+
+ResolutionController make_resolution_controller(f32 target_ms, f32 min_scale, f32 max_scale);
+
+// Feeds in the last frame's timings. scaled_ms is the part that depends on the render size and fixed_ms
+// the part that doesn't. Returns true when the scale changed.
+bool update_resolution(ResolutionController &controller, f32 scaled_ms, f32 fixed_ms);
+
+// The size to render at for the current scale. Both are multiples of TILE_SIZE (apart from never going over
+// the full size), so the tiles along the right and bottom edges aren't mostly wasted.
+void scaled_size(const ResolutionController &controller, int full_width, int full_height, int &width, int &height);
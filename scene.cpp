@@ -0,0 +1,380 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene.h"
+#include "stretchy_buffer.h"
+#include "trace.h"
+
+// How far a leaf's bounds reach past its node's bounds, as a fraction of the node's size.
+const f32 FAT_MARGIN = 0.1f;
+
+Aabb transform_aabb(const Aabb &box, const Mat4f &transform) {
+	auto center = (box.min + box.max) * 0.5f;
+	auto extent = (box.max - box.min) * 0.5f;
+
+	// The new extent along each axis is how far the three old extents can reach along it.
+	Aabb result;
+	for (auto row = 0; row < 3; ++row) {
+		auto m = &transform.dim[row * 4];
+
+		auto new_center = m[0] * center.x + m[1] * center.y + m[2] * center.z + m[3];
+		auto new_extent = fabsf(m[0]) * extent.x + fabsf(m[1]) * extent.y + fabsf(m[2]) * extent.z;
+
+		result.min.dim[row] = new_center - new_extent;
+		result.max.dim[row] = new_center + new_extent;
+	}
+
+	return result;
+}
+
+static Aabb combine(const Aabb &a, const Aabb &b) {
+	Aabb result;
+	for (auto axis = 0; axis < 3; ++axis) {
+		result.min.dim[axis] = min(a.min.dim[axis], b.min.dim[axis]);
+		result.max.dim[axis] = max(a.max.dim[axis], b.max.dim[axis]);
+	}
+	return result;
+}
+
+static bool contains(const Aabb &outer, const Aabb &inner) {
+	for (auto axis = 0; axis < 3; ++axis) {
+		if (inner.min.dim[axis] < outer.min.dim[axis] || inner.max.dim[axis] > outer.max.dim[axis]) return false;
+	}
+	return true;
+}
+
+// Half the surface area, which is all the insertion cost needs since it only compares them.
+static f32 half_area(const Aabb &box) {
+	auto size = box.max - box.min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static Aabb fatten(const Aabb &box) {
+	auto size = box.max - box.min;
+	auto margin = max(size.x, max(size.y, size.z)) * FAT_MARGIN;
+
+	Aabb result = box;
+	for (auto axis = 0; axis < 3; ++axis) {
+		result.min.dim[axis] -= margin;
+		result.max.dim[axis] += margin;
+	}
+	return result;
+}
+
+static bool is_leaf(const BvhNode &node) {
+	return node.children[0] < 0;
+}
+
+static int allocate_bvh_node(Scene &scene) {
+	int index;
+
+	if (scene.free_bvh_node >= 0) {
+		index = scene.free_bvh_node;
+		scene.free_bvh_node = scene.bvh[index].parent;
+	} else {
+		BvhNode node;
+		sb_push(scene.bvh, node);
+		index = sb_count(scene.bvh) - 1;
+	}
+
+	auto &node = scene.bvh[index];
+	node.parent = -1;
+	node.children[0] = -1;
+	node.children[1] = -1;
+	node.scene_node = -1;
+	node.height = 0;
+
+	return index;
+}
+
+static void free_bvh_node(Scene &scene, int index) {
+	scene.bvh[index].parent = scene.free_bvh_node;
+	scene.free_bvh_node = index;
+}
+
+static void refit(Scene &scene, int index) {
+	auto &node = scene.bvh[index];
+	auto &left = scene.bvh[node.children[0]];
+	auto &right = scene.bvh[node.children[1]];
+
+	node.bounds = combine(left.bounds, right.bounds);
+	node.height = 1 + max(left.height, right.height);
+}
+
+// If one of a's children is more than one level taller than the other, the taller one (b) takes a's
+// place and a takes whichever of b's children is shorter. Returns whatever ends up where a was.
+static int balance(Scene &scene, int a) {
+	auto &node_a = scene.bvh[a];
+	if (is_leaf(node_a) || node_a.height < 2) return a;
+
+	auto difference = scene.bvh[node_a.children[1]].height - scene.bvh[node_a.children[0]].height;
+	if (difference >= -1 && difference <= 1) return a;
+
+	auto taller_side = difference > 0 ? 1 : 0;
+	auto b = node_a.children[taller_side];
+	auto &node_b = scene.bvh[b];
+
+	// b moves up into a's spot.
+	node_b.parent = node_a.parent;
+	node_a.parent = b;
+
+	if (node_b.parent < 0) {
+		scene.root = b;
+	} else {
+		auto &parent = scene.bvh[node_b.parent];
+		parent.children[parent.children[0] == a ? 0 : 1] = b;
+	}
+
+	// b keeps its taller child and hands the shorter one down to a, in the slot b used to be in.
+	auto f = node_b.children[0];
+	auto g = node_b.children[1];
+	auto keep = scene.bvh[f].height >= scene.bvh[g].height ? f : g;
+	auto give = keep == f ? g : f;
+
+	node_b.children[0] = a;
+	node_b.children[1] = keep;
+	node_a.children[taller_side] = give;
+	scene.bvh[give].parent = a;
+
+	refit(scene, a);
+	refit(scene, b);
+
+	return b;
+}
+
+// Walks from index up to the root, rebalancing and growing each ancestor to fit its children again.
+static void refit_ancestors(Scene &scene, int index) {
+	while (index >= 0) {
+		index = balance(scene, index);
+		refit(scene, index);
+		index = scene.bvh[index].parent;
+	}
+}
+
+static void insert_leaf(Scene &scene, int leaf) {
+	if (scene.root < 0) {
+		scene.root = leaf;
+		scene.bvh[leaf].parent = -1;
+		return;
+	}
+
+	auto leaf_bounds = scene.bvh[leaf].bounds;
+
+	// Go down towards whichever child would grow the least by taking the leaf, and stop when making
+	// a new parent for the leaf and the current node is cheaper than going any further.
+	auto sibling = scene.root;
+	while (!is_leaf(scene.bvh[sibling])) {
+		auto &node = scene.bvh[sibling];
+
+		auto area = half_area(node.bounds);
+		auto combined_area = half_area(combine(node.bounds, leaf_bounds));
+
+		auto cost_here = 2 * combined_area;
+
+		// Every node on the way down grows by this much no matter which child the leaf ends up under.
+		auto inherited_cost = 2 * (combined_area - area);
+
+		f32 child_costs[2];
+		for (auto child = 0; child < 2; ++child) {
+			auto &child_node = scene.bvh[node.children[child]];
+			auto grown = half_area(combine(child_node.bounds, leaf_bounds));
+			child_costs[child] = inherited_cost + (is_leaf(child_node) ? grown : grown - half_area(child_node.bounds));
+		}
+
+		if (cost_here < child_costs[0] && cost_here < child_costs[1]) break;
+
+		sibling = child_costs[0] <= child_costs[1] ? node.children[0] : node.children[1];
+	}
+
+	auto old_parent = scene.bvh[sibling].parent;
+	auto new_parent = allocate_bvh_node(scene);
+
+	scene.bvh[new_parent].parent = old_parent;
+	scene.bvh[new_parent].children[0] = sibling;
+	scene.bvh[new_parent].children[1] = leaf;
+	scene.bvh[sibling].parent = new_parent;
+	scene.bvh[leaf].parent = new_parent;
+
+	if (old_parent < 0) {
+		scene.root = new_parent;
+	} else {
+		auto &parent = scene.bvh[old_parent];
+		parent.children[parent.children[0] == sibling ? 0 : 1] = new_parent;
+	}
+
+	refit_ancestors(scene, new_parent);
+}
+
+// The leaf's parent goes away and its sibling takes the parent's place.
+static void remove_leaf(Scene &scene, int leaf) {
+	if (leaf == scene.root) {
+		scene.root = -1;
+		return;
+	}
+
+	auto parent = scene.bvh[leaf].parent;
+	auto grandparent = scene.bvh[parent].parent;
+	auto sibling = scene.bvh[parent].children[scene.bvh[parent].children[0] == leaf ? 1 : 0];
+
+	scene.bvh[sibling].parent = grandparent;
+
+	if (grandparent < 0) {
+		scene.root = sibling;
+	} else {
+		auto &node = scene.bvh[grandparent];
+		node.children[node.children[0] == parent ? 0 : 1] = sibling;
+		refit_ancestors(scene, grandparent);
+	}
+
+	free_bvh_node(scene, parent);
+}
+
+Scene make_scene() {
+	Scene scene = {};
+	scene.root = -1;
+	scene.free_bvh_node = -1;
+	return scene;
+}
+
+void free_scene(Scene &scene) {
+	sb_free(scene.nodes);
+	sb_free(scene.bvh);
+	sb_free(scene.visible);
+	sb_free(scene.cull_stack);
+	sb_free(scene.sort_scratch);
+	scene = make_scene();
+}
+
+int add_node(Scene &scene, const PreparedMesh *mesh, const TextureMap *texture_map, const Mat4f &model) {
+	SceneNode node;
+	node.mesh = mesh;
+	node.texture_map = texture_map;
+	node.model = model;
+	node.world_bounds = transform_aabb(Aabb{ mesh->bounds_min, mesh->bounds_max }, model);
+
+	auto index = sb_count(scene.nodes);
+
+	auto leaf = allocate_bvh_node(scene);
+	scene.bvh[leaf].bounds = fatten(node.world_bounds);
+	scene.bvh[leaf].scene_node = index;
+	node.leaf = leaf;
+
+	sb_push(scene.nodes, node);
+	insert_leaf(scene, leaf);
+	scene.version++;
+
+	return index;
+}
+
+void set_node_transform(Scene &scene, int index, const Mat4f &model) {
+	auto &node = scene.nodes[index];
+	if (memcmp(&node.model, &model, sizeof(model)) == 0) return;
+
+	node.model = model;
+	scene.version++;
+	node.world_bounds = transform_aabb(Aabb{ node.mesh->bounds_min, node.mesh->bounds_max }, model);
+
+	// Still inside the fat bounds, so the tree is still right.
+	if (contains(scene.bvh[node.leaf].bounds, node.world_bounds)) return;
+
+	remove_leaf(scene, node.leaf);
+	scene.bvh[node.leaf].bounds = fatten(node.world_bounds);
+	insert_leaf(scene, node.leaf);
+}
+
+// Everything under a node that's entirely inside the frustum is visible without any more tests.
+static void add_all_leaves(Scene &scene, int index) {
+	auto &node = scene.bvh[index];
+
+	if (is_leaf(node)) {
+		sb_push(scene.visible, node.scene_node);
+	} else {
+		add_all_leaves(scene, node.children[0]);
+		add_all_leaves(scene, node.children[1]);
+	}
+}
+
+int cull_scene(Scene &scene, const Frustum &frustum) {
+	TRACE_SCOPE("cull_scene");
+
+	if (scene.visible) stb__sbn(scene.visible) = 0;
+	if (scene.root < 0) return 0;
+
+	// balance() keeps the heights of any two siblings within one of each other, so the tree is never much more
+	// than 1.44 times log2 of the leaf count deep, and the stack never holds much more than a node per level. Nodes
+	// can be added at any time, though, so the stack is a stretchy buffer instead of a fixed size that the
+	// scene could outgrow.
+	auto &stack = scene.cull_stack;
+	if (stack) stb__sbn(stack) = 0;
+	sb_push(stack, scene.root);
+
+	while (sb_count(stack)) {
+		auto index = stack[--stb__sbn(stack)];
+		auto &node = scene.bvh[index];
+
+		auto test = test_box(frustum, node.bounds.min, node.bounds.max);
+		if (test == FRUSTUM_OUTSIDE) continue;
+
+		if (test == FRUSTUM_INSIDE) {
+			add_all_leaves(scene, index);
+		} else if (is_leaf(node)) {
+			// The fat bounds are only for the tree. Test the real ones before calling it visible.
+			auto &scene_node = scene.nodes[node.scene_node];
+			if (test_box(frustum, scene_node.world_bounds.min, scene_node.world_bounds.max) != FRUSTUM_OUTSIDE) {
+				sb_push(scene.visible, node.scene_node);
+			}
+		} else {
+			sb_push(stack, node.children[0]);
+			sb_push(stack, node.children[1]);
+		}
+	}
+
+	return sb_count(scene.visible);
+}
+
+static int compare_nearest_first(const void *a, const void *b) {
+	auto depth_a = ((const VisibleNode *)a)->depth;
+	auto depth_b = ((const VisibleNode *)b)->depth;
+
+	// Bigger depth is nearer.
+	if (depth_a > depth_b) return -1;
+	if (depth_a < depth_b) return 1;
+	return 0;
+}
+
+int occlusion_cull_scene(Scene &scene, OcclusionBuffer &occlusion, const Mat4f &screen_transform) {
+	TRACE_SCOPE("occlusion_cull_scene");
+
+	clear(occlusion);
+
+	auto count = sb_count(scene.visible);
+	if (count == 0) return 0;
+
+	auto &sorted = scene.sort_scratch;
+	if (sorted) stb__sbn(sorted) = 0;
+
+	for (auto index = 0; index < count; ++index) {
+		auto &bounds = scene.nodes[scene.visible[index]].world_bounds;
+
+		// Good enough to get the big occluders in first. It doesn't need to be exact.
+		auto center = project_to_vec3f(screen_transform * ((bounds.min + bounds.max) * 0.5f));
+
+		VisibleNode visible = { center.z, scene.visible[index] };
+		sb_push(sorted, visible);
+	}
+
+	qsort(sorted, count, sizeof(VisibleNode), compare_nearest_first);
+
+	stb__sbn(scene.visible) = 0;
+
+	for (auto index = 0; index < count; ++index) {
+		auto &node = scene.nodes[sorted[index].node];
+		if (is_occluded(occlusion, node.world_bounds.min, node.world_bounds.max, screen_transform)) continue;
+
+		sb_push(scene.visible, sorted[index].node);
+		draw_occluder(occlusion, *node.mesh, screen_transform * node.model);
+	}
+
+	return sb_count(scene.visible);
+}
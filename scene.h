@@ -0,0 +1,117 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "render.h"
+#include "texture.h"
+#include "camera.h"
+#include "instancing.h"
+#include "occlusion.h"
+#include "trace.h"
+#include "stretchy_buffer.h"
+
+struct Aabb {
+	Vec3f min;
+	Vec3f max;
+};
+
+// Moves an object space box by an affine transform and boxes the result back up.
+Aabb transform_aabb(const Aabb &box, const Mat4f &transform);
+
+struct SceneNode {
+	const PreparedMesh *mesh;
+	const TextureMap *texture_map;
+	Mat4f model;
+
+	// The mesh's bounding box after model, kept up to date by set_node_transform.
+	Aabb world_bounds;
+
+	// This node's leaf in the scene's BVH.
+	int leaf;
+};
+
+// Leaves hold one scene node each. Their bounds are the node's world bounds grown by a margin,
+// so a node that only moves a little stays inside them and the tree doesn't have to change.
+struct BvhNode {
+	Aabb bounds;
+	int parent;
+
+	// Both -1 for leaves.
+	int children[2];
+
+	// 0 for leaves. Only used to keep the tree balanced.
+	int height;
+
+	// Only for leaves.
+	int scene_node;
+};
+
+// For sorting what's visible by depth.
+struct VisibleNode {
+	f32 depth;
+	int node;
+};
+
+// Everything that can be drawn, with a dynamic bounding volume hierarchy over it so a frame
+// only has to look at the nodes near the view instead of every one of them.
+//
+// The tree is built incrementally, the same way as the dynamic AABB trees physics engines use for
+// their broadphase. New leaves go next to whichever node makes the tree's total surface area grow
+// the least, and moving a node out of its fat bounds just takes its leaf out and puts it back in.
+// Rotations on the way back up keep it from degenerating into a list when things get added in order.
+struct Scene {
+	// Stretchy buffers. Nodes are referred to by index, since pushing can move the arrays.
+	SceneNode *nodes;
+	BvhNode *bvh;
+
+	int root;
+
+	// Internal nodes freed by removing a leaf get reused. They're chained through parent.
+	int free_bvh_node;
+
+	// Filled by cull_scene.
+	int *visible;
+
+	// Goes up whenever a node is added or moved, so whoever culls can tell when last time's answer still holds.
+	u32 version;
+
+	// Kept around between calls so culling doesn't allocate every frame.
+	int *cull_stack;
+	VisibleNode *sort_scratch;
+};
+
+Scene make_scene();
+void free_scene(Scene &scene);
+
+// Returns the new node's index.
+int add_node(Scene &scene, const PreparedMesh *mesh, const TextureMap *texture_map, const Mat4f &model);
+void set_node_transform(Scene &scene, int node, const Mat4f &model);
+
+// Leaves the nodes whose bounds are at least partly inside the frustum in scene.visible.
+// Returns how many there are.
+int cull_scene(Scene &scene, const Frustum &frustum);
+
+// Takes whatever's hidden out of what the last cull_scene call found. The nodes are gone through nearest
+// first, and each one that isn't hidden by the ones before it gets drawn into occlusion as an occluder.
+// Clears occlusion first. Returns how many nodes are left.
+int occlusion_cull_scene(Scene &scene, OcclusionBuffer &occlusion, const Mat4f &screen_transform);
+
+// Draws what the last cull_scene call found. Every node is drawn with the same shader, but with
+// its texture_map swapped in, so Shader needs a texture_map field. screen_transform is the same
+// world to screen transform the frustum was made from. Returns how many fragments got shaded.
+template <typename Shader>
+u64 draw_scene(RenderTarget &target, const Scene &scene, Shader shader, const Mat4f &screen_transform) {
+	TRACE_SCOPE("draw_scene");
+
+	u64 fragments_shaded = 0;
+
+	for (auto index = 0; index < sb_count(scene.visible); ++index) {
+		auto &node = scene.nodes[scene.visible[index]];
+
+		shader.texture_map = node.texture_map;
+		fragments_shaded += draw_prepared_mesh(target, *node.mesh, shader, screen_transform * node.model);
+	}
+
+	return fragments_shaded;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <math.h>
+
+#include "types.h"
+#include "color.h"
+#include "vectors.h"
+#include "texture.h"
+#include "color_math.h"
+#include "raster.h"
+#include "shadow.h"
+
+// The shading models we actually use. See raster.h for what a shader has to provide.
+// Lighting is done in object space, so light_dir and eye_dir need to be in the same space as the mesh.
+// The fragment stage only picks the texel and the light. draw_triangle does the multiply for a whole row.
+
+// Per-vertex diffuse intensity times a point-sampled texture.
+// This is what draw_triangle used to hard-code.
+struct GouraudShader {
+	enum { VARYING_COUNT = 3 };
+	enum { WRITES_DEPTH = 1 };
+
+	Vec3f light_dir;
+	const TextureMap *texture_map;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = normalize(in.normal).dot(light_dir);
+		varyings[1] = in.uv.x;
+		varyings[2] = in.uv.y;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		auto light_intensity = varyings[0];
+		if (light_intensity <= 0) return false;
+
+		color = sample_nearest(*texture_map, varyings[1], varyings[2]);
+		light = to_fixed_light(light_intensity);
+		return true;
+	}
+};
+
+// GouraudShader, darkened wherever the shadow map says something is between the surface and the light.
+struct ShadowedGouraudShader {
+	enum { VARYING_COUNT = 6 };
+	enum { WRITES_DEPTH = 1 };
+
+	Vec3f light_dir;
+	const TextureMap *texture_map;
+	const ShadowMap *shadow_map;
+
+	// How much light is left in full shadow.
+	f32 shadow_ambient;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = normalize(in.normal).dot(light_dir);
+		varyings[1] = in.uv.x;
+		varyings[2] = in.uv.y;
+
+		// The shadow map transform is affine, so it's fine to interpolate this like any other varying.
+		auto shadow_position = project_to_vec3f(shadow_map->transform * in.position);
+		varyings[3] = shadow_position.x;
+		varyings[4] = shadow_position.y;
+		varyings[5] = shadow_position.z;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		auto light_intensity = varyings[0];
+		if (light_intensity <= 0) return false;
+
+		auto lit = sample_shadow_pcf(*shadow_map, Vec3f{ varyings[3], varyings[4], varyings[5] });
+		light_intensity *= shadow_ambient + (1 - shadow_ambient) * lit;
+
+		color = sample_nearest(*texture_map, varyings[1], varyings[2]);
+		light = to_fixed_light(light_intensity);
+		return true;
+	}
+};
+
+// One intensity for the whole face, from the face normal.
+struct FlatShader {
+	enum { VARYING_COUNT = 2 };
+	enum { WRITES_DEPTH = 1 };
+
+	Vec3f light_dir;
+	const TextureMap *texture_map;
+
+	f32 face_intensity;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {
+		auto normal = normalize((corners[1].position - corners[0].position).cross(corners[2].position - corners[0].position));
+		face_intensity = normal.dot(light_dir);
+	}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = in.uv.x;
+		varyings[1] = in.uv.y;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		if (face_intensity <= 0) return false;
+
+		color = sample_nearest(*texture_map, varyings[0], varyings[1]);
+		light = to_fixed_light(face_intensity);
+		return true;
+	}
+};
+
+// Normals get interpolated instead of intensities, so the lighting is worked out per pixel,
+// with a specular highlight on top.
+struct PhongShader {
+	enum { VARYING_COUNT = 5 };
+	enum { WRITES_DEPTH = 1 };
+
+	Vec3f light_dir;
+	Vec3f eye_dir;
+	const TextureMap *texture_map;
+
+	f32 ambient;
+	f32 specular_strength;
+	f32 shininess;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = in.normal.x;
+		varyings[1] = in.normal.y;
+		varyings[2] = in.normal.z;
+		varyings[3] = in.uv.x;
+		varyings[4] = in.uv.y;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		auto normal = normalize(Vec3f{ varyings[0], varyings[1], varyings[2] });
+		auto diffuse = max(0.0f, normal.dot(light_dir));
+
+		// light_dir points from the surface towards the light, same as the other shaders.
+		auto reflected = normal * (2 * normal.dot(light_dir)) - light_dir;
+		auto specular = powf(max(0.0f, reflected.dot(eye_dir)), shininess) * specular_strength;
+
+		color = sample_nearest(*texture_map, varyings[3], varyings[4]);
+		light = to_fixed_light(min(ambient + diffuse + specular, 1.0f));
+		return true;
+	}
+};
+
+// Same lighting as PhongShader, but the normal comes from an object space normal map
+// (xyz packed into rgb) instead of being interpolated from the vertices.
+struct NormalMappedShader {
+	enum { VARYING_COUNT = 2 };
+	enum { WRITES_DEPTH = 1 };
+
+	Vec3f light_dir;
+	Vec3f eye_dir;
+	const TextureMap *texture_map;
+	const TextureMap *normal_map;
+
+	f32 ambient;
+	f32 specular_strength;
+	f32 shininess;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = in.uv.x;
+		varyings[1] = in.uv.y;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		auto packed = sample_nearest(*normal_map, varyings[0], varyings[1]);
+		auto normal = normalize(Vec3f{ packed.r / 127.5f - 1, packed.g / 127.5f - 1, packed.b / 127.5f - 1 });
+		auto diffuse = max(0.0f, normal.dot(light_dir));
+
+		auto reflected = normal * (2 * normal.dot(light_dir)) - light_dir;
+		auto specular = powf(max(0.0f, reflected.dot(eye_dir)), shininess) * specular_strength;
+
+		color = sample_nearest(*texture_map, varyings[0], varyings[1]);
+		light = to_fixed_light(min(ambient + diffuse + specular, 1.0f));
+		return true;
+	}
+};
+
+// Lighting that was worked out ahead of time by the bake tool (see bake.h), read from the vertices.
+// Ambient light gets darkened by the occlusion, and the static light was already shadowed, so there's
+// nothing left to do per frame. light_dir has no say, the bake picked the light.
+struct BakedVertexShader {
+	enum { VARYING_COUNT = 3 };
+	enum { WRITES_DEPTH = 1 };
+
+	const TextureMap *texture_map;
+
+	// How much of the light is ambient. The rest is the baked direct light.
+	f32 ambient;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = ambient * in.baked.x + (1 - ambient) * in.baked.y;
+		varyings[1] = in.uv.x;
+		varyings[2] = in.uv.y;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		color = sample_nearest(*texture_map, varyings[1], varyings[2]);
+		light = to_fixed_light(varyings[0]);
+		return true;
+	}
+};
+
+// BakedVertexShader, but reading from a lightmap laid out over the same UVs as the texture, so the
+// occlusion and shadows have as much detail as the lightmap has texels instead of going with the vertices.
+struct LightmapShader {
+	enum { VARYING_COUNT = 2 };
+	enum { WRITES_DEPTH = 1 };
+
+	const TextureMap *texture_map;
+
+	// Occlusion in red, direct light in green.
+	const TextureMap *lightmap;
+
+	f32 ambient;
+
+	inline void begin_triangle(const MeshVertex corners[3]) {}
+
+	inline Vec4f vertex(const MeshVertex &in, f32 *varyings) {
+		varyings[0] = in.uv.x;
+		varyings[1] = in.uv.y;
+
+		return Vec4f{ in.position.x, in.position.y, in.position.z, 1 };
+	}
+
+	inline bool fragment(const f32 *varyings, Color &color, FixedLight &light) {
+		auto baked = sample_nearest(*lightmap, varyings[0], varyings[1]);
+
+		color = sample_nearest(*texture_map, varyings[0], varyings[1]);
+		light = to_fixed_light((ambient * baked.r + (1 - ambient) * baked.g) * (1.0f / 255));
+		return true;
+	}
+};
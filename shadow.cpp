@@ -0,0 +1,58 @@
+#include <windows.h>
+#include <float.h>
+#include <math.h>
+
+#include "shadow.h"
+#include "trace.h"
+
+ShadowMap shadow_map_layout(int size) {
+	ShadowMap result = {};
+	result.depth = depth_buffer_layout(size, size);
+	result.transform = Mat4_Identity;
+	result.bias = 1.0f;
+	return result;
+}
+
+ShadowMap make_shadow_map(int size) {
+	auto result = shadow_map_layout(size);
+	result.depth = make_depth_buffer(size, size);
+	return result;
+}
+
+void free_shadow_map(ShadowMap &shadow_map) {
+	free_depth_buffer(shadow_map.depth);
+}
+
+void render_shadow_map(ShadowMap &shadow_map, const WavefrontObj &obj, const Mat4f &transform) {
+	TRACE_SCOPE("render_shadow_map");
+
+	shadow_map.transform = transform;
+
+	clear(shadow_map.depth, -FLT_MAX);
+	draw_mesh_depth(depth_view(shadow_map.depth), obj, transform);
+}
+
+static inline f32 shadow_test(const DepthBuffer &depth, int x, int y, f32 threshold) {
+	x = clamp(x, 0, depth.width - 1);
+	y = clamp(y, 0, depth.height - 1);
+	return threshold >= get_depth(depth, x, y) ? 1.0f : 0.0f;
+}
+
+f32 sample_shadow_pcf(const ShadowMap &shadow_map, const Vec3f &shadow_position) {
+	// Bilinear PCF: the four texels around the sample point are each compared against the point's
+	// depth, then the results get blended by how close the point is to each one. That's as smooth
+	// as a 3x3 box for a little under half the lookups, and this runs for every shaded fragment.
+	auto sample_x = shadow_position.x - 0.5f;
+	auto sample_y = shadow_position.y - 0.5f;
+	auto x = (int)floorf(sample_x);
+	auto y = (int)floorf(sample_y);
+	auto weight_x = sample_x - x;
+	auto weight_y = sample_y - y;
+	auto threshold = shadow_position.z + shadow_map.bias;
+
+	auto &depth = shadow_map.depth;
+	auto top = shadow_test(depth, x, y, threshold) * (1 - weight_x) + shadow_test(depth, x + 1, y, threshold) * weight_x;
+	auto bottom = shadow_test(depth, x, y + 1, threshold) * (1 - weight_x) + shadow_test(depth, x + 1, y + 1, threshold) * weight_x;
+
+	return top * (1 - weight_y) + bottom * weight_y;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "depth.h"
+#include "wavefront.h"
+
+// Depth as seen from the light. Anything with a shadow map depth lower than what's stored
+// is farther from the light than something else, so it's in shadow.
+struct ShadowMap {
+	DepthBuffer depth;
+
+	// Object space to shadow map space, i.e. viewport * light_view. Set by render_shadow_map.
+	Mat4f transform;
+
+	// How far behind the stored depth a point can be and still count as lit.
+	// Keeps surfaces from shadowing themselves.
+	f32 bias;
+};
+
+ShadowMap make_shadow_map(int size);
+void free_shadow_map(ShadowMap &shadow_map);
+
+// A shadow map with no memory for the depth (see depth_buffer_layout), for when it only lives as long as a frame
+// graph's transient buffer. Point depth.tiles at one before render_shadow_map, and don't free_shadow_map it.
+ShadowMap shadow_map_layout(int size);
+
+// Renders obj's depth from the light using the depth-only path.
+void render_shadow_map(ShadowMap &shadow_map, const WavefrontObj &obj, const Mat4f &transform);
+
+// How lit a point in shadow map space is, from 0 (fully shadowed) to 1, using bilinear percentage closer filtering.
+f32 sample_shadow_pcf(const ShadowMap &shadow_map, const Vec3f &shadow_position);
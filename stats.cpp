@@ -0,0 +1,47 @@
+#include <windows.h>
+#include <assert.h>
+
+#include "stats.h"
+
+// Each thread's counters get their own cache lines, so threads counting at the same time don't fight over them.
+struct alignas(64) StatsSlot {
+	PipelineStats stats;
+};
+
+static StatsSlot GlobalStatsSlots[MAX_STATS_THREADS];
+static volatile LONG GlobalStatsSlotCount;
+
+static thread_local PipelineStats *ThreadStats;
+
+PipelineStats &thread_pipeline_stats() {
+	if (!ThreadStats) {
+		auto slot = InterlockedIncrement(&GlobalStatsSlotCount) - 1;
+		assert(slot < MAX_STATS_THREADS);
+
+		// Running out of slots would mean more threads than anything here starts. Sharing the
+		// last one makes the counts a little unreliable, which is better than crashing over them.
+		if (slot >= MAX_STATS_THREADS) slot = MAX_STATS_THREADS - 1;
+
+		ThreadStats = &GlobalStatsSlots[slot].stats;
+	}
+
+	return *ThreadStats;
+}
+
+PipelineStats read_pipeline_stats() {
+	PipelineStats total = {};
+
+	auto slot_count = min((int)GlobalStatsSlotCount, MAX_STATS_THREADS);
+	for (auto index = 0; index < slot_count; ++index) {
+		add_stats(total, GlobalStatsSlots[index].stats);
+	}
+
+	return total;
+}
+
+void reset_pipeline_stats() {
+	auto slot_count = min((int)GlobalStatsSlotCount, MAX_STATS_THREADS);
+	for (auto index = 0; index < slot_count; ++index) {
+		GlobalStatsSlots[index].stats = {};
+	}
+}
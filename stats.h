@@ -0,0 +1,56 @@
+#pragma once
+
+#include "types.h"
+
+// Counts of what the rasterizer did. Every thread that draws gets its own copy, so counting is just
+// adding to plain integers. The rasterizer keeps its counts in locals and only adds them in here once
+// per triangle, so none of this happens per pixel.
+struct PipelineStats {
+	// Triangles that made it to setup, and how many of those were degenerate or entirely off the target.
+	// When a triangle gets drawn in pieces (the bands in draw_instances), each piece counts.
+	u64 triangles_submitted;
+	u64 triangles_culled;
+
+	// Pixels in triangles' bounding boxes that got run through the edge functions, and how many of them
+	// turned out to be inside. The difference is what bounding box traversal wastes.
+	u64 pixels_tested;
+	u64 pixels_inside;
+
+	u64 depth_passed;
+	u64 depth_failed;
+
+	u64 fragments_shaded;
+	u64 fragments_discarded;
+
+	// Color or depth actually stored.
+	u64 pixels_written;
+};
+
+const int MAX_STATS_THREADS = 64;
+
+// The calling thread's counters. Only that thread writes to them.
+PipelineStats &thread_pipeline_stats();
+
+// Adds up every thread's counters. The other threads aren't stopped while this reads, so call it
+// between frames, when nothing is drawing.
+PipelineStats read_pipeline_stats();
+void reset_pipeline_stats();
+
+inline void add_stats(PipelineStats &total, const PipelineStats &more) {
+	total.triangles_submitted += more.triangles_submitted;
+	total.triangles_culled += more.triangles_culled;
+	total.pixels_tested += more.pixels_tested;
+	total.pixels_inside += more.pixels_inside;
+	total.depth_passed += more.depth_passed;
+	total.depth_failed += more.depth_failed;
+	total.fragments_shaded += more.fragments_shaded;
+	total.fragments_discarded += more.fragments_discarded;
+	total.pixels_written += more.pixels_written;
+}
+
+// Counts a triangle coming into setup. set_up is what setup_triangle (or whatever else decided) returned.
+inline void count_triangle(bool set_up) {
+	auto &stats = thread_pipeline_stats();
+	stats.triangles_submitted++;
+	if (!set_up) stats.triangles_culled++;
+}
@@ -0,0 +1,432 @@
+#include <windows.h>
+#include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+
+#include "stream.h"
+#include "utils.h"
+
+static u64 level_size(const ChunkLevel &level) {
+	return sizeof(MeshVertex) * 3 * (u64)level.triangle_count;
+}
+
+static bool read_at(HANDLE file, u64 offset, void *memory, u64 size) {
+	auto bytes = (u8 *)memory;
+	while (size) {
+		auto part = (DWORD)min(size, (u64)64 * 1024 * 1024);
+
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD read;
+		if (!ReadFile(file, bytes, part, &read, &overlapped) || read != part) return false;
+
+		bytes += part;
+		offset += part;
+		size -= part;
+	}
+
+	return true;
+}
+
+static DWORD WINAPI stream_thread_proc(LPVOID parameter) {
+	auto thread = (StreamThread *)parameter;
+	auto mesh = thread->mesh;
+	TRACE_THREAD_NAME("mesh streaming");
+
+	for (;;) {
+		WaitForSingleObject(mesh->request_semaphore, INFINITE);
+		if (mesh->stopping) break;
+
+		auto request = (int)InterlockedIncrement(&mesh->next_request) - 1;
+		auto slot_index = mesh->requests[request % MAX_STREAM_REQUESTS];
+		auto &slot = mesh->slots[slot_index];
+		auto &level = mesh->chunks[slot.chunk].levels[slot.level];
+
+		// Unbuffered reads have to be whole sectors, into sector aligned memory. The levels start on
+		// CHUNK_DATA_ALIGNMENT in the file and the slots are multiples of it, so only the end needs rounding up.
+		// The last level in the file can come up short of that, which is fine as long as all of it is there.
+		auto size = level_size(level);
+		auto aligned_size = (size + CHUNK_DATA_ALIGNMENT - 1) & ~(CHUNK_DATA_ALIGNMENT - 1);
+
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)level.offset;
+		overlapped.OffsetHigh = (DWORD)(level.offset >> 32);
+
+		DWORD read = 0;
+		BOOL succeeded;
+		{
+			TRACE_SCOPE("read chunk");
+			succeeded = ReadFile(thread->file, mesh->cache + slot_index * mesh->slot_size, (DWORD)aligned_size, &read, &overlapped);
+		}
+
+		// The exchange is a full barrier, so whoever sees the slot ready sees everything that got read into it.
+		InterlockedExchange(&slot.state, succeeded && read >= size ? STREAM_SLOT_READY : STREAM_SLOT_FAILED);
+	}
+
+	return 0;
+}
+
+static bool open_file(StreamedMesh &mesh, const char *path, u64 budget) {
+	// The tables and the coarse block get read once, so they go through the file cache like anything else would.
+	auto file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	defer { CloseHandle(file); };
+
+	auto &header = mesh.header;
+	if (!read_at(file, 0, &header, sizeof(header))) return false;
+	if (header.magic != CHUNK_FILE_MAGIC || header.version != CHUNK_FILE_VERSION) return false;
+	if (header.chunk_count <= 0 || header.node_count <= 0 || header.level_count < 1 || header.level_count > MAX_CHUNK_LEVELS) return false;
+
+	auto node_size = sizeof(ChunkNode) * (u64)header.node_count;
+	auto chunk_size = sizeof(ChunkEntry) * (u64)header.chunk_count;
+	auto scratch_size = (sizeof(DrawnChunk) + sizeof(StreamRequest) + sizeof(StreamedChunk)) * (u64)header.chunk_count + sizeof(int) * (u64)header.node_count;
+	if (!make_arena(mesh.arena, (size_t)(node_size + chunk_size + header.coarse_size + scratch_size) + ARENA_COMMIT_SIZE)) return false;
+
+	mesh.nodes = push_array(mesh.arena, ChunkNode, header.node_count);
+	mesh.chunks = push_array(mesh.arena, ChunkEntry, header.chunk_count);
+	mesh.chunk_states = push_array(mesh.arena, StreamedChunk, header.chunk_count);
+	mesh.coarse = (u8 *)push_size(mesh.arena, (size_t)header.coarse_size);
+	mesh.drawn = push_array(mesh.arena, DrawnChunk, header.chunk_count);
+	mesh.candidates = push_array(mesh.arena, StreamRequest, header.chunk_count);
+	mesh.cull_stack = push_array(mesh.arena, int, header.node_count);
+	if (!mesh.nodes || !mesh.chunks || !mesh.chunk_states || !mesh.coarse || !mesh.drawn || !mesh.candidates || !mesh.cull_stack) return false;
+
+	if (!read_at(file, sizeof(header), mesh.nodes, node_size)) return false;
+	if (!read_at(file, sizeof(header) + node_size, mesh.chunks, chunk_size)) return false;
+	if (!read_at(file, header.coarse_offset, mesh.coarse, header.coarse_size)) return false;
+
+	// Everything that gets used to index something, checked once here so nothing after has to.
+	auto coarsest = header.level_count - 1;
+	for (auto index = 0; index < header.chunk_count; ++index) {
+		auto &entry = mesh.chunks[index];
+		for (auto level = 0; level < header.level_count; ++level) {
+			if (entry.levels[level].triangle_count < 0) return false;
+		}
+
+		auto &coarse = entry.levels[coarsest];
+		if (coarse.offset < header.coarse_offset || coarse.offset + level_size(coarse) > header.coarse_offset + header.coarse_size) return false;
+
+		for (auto level = 0; level < coarsest; ++level) {
+			if (level_size(entry.levels[level]) > header.max_level_size || entry.levels[level].offset % CHUNK_DATA_ALIGNMENT) return false;
+		}
+
+		for (auto level = 0; level < MAX_CHUNK_LEVELS; ++level) {
+			mesh.chunk_states[index].slots[level] = -1;
+		}
+		mesh.chunk_states[index].failed_levels = 0;
+	}
+
+	for (auto index = 0; index < header.node_count; ++index) {
+		auto &node = mesh.nodes[index];
+		if (node.count) {
+			if (node.offset < 0 || node.count < 0 || node.offset + node.count > header.chunk_count) return false;
+		} else if (node.offset <= index || node.offset >= header.node_count || index + 1 >= header.node_count) {
+			return false;
+		}
+	}
+
+	// The cache. A file with only one level has nothing to stream, and doesn't need one.
+	if (coarsest > 0) {
+		mesh.slot_size = (header.max_level_size + CHUNK_DATA_ALIGNMENT - 1) & ~(CHUNK_DATA_ALIGNMENT - 1);
+		mesh.slot_count = (int)min(budget / max(mesh.slot_size, (u64)1), (u64)INT_MAX / 2);
+		if (mesh.slot_count < 1) return false;
+
+		mesh.cache = (u8 *)VirtualAlloc(0, (size_t)(mesh.slot_size * mesh.slot_count), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		mesh.slots = (StreamSlot *)calloc(mesh.slot_count, sizeof(StreamSlot));
+		mesh.free_slots = (int *)malloc(mesh.slot_count * sizeof(int));
+		if (!mesh.cache || !mesh.slots || !mesh.free_slots) return false;
+
+		// Handed out from the end, so the first reads go at the start of the cache.
+		for (auto index = 0; index < mesh.slot_count; ++index) {
+			mesh.free_slots[index] = mesh.slot_count - 1 - index;
+		}
+		mesh.free_count = mesh.slot_count;
+	}
+
+	mesh.request_semaphore = CreateSemaphore(0, 0, MAX_STREAM_REQUESTS + STREAM_THREAD_COUNT, 0);
+	if (!mesh.request_semaphore) return false;
+
+	for (auto index = 0; index < STREAM_THREAD_COUNT; ++index) {
+		auto &thread = mesh.threads[index];
+		thread.mesh = &mesh;
+
+		// Opened without buffering, see stream.h.
+		auto file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, 0);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		thread.file = file;
+
+		thread.thread = CreateThread(0, 0, stream_thread_proc, &thread, 0, 0);
+		if (!thread.thread) return false;
+		mesh.thread_count++;
+	}
+
+	mesh.lod_pixels = STREAM_LOD_PIXELS;
+	return true;
+}
+
+bool open_streamed_mesh(StreamedMesh &mesh, const char *path, u64 budget) {
+	mesh = {};
+
+	if (open_file(mesh, path, budget)) return true;
+
+	close_streamed_mesh(mesh);
+	return false;
+}
+
+void close_streamed_mesh(StreamedMesh &mesh) {
+	// The threads only look at stopping between reads, so the ones that are reading finish first.
+	InterlockedExchange(&mesh.stopping, 1);
+	if (mesh.request_semaphore) ReleaseSemaphore(mesh.request_semaphore, mesh.thread_count, 0);
+
+	for (auto index = 0; index < mesh.thread_count; ++index) {
+		WaitForSingleObject(mesh.threads[index].thread, INFINITE);
+		CloseHandle(mesh.threads[index].thread);
+	}
+
+	// There can be one more file than threads, if the last thread couldn't be started.
+	for (auto index = 0; index < STREAM_THREAD_COUNT; ++index) {
+		if (mesh.threads[index].file) CloseHandle(mesh.threads[index].file);
+	}
+
+	if (mesh.request_semaphore) CloseHandle(mesh.request_semaphore);
+	if (mesh.cache) VirtualFree(mesh.cache, 0, MEM_RELEASE);
+	free(mesh.slots);
+	free(mesh.free_slots);
+	free_arena(mesh.arena);
+
+	mesh = {};
+}
+
+static bool level_ready(const StreamedMesh &mesh, int chunk, int level) {
+	if (level == mesh.header.level_count - 1) return true;
+
+	auto slot = mesh.chunk_states[chunk].slots[level];
+	return slot >= 0 && mesh.slots[slot].state == STREAM_SLOT_READY;
+}
+
+static MeshVertex *level_corners(const StreamedMesh &mesh, int chunk, int level) {
+	if (level == mesh.header.level_count - 1) {
+		return (MeshVertex *)(mesh.coarse + (mesh.chunks[chunk].levels[level].offset - mesh.header.coarse_offset));
+	}
+
+	return (MeshVertex *)(mesh.cache + mesh.chunk_states[chunk].slots[level] * mesh.slot_size);
+}
+
+// How many pixels across the box is on screen, and how near it is. Boxes that go behind the camera could be any
+// size, so they come out as big as can be, and nearest.
+static f32 projected_size(const ChunkBounds &bounds, const Mat4f &screen_transform, f32 &depth) {
+	auto screen_min = Vec2f{ FLT_MAX, FLT_MAX };
+	auto screen_max = Vec2f{ -FLT_MAX, -FLT_MAX };
+
+	for (auto corner = 0; corner < 8; ++corner) {
+		Vec3f position = {
+			(corner & 1) ? bounds.max.x : bounds.min.x,
+			(corner & 2) ? bounds.max.y : bounds.min.y,
+			(corner & 4) ? bounds.max.z : bounds.min.z,
+		};
+
+		auto clip = screen_transform * position;
+		if (clip.w <= 0) {
+			depth = FLT_MAX;
+			return FLT_MAX;
+		}
+
+		screen_min.x = min(screen_min.x, clip.x / clip.w);
+		screen_min.y = min(screen_min.y, clip.y / clip.w);
+		screen_max.x = max(screen_max.x, clip.x / clip.w);
+		screen_max.y = max(screen_max.y, clip.y / clip.w);
+	}
+
+	depth = project_to_vec3f(screen_transform * ((bounds.min + bounds.max) * 0.5f)).z;
+	return max(screen_max.x - screen_min.x, screen_max.y - screen_min.y);
+}
+
+static void visit_chunk(StreamedMesh &mesh, int chunk, const Mat4f &screen_transform, int &candidate_count) {
+	auto &entry = mesh.chunks[chunk];
+	auto &state = mesh.chunk_states[chunk];
+	auto coarsest = mesh.header.level_count - 1;
+
+	f32 depth;
+	auto size = projected_size(entry.bounds, screen_transform, depth);
+
+	auto wanted = 0;
+	auto threshold = mesh.lod_pixels;
+	while (wanted < coarsest && (size < threshold || (state.failed_levels & (1 << wanted)))) {
+		wanted++;
+		threshold *= 0.5f;
+	}
+
+	// The level it wants if that's in, otherwise the nearest finer one, otherwise the nearest coarser one.
+	// The coarsest is always in, so there's always something.
+	auto level = -1;
+	for (auto finer = wanted; finer >= 0 && level < 0; --finer) {
+		if (level_ready(mesh, chunk, finer)) level = finer;
+	}
+
+	for (auto coarser = wanted + 1; coarser <= coarsest && level < 0; ++coarser) {
+		if (level_ready(mesh, chunk, coarser)) level = coarser;
+	}
+
+	if (level != wanted && state.slots[wanted] < 0) {
+		mesh.candidates[candidate_count++] = StreamRequest{ size, chunk, wanted };
+	}
+
+	if (level > wanted) mesh.stats.coarser++;
+	if (level < coarsest) mesh.slots[state.slots[level]].last_used = mesh.frame;
+
+	auto &drawn = mesh.drawn[mesh.drawn_count++];
+	drawn.mesh.corners = level_corners(mesh, chunk, level);
+	drawn.mesh.triangle_count = entry.levels[level].triangle_count;
+	drawn.mesh.bounds_min = entry.bounds.min;
+	drawn.mesh.bounds_max = entry.bounds.max;
+	drawn.depth = depth;
+	drawn.chunk = chunk;
+	drawn.level = level;
+
+	mesh.stats.visible++;
+	mesh.stats.drawn[level]++;
+}
+
+// A free slot, or the one drawn the longest ago if there aren't any. Nothing drawn this frame gets taken,
+// nor anything still waiting for an update to see its read, and -1 means everything is.
+static int take_slot(StreamedMesh &mesh) {
+	if (mesh.free_count) return mesh.free_slots[--mesh.free_count];
+
+	auto oldest = -1;
+	for (auto index = 0; index < mesh.slot_count; ++index) {
+		auto &slot = mesh.slots[index];
+		if (slot.state != STREAM_SLOT_READY || slot.pending || slot.last_used == mesh.frame) continue;
+		if (oldest < 0 || slot.last_used < mesh.slots[oldest].last_used) oldest = index;
+	}
+
+	if (oldest >= 0) {
+		auto &slot = mesh.slots[oldest];
+		mesh.chunk_states[slot.chunk].slots[slot.level] = -1;
+		mesh.stats.evictions++;
+	}
+
+	return oldest;
+}
+
+static int compare_biggest_first(const void *a, const void *b) {
+	auto size_a = ((const StreamRequest *)a)->size;
+	auto size_b = ((const StreamRequest *)b)->size;
+
+	if (size_a > size_b) return -1;
+	if (size_a < size_b) return 1;
+	return 0;
+}
+
+static int compare_nearest_first(const void *a, const void *b) {
+	auto depth_a = ((const DrawnChunk *)a)->depth;
+	auto depth_b = ((const DrawnChunk *)b)->depth;
+
+	// Bigger depth is nearer.
+	if (depth_a > depth_b) return -1;
+	if (depth_a < depth_b) return 1;
+	return 0;
+}
+
+void update_streamed_mesh(StreamedMesh &mesh, const Frustum &frustum, const Mat4f &screen_transform) {
+	TRACE_SCOPE("update_streamed_mesh");
+
+	mesh.frame++;
+
+	auto &stats = mesh.stats;
+	stats.visible = 0;
+	stats.coarser = 0;
+	stats.started = 0;
+	for (auto level = 0; level < MAX_CHUNK_LEVELS; ++level) stats.drawn[level] = 0;
+
+	// What came in since the last update.
+	auto still_loading = 0;
+	for (auto index = 0; index < mesh.loading_count; ++index) {
+		auto slot_index = mesh.loading[index];
+		auto &slot = mesh.slots[slot_index];
+
+		if (slot.state == STREAM_SLOT_LOADING) {
+			mesh.loading[still_loading++] = slot_index;
+			continue;
+		}
+
+		slot.pending = false;
+		if (slot.state == STREAM_SLOT_READY) {
+			stats.reads++;
+			stats.bytes_read += level_size(mesh.chunks[slot.chunk].levels[slot.level]);
+		} else {
+			auto &state = mesh.chunk_states[slot.chunk];
+			state.slots[slot.level] = -1;
+			state.failed_levels |= 1 << slot.level;
+			stats.failures++;
+
+			slot.state = STREAM_SLOT_FREE;
+			mesh.free_slots[mesh.free_count++] = slot_index;
+		}
+	}
+	mesh.loading_count = still_loading;
+
+	// What's in the frustum. Everything under a node that's all the way inside is too, without testing it.
+	mesh.drawn_count = 0;
+	auto candidate_count = 0;
+	auto stack_count = 0;
+	mesh.cull_stack[stack_count++] = 0;
+
+	while (stack_count) {
+		auto entry = mesh.cull_stack[--stack_count];
+		auto inside = entry < 0;
+		auto &node = mesh.nodes[inside ? ~entry : entry];
+
+		if (!inside) {
+			auto test = test_box(frustum, node.bounds.min, node.bounds.max);
+			if (test == FRUSTUM_OUTSIDE) continue;
+			inside = test == FRUSTUM_INSIDE;
+		}
+
+		if (node.count) {
+			for (auto chunk = node.offset; chunk < node.offset + node.count; ++chunk) {
+				if (inside || test_box(frustum, mesh.chunks[chunk].bounds.min, mesh.chunks[chunk].bounds.max) != FRUSTUM_OUTSIDE) {
+					visit_chunk(mesh, chunk, screen_transform, candidate_count);
+				}
+			}
+		} else {
+			// Inside nodes go on the stack flipped, so their children don't get tested again.
+			auto left = (int)(&node - mesh.nodes) + 1;
+			mesh.cull_stack[stack_count++] = inside ? ~node.offset : node.offset;
+			mesh.cull_stack[stack_count++] = inside ? ~left : left;
+		}
+	}
+
+	// The reads, for what's biggest on screen first.
+	qsort(mesh.candidates, candidate_count, sizeof(StreamRequest), compare_biggest_first);
+
+	for (auto index = 0; index < candidate_count; ++index) {
+		if (stats.started == MAX_STREAM_REQUESTS_PER_UPDATE || mesh.loading_count == MAX_STREAM_REQUESTS) break;
+
+		auto slot_index = take_slot(mesh);
+		if (slot_index < 0) break;
+
+		auto &request = mesh.candidates[index];
+		auto &slot = mesh.slots[slot_index];
+		slot.chunk = request.chunk;
+		slot.level = request.level;
+		slot.state = STREAM_SLOT_LOADING;
+		slot.last_used = mesh.frame;
+		slot.pending = true;
+
+		mesh.chunk_states[request.chunk].slots[request.level] = slot_index;
+		mesh.loading[mesh.loading_count++] = slot_index;
+		mesh.requests[mesh.request_count % MAX_STREAM_REQUESTS] = slot_index;
+
+		// The increment is a full barrier, so the slot is filled in before any streaming thread can get to it.
+		InterlockedIncrement(&mesh.request_count);
+		ReleaseSemaphore(mesh.request_semaphore, 1, 0);
+		stats.started++;
+	}
+
+	stats.loading = mesh.loading_count;
+	stats.slots_used = mesh.slot_count - mesh.free_count;
+
+	qsort(mesh.drawn, mesh.drawn_count, sizeof(DrawnChunk), compare_nearest_first);
+}
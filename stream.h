@@ -0,0 +1,185 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+#include "vectors.h"
+#include "matrix_math.h"
+#include "render.h"
+#include "camera.h"
+#include "instancing.h"
+#include "arena.h"
+#include "partition.h"
+#include "trace.h"
+
+// Drawing a chunked mesh (see partition.h) that's too big to load, by only keeping the chunks the camera needs
+// in memory. What's always there is the tables and the coarsest level of every chunk, which is a small fraction
+// of the file. Every other level gets read when it's wanted, into a cache that never grows past the budget
+// given to open_streamed_mesh.
+//
+// Every frame, update_streamed_mesh goes down the file's BVH to find the chunks in the frustum, and works out the
+// level each one wants from how big it is on screen. A chunk whose level isn't in the cache yet gets drawn with
+// the nearest one that is (the coarsest, if nothing else), and the ones that are biggest on screen get their reads
+// started. The reads happen on the streaming threads, so a frame never waits on the disk. When the cache is full,
+// a read takes the slot of whatever was drawn the longest ago, as long as that wasn't this frame.
+//
+// The cache is slots of the size of the biggest level in the file, so a level takes one slot however small it is.
+// Levels are read without going through the system's file cache. On a machine with less memory than the file, the
+// file cache would fill up with the scan and push everything else out, and the budget would mean nothing.
+
+const int STREAM_THREAD_COUNT = 2;
+
+// The most reads waiting or going at once.
+const int MAX_STREAM_REQUESTS = 64;
+
+// How many reads an update can start. The rest wait for the next one, which will have a better idea anyway.
+const int MAX_STREAM_REQUESTS_PER_UPDATE = 16;
+
+// A chunk this many pixels across wants level 0. Each level after that is for chunks half the size of the last.
+const f32 STREAM_LOD_PIXELS = 256;
+
+enum StreamSlotState {
+	STREAM_SLOT_FREE,
+	STREAM_SLOT_LOADING,
+	STREAM_SLOT_READY,
+	STREAM_SLOT_FAILED,
+};
+
+struct StreamSlot {
+	int chunk;
+	int level;
+	volatile LONG state;
+
+	// The last update that drew it, or that started reading it.
+	u32 last_used;
+
+	// Set while it's in StreamedMesh::loading. A read can finish after an update has looked through that, and
+	// then the slot is ready but its read hasn't been counted yet, so it can't be taken for another one.
+	bool pending;
+};
+
+struct StreamedChunk {
+	// The slot each level is in, or -1. The coarsest level never is, since it's always in memory.
+	int slots[MAX_CHUNK_LEVELS];
+
+	// A bit per level that couldn't be read. Those don't get asked for again.
+	u32 failed_levels;
+};
+
+struct DrawnChunk {
+	// Pointing into the cache or the coarse block.
+	PreparedMesh mesh;
+
+	// For drawing front to back.
+	f32 depth;
+
+	int chunk;
+	int level;
+};
+
+// Candidates for reading, from one update.
+struct StreamRequest {
+	f32 size;
+	int chunk;
+	int level;
+};
+
+// From the last update, except for the totals at the end, which are since open_streamed_mesh.
+struct StreamStats {
+	int visible;
+	int drawn[MAX_CHUNK_LEVELS];
+
+	// Drawn coarser than they want to be, because what they want isn't in yet.
+	int coarser;
+
+	int started;
+	int loading;
+	int slots_used;
+
+	u64 reads;
+	u64 evictions;
+	u64 failures;
+	u64 bytes_read;
+};
+
+struct StreamedMesh;
+
+// Each streaming thread reads through a handle of its own. A handle opened without FILE_FLAG_OVERLAPPED only
+// does one read at a time, so with just the one, the threads would take turns instead of reading side by side.
+struct StreamThread {
+	StreamedMesh *mesh;
+	HANDLE file;
+	HANDLE thread;
+};
+
+struct StreamedMesh {
+	ChunkFileHeader header;
+	ChunkNode *nodes;
+	ChunkEntry *chunks;
+	StreamedChunk *chunk_states;
+
+	// The coarsest level of every chunk, read in full by open_streamed_mesh.
+	u8 *coarse;
+
+	// The tables, the coarse block and update_streamed_mesh's scratch.
+	MemoryArena arena;
+
+	u8 *cache;
+	u64 slot_size;
+	StreamSlot *slots;
+	int slot_count;
+	int *free_slots;
+	int free_count;
+
+	f32 lod_pixels;
+	u32 frame;
+
+	// The slots being read, so an update only has to look at those to see what came in.
+	int loading[MAX_STREAM_REQUESTS];
+	int loading_count;
+
+	// A ring of slots to read. update_streamed_mesh adds to the end, and each release of the semaphore lets one
+	// streaming thread take the next one. There are never more in it than there are slots loading, so it can't overflow.
+	int requests[MAX_STREAM_REQUESTS];
+	volatile LONG request_count;
+	volatile LONG next_request;
+	HANDLE request_semaphore;
+
+	StreamThread threads[STREAM_THREAD_COUNT];
+	int thread_count;
+	volatile LONG stopping;
+
+	// Filled by update_streamed_mesh, front to back.
+	DrawnChunk *drawn;
+	int drawn_count;
+
+	// Scratch for update_streamed_mesh, big enough for every chunk and node.
+	StreamRequest *candidates;
+	int *cull_stack;
+
+	StreamStats stats;
+};
+
+// budget is how many bytes the cache gets, on top of the tables and the coarse block. It has to have room for
+// at least one level. Returns false if the file isn't a chunked mesh, or there isn't the memory for it.
+bool open_streamed_mesh(StreamedMesh &mesh, const char *path, u64 budget);
+
+// Waits for the reads that are going, so nothing is writing into the cache when it goes away.
+void close_streamed_mesh(StreamedMesh &mesh);
+
+// Works out what to draw this frame, and starts reading what's missing. screen_transform takes world space to
+// the screen, the same as for make_frustum. Has to be called from one thread, and not while drawing.
+void update_streamed_mesh(StreamedMesh &mesh, const Frustum &frustum, const Mat4f &screen_transform);
+
+// Draws what the last update_streamed_mesh picked. Returns how many fragments got shaded.
+template <typename Shader>
+u64 draw_streamed_mesh(RenderTarget &target, const StreamedMesh &mesh, Shader &shader, const Mat4f &screen_transform) {
+	TRACE_SCOPE("draw_streamed_mesh");
+
+	u64 fragments_shaded = 0;
+	for (auto index = 0; index < mesh.drawn_count; ++index) {
+		fragments_shaded += draw_prepared_mesh(target, mesh.drawn[index].mesh, shader, screen_transform);
+	}
+
+	return fragments_shaded;
+}
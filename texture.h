@@ -2,8 +2,7 @@
 
 #include "types.h"
 #include "vectors.h"
-
-struct Color;
+#include "color.h"
 
 struct TextureMap {
 	Color *pixel_data;
@@ -14,4 +13,11 @@ struct TextureMap {
 			int height;
 		};
 	};
-};
\ No newline at end of file
+};
+
+// Point sampling. Coordinates outside [0, 1) get clamped to the edge texel.
+inline Color sample_nearest(const TextureMap &texture_map, f32 u, f32 v) {
+	auto x = clamp((int)(u * texture_map.width), 0, texture_map.width - 1);
+	auto y = clamp((int)(v * texture_map.height), 0, texture_map.height - 1);
+	return texture_map.pixel_data[y * texture_map.width + x];
+}
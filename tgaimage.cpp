@@ -4,9 +4,12 @@
 #include "tgaimage.h"
 #include "utils.h"
 #include "texture.h"
+#include "trace.h"
 
 TgaImageLoadResult load_tga_image(const char *file_name) {
-	TgaImageLoadResult result;
+	TRACE_SCOPE("load_tga_image");
+
+	TgaImageLoadResult result = {};
 
 	auto file_contents = read_entire_file(file_name);
 
@@ -34,6 +37,11 @@ TgaImageLoadResult load_tga_image(const char *file_name) {
 	return result;
 }
 
+void free_tga_image(TgaImageLoadResult &result) {
+	if (result.file_contents) VirtualFree(result.file_contents, 0, MEM_RELEASE);
+	result = {};
+}
+
 Color get_next_pixel(TgaImagePixelCursor *pixel_data) {
 	bool need_pixel = false;
 	if (pixel_data->num_pixels_in_run == 0) {
@@ -58,13 +66,16 @@ Color get_next_pixel(TgaImagePixelCursor *pixel_data) {
 	return pixel_data->current_pixel_color;
 }
 
-TextureMap decompress_tga_image(const TgaImage *texture) {
+TextureMap decompress_tga_image(const TgaImage *texture, MemoryArena &arena) {
+	TRACE_SCOPE("decompress_tga_image");
+
 	auto stride = texture->header->image_spec.image_width;
 
 	TextureMap result;
 	result.width = texture->header->image_spec.image_width;
 	result.height = texture->header->image_spec.image_height;
-	result.pixel_data = (Color *)malloc(texture->header->image_spec.image_width * texture->header->image_spec.image_width * sizeof(Color));
+	result.pixel_data = push_array(arena, Color, result.width * result.height);
+	if (!result.pixel_data) return result;
 
 	TgaImagePixelCursor pixel = {};
 	pixel.next_packet = texture->pixel_packets;
@@ -76,4 +87,73 @@ TextureMap decompress_tga_image(const TgaImage *texture) {
 	}
 
 	return result;
-}
\ No newline at end of file
+}
+
+static u8 *put_pixel(u8 *out, Color color) {
+	*out++ = color.b;
+	*out++ = color.g;
+	*out++ = color.r;
+	return out;
+}
+
+static bool same_rgb(Color a, Color b) {
+	return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+bool write_tga_image(const char *file_name, const TextureMap &texture) {
+	TRACE_SCOPE("write_tga_image");
+
+	// Worst case is a raw packet header for every 128 pixels on top of the pixels themselves.
+	auto row_size = texture.width * 3 + (texture.width + 127) / 128;
+	auto size = sizeof(TgaImageHeader) + (size_t)row_size * texture.height;
+	auto contents = (u8 *)VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!contents) return false;
+	defer { VirtualFree(contents, 0, MEM_RELEASE); };
+
+	auto &header = *(TgaImageHeader *)contents;
+	header.image_type = 10;
+	header.image_spec.image_width = (u16)texture.width;
+	header.image_spec.image_height = (u16)texture.height;
+	header.image_spec.pixel_depth = 24;
+
+	auto out = contents + sizeof(TgaImageHeader);
+
+	// Packets don't cross rows, as the format asks.
+	for (auto row = 0; row < texture.height; ++row) {
+		auto pixels = &texture.pixel_data[row * texture.width];
+		auto column = 0;
+
+		while (column < texture.width) {
+			auto run = 1;
+			while (column + run < texture.width && run < 128 && same_rgb(pixels[column + run], pixels[column])) run++;
+
+			if (run > 1) {
+				*out++ = (u8)(0x80 | (run - 1));
+				out = put_pixel(out, pixels[column]);
+				column += run;
+				continue;
+			}
+
+			// A raw packet goes until the next pair of matching pixels, where a run can start.
+			auto count = 1;
+			while (column + count < texture.width && count < 128 &&
+				!(column + count + 1 < texture.width && same_rgb(pixels[column + count], pixels[column + count + 1]))) {
+				count++;
+			}
+
+			*out++ = (u8)(count - 1);
+			for (auto index = 0; index < count; ++index) {
+				out = put_pixel(out, pixels[column + index]);
+			}
+			column += count;
+		}
+	}
+
+	auto file = CreateFile(file_name, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	defer { CloseHandle(file); };
+
+	auto written_size = (DWORD)(out - contents);
+	DWORD written;
+	return WriteFile(file, contents, written_size, &written, 0) && written == written_size;
+}
@@ -2,6 +2,7 @@
 
 #include "types.h"
 #include "color.h"
+#include "arena.h"
 
 #pragma pack(push, 1)
 struct TgaImageHeader {
@@ -31,7 +32,7 @@ struct TgaImage {
 	u8 *pixel_packets;
 };
 
-// The result of loading the tga image. The file contents are not freed.
+// The result of loading the tga image. The file contents are not freed until free_tga_image.
 // Data are shared between the file contents and the image, so the image
 // is unavailable after freeing.
 struct TgaImageLoadResult {
@@ -50,5 +51,13 @@ struct TgaImagePixelCursor {
 struct TextureMap;
 
 TgaImageLoadResult load_tga_image(const char *file_name);
+void free_tga_image(TgaImageLoadResult &result);
 Color get_next_pixel(TgaImagePixelCursor *pixel_data);
-TextureMap decompress_tga_image(const TgaImage *texture);
\ No newline at end of file
+
+// The pixels go in arena, so the texture map is freed along with it. If there isn't room,
+// pixel_data comes back null.
+TextureMap decompress_tga_image(const TgaImage *texture, MemoryArena &arena);
+
+// Writes the texture as the same kind of TGA load_tga_image reads (run length encoded 24 bit), with
+// row 0 first, so it comes back exactly as it went out. Alpha is dropped.
+bool write_tga_image(const char *file_name, const TextureMap &texture);
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "trace.h"
+
+#if defined(RENDER_TRACE)
+
+struct TraceEvent {
+	const char *name;
+	u64 begin;
+	u64 end;
+};
+
+// Only the owning thread writes to a ring. write_trace reads events [0, written) modulo the size,
+// minus whatever has been overwritten.
+struct TraceRing {
+	DWORD thread_id;
+	char thread_name[32];
+
+	volatile LONG64 written;
+	TraceEvent events[TRACE_RING_EVENTS];
+};
+
+static TraceRing *GlobalTraceRings[MAX_TRACE_THREADS];
+static volatile LONG GlobalTraceRingCount;
+
+static thread_local TraceRing *ThreadTraceRing;
+
+// A thread gets a ring the first time it records anything. If there's no room for it, or the
+// allocation fails, its events just get dropped.
+static TraceRing *thread_trace_ring() {
+	if (!ThreadTraceRing) {
+		auto ring = (TraceRing *)VirtualAlloc(0, sizeof(TraceRing), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!ring) return 0;
+
+		ring->thread_id = GetCurrentThreadId();
+
+		auto slot = InterlockedIncrement(&GlobalTraceRingCount) - 1;
+		assert(slot < MAX_TRACE_THREADS);
+		if (slot >= MAX_TRACE_THREADS) {
+			VirtualFree(ring, 0, MEM_RELEASE);
+			return 0;
+		}
+
+		// The pointer goes in after the ring is set up, so write_trace never sees a half-made one.
+		InterlockedExchangePointer((PVOID volatile *)&GlobalTraceRings[slot], ring);
+		ThreadTraceRing = ring;
+	}
+
+	return ThreadTraceRing;
+}
+
+u64 trace_timestamp() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (u64)counter.QuadPart;
+}
+
+void record_trace_event(const char *name, u64 begin, u64 end) {
+	auto ring = thread_trace_ring();
+	if (!ring) return;
+
+	auto &event = ring->events[ring->written % TRACE_RING_EVENTS];
+	event.name = name;
+	event.begin = begin;
+	event.end = end;
+
+	// Volatile stores have release semantics with MSVC, so the event is there before the count says it is.
+	ring->written = ring->written + 1;
+}
+
+void trace_thread_name(const char *name) {
+	auto ring = thread_trace_ring();
+	if (!ring) return;
+
+	// A name too long for the trace just gets cut off.
+	strncpy_s(ring->thread_name, sizeof(ring->thread_name), name, _TRUNCATE);
+}
+
+bool write_trace(const char *file_name) {
+	FILE *file;
+	if (fopen_s(&file, file_name, "wb") != 0) return false;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	auto microseconds_per_tick = 1000000.0 / (f64)frequency.QuadPart;
+
+	// Timestamps are relative to the earliest event so the numbers in the viewer stay readable.
+	auto ring_count = min((int)GlobalTraceRingCount, MAX_TRACE_THREADS);
+	auto earliest = ~(u64)0;
+
+	for (auto index = 0; index < ring_count; ++index) {
+		auto ring = GlobalTraceRings[index];
+		if (!ring) continue;
+
+		auto written = (u64)ring->written;
+		auto first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+		for (auto event_index = first; event_index < written; ++event_index) {
+			earliest = min(earliest, ring->events[event_index % TRACE_RING_EVENTS].begin);
+		}
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	auto first_line = true;
+
+	for (auto index = 0; index < ring_count; ++index) {
+		auto ring = GlobalTraceRings[index];
+		if (!ring) continue;
+
+		if (ring->thread_name[0]) {
+			fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+				first_line ? "" : ",\n", (unsigned long)ring->thread_id, ring->thread_name);
+			first_line = false;
+		}
+
+		auto written = (u64)ring->written;
+		auto first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+
+		for (auto event_index = first; event_index < written; ++event_index) {
+			auto &event = ring->events[event_index % TRACE_RING_EVENTS];
+
+			// Complete events. The viewer works out the nesting from the times.
+			fprintf(file, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+				first_line ? "" : ",\n", event.name, (unsigned long)ring->thread_id,
+				(event.begin - earliest) * microseconds_per_tick, (event.end - event.begin) * microseconds_per_tick);
+			first_line = false;
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+
+	auto written_ok = !ferror(file);
+	fclose(file);
+	return written_ok;
+}
+
+#else
+
+bool write_trace(const char *file_name) {
+	return false;
+}
+
+#endif
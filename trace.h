@@ -0,0 +1,51 @@
+#pragma once
+
+#include "types.h"
+#include "utils.h"
+
+// Timeline tracing. Put TRACE_SCOPE("name") at the top of a block and the time spent in it shows up
+// as a bar on that thread's track when the dump from write_trace gets opened in chrome://tracing
+// or ui.perfetto.dev. That's the way to see one worker sitting idle while another is still on its
+// band, or the render thread stuck waiting on the present thread, which an FPS number averages away.
+//
+// All of it compiles to nothing unless RENDER_TRACE is defined (add it under C/C++ > Preprocessor
+// in the project settings). Even when it's on, each scope is just two QueryPerformanceCounter calls
+// and a store into the thread's own ring, so it's fine per draw call or per band. Per pixel or per
+// triangle it would swamp what it's measuring.
+//
+// Names have to be string literals (or otherwise live forever). Only the pointer is kept.
+
+// Completed scopes each thread keeps. Once a ring is full the oldest ones get overwritten.
+const int TRACE_RING_EVENTS = 1 << 16;
+const int MAX_TRACE_THREADS = 128;
+
+#if defined(RENDER_TRACE)
+
+u64 trace_timestamp();
+void record_trace_event(const char *name, u64 begin, u64 end);
+
+// Shows up as the track name instead of the thread id. The name gets copied.
+void trace_thread_name(const char *name);
+
+struct TraceScope {
+	const char *name;
+	u64 begin;
+
+	TraceScope(const char *name_) : name(name_), begin(trace_timestamp()) {}
+	~TraceScope() { record_trace_event(name, begin, trace_timestamp()); }
+};
+
+#define TRACE_SCOPE(name) TraceScope TOKENPASTE2(trace_scope_, __COUNTER__)(name)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD_NAME(name)
+
+#endif
+
+// Writes everything still in the rings as Chrome trace-event JSON. The rings are read without stopping
+// anybody, so call it when nothing else is running, like at exit. Returns false if the file couldn't be
+// written, or if tracing is compiled out.
+bool write_trace(const char *file_name);
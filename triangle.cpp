@@ -1,3 +1,6 @@
+#include <windows.h>
+#include <math.h>
+
 #include "triangle.h"
 
 Vec3f Triangle::barycentric_coefficients_of(const int x, const int y) const {
@@ -21,4 +24,62 @@ Vec3f Triangle::barycentric_coefficients_of(const int x, const int y) const {
 	if ((bary_x + bary_y + bary_z) - 1.0f > 0.001f) return Vec3f{ -1, 1, 1 };
 
 	return Vec3f { bary_x, bary_y, bary_z };
-}
\ No newline at end of file
+}
+
+bool setup_triangle(const Triangle &triangle, int width, int height, TriangleSetup &setup) {
+	auto min_x = clamp(min(triangle.p1.x, min(triangle.p2.x, triangle.p3.x)), 0.0f, (f32)width);
+	auto max_x = clamp(max(triangle.p1.x, max(triangle.p2.x, triangle.p3.x)), 0.0f, (f32)width);
+	auto min_y = clamp(min(triangle.p1.y, min(triangle.p2.y, triangle.p3.y)), 0.0f, (f32)height);
+	auto max_y = clamp(max(triangle.p1.y, max(triangle.p2.y, triangle.p3.y)), 0.0f, (f32)height);
+
+	// Same pixels as looping while x < max_x, just as integers.
+	setup.min_x = (int)min_x;
+	setup.min_y = (int)min_y;
+	setup.max_x = (int)ceilf(max_x) - 1;
+	setup.max_y = (int)ceilf(max_y) - 1;
+
+	if (setup.max_x < setup.min_x || setup.max_y < setup.min_y) return false;
+
+	setup.origin_x = setup.min_x;
+	setup.origin_y = setup.min_y;
+
+	Vec3f points[] = {
+		Vec3f{ triangle.p1.x - setup.origin_x, triangle.p1.y - setup.origin_y, triangle.p1.z },
+		Vec3f{ triangle.p2.x - setup.origin_x, triangle.p2.y - setup.origin_y, triangle.p2.z },
+		Vec3f{ triangle.p3.x - setup.origin_x, triangle.p3.y - setup.origin_y, triangle.p3.z },
+	};
+
+	// The edge function for a vertex is the one for the edge across from it.
+	for (auto edge = 0; edge < 3; ++edge) {
+		auto &from = points[(edge + 1) % 3];
+		auto &to = points[(edge + 2) % 3];
+
+		setup.edge_a[edge] = from.y - to.y;
+		setup.edge_b[edge] = to.x - from.x;
+		setup.edge_c[edge] = from.x * to.y - to.x * from.y;
+	}
+
+	auto double_area = setup.edge_a[0] * points[0].x + setup.edge_b[0] * points[0].y + setup.edge_c[0];
+
+	// Same cutoff barycentric_coefficients_of uses for slivers.
+	if (fabsf(double_area) < 0.01f) return false;
+
+	// Either winding gets drawn. Flipping the signs means inside is always positive.
+	if (double_area < 0) {
+		for (auto edge = 0; edge < 3; ++edge) {
+			setup.edge_a[edge] = -setup.edge_a[edge];
+			setup.edge_b[edge] = -setup.edge_b[edge];
+			setup.edge_c[edge] = -setup.edge_c[edge];
+		}
+
+		double_area = -double_area;
+	}
+
+	setup.inverse_double_area = 1.0f / double_area;
+
+	setup.z_a = (points[0].z * setup.edge_a[0] + points[1].z * setup.edge_a[1] + points[2].z * setup.edge_a[2]) * setup.inverse_double_area;
+	setup.z_b = (points[0].z * setup.edge_b[0] + points[1].z * setup.edge_b[1] + points[2].z * setup.edge_b[2]) * setup.inverse_double_area;
+	setup.z_c = (points[0].z * setup.edge_c[0] + points[1].z * setup.edge_c[1] + points[2].z * setup.edge_c[2]) * setup.inverse_double_area;
+
+	return true;
+}
@@ -13,4 +13,66 @@ struct Triangle {
 	// Basically all of my time is being spent in this method, with most of _that_
 	// being spent divided between cross and fabsf. I'm not sure how to make that any better.
 	Vec3f barycentric_coefficients_of(const int x, const int y) const;
-};
\ No newline at end of file
+};
+
+// Everything needed to test and interpolate a triangle at a pixel, worked out once per triangle
+// so the per-pixel work is a few multiply-adds instead of a cross product and two divides.
+//
+// Everything is relative to (origin_x, origin_y), the corner of the clipped bounding box. Keeping the
+// numbers small keeps the edge functions from losing precision far away from the origin of the screen.
+//
+// The shaded path and the depth-only path both go through edge_row/edge_at and depth_row/depth_at,
+// and both do the same multiplies and adds in the same order. That means they come up with the exact
+// same depth for a pixel, which is what lets a depth pre-pass test for equality.
+struct TriangleSetup {
+	// One edge function per vertex, e = a * dx + b * dy + c. It's the vertex's barycentric
+	// coefficient times twice the triangle's area, so all three are >= 0 inside the triangle.
+	f32 edge_a[3];
+	f32 edge_b[3];
+	f32 edge_c[3];
+
+	// z = z_a * dx + z_b * dy + z_c
+	f32 z_a;
+	f32 z_b;
+	f32 z_c;
+
+	f32 inverse_double_area;
+
+	int origin_x;
+	int origin_y;
+
+	// Inclusive, already clamped to the target.
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+};
+
+// Returns false when there's nothing to draw, either because the triangle is degenerate or
+// because its bounding box is off the [0, width) x [0, height) area.
+bool setup_triangle(const Triangle &triangle, int width, int height, TriangleSetup &setup);
+
+// Narrows a set up triangle down to the rows [min_y, max_y], for when a target is split between threads.
+// The origin stays where it was, so every pixel comes out exactly like it would have without the clip.
+// Returns false if there's nothing left.
+inline bool clip_rows(TriangleSetup &setup, int min_y, int max_y) {
+	if (setup.min_y < min_y) setup.min_y = min_y;
+	if (setup.max_y > max_y) setup.max_y = max_y;
+	return setup.min_y <= setup.max_y;
+}
+
+inline f32 edge_row(const TriangleSetup &setup, int edge, int y) {
+	return setup.edge_b[edge] * (f32)(y - setup.origin_y) + setup.edge_c[edge];
+}
+
+inline f32 edge_at(const TriangleSetup &setup, int edge, f32 row, int x) {
+	return setup.edge_a[edge] * (f32)(x - setup.origin_x) + row;
+}
+
+inline f32 depth_row(const TriangleSetup &setup, int y) {
+	return setup.z_b * (f32)(y - setup.origin_y) + setup.z_c;
+}
+
+inline f32 depth_at(const TriangleSetup &setup, f32 row, int x) {
+	return setup.z_a * (f32)(x - setup.origin_x) + row;
+}
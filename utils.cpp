@@ -11,6 +11,8 @@ FileReadResult read_entire_file(const char *file_name) {
 		return read_result;
 	}
 
+	defer { CloseHandle(handle); };
+
 	LARGE_INTEGER file_size;
 	if (!GetFileSizeEx(handle, &file_size)) {
 		return read_result;
@@ -19,7 +21,10 @@ FileReadResult read_entire_file(const char *file_name) {
 	assert(file_size.QuadPart <= 0xFFFFFFFF);
 	auto file_size_32 = (u32)file_size.QuadPart;
 
-	auto result = (char *)malloc(file_size_32);
+	// VirtualAlloc rather than malloc, since the file's usually big and only around until it's parsed.
+	// The extra byte is a terminator (fresh pages are zeroed), so text files can go straight to strtok.
+	assert(file_size_32 < 0xFFFFFFFF);
+	auto result = (char *)VirtualAlloc(0, file_size_32 + 1, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 	if (!result) {
 		return read_result;
 	}
@@ -27,7 +32,7 @@ FileReadResult read_entire_file(const char *file_name) {
 	read_result.result = result;
 
 	DWORD bytes_read;
-	if (!ReadFile(handle, result, file_size_32, &bytes_read, 0) && file_size_32 != bytes_read) {
+	if (!ReadFile(handle, result, file_size_32, &bytes_read, 0) || file_size_32 != bytes_read) {
 		VirtualFree(result, 0, MEM_RELEASE);
 		read_result.result = NULL;
 		return read_result;
@@ -38,3 +43,25 @@ FileReadResult read_entire_file(const char *file_name) {
 
 	return read_result;
 }
+
+bool get_file_size(const char *file_name, u64 &size) {
+	auto handle = CreateFile(file_name, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	defer { CloseHandle(handle); };
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size)) {
+		return false;
+	}
+
+	size = (u64)file_size.QuadPart;
+	return true;
+}
+
+void free_file_contents(FileReadResult &file) {
+	if (file.result) VirtualFree(file.result, 0, MEM_RELEASE);
+	file = {};
+}
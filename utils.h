@@ -10,7 +10,11 @@ struct FileReadResult {
 	bool read;
 };
 
+// The contents come from VirtualAlloc. Give them back with free_file_contents.
 FileReadResult read_entire_file(const char *file_name);
+void free_file_contents(FileReadResult &file);
+
+bool get_file_size(const char *file_name, u64 &size);
 
 // ===============================================================
 // Taken from: https://gist.github.com/p2004a/045726d70a490d12ad62
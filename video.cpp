@@ -0,0 +1,259 @@
+#include <windows.h>
+#include <emmintrin.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "video.h"
+#include "trace.h"
+
+// Full range BT.601 in 8.8 fixed point, in the order the bytes of a pixel are in memory (b, g, r, a).
+// Each row of weights adds up to 256 for Y and 0 for U and V, so white and black come out exact.
+static const s16 Y_WEIGHTS[4] = { 29, 150, 77, 0 };
+static const s16 U_WEIGHTS[4] = { 128, -85, -43, 0 };
+static const s16 V_WEIGHTS[4] = { -21, -107, 128, 0 };
+
+static inline __m128i weights_of(const s16 weights[4]) {
+	return _mm_setr_epi16(weights[0], weights[1], weights[2], weights[3], weights[0], weights[1], weights[2], weights[3]);
+}
+
+// Four pixels in, the four weighted sums out as 32-bit lanes.
+static inline __m128i weigh_pixels(__m128i pixels, __m128i weights) {
+	auto zero = _mm_setzero_si128();
+
+	// Each pixel comes out of the multiply-add as two halves, b * wb + g * wg and r * wr + a * 0.
+	auto low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+	auto high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+
+	// Add the halves together (lanes 0 and 2 end up with the sums), then pull the sums together.
+	low = _mm_add_epi32(low, _mm_srli_epi64(low, 32));
+	high = _mm_add_epi32(high, _mm_srli_epi64(high, 32));
+	low = _mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0));
+	high = _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0));
+
+	return _mm_unpacklo_epi64(low, high);
+}
+
+static inline int weigh_pixel(u32 pixel, const s16 weights[4]) {
+	return (pixel & 0xFF) * weights[0] + ((pixel >> 8) & 0xFF) * weights[1] + ((pixel >> 16) & 0xFF) * weights[2];
+}
+
+// The same rounding as _mm_avg_epu8, so the scalar leftovers match the SIMD part exactly.
+static inline u32 average_pixels(u32 a, u32 b) {
+	u32 result = 0;
+	for (auto shift = 0; shift < 32; shift += 8) {
+		result |= ((((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + 1) >> 1) << shift;
+	}
+
+	return result;
+}
+
+static inline const u32 *source_row(const Backbuffer &buffer, int top_down_row) {
+	return (const u32 *)&buffer.memory[(buffer.height - 1 - top_down_row) * buffer.stride];
+}
+
+void convert_to_yuv420(const Backbuffer &buffer, u8 *y, u8 *u, u8 *v) {
+	assert(buffer.width % 2 == 0 && buffer.height % 2 == 0);
+
+	auto width = buffer.width;
+	auto rounding = _mm_set1_epi32(128);
+	auto chroma_offset = _mm_set1_epi32(128);
+	auto y_weights = weights_of(Y_WEIGHTS);
+	auto u_weights = weights_of(U_WEIGHTS);
+	auto v_weights = weights_of(V_WEIGHTS);
+
+	for (auto row = 0; row < buffer.height; ++row) {
+		auto source = source_row(buffer, row);
+		auto destination = &y[row * width];
+
+		auto x = 0;
+		for (; x + 8 <= width; x += 8) {
+			auto first = weigh_pixels(_mm_loadu_si128((const __m128i *)&source[x]), y_weights);
+			auto second = weigh_pixels(_mm_loadu_si128((const __m128i *)&source[x + 4]), y_weights);
+			first = _mm_srai_epi32(_mm_add_epi32(first, rounding), 8);
+			second = _mm_srai_epi32(_mm_add_epi32(second, rounding), 8);
+
+			auto packed = _mm_packs_epi32(first, second);
+			_mm_storel_epi64((__m128i *)&destination[x], _mm_packus_epi16(packed, packed));
+		}
+
+		for (; x < width; ++x) {
+			destination[x] = (u8)((weigh_pixel(source[x], Y_WEIGHTS) + 128) >> 8);
+		}
+	}
+
+	// Each chroma sample is the average of a 2x2 block. The two rows get averaged first, then the two columns.
+	auto chroma_width = width / 2;
+
+	for (auto chroma_row = 0; chroma_row < buffer.height / 2; ++chroma_row) {
+		auto top = source_row(buffer, chroma_row * 2);
+		auto bottom = source_row(buffer, chroma_row * 2 + 1);
+		auto u_row = &u[chroma_row * chroma_width];
+		auto v_row = &v[chroma_row * chroma_width];
+
+		auto x = 0;
+		for (; x + 8 <= width; x += 8) {
+			auto rows_0 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)&top[x]), _mm_loadu_si128((const __m128i *)&bottom[x]));
+			auto rows_1 = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)&top[x + 4]), _mm_loadu_si128((const __m128i *)&bottom[x + 4]));
+
+			// Pixels 0 and 2 of each end up as the averages of pixels 0, 1 and 2, 3.
+			auto blocks_0 = _mm_shuffle_epi32(_mm_avg_epu8(rows_0, _mm_srli_si128(rows_0, 4)), _MM_SHUFFLE(3, 1, 2, 0));
+			auto blocks_1 = _mm_shuffle_epi32(_mm_avg_epu8(rows_1, _mm_srli_si128(rows_1, 4)), _MM_SHUFFLE(3, 1, 2, 0));
+			auto blocks = _mm_unpacklo_epi64(blocks_0, blocks_1);
+
+			auto u_values = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(weigh_pixels(blocks, u_weights), rounding), 8), chroma_offset);
+			auto v_values = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(weigh_pixels(blocks, v_weights), rounding), 8), chroma_offset);
+
+			// Four bytes of U then four of V.
+			auto packed = _mm_packs_epi32(u_values, v_values);
+			packed = _mm_packus_epi16(packed, packed);
+
+			auto bytes = (u32)_mm_cvtsi128_si32(packed);
+			memcpy(&u_row[x / 2], &bytes, 4);
+			bytes = (u32)_mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+			memcpy(&v_row[x / 2], &bytes, 4);
+		}
+
+		for (; x < width; x += 2) {
+			auto block = average_pixels(average_pixels(top[x], bottom[x]), average_pixels(top[x + 1], bottom[x + 1]));
+			u_row[x / 2] = (u8)clamp(((weigh_pixel(block, U_WEIGHTS) + 128) >> 8) + 128, 0, 255);
+			v_row[x / 2] = (u8)clamp(((weigh_pixel(block, V_WEIGHTS) + 128) >> 8) + 128, 0, 255);
+		}
+	}
+}
+
+void convert_to_rgb24(const Backbuffer &buffer, u8 *rgb) {
+	for (auto row = 0; row < buffer.height; ++row) {
+		auto source = source_row(buffer, row);
+		auto destination = &rgb[row * buffer.width * 3];
+
+		for (auto x = 0; x < buffer.width; ++x) {
+			auto pixel = source[x];
+			destination[x * 3 + 0] = (u8)(pixel >> 16);
+			destination[x * 3 + 1] = (u8)(pixel >> 8);
+			destination[x * 3 + 2] = (u8)pixel;
+		}
+	}
+}
+
+static bool write_all(HANDLE output, const void *data, u32 size) {
+	DWORD bytes_written;
+	return WriteFile(output, data, size, &bytes_written, 0) && bytes_written == size;
+}
+
+static DWORD WINAPI video_writer_proc(LPVOID parameter) {
+	auto writer = (VideoWriter *)parameter;
+	TRACE_THREAD_NAME("video writer");
+
+	for (;;) {
+		WaitForSingleObject(writer->ready_frames, INFINITE);
+
+		// Same trick as the present thread. One more release than there were frames means stop.
+		if (writer->written == writer->submitted) break;
+
+		if (!writer->failed) {
+			TRACE_SCOPE("write video frame");
+
+			static const char FRAME_HEADER[] = "FRAME\n";
+			auto ok = true;
+			if (writer->format == VIDEO_Y4M) ok = write_all(writer->output, FRAME_HEADER, sizeof(FRAME_HEADER) - 1);
+			ok = ok && write_all(writer->output, writer->frames[writer->next_write], writer->frame_size);
+
+			if (!ok) InterlockedExchange(&writer->failed, 1);
+		}
+
+		writer->next_write = (writer->next_write + 1) % writer->frame_count;
+		writer->written++;
+
+		ReleaseSemaphore(writer->free_frames, 1, 0);
+	}
+
+	return 0;
+}
+
+bool start_video_writer(VideoWriter &writer, const char *path, VideoFormat format, int width, int height, int fps, int queue_length) {
+	assert(queue_length > 0 && queue_length <= MAX_VIDEO_FRAMES_IN_FLIGHT);
+	if (format == VIDEO_Y4M && (width % 2 || height % 2)) return false;
+
+	writer = {};
+	writer.format = format;
+	writer.width = width;
+	writer.height = height;
+	writer.frame_size = format == VIDEO_Y4M ? width * height * 3 / 2 : width * height * 3;
+	writer.frame_count = queue_length;
+
+	if (strcmp(path, "-") == 0) {
+		writer.output = GetStdHandle(STD_OUTPUT_HANDLE);
+	} else {
+		writer.output = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+		writer.close_output = true;
+	}
+
+	if (!writer.output || writer.output == INVALID_HANDLE_VALUE) return false;
+
+	if (format == VIDEO_Y4M) {
+		char header[128];
+		auto length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		if (!write_all(writer.output, header, (u32)length)) return false;
+	}
+
+	for (auto index = 0; index < queue_length; ++index) {
+		writer.frames[index] = (u8 *)VirtualAlloc(0, writer.frame_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!writer.frames[index]) return false;
+	}
+
+	writer.free_frames = CreateSemaphore(0, queue_length, queue_length, 0);
+	writer.ready_frames = CreateSemaphore(0, 0, queue_length + 1, 0);
+	if (!writer.free_frames || !writer.ready_frames) return false;
+
+	writer.thread = CreateThread(0, 0, video_writer_proc, &writer, 0, 0);
+	return writer.thread != 0;
+}
+
+bool submit_video_frame(VideoWriter &writer, const Backbuffer &buffer) {
+	assert(buffer.width == writer.width && buffer.height == writer.height);
+	if (writer.failed) return false;
+
+	{
+		TRACE_SCOPE("wait for video slot");
+		WaitForSingleObject(writer.free_frames, INFINITE);
+	}
+
+	{
+		TRACE_SCOPE("convert video frame");
+
+		auto frame = writer.frames[writer.next_fill];
+		if (writer.format == VIDEO_Y4M) {
+			auto luma_size = writer.width * writer.height;
+			convert_to_yuv420(buffer, frame, frame + luma_size, frame + luma_size + luma_size / 4);
+		} else {
+			convert_to_rgb24(buffer, frame);
+		}
+	}
+
+	writer.next_fill = (writer.next_fill + 1) % writer.frame_count;
+
+	// The increment is a full barrier, so the converted frame is there before the writer can wake up for it.
+	InterlockedIncrement(&writer.submitted);
+	ReleaseSemaphore(writer.ready_frames, 1, 0);
+
+	return true;
+}
+
+void stop_video_writer(VideoWriter &writer) {
+	if (writer.thread) {
+		ReleaseSemaphore(writer.ready_frames, 1, 0);
+		WaitForSingleObject(writer.thread, INFINITE);
+		CloseHandle(writer.thread);
+	}
+
+	if (writer.free_frames) CloseHandle(writer.free_frames);
+	if (writer.ready_frames) CloseHandle(writer.ready_frames);
+
+	for (auto index = 0; index < writer.frame_count; ++index) {
+		if (writer.frames[index]) VirtualFree(writer.frames[index], 0, MEM_RELEASE);
+	}
+
+	if (writer.close_output) CloseHandle(writer.output);
+	writer = {};
+}
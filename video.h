@@ -0,0 +1,73 @@
+#pragma once
+
+#include <windows.h>
+
+#include "types.h"
+#include "render.h"
+
+// Streams finished frames to a file (or stdout) for an encoder to pick up, e.g.
+//
+//    render --video - --frames 360 | ffmpeg -i - turntable.mp4
+//
+// submit_video_frame converts the frame into the next free slot of a small queue, and a writer thread
+// does the actual writing. So the only time the caller waits is when the writer has fallen a whole queue
+// behind, and then it's better to slow the renderer down than to drop frames or buffer without limit.
+
+const int MAX_VIDEO_FRAMES_IN_FLIGHT = 16;
+
+enum VideoFormat {
+	// YUV4MPEG2, 4:2:0 with full range BT.601 colors (C420jpeg). Anything that reads video reads this,
+	// and it's under half the size of RGB. Width and height have to be even.
+	VIDEO_Y4M,
+
+	// Packed 8-bit RGB, top row first, no header. For ffmpeg that's -f rawvideo -pix_fmt rgb24 -s WxH.
+	VIDEO_RAW_RGB,
+};
+
+struct VideoWriter {
+	VideoFormat format;
+	int width;
+	int height;
+	int frame_size;
+
+	HANDLE output;
+	bool close_output;
+
+	u8 *frames[MAX_VIDEO_FRAMES_IN_FLIGHT];
+	int frame_count;
+
+	// Same fences as PresentQueue: free_frames counts slots the caller can convert into, and
+	// ready_frames counts converted ones waiting to be written.
+	HANDLE free_frames;
+	HANDLE ready_frames;
+
+	// Only touched by the caller.
+	int next_fill;
+
+	// Only touched by the writer thread.
+	int next_write;
+	LONG written;
+
+	volatile LONG submitted;
+
+	// Set by the writer thread if a write fails. Everything after that is dropped.
+	volatile LONG failed;
+
+	HANDLE thread;
+};
+
+// path "-" means stdout. fps only goes in the Y4M header. queue_length is how many converted frames can be
+// waiting on the writer, up to MAX_VIDEO_FRAMES_IN_FLIGHT.
+bool start_video_writer(VideoWriter &writer, const char *path, VideoFormat format, int width, int height, int fps, int queue_length);
+
+// The buffer has to be width by height. It's converted before this returns, so the caller can reuse it right away.
+// Returns false once a write has failed.
+bool submit_video_frame(VideoWriter &writer, const Backbuffer &buffer);
+
+// Writes out whatever is still queued, then closes the output.
+void stop_video_writer(VideoWriter &writer);
+
+// The conversions. Backbuffers are bottom-up like the DIBs they get blitted as, and both of these flip
+// them so the top row comes first. y is width * height bytes, u and v are a quarter of that each.
+void convert_to_yuv420(const Backbuffer &buffer, u8 *y, u8 *u, u8 *v);
+void convert_to_rgb24(const Backbuffer &buffer, u8 *rgb);
@@ -1,12 +1,26 @@
 #include <windows.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "types.h"
 #include "utils.h"
 #include "wavefront.h"
-#include "stretchy_buffer.h"
+#include "trace.h"
+
+// Whether the line starts with keyword, followed by whitespace. Doesn't change the line, unlike strtok.
+static bool line_starts_with(const char *line, const char *keyword) {
+	while (*line == ' ' || *line == '\t') line++;
+	while (*keyword && *line == *keyword) {
+		line++;
+		keyword++;
+	}
+
+	return !*keyword && (*line == ' ' || *line == '\t');
+}
+
+WavefrontObj load_obj(const char *file_name, MemoryArena &arena) {
+	TRACE_SCOPE("load_obj");
 
-WavefrontObj load_obj(const char *file_name) {
 	WavefrontObj result = {};
 	auto file_contents = read_entire_file(file_name);
 	auto cursor = file_contents.result;
@@ -15,7 +29,33 @@ WavefrontObj load_obj(const char *file_name) {
 		return result;
 	}
 
-	defer { VirtualFree(file_contents.result, 0, MEM_RELEASE); };
+	defer { free_file_contents(file_contents); };
+
+	// Count everything first so each array can go in the arena at its final size, instead of
+	// growing one push at a time.
+	auto vert_count = 0;
+	auto text_coord_count = 0;
+	auto vert_normal_count = 0;
+	auto face_count = 0;
+
+	for (auto line = cursor; line; ) {
+		if (line_starts_with(line, "v")) vert_count++;
+		else if (line_starts_with(line, "vt")) text_coord_count++;
+		else if (line_starts_with(line, "vn")) vert_normal_count++;
+		else if (line_starts_with(line, "f")) face_count++;
+
+		line = strchr(line, '\n');
+		if (line) line++;
+	}
+
+	result.verts = push_array(arena, Vec4f, vert_count);
+	result.text_coords = push_array(arena, Vec3f, text_coord_count);
+	result.vert_normals = push_array(arena, Vec3f, vert_normal_count);
+	result.faces = push_array(arena, Face, face_count);
+
+	if (!result.verts || !result.text_coords || !result.vert_normals || !result.faces) {
+		return WavefrontObj{};
+	}
 
 	char *cursor_tracker;
 	char *line_tracker;
@@ -43,7 +83,10 @@ WavefrontObj load_obj(const char *file_name) {
 				vert.w = (f32)atof(token);
 			}
 
-			sb_push(result.verts, vert);
+			// The counting pass and this one split lines differently, so a line the first didn't count can
+			// still end up here. There's no room for it, and a file like that is broken anyway.
+			if (result.vert_count == vert_count) return WavefrontObj{};
+			result.verts[result.vert_count++] = vert;
 		}
 		else if (strcmp(token, "vn") == 0) {
 			Vec3f normal = {};
@@ -55,7 +98,8 @@ WavefrontObj load_obj(const char *file_name) {
 			token = strtok_s(NULL, " \t", &line_tracker);
 			normal.z = (f32)atof(token);
 
-			sb_push(result.vert_normals, normal);
+			if (result.vert_normal_count == vert_normal_count) return WavefrontObj{};
+			result.vert_normals[result.vert_normal_count++] = normal;
 		}
 		else if (strcmp(token, "vt") == 0) {
 			Vec3f text = {};
@@ -70,7 +114,8 @@ WavefrontObj load_obj(const char *file_name) {
 				text.z = (f32)atof(token);
 			}
 
-			sb_push(result.text_coords, text);
+			if (result.text_coord_count == text_coord_count) return WavefrontObj{};
+			result.text_coords[result.text_coord_count++] = text;
 		}
 		else if (strcmp(token, "f") == 0) {
 			Face face = {};
@@ -156,7 +201,8 @@ WavefrontObj load_obj(const char *file_name) {
 				face.vertex_indices.z = atoi(token) - 1;
 			}
 
-			sb_push(result.faces, face);
+			if (result.face_count == face_count) return WavefrontObj{};
+			result.faces[result.face_count++] = face;
 		}
 		else if (strcmp(token, "#") == 0) {
 			// This is just a comment, discard.
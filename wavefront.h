@@ -2,6 +2,7 @@
 
 #include "types.h"
 #include "vectors.h"
+#include "arena.h"
 
 struct Face {
 	Vec3i vertex_indices;
@@ -9,11 +10,22 @@ struct Face {
 	Vec3i normal_indices;
 };
 
+// Everything points into the arena it was loaded into.
 struct WavefrontObj {
 	Vec4f *verts;
 	Vec3f *text_coords;
 	Vec3f *vert_normals;
 	Face  *faces;
+
+	// Occlusion and direct light per vertex from a bake (see bake.h), or null if there wasn't one.
+	Vec2f *baked;
+
+	int vert_count;
+	int text_coord_count;
+	int vert_normal_count;
+	int face_count;
 };
 
-WavefrontObj load_obj(const char *file_name);
\ No newline at end of file
+// The arrays go in arena, sized exactly, so the obj is freed along with the arena.
+// On failure, the counts are all zero.
+WavefrontObj load_obj(const char *file_name, MemoryArena &arena);
\ No newline at end of file